@@ -0,0 +1,517 @@
+/*  sparql-query - a SPARQL client with GNU readline support
+    Copyright (C) 2006-8 Nick Lamb and Steve Harris for Garlik
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* writes results with sr_arrow and reads the IPC stream back, with just
+ * enough of a flatbuffer reader for Arrow's Message tables, checking the
+ * framing and that every buffer is aligned and inside its message's body.
+ * Small results are compared as a transcript of the schema, dictionaries
+ * and values. A column of more distinct IRIs than a dictionary keeps is
+ * checked row by row, as its dictionary is replaced */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "result-arrow.h"
+
+#define XSD "http://www.w3.org/2001/XMLSchema#"
+#define EX "http://example.org/"
+
+/* more than result-arrow.c's DICT_MAX, so the dictionary starts over */
+#define MANY_IRIS 1100000
+
+/* Schema.fbs Type and MessageHeader unions */
+enum {
+    TYPE_INT = 2,
+    TYPE_FLOATING_POINT = 3,
+    TYPE_UTF8 = 5,
+    TYPE_BOOL = 6,
+
+    HEADER_SCHEMA = 1,
+    HEADER_DICTIONARY_BATCH = 2,
+    HEADER_RECORD_BATCH = 3,
+};
+
+typedef struct {
+    char *name;
+    int type;
+    int dictionary;  /* id, or -1 */
+} column;
+
+typedef struct {
+    const guint8 *data;
+    size_t len;
+    GString *transcript;
+    int values;      /* write values and dictionary entries in it too */
+    int cols;
+    column *col;
+    GPtrArray **dict;
+    gint64 rows;     /* in earlier batches */
+    int bad;
+    /* called for every value when values isn't set, text is NULL for null */
+    void (*check)(void *data, int col, gint64 row, const char *text);
+    void *check_data;
+} reader;
+
+static guint64 get(const guint8 *p, int size)
+{
+    guint64 value = 0;
+    for (int i=size-1; i>=0; i--) {
+        value = value << 8 | p[i];
+    }
+
+    return value;
+}
+
+/* where field id of the table at t in b is, or 0 if it's left out */
+static size_t field(const guint8 *b, size_t t, int id)
+{
+    size_t vtable = t - (gint32) get(b + t, 4);
+    int vtable_size = get(b + vtable, 2);
+    if (4 + 2 * id >= vtable_size) {
+        return 0;
+    }
+    int offset = get(b + vtable + 4 + 2 * id, 2);
+
+    return offset ? t + offset : 0;
+}
+
+static guint64 scalar(const guint8 *b, size_t t, int id, int size)
+{
+    size_t at = field(b, t, id);
+    return at ? get(b + at, size) : 0;
+}
+
+/* follow the offset in field id, to a table, string or vector */
+static size_t follow(const guint8 *b, size_t t, int id)
+{
+    size_t at = field(b, t, id);
+    return at ? at + get(b + at, 4) : 0;
+}
+
+static void read_schema(reader *r, const guint8 *b, size_t schema)
+{
+    size_t fields = follow(b, schema, 1);
+    r->cols = get(b + fields, 4);
+    r->col = g_new0(column, r->cols);
+    r->dict = g_new0(GPtrArray *, r->cols);
+    g_string_append(r->transcript, "schema");
+    for (int i=0; i<r->cols; i++) {
+        size_t slot = fields + 4 + 4 * i;
+        size_t f = slot + get(b + slot, 4);
+        size_t name = follow(b, f, 0);
+        column *c = &r->col[i];
+        c->name = g_strndup((const char *) b + name + 4, get(b + name, 4));
+        c->type = scalar(b, f, 2, 1);
+        c->dictionary = -1;
+        size_t type = follow(b, f, 3);
+        size_t encoding = follow(b, f, 4);
+        g_string_append_printf(r->transcript, " %s:", c->name);
+        if (!scalar(b, f, 1, 1)) {
+            g_string_append(r->transcript, "!");
+        }
+        if (encoding) {
+            size_t index = follow(b, encoding, 1);
+            c->dictionary = scalar(b, encoding, 0, 8);
+            r->dict[i] = g_ptr_array_new_with_free_func(g_free);
+            g_string_append_printf(r->transcript, "dict%d/int%d", c->dictionary, (int) scalar(b, index, 0, 4));
+        }
+        switch (c->type) {
+            case TYPE_INT:
+                g_string_append_printf(r->transcript, "int%d", (int) scalar(b, type, 0, 4));
+                break;
+            case TYPE_FLOATING_POINT:
+                g_string_append(r->transcript, scalar(b, type, 0, 2) == 2 ? "double" : "float?");
+                break;
+            case TYPE_UTF8:
+                g_string_append(r->transcript, encoding ? "" : "utf8");
+                break;
+            case TYPE_BOOL:
+                g_string_append(r->transcript, "bool");
+                break;
+            default:
+                g_string_append_printf(r->transcript, "type%d", c->type);
+        }
+    }
+    g_string_append_c(r->transcript, '\n');
+}
+
+/* the buffers of a RecordBatch, each checked against the body */
+static const guint8 *buffer(reader *r, const guint8 *b, size_t batch, int i, const guint8 *body, gint64 body_len,
+                            gint64 *len)
+{
+    size_t buffers = follow(b, batch, 2);
+    if (i >= (int) get(b + buffers, 4)) {
+        r->bad++;
+        *len = 0;
+        return NULL;
+    }
+    /* a vector of structs is 8-aligned past its length */
+    const guint8 *at = b + buffers + 4 + (-(buffers + 4) & 7) + 16 * i;
+    gint64 offset = get(at, 8);
+    *len = get(at + 8, 8);
+    if (offset % 8 || offset < 0 || *len < 0 || offset + *len > body_len) {
+        r->bad++;
+        *len = 0;
+        return NULL;
+    }
+
+    return body + offset;
+}
+
+static gint64 node(const guint8 *b, size_t batch, int i, gint64 *nulls)
+{
+    size_t nodes = follow(b, batch, 1);
+    const guint8 *at = b + nodes + 4 + (-(nodes + 4) & 7) + 16 * i;
+    *nulls = get(at + 8, 8);
+
+    return get(at, 8);
+}
+
+static int bit(const guint8 *bits, gint64 bits_len, gint64 i)
+{
+    return i / 8 < bits_len && (bits[i / 8] >> (i % 8) & 1);
+}
+
+/* the string at index i of utf8 buffers */
+static char *utf8(reader *r, const guint8 *offsets, gint64 offsets_len, const guint8 *data, gint64 data_len, gint64 i)
+{
+    if (4 * (i + 2) > offsets_len) {
+        r->bad++;
+        return g_strdup("?");
+    }
+    gint64 from = (gint32) get(offsets + 4 * i, 4), to = (gint32) get(offsets + 4 * (i + 1), 4);
+    if (from < 0 || from > to || to > data_len) {
+        r->bad++;
+        return g_strdup("?");
+    }
+
+    return g_strndup((const char *) data + from, to - from);
+}
+
+static void read_dictionary(reader *r, const guint8 *b, size_t message, const guint8 *body, gint64 body_len)
+{
+    int id = scalar(b, message, 0, 8);
+    int delta = scalar(b, message, 2, 1);
+    size_t batch = follow(b, message, 1);
+    gint64 nulls, count = node(b, batch, 0, &nulls);
+    gint64 offsets_len, data_len;
+    const guint8 *offsets = buffer(r, b, batch, 1, body, body_len, &offsets_len);
+    const guint8 *data = buffer(r, b, batch, 2, body, body_len, &data_len);
+
+    int col = 0;
+    while (col < r->cols && r->col[col].dictionary != id) {
+        col++;
+    }
+    if (col == r->cols) {
+        r->bad++;
+        return;
+    }
+    if (!delta) {
+        g_ptr_array_set_size(r->dict[col], 0);
+    }
+    g_string_append_printf(r->transcript, "dictionary %d %s %d", id, delta ? "delta" : "new", (int) count);
+    for (gint64 i=0; i<count; i++) {
+        char *value = utf8(r, offsets, offsets_len, data, data_len, i);
+        if (r->values) {
+            g_string_append_printf(r->transcript, " %s", value);
+        }
+        g_ptr_array_add(r->dict[col], value);
+    }
+    g_string_append_c(r->transcript, '\n');
+}
+
+static void read_batch(reader *r, const guint8 *b, size_t batch, const guint8 *body, gint64 body_len)
+{
+    gint64 length = scalar(b, batch, 0, 8);
+    int buf = 0;
+
+    g_string_append_printf(r->transcript, "batch %d\n", (int) length);
+    for (int i=0; i<r->cols; i++) {
+        column *c = &r->col[i];
+        gint64 nulls, len = node(b, batch, i, &nulls);
+        gint64 validity_len, values_len, data_len = 0;
+        const guint8 *validity = buffer(r, b, batch, buf++, body, body_len, &validity_len);
+        const guint8 *values = buffer(r, b, batch, buf++, body, body_len, &values_len);
+        const guint8 *data = NULL;
+        if (c->type == TYPE_UTF8 && c->dictionary < 0) {
+            data = buffer(r, b, batch, buf++, body, body_len, &data_len);
+        }
+        if (len != length || (nulls && validity_len < (length + 7) / 8)) {
+            r->bad++;
+            continue;
+        }
+
+        gint64 counted = 0;
+        if (r->values) {
+            g_string_append_printf(r->transcript, "%s:", c->name);
+        }
+        for (gint64 row=0; row<length; row++) {
+            char *text = NULL;
+            if (nulls && !bit(validity, validity_len, row)) {
+                counted++;
+            } else if (c->dictionary >= 0) {
+                guint32 index = values_len >= 4 * (row + 1) ? get(values + 4 * row, 4) : G_MAXUINT32;
+                text = g_strdup(index < r->dict[i]->len ? (char *) r->dict[i]->pdata[index] : "?");
+            } else if (c->type == TYPE_UTF8) {
+                text = utf8(r, values, values_len, data, data_len, row);
+            } else if (c->type == TYPE_INT && values_len >= 8 * (row + 1)) {
+                text = g_strdup_printf("%" G_GINT64_FORMAT, (gint64) get(values + 8 * row, 8));
+            } else if (c->type == TYPE_FLOATING_POINT && values_len >= 8 * (row + 1)) {
+                union { double d; guint64 u; } v = { .u = get(values + 8 * row, 8) };
+                text = g_strdup_printf("%g", v.d);
+            } else if (c->type == TYPE_BOOL) {
+                text = g_strdup(bit(values, values_len, row) ? "true" : "false");
+            } else {
+                r->bad++;
+            }
+            if (r->values) {
+                g_string_append_printf(r->transcript, " %s", text ? text : "null");
+            } else {
+                r->check(r->check_data, i, r->rows + row, text);
+            }
+            g_free(text);
+        }
+        if (r->values) {
+            g_string_append_c(r->transcript, '\n');
+        }
+        r->bad += counted != nulls;
+    }
+    r->rows += length;
+}
+
+/* read the whole stream, returning the number of problems found */
+static int read_stream(reader *r)
+{
+    size_t pos = 0;
+
+    while (1) {
+        if (pos + 8 > r->len || get(r->data + pos, 4) != 0xffffffff) {
+            g_string_append(r->transcript, "no end of stream\n");
+            return ++r->bad;
+        }
+        size_t meta_len = get(r->data + pos + 4, 4);
+        pos += 8;
+        if (!meta_len) {
+            break;
+        }
+        if (meta_len % 8 || pos + meta_len > r->len) {
+            g_string_append(r->transcript, "bad message\n");
+            return ++r->bad;
+        }
+        const guint8 *b = r->data + pos;
+        size_t message = get(b, 4);
+        int version = scalar(b, message, 0, 2);
+        int header_type = scalar(b, message, 1, 1);
+        size_t header = follow(b, message, 2);
+        gint64 body_len = scalar(b, message, 3, 8);
+        const guint8 *body = b + meta_len;
+        if (version != 4 || body_len % 8 || pos + meta_len + body_len > r->len) {
+            g_string_append(r->transcript, "bad message\n");
+            return ++r->bad;
+        }
+
+        switch (header_type) {
+            case HEADER_SCHEMA:
+                read_schema(r, b, header);
+                break;
+            case HEADER_DICTIONARY_BATCH:
+                read_dictionary(r, b, header, body, body_len);
+                break;
+            case HEADER_RECORD_BATCH:
+                read_batch(r, b, header, body, body_len);
+                break;
+            default:
+                r->bad++;
+        }
+        pos += meta_len + body_len;
+    }
+    if (pos != r->len) {
+        r->bad++;
+    }
+    g_string_append(r->transcript, "end\n");
+
+    return r->bad;
+}
+
+static void reader_free(reader *r)
+{
+    for (int i=0; i<r->cols; i++) {
+        g_free(r->col[i].name);
+        if (r->dict[i]) {
+            g_ptr_array_free(r->dict[i], TRUE);
+        }
+    }
+    g_free(r->col);
+    g_free(r->dict);
+    g_string_free(r->transcript, TRUE);
+}
+
+static sr_term term(enum sr_term_kind kind, const char *value, const char *datatype, const char *lang)
+{
+    return (sr_term) { kind, (char *) value, (char *) datatype, (char *) lang };
+}
+
+#define UNBOUND term(SR_UNBOUND, NULL, NULL, NULL)
+#define IRI(v) term(SR_URI, EX v, NULL, NULL)
+#define TYPED(v, t) term(SR_LITERAL, v, XSD t, NULL)
+
+/* a column of each type, with nulls, a dictionary with repeats, and a
+ * column that is never bound */
+static int check_types()
+{
+    char *names[] = { "u", "i", "d", "b", "s", "n" };
+    const sr_term rows[][6] = {
+        { IRI("a"), TYPED("1", "integer"), TYPED("1.5", "double"), TYPED("true", "boolean"), IRI("x"), UNBOUND },
+        { UNBOUND, UNBOUND, TYPED("2", "integer"), TYPED("0", "boolean"), term(SR_LITERAL, "lit", NULL, "en"), UNBOUND },
+        { IRI("a"), TYPED("-3", "int"), UNBOUND, UNBOUND, term(SR_BNODE, "b1", NULL, NULL), UNBOUND },
+        { IRI("b"), TYPED("4", "integer"), TYPED("1e3", "double"), TYPED("false", "boolean"), IRI("y"), UNBOUND },
+    };
+    const char *expected =
+        "schema u:dict0/int32 i:int64 d:double b:bool s:utf8 n:utf8\n"
+        "dictionary 0 new 2 " EX "a " EX "b\n"
+        "batch 4\n"
+        "u: " EX "a null " EX "a " EX "b\n"
+        "i: 1 null -3 4\n"
+        "d: 1.5 2 null 1000\n"
+        "b: true false null false\n"
+        "s: <" EX "x> lit _:b1 <" EX "y>\n"
+        "n: null null null null\n"
+        "end\n";
+
+    char *out = NULL;
+    size_t out_len = 0;
+    FILE *f = open_memstream(&out, &out_len);
+    sr_arrow *arrow = sr_arrow_new(f, 6, names);
+    for (guint i=0; i<G_N_ELEMENTS(rows); i++) {
+        sr_arrow_scan(arrow, rows[i]);
+    }
+    sr_arrow_schema(arrow);
+    for (guint i=0; i<G_N_ELEMENTS(rows); i++) {
+        sr_arrow_row(arrow, rows[i]);
+    }
+    sr_arrow_finish(arrow);
+    sr_arrow_free(arrow);
+    fclose(f);
+
+    reader r = { (const guint8 *) out, out_len, g_string_new(NULL), 1 };
+    int ok = !read_stream(&r) && !strcmp(r.transcript->str, expected);
+    if (!ok) {
+        fprintf(stderr, "%d problems, read\n%s", r.bad, r.transcript->str);
+    }
+    reader_free(&r);
+    free(out);
+
+    return ok;
+}
+
+static int check_boolean()
+{
+    char *out = NULL;
+    size_t out_len = 0;
+    FILE *f = open_memstream(&out, &out_len);
+    sr_arrow *arrow = sr_arrow_new(f, 0, NULL);
+    sr_arrow_schema(arrow);
+    sr_arrow_boolean(arrow, 1);
+    sr_arrow_free(arrow);
+    fclose(f);
+
+    reader r = { (const guint8 *) out, out_len, g_string_new(NULL), 1 };
+    int ok = !read_stream(&r) && !strcmp(r.transcript->str, "schema boolean:bool\nbatch 1\nboolean: true\nend\n");
+    if (!ok) {
+        fprintf(stderr, "%d problems, read\n%s", r.bad, r.transcript->str);
+    }
+    reader_free(&r);
+    free(out);
+
+    return ok;
+}
+
+static void check_iri(void *data, int col, gint64 row, const char *text)
+{
+    int *wrong = data;
+    char expected[64];
+    snprintf(expected, sizeof(expected), EX "%" G_GINT64_FORMAT, row);
+    *wrong += !text || strcmp(text, expected);
+}
+
+/* a distinct IRI a row, in many batches, each with a delta of the IRIs it
+ * adds until the dictionary is full and a new one replaces it */
+static int check_many()
+{
+    char *names[] = { "u" };
+    char *out = NULL;
+    size_t out_len = 0;
+    FILE *f = open_memstream(&out, &out_len);
+    sr_arrow *arrow = sr_arrow_new(f, 1, names);
+    sr_term row = IRI("0");
+    sr_arrow_scan(arrow, &row);
+    sr_arrow_schema(arrow);
+    for (int i=0; i<MANY_IRIS; i++) {
+        char iri[64];
+        snprintf(iri, sizeof(iri), EX "%d", i);
+        row.value = iri;
+        sr_arrow_row(arrow, &row);
+    }
+    sr_arrow_finish(arrow);
+    sr_arrow_free(arrow);
+    fclose(f);
+
+    int wrong = 0;
+    reader r = { (const guint8 *) out, out_len, g_string_new(NULL), 0, .check = check_iri, .check_data = &wrong };
+    read_stream(&r);
+    int news = 0, deltas = 0;
+    for (const char *line = r.transcript->str; (line = strstr(line, "dictionary 0 ")); line++) {
+        news += g_str_has_prefix(line, "dictionary 0 new");
+        deltas += g_str_has_prefix(line, "dictionary 0 delta");
+    }
+    int ok = !r.bad && !wrong && r.rows == MANY_IRIS && news == 2 && deltas > 0;
+    if (!ok) {
+        fprintf(stderr, "%d problems, %d wrong of %" G_GINT64_FORMAT " rows, read\n%s", r.bad, wrong, r.rows,
+                r.transcript->str);
+    }
+    reader_free(&r);
+    free(out);
+
+    return ok;
+}
+
+int main()
+{
+    struct {
+        const char *name;
+        int (*check)(void);
+    } checks[] = {
+        { "arrow types and nulls", check_types },
+        { "arrow boolean", check_boolean },
+        { "arrow dictionary replaced", check_many },
+        { NULL, NULL }
+    };
+    int failed = 0;
+
+    for (int i=0; checks[i].name; i++) {
+        int ok = checks[i].check();
+        fprintf(stderr, "%s: %s\n", checks[i].name, ok ? "ok" : "FAILED");
+        failed |= !ok;
+    }
+
+    return failed;
+}
+
+/* vi:set expandtab sts=4 sw=4: */
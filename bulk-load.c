@@ -0,0 +1,372 @@
+/*  sparql-query - a SPARQL client with GNU readline support
+    Copyright (C) 2006-8 Nick Lamb and Steve Harris for Garlik
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Bulk loading N-Triples with INSERT DATA
+ *
+ * The file is read a batch at a time, only as fast as batches can be sent,
+ * and several requests are kept in flight with the curl multi interface.
+ * A batch that fails for a reason that might go away (a dropped connection,
+ * 5xx, 429) is retried with backoff. If the store rejects a batch outright,
+ * it is split in half and both halves are tried again, until the triples it
+ * won't take are found and reported one by one.
+ *
+ * Unless told how many, the number of requests in flight adapts to how the
+ * store copes, growing while batches take no longer per triple and backing
+ * off when they slow down or the store says it's overloaded.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include <curl/curl.h>
+
+#include "bulk-load.h"
+#include "http-share.h"
+#include "limiter.h"
+
+/* attempts at a batch before giving up on it */
+#define MAX_ATTEMPTS 4
+
+/* how much of a failure response to keep for the error message */
+#define MAX_RESPONSE 1024
+
+typedef struct {
+    GString *triples;  /* one per line */
+    GArray *lines;     /* line number in the file of each triple */
+    int attempts;
+    gint64 not_before; /* don't retry until then */
+} batch;
+
+typedef struct {
+    CURL *curl;
+    batch *batch;
+    gint64 started;
+    char *body;
+    GString *response;
+    char error[CURL_ERROR_SIZE];
+} job;
+
+typedef struct {
+    const bl_options *opts;
+    FILE *in;
+    guint line;
+    int eof;
+    GQueue *retry;     /* batches waiting to be sent again */
+    CURLM *multi;
+    int running;
+    limiter *limiter; /* NULL for a fixed number of jobs */
+    guint64 loaded;
+    long rejected;
+    int fatal;
+} loader;
+
+static batch *batch_new(void)
+{
+    batch *b = g_new0(batch, 1);
+    b->triples = g_string_new(NULL);
+    b->lines = g_array_new(FALSE, FALSE, sizeof(guint));
+
+    return b;
+}
+
+static void batch_free(batch *b)
+{
+    g_string_free(b->triples, TRUE);
+    g_array_free(b->lines, TRUE);
+    g_free(b);
+}
+
+/* the next batch from the file, or NULL at the end */
+static batch *read_batch(loader *l)
+{
+    batch *b = batch_new();
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+
+    while ((int) b->lines->len < l->opts->triples && b->triples->len < l->opts->bytes &&
+           (len = getline(&line, &size, l->in)) >= 0) {
+        l->line++;
+        while (len > 0 && g_ascii_isspace(line[len - 1])) {
+            len--;
+        }
+        char *start = line;
+        while (g_ascii_isspace(*start)) {
+            start++;
+            len--;
+        }
+        if (len <= 0 || *start == '#') {
+            continue;
+        }
+        g_string_append_len(b->triples, start, len);
+        g_string_append_c(b->triples, '\n');
+        g_array_append_val(b->lines, l->line);
+    }
+    free(line);
+    if (ferror(l->in)) {
+        perror("failed to read triples");
+        l->fatal = 1;
+    }
+    if (b->lines->len == 0) {
+        l->eof = 1;
+        batch_free(b);
+        return NULL;
+    }
+
+    return b;
+}
+
+/* split b into two halves, in order, at the head of the retry queue */
+static void bisect(loader *l, batch *b)
+{
+    guint half = b->lines->len / 2;
+    const char *split = b->triples->str;
+    for (guint i=0; i<half; i++) {
+        split = strchr(split, '\n') + 1;
+    }
+
+    batch *first = batch_new();
+    batch *second = batch_new();
+    g_string_append_len(first->triples, b->triples->str, split - b->triples->str);
+    g_string_append(second->triples, split);
+    g_array_append_vals(first->lines, b->lines->data, half);
+    g_array_append_vals(second->lines, &g_array_index(b->lines, guint, half), b->lines->len - half);
+    batch_free(b);
+
+    g_queue_push_head(l->retry, second);
+    g_queue_push_head(l->retry, first);
+}
+
+static size_t response_fn(void *ptr, size_t size, size_t nmemb, void *data)
+{
+    GString *response = data;
+    size_t len = size * nmemb;
+    if (response->len < MAX_RESPONSE) {
+        g_string_append_len(response, ptr, MIN(len, MAX_RESPONSE - response->len));
+    }
+
+    return len;
+}
+
+static void start(loader *l, job *j, batch *b)
+{
+    GString *update = g_string_sized_new(b->triples->len + 32);
+    g_string_append(update, "INSERT DATA {\n");
+    g_string_append_len(update, b->triples->str, b->triples->len);
+    g_string_append(update, "}\n");
+    char *encoded = curl_easy_escape(j->curl, update->str, update->len);
+    g_string_free(update, TRUE);
+
+    j->batch = b;
+    j->body = g_strconcat("update=", encoded, NULL);
+    curl_free(encoded);
+    g_string_truncate(j->response, 0);
+    j->error[0] = '\0';
+    j->started = g_get_monotonic_time();
+    b->attempts++;
+
+    curl_easy_setopt(j->curl, CURLOPT_POSTFIELDS, j->body);
+    curl_multi_add_handle(l->multi, j->curl);
+    l->running++;
+}
+
+/* the next batch to send: a retry if one is due, otherwise more of the file */
+static batch *next_batch(loader *l)
+{
+    batch *b = g_queue_peek_head(l->retry);
+    if (b && b->not_before <= g_get_monotonic_time()) {
+        return g_queue_pop_head(l->retry);
+    }
+    if (l->eof || l->fatal) {
+        return NULL;
+    }
+
+    return read_batch(l);
+}
+
+static void finish(loader *l, job *j, CURLcode code)
+{
+    batch *b = j->batch;
+    long status = 0;
+
+    curl_easy_getinfo(j->curl, CURLINFO_RESPONSE_CODE, &status);
+    curl_multi_remove_handle(l->multi, j->curl);
+    if (l->limiter) {
+        double seconds = (g_get_monotonic_time() - j->started) / (double) G_USEC_PER_SEC;
+        int overloaded = code == CURLE_OPERATION_TIMEDOUT || status >= 500 || status == 408 || status == 429;
+        if (overloaded || (!code && status >= 200 && status < 300)) {
+            limiter_sample(l->limiter, seconds / b->lines->len, overloaded);
+        }
+    }
+    l->running--;
+    g_free(j->body);
+    j->body = NULL;
+    j->batch = NULL;
+
+    if (!code && status >= 200 && status < 300) {
+        l->loaded += b->lines->len;
+        batch_free(b);
+        return;
+    }
+
+    int transient = code || status >= 500 || status == 408 || status == 429;
+    if (transient && b->attempts < MAX_ATTEMPTS) {
+        /* 1s, 2s, 4s ... */
+        b->not_before = g_get_monotonic_time() + G_USEC_PER_SEC * (1 << (b->attempts - 1));
+        g_queue_push_tail(l->retry, b);
+        return;
+    }
+    if (code) {
+        /* the store isn't answering, splitting the batch won't help */
+        fprintf(stderr, "%sCURL: %s, giving up after %d attempts\n", isatty(STDERR_FILENO) ? "\n" : "",
+                j->error, b->attempts);
+        l->fatal = 1;
+        batch_free(b);
+        return;
+    }
+    if (b->lines->len > 1) {
+        bisect(l, b);
+        return;
+    }
+
+    char *reason = g_strndup(j->response->str, strcspn(j->response->str, "\r\n"));
+    fprintf(stderr, "%sline %u: rejected with HTTP %ld: %s\n", isatty(STDERR_FILENO) ? "\n" : "",
+            g_array_index(b->lines, guint, 0), status, reason);
+    g_free(reason);
+    l->rejected++;
+    batch_free(b);
+}
+
+static void progress(loader *l, gint64 started, int done)
+{
+    double seconds = (g_get_monotonic_time() - started) / (double) G_USEC_PER_SEC;
+    double rate = seconds > 0.0 ? l->loaded / seconds : 0.0;
+
+    if (done) {
+        fprintf(stderr, "%s%" G_GUINT64_FORMAT " triples loaded in %.1fs (%.0f triples/s)",
+                isatty(STDERR_FILENO) ? "\r" : "", l->loaded, seconds, rate);
+        if (l->rejected) {
+            fprintf(stderr, ", %ld rejected", l->rejected);
+        }
+        fprintf(stderr, "\n");
+    } else if (isatty(STDERR_FILENO)) {
+        fprintf(stderr, "\r%" G_GUINT64_FORMAT " triples loaded (%.0f triples/s)", l->loaded, rate);
+    }
+}
+
+long bulk_load(const bl_options *opts)
+{
+    loader l = { .opts = opts };
+    int jobs = opts->jobs > 0 ? opts->jobs : BL_MAX_JOBS;
+    job *pool = g_new0(job, jobs);
+
+    if (!strcmp(opts->filename, "-")) {
+        l.in = stdin;
+    } else if (!(l.in = fopen(opts->filename, "r"))) {
+        perror(opts->filename);
+        g_free(pool);
+        return -1;
+    }
+
+    l.multi = curl_multi_init();
+    l.retry = g_queue_new();
+    if (opts->jobs <= 0) {
+        l.limiter = limiter_new(BL_DEFAULT_JOBS, BL_MAX_JOBS);
+    }
+    for (int i=0; i<jobs; i++) {
+        pool[i].curl = hs_easy_init();
+        pool[i].response = g_string_new(NULL);
+        curl_easy_setopt(pool[i].curl, CURLOPT_URL, hs_endpoint(pool[i].curl, opts->endpoint));
+        curl_easy_setopt(pool[i].curl, CURLOPT_VERBOSE, opts->verbose);
+        curl_easy_setopt(pool[i].curl, CURLOPT_ERRORBUFFER, pool[i].error);
+        curl_easy_setopt(pool[i].curl, CURLOPT_WRITEFUNCTION, response_fn);
+        curl_easy_setopt(pool[i].curl, CURLOPT_WRITEDATA, pool[i].response);
+        curl_easy_setopt(pool[i].curl, CURLOPT_PRIVATE, &pool[i]);
+    }
+
+    gint64 started = g_get_monotonic_time();
+    gint64 reported = started;
+    while (!l.fatal) {
+        int limit = l.limiter ? limiter_limit(l.limiter) : jobs;
+        for (int i=0; i<jobs && l.running < limit && !l.fatal; i++) {
+            if (!pool[i].batch) {
+                batch *b = next_batch(&l);
+                if (!b) {
+                    break;
+                }
+                start(&l, &pool[i], b);
+            }
+        }
+        if (!l.running && (l.fatal || (l.eof && g_queue_is_empty(l.retry)))) {
+            break;
+        }
+
+        if (!l.running) {
+            /* only waiting for a retry to come due */
+            g_usleep(G_USEC_PER_SEC / 10);
+            continue;
+        }
+
+        int still_running;
+        curl_multi_perform(l.multi, &still_running);
+        curl_multi_wait(l.multi, NULL, 0, 100, NULL);
+
+        CURLMsg *msg;
+        int left;
+        while ((msg = curl_multi_info_read(l.multi, &left))) {
+            if (msg->msg == CURLMSG_DONE) {
+                job *j;
+                curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &j);
+                finish(&l, j, msg->data.result);
+            }
+        }
+
+        if (g_get_monotonic_time() - reported >= G_USEC_PER_SEC) {
+            reported = g_get_monotonic_time();
+            progress(&l, started, 0);
+        }
+    }
+    progress(&l, started, 1);
+    if (l.limiter) {
+        limiter_report(l.limiter, stderr, opts->verbose);
+        limiter_free(l.limiter);
+    }
+
+    for (int i=0; i<jobs; i++) {
+        if (pool[i].batch) {
+            curl_multi_remove_handle(l.multi, pool[i].curl);
+            batch_free(pool[i].batch);
+            g_free(pool[i].body);
+        }
+        curl_easy_cleanup(pool[i].curl);
+        g_string_free(pool[i].response, TRUE);
+    }
+    g_free(pool);
+    g_queue_free_full(l.retry, (GDestroyNotify) batch_free);
+    curl_multi_cleanup(l.multi);
+    if (l.in != stdin) {
+        fclose(l.in);
+    }
+
+    return l.fatal ? -1 : l.rejected;
+}
+
+/* vi:set expandtab sts=4 sw=4: */
@@ -0,0 +1,24 @@
+#ifndef BULK_LOAD_H
+#define BULK_LOAD_H
+
+#include <stddef.h>
+
+#define BL_DEFAULT_TRIPLES 10000
+#define BL_DEFAULT_BYTES (4 << 20)
+#define BL_DEFAULT_JOBS 4
+#define BL_MAX_JOBS 32
+
+typedef struct {
+    const char *endpoint;
+    const char *filename; /* "-" for standard input */
+    int triples;          /* most triples in one INSERT DATA */
+    size_t bytes;         /* most bytes of triples in one INSERT DATA */
+    int jobs;             /* requests kept in flight, 0 to adapt up to BL_MAX_JOBS */
+    int verbose;
+} bl_options;
+
+/* load an N-Triples file into a store with SPARQL Update, returning the
+ * number of triples the store refused, or -1 if the load couldn't finish */
+long bulk_load(const bl_options *opts);
+
+#endif
@@ -0,0 +1,140 @@
+/*  sparql-query - a SPARQL client with GNU readline support
+    Copyright (C) 2006-8 Nick Lamb and Steve Harris for Garlik
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Times how long a command takes to start writing, and to finish, over
+ * many runs, as scripts that run sparql-query over and over see it. Only
+ * needs libc, so it adds nothing of its own to what it measures */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define DEFAULT_RUNS 100
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int by_value(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* the fraction q of the way through sorted times */
+static double quantile(const double *times, int runs, double q)
+{
+    return times[(int) (q * (runs - 1) + 0.5)];
+}
+
+static void report(const char *what, double *times, int runs)
+{
+    qsort(times, runs, sizeof(double), by_value);
+    printf("%-11s median %7.2fms  90%% %7.2fms  min %7.2fms  max %7.2fms\n", what,
+           quantile(times, runs, 0.5) * 1e3, quantile(times, runs, 0.9) * 1e3,
+           times[0] * 1e3, times[runs - 1] * 1e3);
+}
+
+/* run argv once, noting when its first byte of output came and when it
+ * exited, both from just before the fork. Returns its exit status */
+static int run(char *argv[], double *first, double *done)
+{
+    int out[2];
+    if (pipe(out)) {
+        perror("pipe");
+        return -1;
+    }
+    double start = now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        close(out[0]);
+        dup2(out[1], 1);
+        close(out[1]);
+        execvp(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+    close(out[1]);
+
+    char block[65536];
+    ssize_t len;
+    *first = -1.0;
+    while ((len = read(out[0], block, sizeof(block))) > 0) {
+        if (*first < 0.0) {
+            *first = now() - start;
+        }
+    }
+    close(out[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    *done = now() - start;
+    if (*first < 0.0) {
+        /* it wrote nothing */
+        *first = *done;
+    }
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    int runs = DEFAULT_RUNS;
+    int c;
+
+    while ((c = getopt(argc, argv, "+n:")) != -1) {
+        switch (c) {
+            case 'n': runs = atoi(optarg); break;
+            default: runs = 0; break;
+        }
+    }
+    if (runs < 1 || optind >= argc) {
+        fprintf(stderr, "Usage: %s [-n runs] <command> [<arg>...]\n", argv[0]);
+        fprintf(stderr, " -n  how many times to run it (default %d)\n", DEFAULT_RUNS);
+        return 1;
+    }
+
+    double *first = malloc(runs * sizeof(double));
+    double *done = malloc(runs * sizeof(double));
+    for (int i=0; i<runs; i++) {
+        int status = run(argv + optind, first + i, done + i);
+        if (status) {
+            fprintf(stderr, "%s exited with status %d\n", argv[optind], status);
+            return 1;
+        }
+    }
+    report("first byte", first, runs);
+    report("exit", done, runs);
+    free(first);
+    free(done);
+
+    return 0;
+}
+
+/* vi:set expandtab sts=4 sw=4: */
@@ -0,0 +1,317 @@
+/*  sparql-query - a SPARQL client with GNU readline support
+    Copyright (C) 2006-8 Nick Lamb and Steve Harris for Garlik
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* compares results with diff_results() and polls them with watch_results(),
+ * against a tiny HTTP server on the loopback. Rows are held in almost no
+ * memory, so they go through the temporary partitions, and the watched
+ * results change only once, so every later poll is answered 304 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <glib.h>
+
+#include "diff.h"
+
+#define DOC_START \
+    "<?xml version=\"1.0\"?>\n" \
+    "<sparql xmlns=\"http://www.w3.org/2005/sparql-results#\">\n"
+
+#define EX "http://example.org/"
+
+#define ROW(s, o) "<result><binding name=\"s\">" s "</binding><binding name=\"o\">" o "</binding></result>\n"
+
+/* each side has a row the other hasn't, and one more copy of another. The
+ * rows with blank nodes and language tags that differ only in case match */
+static const char *before_rows =
+    DOC_START "<head><variable name=\"s\"/><variable name=\"o\"/></head><results>\n"
+    ROW("<uri>" EX "a</uri>", "<literal>1</literal>")
+    ROW("<uri>" EX "b</uri>", "<literal>2</literal>")
+    ROW("<uri>" EX "c</uri>", "<literal>3</literal>")
+    ROW("<uri>" EX "c</uri>", "<literal>3</literal>")
+    ROW("<bnode>b1</bnode>", "<literal>4</literal>")
+    ROW("<uri>" EX "d</uri>", "<literal xml:lang=\"EN\">x</literal>")
+    "</results></sparql>\n";
+
+static const char *after_rows =
+    DOC_START "<head><variable name=\"s\"/><variable name=\"o\"/></head><results>\n"
+    ROW("<uri>" EX "c</uri>", "<literal>3</literal>")
+    ROW("<uri>" EX "d</uri>", "<literal xml:lang=\"en\">x</literal>")
+    ROW("<uri>" EX "a</uri>", "<literal>1</literal>")
+    ROW("<uri>" EX "c</uri>", "<literal>3</literal>")
+    ROW("<bnode>zz</bnode>", "<literal>4</literal>")
+    ROW("<uri>" EX "e</uri>", "<literal>5</literal>")
+    ROW("<uri>" EX "c</uri>", "<literal>3</literal>")
+    "</results></sparql>\n";
+
+static const char *rows_diff =
+    "\t?s\t?o\n"
+    "+\t<" EX "c>\t\"3\"\n"
+    "+\t<" EX "e>\t\"5\"\n"
+    "-\t<" EX "b>\t\"2\"\n";
+
+static const char *ask_true = DOC_START "<head/><boolean>true</boolean></sparql>\n";
+static const char *ask_false = DOC_START "<head/><boolean>false</boolean></sparql>\n";
+
+static const char *watched =
+    DOC_START "<head><variable name=\"s\"/></head><results>\n"
+    "<result><binding name=\"s\"><uri>" EX "a</uri></binding></result>\n"
+    "</results></sparql>\n";
+
+#define WATCH_ETAG "\"v1\""
+#define WATCH_POLLS 4
+
+static int port;
+static gint watch_polls, watch_unchanged;
+
+static void respond(int fd, const char *status, const char *extra, const char *body)
+{
+    char *response = g_strdup_printf("HTTP/1.1 %s\r\nContent-Type: application/sparql-results+xml\r\n"
+                                     "Content-Length: %zu\r\n%sConnection: close\r\n\r\n%s",
+                                     status, strlen(body), extra, body);
+    size_t len = strlen(response);
+    for (size_t at = 0; at < len; ) {
+        ssize_t n = write(fd, response + at, len - at);
+        if (n <= 0) {
+            break;
+        }
+        at += n;
+    }
+    g_free(response);
+}
+
+/* one request a connection: /rows, /ask, or /watch, which is unchanged
+ * once the client has its ETag */
+static gpointer serve(gpointer data)
+{
+    int listener = GPOINTER_TO_INT(data);
+    int fd;
+
+    while ((fd = accept(listener, NULL, NULL)) >= 0) {
+        GString *request = g_string_new(NULL);
+        char buf[4096];
+        ssize_t n;
+        while (!strstr(request->str, "\r\n\r\n") && (n = read(fd, buf, sizeof(buf))) > 0) {
+            g_string_append_len(request, buf, n);
+        }
+        if (g_str_has_prefix(request->str, "GET /rows")) {
+            respond(fd, "200 OK", "", after_rows);
+        } else if (g_str_has_prefix(request->str, "GET /ask")) {
+            respond(fd, "200 OK", "", ask_false);
+        } else if (g_str_has_prefix(request->str, "GET /watch")) {
+            g_atomic_int_inc(&watch_polls);
+            if (strstr(request->str, "If-None-Match: " WATCH_ETAG)) {
+                g_atomic_int_inc(&watch_unchanged);
+                respond(fd, "304 Not Modified", "ETag: " WATCH_ETAG "\r\n", "");
+            } else {
+                respond(fd, "200 OK", "ETag: " WATCH_ETAG "\r\n", watched);
+            }
+        } else {
+            respond(fd, "404 Not Found", "", "");
+        }
+        g_string_free(request, TRUE);
+        close(fd);
+    }
+
+    return NULL;
+}
+
+static void start_server()
+{
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t len = sizeof(addr);
+
+    if (listener < 0 || bind(listener, (struct sockaddr *) &addr, len) || listen(listener, 16) ||
+        getsockname(listener, (struct sockaddr *) &addr, &len)) {
+        perror("can't listen on the loopback");
+        exit(1);
+    }
+    port = ntohs(addr.sin_port);
+    g_thread_new("server", serve, GINT_TO_POINTER(listener));
+}
+
+static char *write_temp(const char *text)
+{
+    char *name = g_strdup("/tmp/sparql-test-XXXXXX");
+    int fd = mkstemp(name);
+    if (fd < 0 || write(fd, text, strlen(text)) != (ssize_t) strlen(text)) {
+        perror(name);
+        exit(1);
+    }
+    close(fd);
+
+    return name;
+}
+
+/* send what's written to standard out to a new temporary file */
+static int capture(void)
+{
+    char name[] = "/tmp/sparql-test-XXXXXX";
+    int fd = mkstemp(name);
+    unlink(name);
+    fflush(stdout);
+    int saved = dup(1);
+    dup2(fd, 1);
+    close(fd);
+
+    return saved;
+}
+
+/* put standard out back, returning what was written meanwhile */
+static char *captured(int saved)
+{
+    fflush(stdout);
+    off_t len = lseek(1, 0, SEEK_END);
+    char *text = g_malloc0(len + 1);
+    if (pread(1, text, len, 0) != len) {
+        perror("captured output");
+    }
+    dup2(saved, 1);
+    close(saved);
+
+    return text;
+}
+
+static int by_string(const void *a, const void *b)
+{
+    return strcmp(*(char **) a, *(char **) b);
+}
+
+/* the head, then the rows in order, whichever partitions they came from */
+static char *sorted_lines(const char *text)
+{
+    char **lines = g_strsplit(text, "\n", -1);
+    guint count = g_strv_length(lines);
+    if (count > 2) {
+        /* the last is empty, after the final newline */
+        qsort(lines + 1, count - 2, sizeof(char *), by_string);
+    }
+    char *joined = g_strjoinv("\n", lines);
+    g_strfreev(lines);
+
+    return joined;
+}
+
+/* before from a saved file, after from path on the server */
+static int check_diff(const char *before, const char *path, size_t memory, const char *expected, int differences)
+{
+    char *filename = write_temp(before);
+    char *endpoint = g_strdup_printf("http://127.0.0.1:%d%s", port, path);
+    df_options opts = {
+        .query = "SELECT * WHERE { ?s ?o ?x }",
+        .before = filename,
+        .is_file = 1,
+        .after = endpoint,
+        .memory = memory,
+    };
+
+    int saved = capture();
+    int found = diff_results(&opts);
+    char *text = captured(saved);
+    char *lines = sorted_lines(text);
+    int ok = found == differences && (!expected || !strcmp(lines, expected));
+    if (!ok) {
+        fprintf(stderr, "%s with %zu bytes: %d differences, wrote\n%s", path, memory, found, text);
+    }
+
+    unlink(filename);
+    g_free(filename);
+    g_free(endpoint);
+    g_free(text);
+    g_free(lines);
+
+    return ok;
+}
+
+/* polls until the results have been unchanged a few times. Only the first
+ * poll's rows are written, and only it is counted up on standard error */
+static int check_watch()
+{
+    char name[] = "/tmp/sparql-test-XXXXXX", err_name[] = "/tmp/sparql-test-XXXXXX";
+    int fd = mkstemp(name), err = mkstemp(err_name);
+    unlink(name);
+    unlink(err_name);
+    fflush(stdout);
+
+    pid_t child = fork();
+    if (child == 0) {
+        char *endpoint = g_strdup_printf("http://127.0.0.1:%d/watch", port);
+        df_options opts = { .query = "SELECT * WHERE { ?s ?p ?o }", .after = endpoint };
+        dup2(fd, 1);
+        dup2(err, 2);
+        watch_results(&opts, 0.01);
+        _exit(1);
+    }
+
+    for (int waited = 0; g_atomic_int_get(&watch_unchanged) < WATCH_POLLS && waited < 1000; waited++) {
+        g_usleep(10000);
+    }
+    kill(child, SIGKILL);
+    waitpid(child, NULL, 0);
+
+    char text[4096] = { 0 }, messages[4096] = { 0 };
+    if (pread(fd, text, sizeof(text) - 1, 0) < 0 || pread(err, messages, sizeof(messages) - 1, 0) < 0) {
+        perror("watch output");
+    }
+    close(fd);
+    close(err);
+
+    char *newline = strchr(messages, '\n');
+    int ok = g_atomic_int_get(&watch_unchanged) >= WATCH_POLLS && !strcmp(text, "\t?s\n+\t<" EX "a>\n") &&
+             g_str_has_suffix(messages, " 0 rows gone, 1 new, of 1\n") && newline && !newline[1];
+    if (!ok) {
+        fprintf(stderr, "%d polls, %d unchanged, wrote\n%s%s", g_atomic_int_get(&watch_polls),
+                g_atomic_int_get(&watch_unchanged), text, messages);
+    }
+
+    return ok;
+}
+
+int main()
+{
+    int failed = 0;
+
+    start_server();
+
+    struct {
+        const char *name;
+        int ok;
+    } checks[] = {
+        /* one byte, so every row goes to the partitions */
+        { "diff spilled", check_diff(before_rows, "/rows", 1, rows_diff, 3) },
+        { "diff in memory", check_diff(before_rows, "/rows", 1024 * 1024, rows_diff, 3) },
+        { "diff ask", check_diff(ask_true, "/ask", 1, "-\ttrue\n+\tfalse\n", 2) },
+        { "diff ask with rows", check_diff(before_rows, "/ask", 1, NULL, -1) },
+        { "watch unchanged", check_watch() },
+        { NULL, 0 }
+    };
+    for (int i=0; checks[i].name; i++) {
+        fprintf(stderr, "%s: %s\n", checks[i].name, checks[i].ok ? "ok" : "FAILED");
+        failed |= !checks[i].ok;
+    }
+
+    return failed;
+}
+
+/* vi:set expandtab sts=4 sw=4: */
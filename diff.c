@@ -0,0 +1,681 @@
+/*  sparql-query - a SPARQL client with GNU readline support
+    Copyright (C) 2006-8 Nick Lamb and Steve Harris for Garlik
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* One query, two sets of results, and the rows that differ
+ *
+ * Both sides are parsed as they arrive, as in federate.c, with the head of
+ * whichever answers first. Each row is reduced to a 64-bit hash of its
+ * terms, with blank node labels left out since two stores needn't agree on
+ * them and language tags folded to lower case, and counted up for one side
+ * and down for the other in a table of hashes. A row that both sides have
+ * leaves the table as soon as the second copy arrives, so identical results
+ * need little memory however big they are. Whatever remains at the end is
+ * the difference.
+ *
+ * If the table outgrows the memory allowed, it's written out to PARTITIONS
+ * temporary files by hash, and emptied. At the end each file is read back
+ * into the table in turn, where the rows of each side left in it meet.
+ *
+ * Watching a query compares each poll's results with the last's the same
+ * way, keeping the last in a second table. Polls ask for the results only
+ * if their ETag or Last-Modified has changed, and a 304 isn't parsed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <glib.h>
+#include <zlib.h>
+
+#include <curl/curl.h>
+
+#include "diff.h"
+#include "hash.h"
+#include "http-share.h"
+#include "sparqlquery.h"
+
+#define SPARQL_RESULTS "application/sparql-results+xml"
+
+#define PARTITIONS 16
+
+/* read from a saved file at a time, and how many rows it may get ahead of
+ * the endpoint */
+#define FILE_CHUNK (64 * 1024)
+#define FILE_AHEAD 4096
+
+/* what holding a row costs beyond its text */
+#define ENTRY_OVERHEAD (sizeof(entry) + 48)
+
+typedef struct {
+    guint64 hash;    /* first, it's the key */
+    gint64 balance;  /* copies after has, less copies before has */
+    char line[];     /* as written out */
+} entry;
+
+struct diff;
+
+typedef struct {
+    const char *name;
+    int sign;        /* -1 before, 1 after */
+    CURL *curl;
+    gzFile file;
+    char error[CURL_ERROR_SIZE];
+    sq_parser *results;
+    int unsupported;
+    int *map;        /* column of each of this side's variables, or -1 */
+    int vars;
+    int boolean;     /* -1 until the answer to an ASK is seen */
+    long rows;
+    GString *line, *key; /* for each row in turn */
+    char *etag, *modified;            /* validators of the results we have */
+    char *next_etag, *next_modified;  /* and of those arriving */
+    struct diff *diff;
+} side;
+
+struct diff {
+    const df_options *opts;
+    GPtrArray *head;
+    GHashTable *table; /* hash to entry */
+    size_t held;
+    gzFile parts[PARTITIONS];
+    int part_fds[PARTITIONS];
+    int spilled;
+    long removed, added;
+};
+
+static void count_row(struct diff *d, guint64 hash, gint64 change, const char *line, int may_spill);
+
+/* write out the table and empty it */
+static void spill(struct diff *d)
+{
+    if (!d->spilled) {
+        for (int i=0; i<PARTITIONS; i++) {
+            GError *error = NULL;
+            char *name = NULL;
+            d->part_fds[i] = g_file_open_tmp("sparql-query-XXXXXX", &name, &error);
+            if (d->part_fds[i] < 0) {
+                fprintf(stderr, "can't write rows to a temporary file: %s\n", error->message);
+                g_error_free(error);
+                /* carry on in memory */
+                while (i-- > 0) {
+                    gzclose(d->parts[i]);
+                    close(d->part_fds[i]);
+                }
+                d->held = 0;
+                d->opts = NULL;
+                return;
+            }
+            unlink(name);
+            g_free(name);
+            d->parts[i] = gzdopen(dup(d->part_fds[i]), "wb1");
+        }
+        d->spilled = 1;
+    }
+
+    GHashTableIter iter;
+    entry *e;
+    g_hash_table_iter_init(&iter, d->table);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &e)) {
+        gzFile part = d->parts[e->hash >> 60];
+        guint32 len = strlen(e->line);
+        gzwrite(part, &e->hash, sizeof(e->hash));
+        gzwrite(part, &e->balance, sizeof(e->balance));
+        gzwrite(part, &len, sizeof(len));
+        gzwrite(part, e->line, len);
+    }
+    g_hash_table_remove_all(d->table);
+    d->held = 0;
+}
+
+static void count_row(struct diff *d, guint64 hash, gint64 change, const char *line, int may_spill)
+{
+    entry *e = g_hash_table_lookup(d->table, &hash);
+    if (!e) {
+        size_t len = strlen(line);
+        e = g_malloc(sizeof(entry) + len + 1);
+        e->hash = hash;
+        e->balance = 0;
+        memcpy(e->line, line, len + 1);
+        g_hash_table_insert(d->table, &e->hash, e);
+        d->held += ENTRY_OVERHEAD + len;
+    }
+    e->balance += change;
+    if (e->balance == 0) {
+        d->held -= ENTRY_OVERHEAD + strlen(e->line);
+        g_hash_table_remove(d->table, &hash);
+    } else if (may_spill && d->opts && d->held > d->opts->memory) {
+        spill(d);
+    }
+}
+
+/* the head is fixed by the first side to send one */
+static void side_head(void *data, int count, char **names)
+{
+    side *s = data;
+    struct diff *d = s->diff;
+
+    if (!count) {
+        /* an ASK */
+        return;
+    }
+    if (!d->head) {
+        d->head = g_ptr_array_new_with_free_func(g_free);
+        for (int i=0; i<count; i++) {
+            g_ptr_array_add(d->head, g_strdup(names[i]));
+        }
+    }
+    s->vars = count;
+    g_free(s->map);
+    s->map = g_new(int, MAX(count, 1));
+    for (int i=0; i<count; i++) {
+        s->map[i] = -1;
+        for (guint j=0; j<d->head->len; j++) {
+            if (!strcmp(names[i], d->head->pdata[j])) {
+                s->map[i] = j;
+                break;
+            }
+        }
+        if (s->map[i] < 0) {
+            fprintf(stderr, "%s: not comparing ?%s, the other results don't have it\n", s->name, names[i]);
+        }
+    }
+}
+
+static void side_row(void *data, const sq_term *terms)
+{
+    side *s = data;
+    struct diff *d = s->diff;
+    GString *line = s->line, *key = s->key;
+
+    if (!d->head) {
+        /* a SELECT with no variables */
+        d->head = g_ptr_array_new_with_free_func(g_free);
+    }
+    const sq_term *row[MAX(d->head->len, 1)];
+    memset(row, 0, sizeof(row));
+    g_string_truncate(line, 0);
+    g_string_truncate(key, 0);
+
+    for (int i=0; i<s->vars; i++) {
+        if (s->map[i] >= 0 && terms[i].kind != SQ_UNBOUND) {
+            row[s->map[i]] = &terms[i];
+        }
+    }
+    for (guint i=0; i<d->head->len; i++) {
+        if (i > 0) {
+            g_string_append_c(line, '\t');
+        }
+        g_string_append_c(key, row[i] ? row[i]->kind : SQ_UNBOUND);
+        if (!row[i]) {
+            continue;
+        }
+        char *term = sq_term_ntriples(row[i]);
+        g_string_append(line, term);
+        free(term);
+        if (row[i]->kind == SQ_BNODE) {
+            /* any blank node matches any other */
+            continue;
+        }
+        g_string_append(key, row[i]->value);
+        g_string_append_c(key, '\0');
+        if (row[i]->lang) {
+            char *lang = g_ascii_strdown(row[i]->lang, -1);
+            g_string_append_printf(key, "@%s", lang);
+            g_free(lang);
+        } else if (row[i]->datatype) {
+            g_string_append_printf(key, "^^%s", row[i]->datatype);
+        }
+        g_string_append_c(key, '\0');
+    }
+    s->rows++;
+    count_row(d, hash_bytes(key->str, key->len), s->sign, line->str, 1);
+}
+
+static void side_boolean(void *data, int value)
+{
+    side *s = data;
+    s->boolean = value;
+}
+
+static size_t write_fn(void *ptr, size_t size, size_t nmemb, void *data)
+{
+    side *s = data;
+    size_t len = size * nmemb;
+
+    if (s->results) {
+        sq_parser_write(s->results, ptr, len);
+    }
+
+    return len;
+}
+
+/* the value of header name, if that's the header in ptr */
+static char *header_value(const char *ptr, size_t len, const char *name)
+{
+    size_t name_len = strlen(name);
+
+    if (len <= name_len || g_ascii_strncasecmp(ptr, name, name_len)) {
+        return NULL;
+    }
+
+    return g_strstrip(g_strndup(ptr + name_len, len - name_len));
+}
+
+static size_t header_fn(void *ptr, size_t size, size_t nmemb, void *data)
+{
+    side *s = data;
+    size_t len = size * nmemb;
+    long status = 0;
+
+    curl_easy_getinfo(s->curl, CURLINFO_RESPONSE_CODE, &status);
+    if (status >= 300) {
+        return len;
+    }
+
+    char *value;
+    if ((value = header_value(ptr, len, "ETag:"))) {
+        g_free(s->next_etag);
+        s->next_etag = value;
+        return len;
+    }
+    if ((value = header_value(ptr, len, "Last-Modified:"))) {
+        g_free(s->next_modified);
+        s->next_modified = value;
+        return len;
+    }
+    char *type = header_value(ptr, len, "Content-Type:");
+    if (!type || s->results) {
+        g_free(type);
+        return len;
+    }
+
+    if (!g_ascii_strncasecmp(type, SPARQL_RESULTS, strlen(SPARQL_RESULTS))) {
+        s->results = sq_parser_new(side_head, side_row, side_boolean, s);
+    } else {
+        fprintf(stderr, "%s: can't compare results of type %s\n", s->name, type);
+        s->unsupported = 1;
+    }
+    g_free(type);
+
+    return len;
+}
+
+static CURL *side_request(side *s, const char *query, struct curl_slist *headers, int verbose)
+{
+    s->curl = hs_easy_init();
+    const char *ep = hs_endpoint(s->curl, s->name);
+    char *encoded = curl_easy_escape(s->curl, query, 0);
+    char *url = g_strdup_printf("%s%squery=%s", ep, strchr(ep, '?') ? "&" : "?", encoded);
+    curl_free(encoded);
+    curl_easy_setopt(s->curl, CURLOPT_URL, url);
+    g_free(url);
+    curl_easy_setopt(s->curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(s->curl, CURLOPT_VERBOSE, (long) verbose);
+    curl_easy_setopt(s->curl, CURLOPT_ERRORBUFFER, s->error);
+    curl_easy_setopt(s->curl, CURLOPT_HEADERFUNCTION, header_fn);
+    curl_easy_setopt(s->curl, CURLOPT_HEADERDATA, s);
+    curl_easy_setopt(s->curl, CURLOPT_WRITEFUNCTION, write_fn);
+    curl_easy_setopt(s->curl, CURLOPT_WRITEDATA, s);
+    curl_easy_setopt(s->curl, CURLOPT_PRIVATE, s);
+
+    return s->curl;
+}
+
+/* hand the parser the next piece of a saved file, returning 0 at the end */
+static int read_file(side *s)
+{
+    char buf[FILE_CHUNK];
+    int len = gzread(s->file, buf, sizeof(buf));
+
+    if (len > 0) {
+        sq_parser_write(s->results, buf, len);
+        return 1;
+    }
+    if (len < 0) {
+        int code;
+        fprintf(stderr, "%s: %s\n", s->name, gzerror(s->file, &code));
+        s->unsupported = 1;
+    }
+
+    return 0;
+}
+
+/* returns non-zero if the side failed */
+static int finish_side(side *s, CURLcode code)
+{
+    int failed = s->unsupported;
+    long status = 0;
+
+    if (s->results && sq_parser_finish(s->results)) {
+        fprintf(stderr, "%s: results aren't well-formed\n", s->name);
+        failed = 1;
+    }
+    s->results = NULL;
+    if (!s->curl) {
+        return failed;
+    }
+    curl_easy_getinfo(s->curl, CURLINFO_RESPONSE_CODE, &status);
+    if (code) {
+        fprintf(stderr, "%s: %s\n", s->name, s->error);
+        failed = 1;
+    } else if (status >= 300) {
+        fprintf(stderr, "%s: HTTP %ld\n", s->name, status);
+        failed = 1;
+    }
+
+    return failed;
+}
+
+static gint by_line(gconstpointer a, gconstpointer b)
+{
+    return strcmp((*(entry **) a)->line, (*(entry **) b)->line);
+}
+
+/* write out what's left in the table, in order, and empty it */
+static void report(struct diff *d)
+{
+    GPtrArray *entries = g_ptr_array_sized_new(g_hash_table_size(d->table));
+    GHashTableIter iter;
+    entry *e;
+
+    g_hash_table_iter_init(&iter, d->table);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &e)) {
+        g_ptr_array_add(entries, e);
+    }
+    g_ptr_array_sort(entries, by_line);
+    for (guint i=0; i<entries->len; i++) {
+        e = entries->pdata[i];
+        for (gint64 n = e->balance; n != 0; n += n < 0 ? 1 : -1) {
+            printf("%c\t%s\n", n < 0 ? '-' : '+', e->line);
+            if (n < 0) {
+                d->removed++;
+            } else {
+                d->added++;
+            }
+        }
+    }
+    g_ptr_array_free(entries, TRUE);
+    g_hash_table_remove_all(d->table);
+    d->held = 0;
+}
+
+/* read each partition back into the table and write out what's left */
+static void report_spilled(struct diff *d)
+{
+    spill(d);
+    for (int i=0; i<PARTITIONS; i++) {
+        gzclose(d->parts[i]);
+        lseek(d->part_fds[i], 0, SEEK_SET);
+        gzFile part = gzdopen(d->part_fds[i], "rb");
+        guint64 hash;
+        gint64 balance;
+        guint32 len;
+        GString *line = g_string_new(NULL);
+        while (gzread(part, &hash, sizeof(hash)) == sizeof(hash) &&
+               gzread(part, &balance, sizeof(balance)) == sizeof(balance) &&
+               gzread(part, &len, sizeof(len)) == sizeof(len)) {
+            g_string_set_size(line, len);
+            if (gzread(part, line->str, len) != (int) len) {
+                fprintf(stderr, "rows read back from a temporary file end abruptly\n");
+                break;
+            }
+            count_row(d, hash, balance, line->str, 0);
+        }
+        g_string_free(line, TRUE);
+        gzclose(part);
+        report(d);
+    }
+}
+
+static void write_head(struct diff *d)
+{
+    for (guint i=0; i<d->head->len; i++) {
+        printf("\t?%s", (char *) d->head->pdata[i]);
+    }
+    printf("\n");
+}
+
+int diff_results(const df_options *opts)
+{
+    struct diff d = { .opts = opts };
+    side sides[2] = {
+        { .name = opts->before, .sign = -1, .boolean = -1, .diff = &d },
+        { .name = opts->after, .sign = 1, .boolean = -1, .diff = &d },
+    };
+    for (int i=0; i<2; i++) {
+        sides[i].line = g_string_new(NULL);
+        sides[i].key = g_string_new(NULL);
+    }
+    side *file = NULL, *ep = &sides[1];
+    CURLM *multi = curl_multi_init();
+    struct curl_slist *headers = curl_slist_append(NULL, "Accept: " SPARQL_RESULTS);
+    int failed = 0;
+
+    d.table = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, g_free);
+    if (opts->is_file) {
+        file = &sides[0];
+        if (!(file->file = gzopen(file->name, "rb"))) {
+            fprintf(stderr, "can't read %s\n", file->name);
+            failed = 1;
+        }
+        file->results = sq_parser_new(side_head, side_row, side_boolean, file);
+    } else {
+        curl_multi_add_handle(multi, side_request(&sides[0], opts->query, headers, opts->verbose));
+    }
+    curl_multi_add_handle(multi, side_request(ep, opts->query, headers, opts->verbose));
+
+    int running = 1, reading = file && file->file;
+    while (running || reading) {
+        if (running) {
+            curl_multi_perform(multi, &running);
+        }
+        /* keep the file level with the endpoint, so that rows meet early */
+        while (reading && (!running || file->rows <= ep->rows + FILE_AHEAD)) {
+            reading = read_file(file);
+        }
+        if (running) {
+            curl_multi_wait(multi, NULL, 0, 1000, NULL);
+        }
+
+        CURLMsg *msg;
+        int left;
+        while ((msg = curl_multi_info_read(multi, &left))) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+            side *s;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &s);
+            failed |= finish_side(s, msg->data.result);
+        }
+    }
+    if (file) {
+        failed |= finish_side(file, CURLE_OK);
+        if (file->file) {
+            gzclose(file->file);
+        }
+    }
+
+    if (!failed && (sides[0].boolean >= 0) != (sides[1].boolean >= 0)) {
+        fprintf(stderr, "can't compare the answer to an ASK with rows\n");
+        failed = 1;
+    }
+    if (!failed) {
+        if (d.head) {
+            write_head(&d);
+        }
+        if (d.spilled) {
+            report_spilled(&d);
+        } else {
+            report(&d);
+        }
+        if (sides[0].boolean >= 0 && sides[1].boolean >= 0 && sides[0].boolean != sides[1].boolean) {
+            printf("-\t%s\n+\t%s\n", sides[0].boolean ? "true" : "false", sides[1].boolean ? "true" : "false");
+            d.removed++;
+            d.added++;
+        }
+        fflush(stdout);
+        fprintf(stderr, "%ld rows only from %s, %ld only from %s\n", d.removed, sides[0].name, d.added, sides[1].name);
+    } else if (d.spilled) {
+        for (int i=0; i<PARTITIONS; i++) {
+            gzclose(d.parts[i]);
+            close(d.part_fds[i]);
+        }
+    }
+    fflush(stdout);
+
+    for (int i=0; i<2; i++) {
+        if (sides[i].curl) {
+            curl_multi_remove_handle(multi, sides[i].curl);
+            curl_easy_cleanup(sides[i].curl);
+        }
+        if (sides[i].results) {
+            sq_parser_finish(sides[i].results);
+        }
+        g_free(sides[i].map);
+        g_string_free(sides[i].line, TRUE);
+        g_string_free(sides[i].key, TRUE);
+        g_free(sides[i].next_etag);
+        g_free(sides[i].next_modified);
+    }
+    curl_multi_cleanup(multi);
+    curl_slist_free_all(headers);
+    g_hash_table_destroy(d.table);
+    if (d.head) {
+        g_ptr_array_free(d.head, TRUE);
+    }
+
+    return failed ? -1 : d.removed + d.added;
+}
+
+/* replace the validators sent with a poll by those of its results */
+static void keep_validator(char **have, char **arrived)
+{
+    g_free(*have);
+    *have = *arrived;
+    *arrived = NULL;
+}
+
+void watch_results(const df_options *opts, double interval)
+{
+    /* the rows of one poll are held in memory */
+    df_options in_memory = *opts;
+    in_memory.memory = G_MAXSIZE;
+    struct diff d = { .opts = &in_memory };
+    side s = { .name = opts->after, .sign = 1, .boolean = -1, .diff = &d };
+    GHashTable *last = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, g_free);
+    int last_boolean = -1, head_written = 0;
+
+    s.line = g_string_new(NULL);
+    s.key = g_string_new(NULL);
+    side_request(&s, opts->query, NULL, opts->verbose);
+    curl_easy_setopt(s.curl, CURLOPT_ACCEPT_ENCODING, "");
+
+    for (int poll = 0; ; poll++) {
+        if (poll) {
+            g_usleep(interval * G_USEC_PER_SEC);
+        }
+        struct curl_slist *headers = curl_slist_append(NULL, "Accept: " SPARQL_RESULTS);
+        if (s.etag) {
+            char *header = g_strdup_printf("If-None-Match: %s", s.etag);
+            headers = curl_slist_append(headers, header);
+            g_free(header);
+        }
+        if (s.modified) {
+            char *header = g_strdup_printf("If-Modified-Since: %s", s.modified);
+            headers = curl_slist_append(headers, header);
+            g_free(header);
+        }
+        curl_easy_setopt(s.curl, CURLOPT_HTTPHEADER, headers);
+        d.table = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, g_free);
+        s.boolean = -1;
+        s.unsupported = 0;
+        s.rows = 0;
+
+        CURLcode code = curl_easy_perform(s.curl);
+        long status = 0;
+        curl_easy_getinfo(s.curl, CURLINFO_RESPONSE_CODE, &status);
+        curl_slist_free_all(headers);
+        if (!code && status == 304) {
+            if (opts->verbose) {
+                fprintf(stderr, "%s: unchanged\n", s.name);
+            }
+            g_hash_table_destroy(d.table);
+            continue;
+        }
+        if (finish_side(&s, code)) {
+            /* try again next time, against the last results we had */
+            g_free(s.next_etag);
+            g_free(s.next_modified);
+            s.next_etag = s.next_modified = NULL;
+            g_hash_table_destroy(d.table);
+            continue;
+        }
+        keep_validator(&s.etag, &s.next_etag);
+        keep_validator(&s.modified, &s.next_modified);
+
+        /* what's changed goes in a table of its own, for report() */
+        GHashTable *now = d.table;
+        GHashTableIter iter;
+        entry *e;
+        d.table = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, g_free);
+        d.held = 0;
+        g_hash_table_iter_init(&iter, now);
+        while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &e)) {
+            entry *was = g_hash_table_lookup(last, &e->hash);
+            if (!was || was->balance != e->balance) {
+                count_row(&d, e->hash, e->balance - (was ? was->balance : 0), e->line, 0);
+            }
+        }
+        g_hash_table_iter_init(&iter, last);
+        while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &e)) {
+            if (!g_hash_table_lookup(now, &e->hash)) {
+                count_row(&d, e->hash, -e->balance, e->line, 0);
+            }
+        }
+        g_hash_table_destroy(last);
+        last = now;
+
+        if (d.head && !head_written) {
+            write_head(&d);
+            head_written = 1;
+        }
+        d.removed = d.added = 0;
+        report(&d);
+        g_hash_table_destroy(d.table);
+        if (s.boolean >= 0 && s.boolean != last_boolean) {
+            if (last_boolean >= 0) {
+                printf("-\t%s\n", last_boolean ? "true" : "false");
+                d.removed++;
+            }
+            printf("+\t%s\n", s.boolean ? "true" : "false");
+            d.added++;
+            last_boolean = s.boolean;
+        }
+        fflush(stdout);
+        if (d.removed || d.added || opts->verbose) {
+            char when[32];
+            time_t now_time = time(NULL);
+            strftime(when, sizeof(when), "%H:%M:%S", localtime(&now_time));
+            fprintf(stderr, "%s %ld rows gone, %ld new, of %ld\n", when, d.removed, d.added, s.rows);
+        }
+    }
+}
+
+/* vi:set expandtab sts=4 sw=4: */
@@ -0,0 +1,25 @@
+#ifndef DIFF_H
+#define DIFF_H
+
+#include <stddef.h>
+
+typedef struct {
+    const char *query;
+    const char *before; /* endpoint, or saved SPARQL XML results if is_file */
+    int is_file;
+    const char *after;  /* endpoint, or the one watched */
+    size_t memory;      /* bytes of rows held before using temporary files */
+    int verbose;
+} df_options;
+
+/* compare the results of query from before and after, running it on both
+ * at once, and write the rows only one of them has, marked - or +.
+ * Returns how many there were, or -1 if either failed */
+int diff_results(const df_options *opts);
+
+/* run the query on after every interval seconds, once the last run is
+ * done, writing the rows that came or went since as diff_results() does.
+ * Runs until it's killed */
+void watch_results(const df_options *opts, double interval);
+
+#endif
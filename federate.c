@@ -0,0 +1,323 @@
+/*  sparql-query - a SPARQL client with GNU readline support
+    Copyright (C) 2006-8 Nick Lamb and Steve Harris for Garlik
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* One query, several endpoints
+ *
+ * Each endpoint's results go through their own libxml2 push parser as they
+ * arrive, and every row is written out as soon as it is complete, so the
+ * output can't be lined up as a table and is always TSV, with terms written
+ * as in SPARQL TSV. The variables of whichever endpoint answers first become
+ * the head. Later endpoints' columns are matched to it by name. Blank nodes
+ * are only the same node within one endpoint's results, so each endpoint's
+ * labels get a prefix of their own.
+ *
+ * RDF results are turned into N-Triples just as for a single endpoint.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+#include <curl/curl.h>
+
+#include "federate.h"
+#include "http-share.h"
+#include "rdf-parse.h"
+#include "sparqlquery.h"
+
+#define SPARQL_RESULTS "application/sparql-results+xml"
+
+typedef struct {
+    const char *endpoint;
+    CURL *curl;
+    char error[CURL_ERROR_SIZE];
+    sq_parser *results;
+    rdf_parser *rdf;
+    int unsupported;
+    int index;       /* of the endpoint, which tells its blank nodes apart */
+
+    int *map;        /* column of each of this endpoint's variables, or -1 */
+    int vars;
+    int boolean;     /* -1 until the answer to an ASK is seen */
+    long rows;
+    struct fed *fed;
+} shard;
+
+struct fed {
+    const fed_options *opts;
+    GPtrArray *head;   /* variable names */
+    GHashTable *seen;  /* rows written, for distinct */
+    int boolean;
+};
+
+/* the head is fixed by the first endpoint to send one */
+static void fix_head(struct fed *f, int count, char **names)
+{
+    f->head = g_ptr_array_new_with_free_func(g_free);
+    for (int i=0; i<count; i++) {
+        g_ptr_array_add(f->head, g_strdup(names[i]));
+    }
+    for (guint i=0; i<f->head->len; i++) {
+        printf("%s?%s", i > 0 ? "\t" : "", (char *) f->head->pdata[i]);
+    }
+    if (f->opts->source) {
+        printf("%s?source", f->head->len > 0 ? "\t" : "");
+    }
+    printf("\n");
+}
+
+static void shard_head(void *data, int count, char **names)
+{
+    shard *s = data;
+    struct fed *f = s->fed;
+
+    if (!f->head) {
+        fix_head(f, count, names);
+    }
+    s->vars = count;
+    s->map = g_new(int, MAX(count, 1));
+    for (int i=0; i<count; i++) {
+        s->map[i] = -1;
+        for (guint j=0; j<f->head->len; j++) {
+            if (!strcmp(names[i], f->head->pdata[j])) {
+                s->map[i] = j;
+                break;
+            }
+        }
+        if (s->map[i] < 0) {
+            fprintf(stderr, "%s: dropping ?%s, the first endpoint to answer didn't have it\n",
+                    s->endpoint, names[i]);
+        }
+    }
+}
+
+static void shard_row(void *data, const sq_term *terms)
+{
+    shard *s = data;
+    struct fed *f = s->fed;
+    const sq_term **row = g_new0(const sq_term *, MAX(f->head->len, 1));
+    GString *line = g_string_new(NULL);
+
+    for (int i=0; i<s->vars; i++) {
+        if (s->map[i] >= 0 && terms[i].kind != SQ_UNBOUND) {
+            row[s->map[i]] = &terms[i];
+        }
+    }
+    for (guint i=0; i<f->head->len; i++) {
+        if (i > 0) {
+            g_string_append_c(line, '\t');
+        }
+        if (row[i] && row[i]->kind == SQ_BNODE) {
+            /* labelled as the RDF parser labels this endpoint's */
+            g_string_append_printf(line, "_:s%d%s", s->index, row[i]->value);
+        } else if (row[i]) {
+            char *term = sq_term_ntriples(row[i]);
+            g_string_append(line, term);
+            g_free(term);
+        }
+    }
+    g_free(row);
+    s->rows++;
+    if (f->opts->distinct) {
+        if (g_hash_table_contains(f->seen, line->str)) {
+            g_string_free(line, TRUE);
+            return;
+        }
+        g_hash_table_add(f->seen, g_strdup(line->str));
+    }
+    if (f->opts->source) {
+        g_string_append_printf(line, "%s%s", f->head->len > 0 ? "\t" : "", s->endpoint);
+    }
+    g_string_append(line, "\t\n");
+    fwrite(line->str, line->len, 1, stdout);
+    g_string_free(line, TRUE);
+}
+
+static void shard_boolean(void *data, int value)
+{
+    shard *s = data;
+    s->boolean = value;
+}
+
+static size_t write_fn(void *ptr, size_t size, size_t nmemb, void *data)
+{
+    shard *s = data;
+    size_t len = size * nmemb;
+
+    if (s->results) {
+        sq_parser_write(s->results, ptr, len);
+    } else if (s->rdf) {
+        rdf_parser_write(ptr, size, nmemb, s->rdf);
+    }
+    fflush(stdout);
+
+    return len;
+}
+
+static size_t header_fn(void *ptr, size_t size, size_t nmemb, void *data)
+{
+    shard *s = data;
+    size_t len = size * nmemb;
+    const char content_type[] = "Content-Type:";
+
+    if (len <= sizeof(content_type) || g_ascii_strncasecmp(ptr, content_type, sizeof(content_type) - 1)) {
+        return len;
+    }
+    long status = 0;
+    curl_easy_getinfo(s->curl, CURLINFO_RESPONSE_CODE, &status);
+    if (status >= 300 || s->results || s->rdf) {
+        return len;
+    }
+
+    char *type = g_strstrip(g_strndup((char *) ptr + sizeof(content_type) - 1, len - sizeof(content_type) + 1));
+    enum rdf_syntax syntax;
+    if (!g_ascii_strncasecmp(type, SPARQL_RESULTS, strlen(SPARQL_RESULTS))) {
+        s->results = sq_parser_new(shard_head, shard_row, shard_boolean, s);
+    } else if ((syntax = rdf_syntax_for_type(type)) != RDF_NONE) {
+        char *url = NULL;
+        curl_easy_getinfo(s->curl, CURLINFO_EFFECTIVE_URL, &url);
+        char *bnode_prefix = g_strdup_printf("s%d", s->index);
+        s->rdf = rdf_parser_new(syntax, url, bnode_prefix, stdout);
+        g_free(bnode_prefix);
+    } else {
+        fprintf(stderr, "%s: can't merge results of type %s\n", s->endpoint, type);
+        s->unsupported = 1;
+    }
+    g_free(type);
+
+    return len;
+}
+
+static void report(shard *s, CURLcode code)
+{
+    long status = 0;
+    double first = 0.0, total = 0.0;
+    curl_easy_getinfo(s->curl, CURLINFO_RESPONSE_CODE, &status);
+    curl_easy_getinfo(s->curl, CURLINFO_STARTTRANSFER_TIME, &first);
+    curl_easy_getinfo(s->curl, CURLINFO_TOTAL_TIME, &total);
+
+    if (code) {
+        fprintf(stderr, "%s: failed after %.1fms: %s\n", s->endpoint, total * 1000.0, s->error);
+    } else if (status >= 300) {
+        fprintf(stderr, "%s: HTTP %ld after %.1fms\n", s->endpoint, status, total * 1000.0);
+    } else {
+        fprintf(stderr, "%s: %ld rows, first byte %.1fms, total %.1fms\n", s->endpoint, s->rows,
+                first * 1000.0, total * 1000.0);
+    }
+}
+
+int federate(const fed_options *opts)
+{
+    struct fed f = { .opts = opts, .boolean = -1 };
+    shard *shards = g_new0(shard, opts->count);
+    CURLM *multi = curl_multi_init();
+    int failed = 0;
+
+    struct curl_slist *headers = curl_slist_append(NULL, "Accept: " SPARQL_RESULTS ", "
+        "application/n-triples;q=0.9, text/turtle;q=0.8, application/rdf+xml;q=0.7");
+    if (opts->distinct) {
+        f.seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    }
+
+    for (int i=0; i<opts->count; i++) {
+        shard *s = &shards[i];
+        s->endpoint = opts->endpoints[i];
+        s->index = i;
+        s->fed = &f;
+        s->boolean = -1;
+        s->curl = hs_easy_init();
+        const char *ep = hs_endpoint(s->curl, s->endpoint);
+        char *encoded = curl_easy_escape(s->curl, opts->query, 0);
+        char *url = g_strdup_printf("%s%squery=%s", ep, strchr(ep, '?') ? "&" : "?", encoded);
+        curl_free(encoded);
+        curl_easy_setopt(s->curl, CURLOPT_URL, url);
+        g_free(url);
+        curl_easy_setopt(s->curl, CURLOPT_HTTPHEADER, headers);
+        curl_easy_setopt(s->curl, CURLOPT_VERBOSE, opts->verbose);
+        curl_easy_setopt(s->curl, CURLOPT_ERRORBUFFER, s->error);
+        curl_easy_setopt(s->curl, CURLOPT_HEADERFUNCTION, header_fn);
+        curl_easy_setopt(s->curl, CURLOPT_HEADERDATA, s);
+        curl_easy_setopt(s->curl, CURLOPT_WRITEFUNCTION, write_fn);
+        curl_easy_setopt(s->curl, CURLOPT_WRITEDATA, s);
+        curl_easy_setopt(s->curl, CURLOPT_PRIVATE, s);
+        curl_multi_add_handle(multi, s->curl);
+    }
+
+    int running = 1;
+    while (running) {
+        curl_multi_perform(multi, &running);
+        if (running) {
+            curl_multi_wait(multi, NULL, 0, 1000, NULL);
+        }
+
+        CURLMsg *msg;
+        int left;
+        while ((msg = curl_multi_info_read(multi, &left))) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+            shard *s;
+            long status = 0;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &s);
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &status);
+            int broken = 0;
+            if (s->results) {
+                broken = sq_parser_finish(s->results);
+                s->results = NULL;
+            }
+            if (s->rdf) {
+                broken = rdf_parser_finish(s->rdf);
+                s->rdf = NULL;
+            }
+            if (msg->data.result || status >= 300 || s->unsupported || broken) {
+                failed++;
+            }
+            if (s->boolean >= 0) {
+                f.boolean = MAX(f.boolean, s->boolean);
+            }
+            report(s, msg->data.result);
+        }
+    }
+    if (f.boolean >= 0) {
+        printf("%s\n", f.boolean ? "true" : "false");
+    }
+    fflush(stdout);
+
+    for (int i=0; i<opts->count; i++) {
+        shard *s = &shards[i];
+        curl_multi_remove_handle(multi, s->curl);
+        curl_easy_cleanup(s->curl);
+        if (s->results) {
+            sq_parser_finish(s->results);
+        }
+        g_free(s->map);
+    }
+    g_free(shards);
+    curl_multi_cleanup(multi);
+    curl_slist_free_all(headers);
+    if (f.head) {
+        g_ptr_array_free(f.head, TRUE);
+    }
+    if (f.seen) {
+        g_hash_table_destroy(f.seen);
+    }
+
+    return failed;
+}
+
+/* vi:set expandtab sts=4 sw=4: */
@@ -0,0 +1,17 @@
+#ifndef FEDERATE_H
+#define FEDERATE_H
+
+typedef struct {
+    const char *query;
+    const char **endpoints;
+    int count;
+    int source;   /* add a ?source column naming the endpoint of each row */
+    int distinct; /* drop rows already written */
+    int verbose;
+} fed_options;
+
+/* send query to every endpoint at once, writing the rows as TSV as soon as
+ * they arrive from any of them, and returning the number that failed */
+int federate(const fed_options *opts);
+
+#endif
@@ -0,0 +1,209 @@
+/*  sparql-query - a SPARQL client with GNU readline support
+    Copyright (C) 2006-8 Nick Lamb and Steve Harris for Garlik
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* SPARQL 1.1 Graph Store HTTP Protocol uploads
+ *
+ * The RDF is sent as it is read from disk, so a file of any size needs only
+ * a buffer's worth of memory. Uploads of unknown length (standard input, or
+ * compressed as they go) use chunked transfer encoding.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <zlib.h>
+
+#include <curl/curl.h>
+
+#include "graph-store.h"
+#include "http-share.h"
+
+#define READ_SIZE 65536
+
+typedef struct {
+    FILE *in;
+    int gzip;
+    z_stream z;
+    unsigned char buf[READ_SIZE];
+    int finished;
+} upload;
+
+static const struct {
+    const char *suffix;
+    const char *type;
+} types[] = {
+    { ".nt", "application/n-triples" },
+    { ".ttl", "text/turtle" },
+    { ".n3", "text/n3" },
+    { ".rdf", "application/rdf+xml" },
+    { ".owl", "application/rdf+xml" },
+    { ".xml", "application/rdf+xml" },
+    { ".nq", "application/n-quads" },
+    { ".trig", "application/trig" },
+    { ".jsonld", "application/ld+json" },
+    { NULL, NULL }
+};
+
+/* the RDF syntax suggested by name, ignoring a .gz suffix */
+static const char *guess_type(const char *name)
+{
+    char *base = g_str_has_suffix(name, ".gz") ? g_strndup(name, strlen(name) - 3) : g_strdup(name);
+    const char *type = "text/turtle";
+    for (int i=0; types[i].suffix; i++) {
+        if (g_str_has_suffix(base, types[i].suffix)) {
+            type = types[i].type;
+            break;
+        }
+    }
+    g_free(base);
+
+    return type;
+}
+
+static size_t read_fn(char *ptr, size_t size, size_t nmemb, void *data)
+{
+    upload *up = data;
+    size_t len = size * nmemb;
+
+    if (!up->gzip) {
+        size_t got = fread(ptr, 1, len, up->in);
+        return ferror(up->in) ? CURL_READFUNC_ABORT : got;
+    }
+
+    up->z.next_out = (unsigned char *) ptr;
+    up->z.avail_out = len;
+    while (up->z.avail_out > 0 && !up->finished) {
+        if (up->z.avail_in == 0 && !feof(up->in)) {
+            up->z.next_in = up->buf;
+            up->z.avail_in = fread(up->buf, 1, READ_SIZE, up->in);
+            if (ferror(up->in)) {
+                return CURL_READFUNC_ABORT;
+            }
+        }
+        int flush = feof(up->in) && up->z.avail_in == 0 ? Z_FINISH : Z_NO_FLUSH;
+        int ret = deflate(&up->z, flush);
+        if (ret == Z_STREAM_END) {
+            up->finished = 1;
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            return CURL_READFUNC_ABORT;
+        }
+    }
+
+    return len - up->z.avail_out;
+}
+
+int graph_store(enum gs_method method, const gs_options *opts)
+{
+    char error[CURL_ERROR_SIZE];
+    upload *up = NULL;
+    struct curl_slist *headers = NULL;
+    curl_off_t size = -1;
+
+    CURL *curl = hs_easy_init();
+    char *target;
+    const char *ep = hs_endpoint(curl, opts->endpoint);
+    const char *sep = strchr(ep, '?') ? "&" : "?";
+    if (opts->graph) {
+        char *encoded = curl_easy_escape(curl, opts->graph, 0);
+        target = g_strdup_printf("%s%sgraph=%s", ep, sep, encoded);
+        curl_free(encoded);
+    } else {
+        target = g_strdup_printf("%s%sdefault", ep, sep);
+    }
+
+    if (method == GS_PUT || method == GS_POST) {
+        up = g_new0(upload, 1);
+        if (!strcmp(opts->filename, "-")) {
+            up->in = stdin;
+        } else if (!(up->in = fopen(opts->filename, "rb"))) {
+            perror(opts->filename);
+            g_free(up);
+            g_free(target);
+            curl_easy_cleanup(curl);
+            return 1;
+        }
+
+        char *type = g_strdup_printf("Content-Type: %s", opts->type ? opts->type : guess_type(opts->filename));
+        headers = curl_slist_append(headers, type);
+        g_free(type);
+
+        if (opts->gzip && !g_str_has_suffix(opts->filename, ".gz")) {
+            up->gzip = 1;
+            /* 16 more window bits for a gzip rather than zlib wrapper */
+            deflateInit2(&up->z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+        } else {
+            struct stat st;
+            if (up->in != stdin && !fstat(fileno(up->in), &st) && S_ISREG(st.st_mode)) {
+                size = st.st_size;
+            }
+        }
+        if (opts->gzip || g_str_has_suffix(opts->filename, ".gz")) {
+            headers = curl_slist_append(headers, "Content-Encoding: gzip");
+        }
+        if (size < 0) {
+            headers = curl_slist_append(headers, "Transfer-Encoding: chunked");
+        }
+
+        curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_fn);
+        curl_easy_setopt(curl, CURLOPT_READDATA, up);
+        if (method == GS_PUT) {
+            curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+            curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, size);
+        } else {
+            curl_easy_setopt(curl, CURLOPT_POST, 1L);
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, size);
+        }
+    } else if (method == GS_DELETE) {
+        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
+    }
+
+    curl_easy_setopt(curl, CURLOPT_URL, target);
+    curl_easy_setopt(curl, CURLOPT_VERBOSE, opts->verbose);
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, error);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    CURLcode code = curl_easy_perform(curl);
+
+    long status = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    int failed = 0;
+    if (code) {
+        fprintf(stderr, "CURL: %s\n", error);
+        failed = 1;
+    } else if (status < 200 || status >= 300) {
+        fprintf(stderr, "%s failed with HTTP %ld\n", target, status);
+        failed = 1;
+    }
+
+    if (up) {
+        if (up->gzip) {
+            deflateEnd(&up->z);
+        }
+        if (up->in != stdin) {
+            fclose(up->in);
+        }
+        g_free(up);
+    }
+    curl_slist_free_all(headers);
+    curl_easy_cleanup(curl);
+    g_free(target);
+
+    return failed;
+}
+
+/* vi:set expandtab sts=4 sw=4: */
@@ -0,0 +1,23 @@
+#ifndef GRAPH_STORE_H
+#define GRAPH_STORE_H
+
+enum gs_method {
+    GS_NONE,
+    GS_PUT,
+    GS_POST,
+    GS_DELETE,
+};
+
+typedef struct {
+    const char *endpoint; /* the graph store, not the SPARQL endpoint */
+    const char *graph;    /* NULL for the default graph */
+    const char *filename; /* "-" for standard input */
+    const char *type;     /* NULL to guess from filename */
+    int gzip;             /* compress the upload as it's sent */
+    int verbose;
+} gs_options;
+
+/* a Graph Store Protocol request, returning 0 on success */
+int graph_store(enum gs_method method, const gs_options *opts);
+
+#endif
@@ -0,0 +1,62 @@
+/*  sparql-query - a SPARQL client with GNU readline support
+    Copyright (C) 2006-8 Nick Lamb and Steve Harris for Garlik
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Hashing
+ *
+ * FNV-1a, then MurmurHash3's finaliser so every bit is mixed. FNV-1a alone
+ * is quick but leaves the high bits poorly spread, and those are the ones
+ * that pick HyperLogLog registers and spill partitions.
+ */
+
+#include "hash.h"
+
+#define FNV_PRIME 1099511628211ULL
+
+guint64 hash_add(guint64 h, const void *bytes, size_t len)
+{
+    const unsigned char *c = bytes;
+
+    for (size_t i=0; i<len; i++) {
+        h = (h ^ c[i]) * FNV_PRIME;
+    }
+
+    return h;
+}
+
+guint64 hash_add_byte(guint64 h, unsigned char byte)
+{
+    return (h ^ byte) * FNV_PRIME;
+}
+
+guint64 hash_finish(guint64 h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+guint64 hash_bytes(const void *bytes, size_t len)
+{
+    return hash_finish(hash_add(HASH_INIT, bytes, len));
+}
+
+/* vi:set expandtab sts=4 sw=4: */
@@ -0,0 +1,20 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <glib.h>
+
+/* 64-bit hashes of bytes fed in a piece at a time: start from HASH_INIT,
+ * add each piece with hash_add(), then mix with hash_finish() */
+#define HASH_INIT 14695981039346656037ULL
+
+guint64 hash_add(guint64 h, const void *bytes, size_t len);
+
+guint64 hash_add_byte(guint64 h, unsigned char byte);
+
+guint64 hash_finish(guint64 h);
+
+/* all of the above at once, for bytes in one piece */
+guint64 hash_bytes(const void *bytes, size_t len);
+
+#endif
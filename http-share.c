@@ -0,0 +1,272 @@
+/*  sparql-query - a SPARQL client with GNU readline support
+    Copyright (C) 2006-8 Nick Lamb and Steve Harris for Garlik
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Connection reuse across every curl handle in the process
+ *
+ * All handles share one curl share object, so a host's DNS lookup, TCP
+ * connection and TLS session are only set up once, whichever part of the
+ * program talks to it first. The warm-up runs on its own thread, so the
+ * share is locked.
+ *
+ * An endpoint may be reached through a Unix socket instead of TCP, which
+ * saves a local store and its clients the loopback network stack. Those
+ * connections are kept alive and reused just the same.
+ *
+ * libcurl 8.12 and later can export TLS sessions, which are then kept in a
+ * key file between runs. Older libcurl only shares them within one run.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+#include "http-share.h"
+
+#if LIBCURL_VERSION_NUM >= 0x080c00
+#define HS_PERSIST_SESSIONS 1
+#endif
+
+struct _hs_warmup {
+    CURL *curl;
+    GThread *thread;
+    CURLcode code;
+    char error[CURL_ERROR_SIZE];
+};
+
+static CURLSH *share = NULL;
+static gsize share_ready = 0;
+static GMutex locks[CURL_LOCK_DATA_LAST];
+static char *sessions_filename = NULL;
+
+static void lock_fn(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr)
+{
+    g_mutex_lock(&locks[data]);
+}
+
+static void unlock_fn(CURL *handle, curl_lock_data data, void *userptr)
+{
+    g_mutex_unlock(&locks[data]);
+}
+
+#ifdef HS_PERSIST_SESSIONS
+static void load_sessions(void)
+{
+    GKeyFile *keyfile = g_key_file_new();
+    if (!g_key_file_load_from_file(keyfile, sessions_filename, G_KEY_FILE_NONE, NULL)) {
+        g_key_file_free(keyfile);
+        return;
+    }
+
+    CURL *curl = hs_easy_init();
+    gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+    char **groups = g_key_file_get_groups(keyfile, NULL);
+    for (int i=0; groups[i]; i++) {
+        gint64 until = g_key_file_get_int64(keyfile, groups[i], "until", NULL);
+        char *key = g_key_file_get_string(keyfile, groups[i], "key", NULL);
+        char *shmac64 = g_key_file_get_string(keyfile, groups[i], "shmac", NULL);
+        char *data64 = g_key_file_get_string(keyfile, groups[i], "data", NULL);
+        if (until > now && shmac64 && data64) {
+            gsize shmac_len, data_len;
+            guchar *shmac = g_base64_decode(shmac64, &shmac_len);
+            guchar *data = g_base64_decode(data64, &data_len);
+            curl_easy_ssls_import(curl, key, shmac, shmac_len, data, data_len);
+            g_free(shmac);
+            g_free(data);
+        }
+        g_free(key);
+        g_free(shmac64);
+        g_free(data64);
+    }
+    g_strfreev(groups);
+    curl_easy_cleanup(curl);
+    g_key_file_free(keyfile);
+}
+
+static CURLcode export_fn(CURL *handle, void *userptr, const char *session_key,
+                          const unsigned char *shmac, size_t shmac_len,
+                          const unsigned char *sdata, size_t sdata_len,
+                          curl_off_t valid_until, int ietf_tls_id, const char *alpn,
+                          size_t earlydata_max)
+{
+    GKeyFile *keyfile = userptr;
+    gsize sessions = 0;
+    g_strfreev(g_key_file_get_groups(keyfile, &sessions));
+    char *group = g_strdup_printf("session %d", (int) sessions);
+    char *shmac64 = g_base64_encode(shmac, shmac_len);
+    char *data64 = g_base64_encode(sdata, sdata_len);
+
+    if (session_key) {
+        g_key_file_set_string(keyfile, group, "key", session_key);
+    }
+    g_key_file_set_string(keyfile, group, "shmac", shmac64);
+    g_key_file_set_string(keyfile, group, "data", data64);
+    g_key_file_set_int64(keyfile, group, "until", valid_until);
+    g_free(group);
+    g_free(shmac64);
+    g_free(data64);
+
+    return CURLE_OK;
+}
+
+static void save_sessions(void)
+{
+    GKeyFile *keyfile = g_key_file_new();
+    CURL *curl = hs_easy_init();
+    if (curl_easy_ssls_export(curl, export_fn, keyfile) == CURLE_OK) {
+        gsize length = 0;
+        char *data = g_key_file_to_data(keyfile, &length, NULL);
+        GError *error = NULL;
+        /* session tickets are as good as keys, so they're for us alone */
+        if (!g_file_set_contents_full(sessions_filename, data, length, G_FILE_SET_CONTENTS_CONSISTENT, 0600, &error)) {
+            fprintf(stderr, "can't save TLS sessions to %s: %s\n", sessions_filename, error->message);
+            g_error_free(error);
+        }
+        g_free(data);
+    }
+    curl_easy_cleanup(curl);
+    g_key_file_free(keyfile);
+}
+#endif
+
+void hs_init(const char *session_file)
+{
+    /* whichever thread gets here first sets it up, the others wait */
+    if (!g_once_init_enter(&share_ready)) {
+        return;
+    }
+
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    for (int i=0; i<CURL_LOCK_DATA_LAST; i++) {
+        g_mutex_init(&locks[i]);
+    }
+    share = curl_share_init();
+    curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lock_fn);
+    curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlock_fn);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+
+    if (session_file) {
+        sessions_filename = g_strdup(session_file);
+#ifndef HS_PERSIST_SESSIONS
+        fprintf(stderr, "warning: libcurl %s can't save TLS sessions, they will only be shared within this run\n",
+                LIBCURL_VERSION);
+#endif
+    }
+    g_once_init_leave(&share_ready, 1);
+
+#ifdef HS_PERSIST_SESSIONS
+    /* only now, as it takes a handle of its own */
+    if (sessions_filename) {
+        load_sessions();
+    }
+#endif
+}
+
+void hs_fini(void)
+{
+    if (!share) {
+        return;
+    }
+#ifdef HS_PERSIST_SESSIONS
+    if (sessions_filename) {
+        save_sessions();
+    }
+#endif
+    g_free(sessions_filename);
+    sessions_filename = NULL;
+    curl_share_cleanup(share);
+    share = NULL;
+    for (int i=0; i<CURL_LOCK_DATA_LAST; i++) {
+        g_mutex_clear(&locks[i]);
+    }
+}
+
+CURL *hs_easy_init(void)
+{
+    hs_init(NULL);
+    CURL *curl = curl_easy_init();
+    curl_easy_setopt(curl, CURLOPT_SHARE, share);
+
+    return curl;
+}
+
+const char *hs_endpoint(CURL *curl, const char *endpoint)
+{
+    const char unix_prefix[] = "unix:";
+    if (strncmp(endpoint, unix_prefix, sizeof(unix_prefix) - 1)) {
+        return endpoint;
+    }
+
+    const char *path = endpoint + sizeof(unix_prefix) - 1;
+    const char *url = strstr(path, ":http://");
+    if (!url) {
+        url = strstr(path, ":https://");
+    }
+    char *socket = url ? g_strndup(path, url - path) : g_strdup(path);
+    if (curl && socket[0] == '@') {
+#if LIBCURL_VERSION_NUM >= 0x073500
+        curl_easy_setopt(curl, CURLOPT_ABSTRACT_UNIX_SOCKET, socket + 1);
+#else
+        fprintf(stderr, "%s: this libcurl can't use abstract sockets\n", endpoint);
+        /* rather than go to URL over TCP, every request on curl fails */
+        curl_easy_setopt(curl, CURLOPT_PROTOCOLS, 0L);
+#endif
+    } else if (curl) {
+        curl_easy_setopt(curl, CURLOPT_UNIX_SOCKET_PATH, socket);
+    }
+    g_free(socket);
+
+    return url ? url + 1 : HS_UNIX_URL;
+}
+
+static gpointer warmup_thread(gpointer data)
+{
+    hs_warmup *w = data;
+    w->code = curl_easy_perform(w->curl);
+
+    return NULL;
+}
+
+hs_warmup *hs_warmup_start(const char *endpoint, int verbose)
+{
+    hs_warmup *w = g_new0(hs_warmup, 1);
+    w->curl = hs_easy_init();
+    curl_easy_setopt(w->curl, CURLOPT_URL, hs_endpoint(w->curl, endpoint));
+    curl_easy_setopt(w->curl, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(w->curl, CURLOPT_VERBOSE, (long) verbose);
+    curl_easy_setopt(w->curl, CURLOPT_ERRORBUFFER, w->error);
+    /* signals can't be used for timeouts off the main thread */
+    curl_easy_setopt(w->curl, CURLOPT_NOSIGNAL, 1L);
+    w->thread = g_thread_new("warmup", warmup_thread, w);
+
+    return w;
+}
+
+CURLcode hs_warmup_finish(hs_warmup *w, char *error)
+{
+    g_thread_join(w->thread);
+    CURLcode code = w->code;
+    strcpy(error, w->error);
+    curl_easy_cleanup(w->curl);
+    g_free(w);
+
+    return code;
+}
+
+/* vi:set expandtab sts=4 sw=4: */
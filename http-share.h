@@ -0,0 +1,36 @@
+#ifndef HTTP_SHARE_H
+#define HTTP_SHARE_H
+
+#include <curl/curl.h>
+
+typedef struct _hs_warmup hs_warmup;
+
+/* set up the shared caches, keeping TLS sessions in session_file between
+ * runs if it isn't NULL. Optional, hs_easy_init() does it on first use,
+ * and only the first call from any thread counts */
+void hs_init(const char *session_file);
+
+/* save TLS sessions and release the shared caches */
+void hs_fini(void);
+
+/* a new easy handle sharing DNS, TLS sessions and connections with every
+ * other handle made here */
+CURL *hs_easy_init(void);
+
+/* the URL to ask for at endpoint. Endpoints on this machine may be given
+ * as unix:PATH:URL, or unix:@NAME:URL for a Linux abstract socket, to
+ * reach URL through that Unix socket rather than TCP. URL defaults to
+ * HS_UNIX_URL. If curl isn't NULL it's set up to use the socket, or if
+ * libcurl is too old for an abstract socket, to fail every request */
+const char *hs_endpoint(CURL *curl, const char *endpoint);
+
+#define HS_UNIX_URL "http://localhost/sparql"
+
+/* HEAD endpoint in the background, so the connection is ready when needed */
+hs_warmup *hs_warmup_start(const char *endpoint, int verbose);
+
+/* wait for a warm-up to finish and free it, returning how it went. error
+ * must have room for CURL_ERROR_SIZE bytes */
+CURLcode hs_warmup_finish(hs_warmup *warmup, char *error);
+
+#endif
@@ -0,0 +1,149 @@
+/*  sparql-query - a SPARQL client with GNU readline support
+    Copyright (C) 2006-8 Nick Lamb and Steve Harris for Garlik
+ 
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Adaptive concurrency
+ *
+ * A gradient limiter: the ratio of the lowest latency seen to the recent
+ * average says whether requests are queueing at the server. While it stays
+ * near 1 the limit creeps up, by about the square root of itself each time,
+ * and as latency grows the limit shrinks in proportion. A timeout or an
+ * overloaded response halves it, at most once per limit's worth of
+ * requests, so one burst of failures isn't punished repeatedly.
+ *
+ * The lowest latency drifts up slowly, so a server that has become slower
+ * for good is eventually taken at its new speed.
+ */
+
+#include <math.h>
+#include <glib.h>
+
+#include "limiter.h"
+
+/* weight of each new sample in the averages */
+#define SMOOTHING 0.2
+/* the baseline latency forgets this fraction of itself per sample */
+#define BASELINE_DRIFT 0.01
+/* how far latency growth alone can cut the limit per sample */
+#define MIN_GRADIENT 0.5
+
+typedef struct {
+    double seconds;
+    int limit;
+} change;
+
+struct _limiter {
+    double limit;
+    int max;
+    double baseline; /* latency with nothing queued, 0 until known */
+    double average;
+    int since_decrease; /* requests since the last halving */
+    gint64 started;
+    gint64 changed;
+    double weighted; /* limit multiplied by seconds it held */
+    int lowest, highest;
+    GArray *history;
+};
+
+static void record(limiter *lim, int previous)
+{
+    gint64 now = g_get_monotonic_time();
+    int limit = limiter_limit(lim);
+
+    if (limit == previous) {
+        return;
+    }
+    lim->weighted += previous * (now - lim->changed) / (double) G_USEC_PER_SEC;
+    lim->changed = now;
+    lim->lowest = MIN(lim->lowest, limit);
+    lim->highest = MAX(lim->highest, limit);
+
+    change c = { (now - lim->started) / (double) G_USEC_PER_SEC, limit };
+    g_array_append_val(lim->history, c);
+}
+
+limiter *limiter_new(int initial, int max)
+{
+    limiter *lim = g_new0(limiter, 1);
+    lim->max = MAX(max, 1);
+    lim->limit = CLAMP(initial, 1, lim->max);
+    lim->started = lim->changed = g_get_monotonic_time();
+    lim->lowest = lim->highest = limiter_limit(lim);
+    lim->history = g_array_new(FALSE, FALSE, sizeof(change));
+
+    change c = { 0.0, limiter_limit(lim) };
+    g_array_append_val(lim->history, c);
+
+    return lim;
+}
+
+int limiter_limit(const limiter *lim)
+{
+    return (int) lim->limit;
+}
+
+void limiter_sample(limiter *lim, double latency, int overloaded)
+{
+    int previous = limiter_limit(lim);
+    lim->since_decrease++;
+
+    if (overloaded) {
+        if (lim->since_decrease >= previous) {
+            lim->limit = MAX(lim->limit / 2.0, 1.0);
+            lim->since_decrease = 0;
+        }
+        record(lim, previous);
+        return;
+    }
+
+    if (lim->baseline == 0.0) {
+        lim->baseline = lim->average = latency;
+    }
+    lim->baseline = MIN(lim->baseline * (1.0 + BASELINE_DRIFT), latency);
+    lim->average += SMOOTHING * (latency - lim->average);
+
+    double gradient = lim->average > 0.0 ? CLAMP(lim->baseline / lim->average, MIN_GRADIENT, 1.0) : 1.0;
+    double target = lim->limit * gradient + sqrt(lim->limit);
+    lim->limit += SMOOTHING * (target - lim->limit);
+    lim->limit = CLAMP(lim->limit, 1.0, (double) lim->max);
+    record(lim, previous);
+}
+
+void limiter_report(const limiter *lim, FILE *out, int verbose)
+{
+    gint64 now = g_get_monotonic_time();
+    double seconds = (now - lim->started) / (double) G_USEC_PER_SEC;
+    double weighted = lim->weighted + limiter_limit(lim) * (now - lim->changed) / (double) G_USEC_PER_SEC;
+
+    fprintf(out, "concurrency: %d to %d in flight, %.1f on average, %d at the end\n",
+            lim->lowest, lim->highest, seconds > 0.0 ? weighted / seconds : (double) limiter_limit(lim),
+            limiter_limit(lim));
+    if (verbose) {
+        for (guint i=0; i<lim->history->len; i++) {
+            change *c = &g_array_index(lim->history, change, i);
+            fprintf(out, "  %8.1fs %d\n", c->seconds, c->limit);
+        }
+    }
+}
+
+void limiter_free(limiter *lim)
+{
+    g_array_free(lim->history, TRUE);
+    g_free(lim);
+}
+
+/* vi:set expandtab sts=4 sw=4: */
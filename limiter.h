@@ -0,0 +1,25 @@
+#ifndef LIMITER_H
+#define LIMITER_H
+
+#include <stdio.h>
+
+typedef struct _limiter limiter;
+
+/* an adaptive limit on requests in flight, starting at initial and never
+ * more than max */
+limiter *limiter_new(int initial, int max);
+
+/* how many requests may be in flight now */
+int limiter_limit(const limiter *lim);
+
+/* record a finished request: its latency, in seconds per unit of work so
+ * that requests of different sizes compare, or that it timed out or the
+ * server said it was overloaded */
+void limiter_sample(limiter *lim, double latency, int overloaded);
+
+/* describe the limits chosen, and with verbose every change to them */
+void limiter_report(const limiter *lim, FILE *out, int verbose);
+
+void limiter_free(limiter *lim);
+
+#endif
@@ -0,0 +1,609 @@
+/*  sparql-query - a SPARQL client with GNU readline support
+    Copyright (C) 2006-8 Nick Lamb and Steve Harris for Garlik
+ 
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Lookups with VALUES
+ *
+ * The same query run for many values is sent for a batch of them at once,
+ * with a VALUES block at the start of its WHERE clause, so a thousand
+ * lookups take a handful of requests rather than a thousand. Queries too
+ * long for a URL are POSTed.
+ *
+ * The variable is bound in every result, which is how results are split
+ * back to the values they belong to. Each value gets its rows, or a row
+ * with nothing but itself if there were none, in the order the values were
+ * read. Batches can finish out of order, so a finished one is held until
+ * those before it have been written.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include <curl/curl.h>
+
+#include "lookup.h"
+#include "http-share.h"
+#include "limiter.h"
+#include "sparqlquery.h"
+
+#define SPARQL_RESULTS "application/sparql-results+xml"
+#define XSD_STRING "^^<http://www.w3.org/2001/XMLSchema#string>"
+
+/* longer queries are POSTed, as servers often limit URLs to about 8k */
+#define MAX_GET 4096
+
+/* attempts at a batch before giving up on it */
+#define MAX_ATTEMPTS 4
+
+/* how much of a failure response to keep for the error message */
+#define MAX_RESPONSE 1024
+
+typedef struct {
+    guint first_line, last_line;
+    GPtrArray *values; /* N-Triples terms, as read, duplicates and all */
+    GHashTable *rows;  /* value to a GPtrArray of the rest of each of its rows */
+    int attempts;
+    gint64 not_before; /* don't retry until then */
+    int done;          /* 1 when answered, -1 if given up on */
+} batch;
+
+struct lookup;
+
+typedef struct {
+    CURL *curl;
+    batch *batch;
+    gint64 started;
+    char *url;
+    char *body;
+    sq_parser *results;
+    int *map;          /* column of each variable in the head, -1 for the value */
+    int vars;
+    int key;           /* which variable is the value, or -1 */
+    GString *response; /* the start of anything other than results */
+    char error[CURL_ERROR_SIZE];
+    struct lookup *lk;
+} job;
+
+struct lookup {
+    const lk_options *opts;
+    FILE *in;
+    guint line;
+    int eof;
+    char *before;      /* the query either side of the VALUES block */
+    const char *after;
+    struct curl_slist *headers;
+    const char *url;   /* of the endpoint, see hs_endpoint() */
+    GQueue *pending;   /* batches read and not yet written, in order */
+    GQueue *retry;     /* batches waiting to be sent again */
+    CURLM *multi;
+    int running;
+    int jobs;
+    limiter *limiter;  /* NULL for a fixed number of jobs */
+    GPtrArray *head;   /* the variables other than the value's */
+    long failed;
+    int fatal;
+};
+
+/* where the VALUES block goes: just inside the first brace, which opens the
+ * WHERE clause of a SELECT. -1 if there's nowhere, or the query is a
+ * CONSTRUCT or DESCRIBE, as those answer with RDF rather than rows. In
+ * CONSTRUCT WHERE { ... } the braces are the template too, where VALUES
+ * can't go */
+static int values_position(const char *query)
+{
+    for (const char *c = query; *c; c++) {
+        if (*c == '#') {
+            c += strcspn(c, "\n");
+            if (!*c) {
+                break;
+            }
+        } else if (*c == '"' || *c == '\'') {
+            const char quote = *c;
+            for (c++; *c && *c != quote; c++) {
+                if (*c == '\\' && c[1]) {
+                    c++;
+                }
+            }
+            if (!*c) {
+                break;
+            }
+        } else if (*c == '<' && c[1] && !strchr(" \t\r\n=", c[1])) {
+            const char *end = c + strcspn(c, "> \t\r\n");
+            if (*end == '>') {
+                c = end;
+            }
+        } else if (*c == '{') {
+            return c - query + 1;
+        } else if (g_ascii_isalpha(*c) && (c == query || !(g_ascii_isalnum(c[-1]) || strchr("?$:_", c[-1])))) {
+            size_t len = 0;
+            while (g_ascii_isalnum(c[len]) || c[len] == '_') {
+                len++;
+            }
+            /* a keyword, rather than a prefix */
+            if (c[len] != ':' && ((len == 9 && !g_ascii_strncasecmp(c, "CONSTRUCT", 9)) ||
+                                  (len == 8 && !g_ascii_strncasecmp(c, "DESCRIBE", 8)))) {
+                return -1;
+            }
+            c += len - 1;
+        }
+    }
+
+    return -1;
+}
+
+/* a value as it appears in N-Triples, so that it can be matched to results */
+static char *term_key(const sq_term *term)
+{
+    char *key = sq_term_ntriples(term);
+    if (g_str_has_suffix(key, XSD_STRING)) {
+        key[strlen(key) - strlen(XSD_STRING)] = '\0';
+    }
+
+    return key;
+}
+
+/* a line of input as a term: N-Triples as it is, something that looks like
+ * an IRI between <>, and anything else a plain literal */
+static char *parse_value(char *line)
+{
+    if (*line == '<' || *line == '"' || g_str_has_prefix(line, "_:")) {
+        if (g_str_has_suffix(line, XSD_STRING)) {
+            line[strlen(line) - strlen(XSD_STRING)] = '\0';
+        }
+        return g_strdup(line);
+    }
+    if (strstr(line, "://") || g_str_has_prefix(line, "urn:")) {
+        return g_strdup_printf("<%s>", line);
+    }
+    sq_term literal = { .kind = SQ_LITERAL, .value = line };
+
+    return sq_term_ntriples(&literal);
+}
+
+static void free_rows(gpointer rows)
+{
+    g_ptr_array_free(rows, TRUE);
+}
+
+static batch *batch_new(void)
+{
+    batch *b = g_new0(batch, 1);
+    b->values = g_ptr_array_new_with_free_func(g_free);
+    b->rows = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free_rows);
+
+    return b;
+}
+
+static void batch_free(batch *b)
+{
+    g_ptr_array_free(b->values, TRUE);
+    g_hash_table_destroy(b->rows);
+    g_free(b);
+}
+
+/* the next batch of values from the file, or NULL at the end */
+static batch *read_batch(struct lookup *lk)
+{
+    batch *b = batch_new();
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+
+    while ((int) b->values->len < lk->opts->batch && (len = getline(&line, &size, lk->in)) >= 0) {
+        lk->line++;
+        g_strstrip(line);
+        if (!*line) {
+            continue;
+        }
+        if (!b->values->len) {
+            b->first_line = lk->line;
+        }
+        b->last_line = lk->line;
+        g_ptr_array_add(b->values, parse_value(line));
+    }
+    free(line);
+    if (ferror(lk->in)) {
+        perror("failed to read values");
+        lk->fatal = 1;
+    }
+    if (b->values->len == 0) {
+        lk->eof = 1;
+        batch_free(b);
+        return NULL;
+    }
+
+    return b;
+}
+
+static void job_head(void *data, int count, char **names)
+{
+    job *j = data;
+    struct lookup *lk = j->lk;
+
+    j->key = -1;
+    for (int i=0; i<count; i++) {
+        if (!strcmp(names[i], lk->opts->var)) {
+            j->key = i;
+        }
+    }
+    if (j->key < 0) {
+        /* nothing can be matched, finish() says so */
+        return;
+    }
+
+    if (!lk->head) {
+        lk->head = g_ptr_array_new_with_free_func(g_free);
+        for (int i=0; i<count; i++) {
+            if (strcmp(names[i], lk->opts->var)) {
+                g_ptr_array_add(lk->head, g_strdup(names[i]));
+            }
+        }
+        printf("?%s", lk->opts->var);
+        for (guint i=0; i<lk->head->len; i++) {
+            printf("\t?%s", (char *) lk->head->pdata[i]);
+        }
+        printf("\n");
+    }
+
+    g_free(j->map);
+    j->map = g_new(int, MAX(count, 1));
+    j->vars = count;
+    for (int i=0; i<count; i++) {
+        j->map[i] = -1;
+        for (guint k=0; k<lk->head->len; k++) {
+            if (!strcmp(names[i], lk->head->pdata[k])) {
+                j->map[i] = k;
+                break;
+            }
+        }
+    }
+}
+
+static void job_row(void *data, const sq_term *terms)
+{
+    job *j = data;
+    struct lookup *lk = j->lk;
+
+    if (j->key < 0 || terms[j->key].kind == SQ_UNBOUND) {
+        return;
+    }
+
+    char **cells = g_new0(char *, lk->head->len + 1);
+    for (int i=0; i<j->vars; i++) {
+        if (j->map[i] >= 0) {
+            g_free(cells[j->map[i]]);
+            cells[j->map[i]] = sq_term_ntriples(&terms[i]);
+        }
+    }
+    GString *rest = g_string_new(NULL);
+    for (guint k=0; k<lk->head->len; k++) {
+        g_string_append_printf(rest, "\t%s", cells[k] ? cells[k] : "");
+        g_free(cells[k]);
+    }
+    g_free(cells);
+
+    char *key = term_key(&terms[j->key]);
+    GPtrArray *rows = g_hash_table_lookup(j->batch->rows, key);
+    if (!rows) {
+        rows = g_ptr_array_new_with_free_func(g_free);
+        g_hash_table_insert(j->batch->rows, key, rows);
+    } else {
+        g_free(key);
+    }
+    g_ptr_array_add(rows, g_string_free(rest, FALSE));
+}
+
+static size_t write_fn(void *ptr, size_t size, size_t nmemb, void *data)
+{
+    job *j = data;
+    size_t len = size * nmemb;
+
+    if (j->results) {
+        sq_parser_write(j->results, ptr, len);
+    } else if (j->response->len < MAX_RESPONSE) {
+        g_string_append_len(j->response, ptr, MIN(len, MAX_RESPONSE - j->response->len));
+    }
+
+    return len;
+}
+
+static size_t header_fn(void *ptr, size_t size, size_t nmemb, void *data)
+{
+    job *j = data;
+    size_t len = size * nmemb;
+    const char content_type[] = "Content-Type:";
+
+    if (len <= sizeof(content_type) || g_ascii_strncasecmp(ptr, content_type, sizeof(content_type) - 1)) {
+        return len;
+    }
+    long status = 0;
+    curl_easy_getinfo(j->curl, CURLINFO_RESPONSE_CODE, &status);
+    char *type = g_strstrip(g_strndup((char *) ptr + sizeof(content_type) - 1, len - sizeof(content_type) + 1));
+    if (status < 300 && !j->results && !g_ascii_strncasecmp(type, SPARQL_RESULTS, strlen(SPARQL_RESULTS))) {
+        j->results = sq_parser_new(job_head, job_row, NULL, j);
+    }
+    g_free(type);
+
+    return len;
+}
+
+static void start(struct lookup *lk, job *j, batch *b)
+{
+    /* each value once, in the order read */
+    GHashTable *seen = g_hash_table_new(g_str_hash, g_str_equal);
+    GString *query = g_string_new(lk->before);
+    g_string_append_printf(query, " VALUES ?%s {", lk->opts->var);
+    for (guint i=0; i<b->values->len; i++) {
+        if (g_hash_table_add(seen, b->values->pdata[i])) {
+            g_string_append_printf(query, " %s", (char *) b->values->pdata[i]);
+        }
+    }
+    g_string_append(query, " } ");
+    g_string_append(query, lk->after);
+    g_hash_table_destroy(seen);
+
+    char *encoded = curl_easy_escape(j->curl, query->str, query->len);
+    g_string_free(query, TRUE);
+    if (strlen(encoded) > MAX_GET) {
+        j->body = g_strconcat("query=", encoded, NULL);
+        curl_easy_setopt(j->curl, CURLOPT_URL, lk->url);
+        curl_easy_setopt(j->curl, CURLOPT_POSTFIELDS, j->body);
+    } else {
+        j->url = g_strdup_printf("%s%squery=%s", lk->url, strchr(lk->url, '?') ? "&" : "?", encoded);
+        curl_easy_setopt(j->curl, CURLOPT_URL, j->url);
+        curl_easy_setopt(j->curl, CURLOPT_HTTPGET, 1L);
+    }
+    curl_free(encoded);
+
+    j->batch = b;
+    j->key = -1;
+    j->started = g_get_monotonic_time();
+    g_string_truncate(j->response, 0);
+    j->error[0] = '\0';
+    b->attempts++;
+    curl_multi_add_handle(lk->multi, j->curl);
+    lk->running++;
+}
+
+/* the next batch to send: a retry if one is due, otherwise more values, as
+ * long as not too many are waiting on a slow one to be written */
+static batch *next_batch(struct lookup *lk)
+{
+    batch *b = g_queue_peek_head(lk->retry);
+    if (b && b->not_before <= g_get_monotonic_time()) {
+        return g_queue_pop_head(lk->retry);
+    }
+    if (lk->eof || lk->fatal || (int) g_queue_get_length(lk->pending) >= 2 * lk->jobs) {
+        return NULL;
+    }
+    if ((b = read_batch(lk))) {
+        g_queue_push_tail(lk->pending, b);
+    }
+
+    return b;
+}
+
+static void finish(struct lookup *lk, job *j, CURLcode code)
+{
+    batch *b = j->batch;
+    long status = 0;
+
+    curl_easy_getinfo(j->curl, CURLINFO_RESPONSE_CODE, &status);
+    curl_multi_remove_handle(lk->multi, j->curl);
+    lk->running--;
+    g_free(j->url);
+    g_free(j->body);
+    j->url = j->body = NULL;
+    j->batch = NULL;
+    int answered = j->results != NULL;
+    if (j->results && sq_parser_finish(j->results)) {
+        answered = 0;
+        if (!code) {
+            snprintf(j->error, CURL_ERROR_SIZE, "results were not well-formed XML");
+        }
+    }
+    j->results = NULL;
+
+    int overloaded = code == CURLE_OPERATION_TIMEDOUT || status >= 500 || status == 408 || status == 429;
+    if (lk->limiter && (overloaded || (!code && answered))) {
+        double seconds = (g_get_monotonic_time() - j->started) / (double) G_USEC_PER_SEC;
+        limiter_sample(lk->limiter, seconds / b->values->len, overloaded);
+    }
+
+    if (!code && answered && status >= 200 && status < 300) {
+        if (j->key < 0) {
+            fprintf(stderr, "the query doesn't select ?%s, so results can't be matched to values\n", lk->opts->var);
+            lk->fatal = 1;
+            b->done = -1;
+            return;
+        }
+        b->done = 1;
+        return;
+    }
+
+    /* start afresh next time */
+    g_hash_table_remove_all(b->rows);
+    int transient = code || status >= 500 || status == 408 || status == 429;
+    if (transient && b->attempts < MAX_ATTEMPTS) {
+        /* 1s, 2s, 4s ... */
+        b->not_before = g_get_monotonic_time() + G_USEC_PER_SEC * (1 << (b->attempts - 1));
+        g_queue_push_tail(lk->retry, b);
+        return;
+    }
+    if (code) {
+        /* the endpoint isn't answering, the next batch won't fare better */
+        fprintf(stderr, "CURL: %s, giving up after %d attempts\n", j->error, b->attempts);
+        lk->fatal = 1;
+    } else if (status < 200 || status >= 300) {
+        char *reason = g_strndup(j->response->str, strcspn(j->response->str, "\r\n"));
+        fprintf(stderr, "lines %u-%u: HTTP %ld: %s\n", b->first_line, b->last_line, status, reason);
+        g_free(reason);
+    } else {
+        fprintf(stderr, "lines %u-%u: %s\n", b->first_line, b->last_line,
+                j->error[0] ? j->error : "the endpoint didn't send SPARQL XML results");
+    }
+    lk->failed += b->values->len;
+    b->done = -1;
+}
+
+/* write out every finished batch that isn't waiting on an earlier one */
+static void flush(struct lookup *lk)
+{
+    batch *b;
+
+    while ((b = g_queue_peek_head(lk->pending)) && b->done) {
+        g_queue_pop_head(lk->pending);
+        for (guint i=0; b->done > 0 && i<b->values->len; i++) {
+            const char *value = b->values->pdata[i];
+            GPtrArray *rows = g_hash_table_lookup(b->rows, value);
+            if (rows) {
+                for (guint k=0; k<rows->len; k++) {
+                    printf("%s%s\n", value, (char *) rows->pdata[k]);
+                }
+            } else {
+                printf("%s", value);
+                for (guint k=0; k<lk->head->len; k++) {
+                    putchar('\t');
+                }
+                putchar('\n');
+            }
+        }
+        batch_free(b);
+    }
+    fflush(stdout);
+}
+
+long lookup(const lk_options *opts)
+{
+    struct lookup lk = { .opts = opts };
+    int pos = values_position(opts->query);
+
+    if (pos < 0) {
+        fprintf(stderr, "can't find a WHERE clause to add VALUES to, --keys needs a SELECT query\n");
+        return -1;
+    }
+    if (!strcmp(opts->filename, "-")) {
+        lk.in = stdin;
+    } else if (!(lk.in = fopen(opts->filename, "r"))) {
+        perror(opts->filename);
+        return -1;
+    }
+
+    lk.before = g_strndup(opts->query, pos);
+    lk.after = opts->query + pos;
+    lk.jobs = opts->jobs > 0 ? opts->jobs : LK_MAX_JOBS;
+    lk.multi = curl_multi_init();
+    lk.pending = g_queue_new();
+    lk.retry = g_queue_new();
+    lk.headers = curl_slist_append(NULL, "Accept: " SPARQL_RESULTS);
+    if (opts->jobs <= 0) {
+        lk.limiter = limiter_new(LK_DEFAULT_JOBS, LK_MAX_JOBS);
+    }
+
+    job *pool = g_new0(job, lk.jobs);
+    for (int i=0; i<lk.jobs; i++) {
+        pool[i].lk = &lk;
+        pool[i].key = -1;
+        pool[i].response = g_string_new(NULL);
+        pool[i].curl = hs_easy_init();
+        lk.url = hs_endpoint(pool[i].curl, opts->endpoint);
+        curl_easy_setopt(pool[i].curl, CURLOPT_HTTPHEADER, lk.headers);
+        curl_easy_setopt(pool[i].curl, CURLOPT_VERBOSE, opts->verbose);
+        curl_easy_setopt(pool[i].curl, CURLOPT_ERRORBUFFER, pool[i].error);
+        curl_easy_setopt(pool[i].curl, CURLOPT_HEADERFUNCTION, header_fn);
+        curl_easy_setopt(pool[i].curl, CURLOPT_HEADERDATA, &pool[i]);
+        curl_easy_setopt(pool[i].curl, CURLOPT_WRITEFUNCTION, write_fn);
+        curl_easy_setopt(pool[i].curl, CURLOPT_WRITEDATA, &pool[i]);
+        curl_easy_setopt(pool[i].curl, CURLOPT_PRIVATE, &pool[i]);
+    }
+
+    while (!lk.fatal) {
+        int limit = lk.limiter ? limiter_limit(lk.limiter) : lk.jobs;
+        for (int i=0; i<lk.jobs && lk.running < limit && !lk.fatal; i++) {
+            if (!pool[i].batch) {
+                batch *b = next_batch(&lk);
+                if (!b) {
+                    break;
+                }
+                start(&lk, &pool[i], b);
+            }
+        }
+        flush(&lk);
+        if (!lk.running && (lk.fatal || (lk.eof && g_queue_is_empty(lk.retry)))) {
+            break;
+        }
+
+        if (!lk.running) {
+            /* only waiting for a retry to come due */
+            g_usleep(G_USEC_PER_SEC / 10);
+            continue;
+        }
+
+        int still_running;
+        curl_multi_perform(lk.multi, &still_running);
+        curl_multi_wait(lk.multi, NULL, 0, 100, NULL);
+
+        CURLMsg *msg;
+        int left;
+        while ((msg = curl_multi_info_read(lk.multi, &left))) {
+            if (msg->msg == CURLMSG_DONE) {
+                job *j;
+                curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &j);
+                finish(&lk, j, msg->data.result);
+            }
+        }
+    }
+    flush(&lk);
+    if (lk.limiter) {
+        limiter_report(lk.limiter, stderr, opts->verbose);
+        limiter_free(lk.limiter);
+    }
+
+    for (int i=0; i<lk.jobs; i++) {
+        if (pool[i].batch) {
+            curl_multi_remove_handle(lk.multi, pool[i].curl);
+        }
+        if (pool[i].results) {
+            sq_parser_finish(pool[i].results);
+        }
+        g_free(pool[i].url);
+        g_free(pool[i].body);
+        g_free(pool[i].map);
+        curl_easy_cleanup(pool[i].curl);
+        g_string_free(pool[i].response, TRUE);
+    }
+    g_free(pool);
+    /* batches still in flight are in pending too */
+    g_queue_free_full(lk.pending, (GDestroyNotify) batch_free);
+    g_queue_free(lk.retry);
+    curl_multi_cleanup(lk.multi);
+    curl_slist_free_all(lk.headers);
+    g_free(lk.before);
+    if (lk.head) {
+        g_ptr_array_free(lk.head, TRUE);
+    }
+    if (lk.in != stdin) {
+        fclose(lk.in);
+    }
+
+    return lk.fatal ? -1 : lk.failed;
+}
+
+/* vi:set expandtab sts=4 sw=4: */
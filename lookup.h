@@ -0,0 +1,24 @@
+#ifndef LOOKUP_H
+#define LOOKUP_H
+
+#define LK_DEFAULT_BATCH 100
+#define LK_DEFAULT_JOBS 2
+#define LK_MAX_JOBS 16
+
+typedef struct {
+    const char *endpoint;
+    const char *query;    /* a SELECT using ?var */
+    const char *var;      /* without the ? */
+    const char *filename; /* one value per line, "-" for standard input */
+    int batch;            /* most values in one query */
+    int jobs;             /* queries kept in flight, 0 to adapt up to LK_MAX_JOBS */
+    int verbose;
+} lk_options;
+
+/* run query once for each value, sending many values at a time in a VALUES
+ * block, and write the results as TSV grouped by value in input order.
+ * Returns the number of values whose results couldn't be had, or -1 if the
+ * lookup couldn't start */
+long lookup(const lk_options *opts);
+
+#endif
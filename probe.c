@@ -0,0 +1,167 @@
+/*  sparql-query - a SPARQL client with GNU readline support
+    Copyright (C) 2006-8 Nick Lamb and Steve Harris for Garlik
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Finding out which results formats an endpoint serves
+ *
+ * A query with no results is sent once for each format, all at once, each
+ * accepting only that format, and a format is served if it comes back as
+ * asked. Endpoints that ignore Accept and always send the same thing are
+ * found to serve just that. The answers are kept in a keyfile beside
+ * ~/.sparql, a group for each endpoint.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+#include <curl/curl.h>
+
+#include "probe.h"
+#include "http-share.h"
+
+#define PROBE_QUERY "SELECT ?x WHERE { } LIMIT 0"
+
+/* seconds each probe may take */
+#define PROBE_TIMEOUT 10L
+
+static const struct {
+    enum pr_format format;
+    const char *name;   /* as kept in the keyfile */
+    const char *type;
+} formats[] = {
+    { PR_XML, "xml", "application/sparql-results+xml" },
+    { PR_JSON, "json", "application/sparql-results+json" },
+    { PR_TSV, "tsv", "text/tab-separated-values" },
+    { PR_CSV, "csv", "text/csv" },
+};
+
+#define FORMATS (sizeof(formats) / sizeof(formats[0]))
+
+/* the body of a probe isn't wanted */
+static size_t discard_fn(void *ptr, size_t size, size_t nmemb, void *data)
+{
+    return size * nmemb;
+}
+
+static int probe(const char *endpoint, int verbose)
+{
+    CURLM *multi = curl_multi_init();
+    CURL *curl[FORMATS];
+    struct curl_slist *headers[FORMATS];
+    int served = 0;
+
+    for (size_t i=0; i<FORMATS; i++) {
+        curl[i] = hs_easy_init();
+        const char *url = hs_endpoint(curl[i], endpoint);
+        char *encoded = curl_easy_escape(curl[i], PROBE_QUERY, 0);
+        char *query_url = g_strdup_printf("%s%squery=%s", url, strchr(url, '?') ? "&" : "?", encoded);
+        char *accept = g_strdup_printf("Accept: %s", formats[i].type);
+        headers[i] = curl_slist_append(NULL, accept);
+        curl_easy_setopt(curl[i], CURLOPT_URL, query_url);
+        curl_easy_setopt(curl[i], CURLOPT_HTTPHEADER, headers[i]);
+        curl_easy_setopt(curl[i], CURLOPT_WRITEFUNCTION, discard_fn);
+        curl_easy_setopt(curl[i], CURLOPT_TIMEOUT, PROBE_TIMEOUT);
+        curl_easy_setopt(curl[i], CURLOPT_VERBOSE, (long) (verbose > 1));
+        curl_multi_add_handle(multi, curl[i]);
+        curl_free(encoded);
+        g_free(query_url);
+        g_free(accept);
+    }
+
+    int running = 1;
+    while (running) {
+        curl_multi_perform(multi, &running);
+        if (running) {
+            curl_multi_wait(multi, NULL, 0, 1000, NULL);
+        }
+    }
+
+    for (size_t i=0; i<FORMATS; i++) {
+        long status = 0;
+        char *type = NULL;
+        curl_easy_getinfo(curl[i], CURLINFO_RESPONSE_CODE, &status);
+        curl_easy_getinfo(curl[i], CURLINFO_CONTENT_TYPE, &type);
+        if (status >= 200 && status < 300 && type &&
+            !g_ascii_strncasecmp(type, formats[i].type, strlen(formats[i].type))) {
+            served |= formats[i].format;
+        }
+        curl_multi_remove_handle(multi, curl[i]);
+        curl_easy_cleanup(curl[i]);
+        curl_slist_free_all(headers[i]);
+    }
+    curl_multi_cleanup(multi);
+
+    return served;
+}
+
+int pr_formats(const char *endpoint, int verbose)
+{
+    char *filename = g_strconcat(g_get_home_dir(), "/.sparql_formats", NULL);
+    GKeyFile *keyfile = g_key_file_new();
+    gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+    int served = 0;
+
+    g_key_file_load_from_file(keyfile, filename, G_KEY_FILE_KEEP_COMMENTS, NULL);
+    char *kept = g_key_file_get_string(keyfile, endpoint, "formats", NULL);
+    gint64 probed = g_key_file_get_int64(keyfile, endpoint, "probed", NULL);
+    if (kept) {
+        char **names = g_strsplit(kept, ";", -1);
+        for (int i=0; names[i]; i++) {
+            for (size_t j=0; j<FORMATS; j++) {
+                if (!strcmp(names[i], formats[j].name)) {
+                    served |= formats[j].format;
+                }
+            }
+        }
+        g_strfreev(names);
+    }
+    int found;
+    if ((!kept || now - probed >= PR_MAX_AGE) && (found = probe(endpoint, verbose))) {
+        /* if it can't be asked now, what it served last time will do */
+        served = found;
+        GString *names = g_string_new(NULL);
+        for (size_t j=0; j<FORMATS; j++) {
+            if (served & formats[j].format) {
+                g_string_append_printf(names, "%s%s", names->len ? ";" : "", formats[j].name);
+            }
+        }
+        g_key_file_set_string(keyfile, endpoint, "formats", names->str);
+        g_key_file_set_int64(keyfile, endpoint, "probed", now);
+        gsize length = 0;
+        char *data = g_key_file_to_data(keyfile, &length, NULL);
+        g_file_set_contents(filename, data, length, NULL);
+        g_free(data);
+        g_string_free(names, TRUE);
+    }
+    if (verbose) {
+        fprintf(stderr, "%s serves", endpoint);
+        for (size_t j=0; j<FORMATS; j++) {
+            if (served & formats[j].format) {
+                fprintf(stderr, " %s", formats[j].type);
+            }
+        }
+        fprintf(stderr, "%s\n", served ? "" : " nothing that could be found");
+    }
+    g_free(kept);
+    g_key_file_free(keyfile);
+    g_free(filename);
+
+    return served;
+}
+
+/* vi:set expandtab sts=4 sw=4: */
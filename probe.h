@@ -0,0 +1,20 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+/* SPARQL results formats an endpoint may serve */
+enum pr_format {
+    PR_XML = 1,
+    PR_JSON = 2,
+    PR_TSV = 4,
+    PR_CSV = 8,
+};
+
+/* probes older than this many seconds are made again */
+#define PR_MAX_AGE (24 * 60 * 60)
+
+/* which of the formats endpoint serves, as found by asking it for each in
+ * turn, or by an earlier run if that was recent. What's found is kept in
+ * ~/.sparql_formats. Returns 0 if nothing could be found */
+int pr_formats(const char *endpoint, int verbose);
+
+#endif
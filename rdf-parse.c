@@ -0,0 +1,1488 @@
+/*  sparql-query - a SPARQL client with GNU readline support
+    Copyright (C) 2006-8 Nick Lamb and Steve Harris for Garlik
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Streaming RDF to N-Triples, for CONSTRUCT and DESCRIBE results
+ *
+ * Turtle (and so N-Triples) is parsed one statement at a time from a buffer
+ * holding only what hasn't been parsed yet. A statement cut off by the end
+ * of the data received so far is parsed again from its start once more has
+ * arrived. RDF/XML goes through a libxml2 push parser. Either way each
+ * triple is written out as soon as its statement is complete, so memory use
+ * depends on the size of a statement, not of the graph.
+ *
+ * Blank node labels from the document get a "b" prefix, and generated ones
+ * are "g" followed by a number, so the two can't collide.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <libxml/parser.h>
+#include <libxml/parserInternals.h>
+#include <libxml/SAX2.h>
+#include <libxml/uri.h>
+
+#include "rdf-parse.h"
+
+#define RDF_NS "http://www.w3.org/1999/02/22-rdf-syntax-ns#"
+#define XML_NS "http://www.w3.org/XML/1998/namespace"
+#define XSD "http://www.w3.org/2001/XMLSchema#"
+
+#define RDF_TYPE "<" RDF_NS "type>"
+#define RDF_FIRST "<" RDF_NS "first>"
+#define RDF_REST "<" RDF_NS "rest>"
+#define RDF_NIL "<" RDF_NS "nil>"
+
+/* an incomplete statement is retried once the buffer has grown this much */
+#define RETRY_GROWTH 2
+
+/* write out triples once this many bytes of them are waiting */
+#define FLUSH_SIZE 65536
+
+/* stop reporting syntax errors after this many */
+#define MAX_REPORTED 10
+
+enum ttl_status {
+    TTL_OK,
+    TTL_MORE,
+    TTL_ERROR,
+};
+
+enum frame_kind {
+    FRAME_RDF,
+    FRAME_NODE,
+    FRAME_PROPERTY,
+    FRAME_EMPTY,
+    FRAME_RESOURCE,
+    FRAME_LITERAL,
+    FRAME_COLLECTION,
+};
+
+/* an open RDF/XML element, terms are in N-Triples form */
+struct frame {
+    enum frame_kind kind;
+    char *subject;   /* of a node, or the bnode of parseType="Resource" */
+    char *parent;    /* subject a property belongs to */
+    char *predicate;
+    char *object;
+    char *datatype;
+    char *reify;     /* from rdf:ID on a property */
+    char *base;
+    char *lang;
+    char *last;      /* list node of the last collection member */
+    int li;
+    int depth;       /* of elements inside parseType="Literal" */
+    GString *text;
+};
+
+struct _rdf_parser {
+    enum rdf_syntax syntax;
+    FILE *out;
+    char *base;
+    GString *triples; /* not yet written */
+    char *bnode_prefix; /* of every blank node label written */
+    long bnodes;
+    int errors;
+
+    /* Turtle and N-Triples */
+    GString *buf;
+    gsize retry_at;
+    gint64 offset; /* of buf in the document */
+    int skip_line;
+    GHashTable *prefixes;
+
+    /* RDF/XML */
+    xmlParserCtxtPtr xml;
+    GSList *frames;
+};
+
+typedef struct {
+    rdf_parser *p;
+    const char *pos;
+    const char *end;
+    int eof;
+    enum ttl_status status;
+    const char *error;
+    GPtrArray *strings; /* terms made while parsing a statement */
+} ttl;
+
+enum rdf_syntax rdf_syntax_for_type(const char *type)
+{
+    static const struct {
+        const char *type;
+        enum rdf_syntax syntax;
+    } types[] = {
+        { "application/n-triples", RDF_NTRIPLES },
+        { "text/turtle", RDF_TURTLE },
+        { "application/x-turtle", RDF_TURTLE },
+        { "text/n3", RDF_TURTLE },
+        { "text/rdf+n3", RDF_TURTLE },
+        { "application/rdf+xml", RDF_XML },
+        { NULL, RDF_NONE }
+    };
+
+    for (int i=0; types[i].type; i++) {
+        size_t len = strlen(types[i].type);
+        if (!g_ascii_strncasecmp(type, types[i].type, len) &&
+            (type[len] == '\0' || type[len] == ';' || type[len] == ' ' || type[len] == '\r')) {
+            return types[i].syntax;
+        }
+    }
+
+    return RDF_NONE;
+}
+
+/* N-Triples output */
+
+static void nt_iri(GString *out, const char *iri)
+{
+    g_string_append_c(out, '<');
+    for (const unsigned char *c = (const unsigned char *) iri; *c; c++) {
+        if (*c <= 0x20 || strchr("<>\"{}|^`\\", *c)) {
+            g_string_append_printf(out, "\\u%04X", *c);
+        } else {
+            g_string_append_c(out, *c);
+        }
+    }
+    g_string_append_c(out, '>');
+}
+
+static char *nt_literal(const char *value, gsize len, const char *lang, const char *datatype)
+{
+    GString *out = g_string_sized_new(len + 2);
+    g_string_append_c(out, '"');
+    for (gsize i=0; i<len; i++) {
+        unsigned char c = value[i];
+        if (c == '"') {
+            g_string_append(out, "\\\"");
+        } else if (c == '\\') {
+            g_string_append(out, "\\\\");
+        } else if (c == '\n') {
+            g_string_append(out, "\\n");
+        } else if (c == '\r') {
+            g_string_append(out, "\\r");
+        } else if ((c < 0x20 && c != '\t') || c == 0x7f) {
+            g_string_append_printf(out, "\\u%04X", c);
+        } else {
+            g_string_append_c(out, c);
+        }
+    }
+    g_string_append_c(out, '"');
+    if (lang && *lang) {
+        g_string_append_c(out, '@');
+        char *lower = g_ascii_strdown(lang, -1);
+        g_string_append(out, lower);
+        g_free(lower);
+    } else if (datatype && strcmp(datatype, XSD "string")) {
+        g_string_append(out, "^^");
+        nt_iri(out, datatype);
+    }
+
+    return g_string_free(out, FALSE);
+}
+
+static char *term_iri(const char *iri)
+{
+    GString *out = g_string_new(NULL);
+    nt_iri(out, iri);
+
+    return g_string_free(out, FALSE);
+}
+
+static char *new_bnode(rdf_parser *p)
+{
+    return g_strdup_printf("_:%sg%ld", p->bnode_prefix, ++p->bnodes);
+}
+
+static void emit(rdf_parser *p, const char *s, const char *pr, const char *o)
+{
+    g_string_append(p->triples, s);
+    g_string_append_c(p->triples, ' ');
+    g_string_append(p->triples, pr);
+    g_string_append_c(p->triples, ' ');
+    g_string_append(p->triples, o);
+    g_string_append(p->triples, " .\n");
+}
+
+static void flush_triples(rdf_parser *p)
+{
+    fwrite(p->triples->str, p->triples->len, 1, p->out);
+    g_string_truncate(p->triples, 0);
+}
+
+/* resolve iri against base, unless it already has a scheme */
+static char *resolve(const char *base, const char *iri)
+{
+    const char *c = iri;
+    if (g_ascii_isalpha(*c)) {
+        while (g_ascii_isalnum(*c) || *c == '+' || *c == '-' || *c == '.') {
+            c++;
+        }
+        if (*c == ':') {
+            return g_strdup(iri);
+        }
+    }
+    if (!base) {
+        return g_strdup(iri);
+    }
+
+    xmlChar *resolved = xmlBuildURI((const xmlChar *) iri, (const xmlChar *) base);
+    if (!resolved) {
+        return g_strdup(iri);
+    }
+    char *result = g_strdup((const char *) resolved);
+    xmlFree(resolved);
+
+    return result;
+}
+
+static void report(rdf_parser *p, gint64 offset, const char *error)
+{
+    if (++(p->errors) <= MAX_REPORTED) {
+        fprintf(stderr, "RDF syntax error at byte %" G_GINT64_FORMAT ": %s\n", offset, error);
+    } else if (p->errors == MAX_REPORTED + 1) {
+        fprintf(stderr, "further RDF syntax errors not reported\n");
+    }
+}
+
+/* Turtle */
+
+static const char *ttl_keep(ttl *t, char *str)
+{
+    g_ptr_array_add(t->strings, str);
+
+    return str;
+}
+
+static void ttl_more(ttl *t)
+{
+    if (!t->status) {
+        t->status = TTL_MORE;
+    }
+}
+
+/* failing at the end of the data just means there's more to come */
+static void ttl_fail(ttl *t, const char *error)
+{
+    if (t->status) {
+        return;
+    }
+    if (t->pos >= t->end && !t->eof) {
+        t->status = TTL_MORE;
+    } else {
+        t->status = TTL_ERROR;
+        t->error = error;
+    }
+}
+
+static int ttl_peek(ttl *t)
+{
+    if (t->pos < t->end) {
+        return (unsigned char) *t->pos;
+    }
+    ttl_fail(t, "unexpected end of data");
+
+    return -1;
+}
+
+static void ttl_expect(ttl *t, int c)
+{
+    static char error[] = "expected 'x'";
+    if (ttl_peek(t) == c) {
+        t->pos++;
+    } else {
+        error[10] = c;
+        ttl_fail(t, error);
+    }
+}
+
+static void ttl_skip_ws(ttl *t)
+{
+    while (!t->status && t->pos < t->end) {
+        char c = *t->pos;
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            t->pos++;
+        } else if (c == '#') {
+            const char *nl = memchr(t->pos, '\n', t->end - t->pos);
+            if (!nl && !t->eof) {
+                ttl_more(t);
+                return;
+            }
+            t->pos = nl ? nl + 1 : t->end;
+        } else {
+            return;
+        }
+    }
+}
+
+static int pn_chars_base(int c)
+{
+    return g_ascii_isalpha(c) || c >= 0x80;
+}
+
+static int pn_chars(int c)
+{
+    return pn_chars_base(c) || c == '_' || c == '-' || g_ascii_isdigit(c);
+}
+
+static int ttl_hex(ttl *t, int digits, gunichar *value)
+{
+    if (t->end - t->pos < digits) {
+        t->pos = t->end;
+        ttl_fail(t, "truncated escape");
+        return 0;
+    }
+    *value = 0;
+    for (int i=0; i<digits; i++) {
+        int c = *(t->pos++);
+        if (!g_ascii_isxdigit(c)) {
+            ttl_fail(t, "bad hex digit in escape");
+            return 0;
+        }
+        *value = *value * 16 + g_ascii_xdigit_value(c);
+    }
+
+    return 1;
+}
+
+/* after a backslash, \uXXXX or \UXXXXXXXX */
+static void ttl_uchar(ttl *t, GString *out)
+{
+    int c = ttl_peek(t);
+    gunichar value;
+    if (c == 'u' || c == 'U') {
+        t->pos++;
+        if (ttl_hex(t, c == 'u' ? 4 : 8, &value)) {
+            g_string_append_unichar(out, value);
+        }
+    } else if (c >= 0) {
+        ttl_fail(t, "bad escape");
+    }
+}
+
+static const char *ttl_iriref(ttl *t)
+{
+    GString *iri = g_string_new(NULL);
+    t->pos++;
+    while (!t->status) {
+        int c = ttl_peek(t);
+        if (c < 0) {
+            break;
+        }
+        t->pos++;
+        if (c == '>') {
+            char *resolved = resolve(t->p->base, iri->str);
+            g_string_free(iri, TRUE);
+            return ttl_keep(t, resolved);
+        } else if (c == '\\') {
+            ttl_uchar(t, iri);
+        } else if (c <= 0x20 || strchr("<\"{}|^`", c)) {
+            ttl_fail(t, "bad character in IRI");
+        } else {
+            g_string_append_c(iri, c);
+        }
+    }
+    g_string_free(iri, TRUE);
+
+    return NULL;
+}
+
+static const char *ttl_pname(ttl *t)
+{
+    const char *q = t->pos;
+    while (q < t->end && (pn_chars(*q) || *q == '.')) {
+        q++;
+    }
+    if (q >= t->end) {
+        t->pos = q;
+        ttl_fail(t, "unexpected end of data");
+        return NULL;
+    }
+    if (*q != ':') {
+        t->pos = q;
+        ttl_fail(t, "expected a prefixed name");
+        return NULL;
+    }
+    char *prefix = g_strndup(t->pos, q - t->pos);
+    const char *ns = g_hash_table_lookup(t->p->prefixes, prefix);
+    g_free(prefix);
+    if (!ns) {
+        ttl_fail(t, "undefined prefix");
+        return NULL;
+    }
+
+    GString *name = g_string_new(ns);
+    for (q++; q < t->end; ) {
+        char c = *q;
+        if (pn_chars(c) || c == ':') {
+            g_string_append_c(name, c);
+            q++;
+        } else if (c == '.') {
+            /* dots may not end a name */
+            const char *r = q;
+            while (r < t->end && *r == '.') {
+                r++;
+            }
+            if (r < t->end && (pn_chars(*r) || *r == ':' || *r == '%' || *r == '\\')) {
+                g_string_append_len(name, q, r - q);
+                q = r;
+            } else if (r >= t->end && !t->eof) {
+                q = t->end;
+            } else {
+                break;
+            }
+        } else if (c == '%') {
+            if (t->end - q < 3) {
+                q = t->end;
+                continue;
+            }
+            g_string_append_len(name, q, 3);
+            q += 3;
+        } else if (c == '\\') {
+            if (t->end - q < 2) {
+                q = t->end;
+                continue;
+            }
+            g_string_append_c(name, q[1]);
+            q += 2;
+        } else {
+            break;
+        }
+    }
+    t->pos = q;
+    if (q >= t->end && !t->eof) {
+        /* the name might go on */
+        ttl_more(t);
+        g_string_free(name, TRUE);
+        return NULL;
+    }
+
+    return ttl_keep(t, g_string_free(name, FALSE));
+}
+
+/* an IRI, written either way, unescaped and resolved */
+static const char *ttl_iri(ttl *t)
+{
+    if (ttl_peek(t) == '<') {
+        return ttl_iriref(t);
+    }
+
+    return t->status ? NULL : ttl_pname(t);
+}
+
+static const char *ttl_iri_term(ttl *t)
+{
+    const char *iri = ttl_iri(t);
+
+    return iri ? ttl_keep(t, term_iri(iri)) : NULL;
+}
+
+/* does word appear here, followed by something that can't be part of it? */
+static int ttl_word(ttl *t, const char *word, int nocase)
+{
+    if (t->status) {
+        return 0;
+    }
+    size_t len = strlen(word);
+    size_t avail = t->end - t->pos;
+    size_t n = MIN(len, avail);
+    if (nocase ? g_ascii_strncasecmp(t->pos, word, n) : strncmp(t->pos, word, n)) {
+        return 0;
+    }
+    if (avail <= len) {
+        if (!t->eof) {
+            ttl_more(t);
+        }
+        return 0;
+    }
+    char c = t->pos[len];
+    if (pn_chars(c) || c == ':' || c == '.' || c == '%' || c == '\\') {
+        return 0;
+    }
+    t->pos += len;
+
+    return 1;
+}
+
+static const char *ttl_bnode_label(ttl *t)
+{
+    t->pos++;
+    ttl_expect(t, ':');
+    if (t->status) {
+        return NULL;
+    }
+    const char *start = t->pos;
+    while (t->pos < t->end && (pn_chars(*t->pos) || *t->pos == '.')) {
+        t->pos++;
+    }
+    if (t->pos >= t->end && !t->eof) {
+        ttl_more(t);
+        return NULL;
+    }
+    while (t->pos > start && t->pos[-1] == '.') {
+        t->pos--;
+    }
+    if (t->status || t->pos == start) {
+        ttl_fail(t, "bad blank node label");
+        return NULL;
+    }
+
+    return ttl_keep(t, g_strdup_printf("_:%sb%.*s", t->p->bnode_prefix, (int) (t->pos - start), start));
+}
+
+static void ttl_string(ttl *t, GString *value)
+{
+    char quote = *t->pos;
+    if (t->end - t->pos < 3) {
+        if (!t->eof) {
+            ttl_more(t);
+            return;
+        }
+    }
+    int is_long = t->end - t->pos >= 3 && t->pos[1] == quote && t->pos[2] == quote;
+    t->pos += is_long ? 3 : 1;
+
+    while (!t->status) {
+        int c = ttl_peek(t);
+        if (c < 0) {
+            return;
+        }
+        if (c == quote) {
+            if (!is_long) {
+                t->pos++;
+                return;
+            }
+            if (t->end - t->pos < 3) {
+                t->pos = t->end;
+                ttl_fail(t, "unterminated string");
+                return;
+            }
+            if (t->pos[1] == quote && t->pos[2] == quote) {
+                t->pos += 3;
+                return;
+            }
+            g_string_append_c(value, c);
+            t->pos++;
+        } else if (c == '\\') {
+            t->pos++;
+            c = ttl_peek(t);
+            const char *echar = c < 0 ? NULL : strchr("tbnrf\"'\\", c);
+            if (c > 0 && echar) {
+                g_string_append_c(value, "\t\b\n\r\f\"'\\"[echar - "tbnrf\"'\\"]);
+                t->pos++;
+            } else {
+                ttl_uchar(t, value);
+            }
+        } else if (!is_long && (c == '\n' || c == '\r')) {
+            ttl_fail(t, "newline in string");
+        } else {
+            g_string_append_c(value, c);
+            t->pos++;
+        }
+    }
+}
+
+static const char *ttl_literal(ttl *t)
+{
+    GString *value = g_string_new(NULL);
+    const char *lang = NULL;
+    const char *datatype = NULL;
+
+    ttl_string(t, value);
+    int c = t->status ? -1 : ttl_peek(t);
+    if (c == '@') {
+        const char *start = ++t->pos;
+        while (t->pos < t->end && (g_ascii_isalnum(*t->pos) || *t->pos == '-')) {
+            t->pos++;
+        }
+        if (t->pos >= t->end && !t->eof) {
+            ttl_more(t);
+        } else if (t->pos == start) {
+            ttl_fail(t, "bad language tag");
+        } else {
+            lang = ttl_keep(t, g_strndup(start, t->pos - start));
+        }
+    } else if (c == '^') {
+        t->pos++;
+        ttl_expect(t, '^');
+        if (!t->status) {
+            datatype = ttl_iri(t);
+        }
+    }
+
+    const char *literal = NULL;
+    if (!t->status) {
+        literal = ttl_keep(t, nt_literal(value->str, value->len, lang, datatype));
+    }
+    g_string_free(value, TRUE);
+
+    return literal;
+}
+
+static const char *ttl_number(ttl *t)
+{
+    const char *start = t->pos;
+    const char *datatype = XSD "integer";
+    const char *q = t->pos;
+
+    if (*q == '+' || *q == '-') {
+        q++;
+    }
+    while (q < t->end && g_ascii_isdigit(*q)) {
+        q++;
+    }
+    /* a dot is only part of the number if a digit follows */
+    if (q < t->end && *q == '.' && (q + 1 >= t->end || g_ascii_isdigit(q[1]))) {
+        if (q + 1 >= t->end && !t->eof) {
+            q = t->end;
+        } else if (q + 1 < t->end) {
+            datatype = XSD "decimal";
+            for (q++; q < t->end && g_ascii_isdigit(*q); q++) ;
+        }
+    }
+    if (q < t->end && (*q == 'e' || *q == 'E')) {
+        datatype = XSD "double";
+        q++;
+        if (q < t->end && (*q == '+' || *q == '-')) {
+            q++;
+        }
+        const char *digits = q;
+        while (q < t->end && g_ascii_isdigit(*q)) {
+            q++;
+        }
+        if (q == digits && q < t->end) {
+            t->pos = q;
+            ttl_fail(t, "bad exponent");
+            return NULL;
+        }
+    }
+    if (q >= t->end && !t->eof) {
+        ttl_more(t);
+        return NULL;
+    }
+    t->pos = q;
+    if (q == start || (!g_ascii_isdigit(q[-1]) && strcmp(datatype, XSD "double"))) {
+        ttl_fail(t, "bad number");
+        return NULL;
+    }
+
+    return ttl_keep(t, nt_literal(start, q - start, NULL, datatype));
+}
+
+static const char *ttl_object(ttl *t);
+static void ttl_predicate_object_list(ttl *t, const char *subject);
+
+static const char *ttl_collection(ttl *t)
+{
+    const char *head = RDF_NIL;
+    const char *last = NULL;
+
+    t->pos++;
+    while (1) {
+        ttl_skip_ws(t);
+        int c = ttl_peek(t);
+        if (t->status) {
+            return NULL;
+        }
+        if (c == ')') {
+            t->pos++;
+            break;
+        }
+        const char *item = ttl_object(t);
+        if (t->status) {
+            return NULL;
+        }
+        const char *node = ttl_keep(t, new_bnode(t->p));
+        if (last) {
+            emit(t->p, last, RDF_REST, node);
+        } else {
+            head = node;
+        }
+        emit(t->p, node, RDF_FIRST, item);
+        last = node;
+    }
+    if (last) {
+        emit(t->p, last, RDF_REST, RDF_NIL);
+    }
+
+    return head;
+}
+
+static const char *ttl_blank_node_property_list(ttl *t)
+{
+    const char *node = ttl_keep(t, new_bnode(t->p));
+
+    t->pos++;
+    ttl_skip_ws(t);
+    if (ttl_peek(t) == ']') {
+        t->pos++;
+        return node;
+    }
+    if (t->status) {
+        return NULL;
+    }
+    ttl_predicate_object_list(t, node);
+    ttl_skip_ws(t);
+    ttl_expect(t, ']');
+
+    return node;
+}
+
+static const char *ttl_object(ttl *t)
+{
+    int c = ttl_peek(t);
+
+    switch (c) {
+    case -1:
+        return NULL;
+    case '<':
+        return ttl_iri_term(t);
+    case '_':
+        return ttl_bnode_label(t);
+    case '[':
+        return ttl_blank_node_property_list(t);
+    case '(':
+        return ttl_collection(t);
+    case '"':
+    case '\'':
+        return ttl_literal(t);
+    case '+':
+    case '-':
+    case '.':
+        return ttl_number(t);
+    }
+    if (g_ascii_isdigit(c)) {
+        return ttl_number(t);
+    }
+    if (ttl_word(t, "true", 0)) {
+        return ttl_keep(t, nt_literal("true", 4, NULL, XSD "boolean"));
+    }
+    if (!t->status && ttl_word(t, "false", 0)) {
+        return ttl_keep(t, nt_literal("false", 5, NULL, XSD "boolean"));
+    }
+
+    return t->status ? NULL : ttl_iri_term(t);
+}
+
+static const char *ttl_verb(ttl *t)
+{
+    if (ttl_word(t, "a", 0)) {
+        return RDF_TYPE;
+    }
+
+    return t->status ? NULL : ttl_iri_term(t);
+}
+
+static void ttl_object_list(ttl *t, const char *subject, const char *predicate)
+{
+    while (1) {
+        ttl_skip_ws(t);
+        const char *object = ttl_object(t);
+        if (t->status) {
+            return;
+        }
+        emit(t->p, subject, predicate, object);
+        ttl_skip_ws(t);
+        if (ttl_peek(t) != ',') {
+            return;
+        }
+        t->pos++;
+    }
+}
+
+static void ttl_predicate_object_list(ttl *t, const char *subject)
+{
+    while (1) {
+        ttl_skip_ws(t);
+        const char *predicate = ttl_verb(t);
+        if (t->status) {
+            return;
+        }
+        ttl_object_list(t, subject, predicate);
+        if (t->status) {
+            return;
+        }
+        int c = ttl_peek(t);
+        if (c != ';') {
+            return;
+        }
+        while (c == ';') {
+            t->pos++;
+            ttl_skip_ws(t);
+            c = ttl_peek(t);
+        }
+        if (t->status || c == '.' || c == ']') {
+            return;
+        }
+    }
+}
+
+static void ttl_triples(ttl *t)
+{
+    const char *subject;
+    int c = ttl_peek(t);
+
+    if (c == '[') {
+        subject = ttl_blank_node_property_list(t);
+        ttl_skip_ws(t);
+        if (t->status || ttl_peek(t) == '.') {
+            return;
+        }
+    } else if (c == '<') {
+        subject = ttl_iri_term(t);
+    } else if (c == '_') {
+        subject = ttl_bnode_label(t);
+    } else if (c == '(') {
+        subject = ttl_collection(t);
+    } else {
+        subject = ttl_iri_term(t);
+    }
+    if (t->status) {
+        return;
+    }
+    ttl_predicate_object_list(t, subject);
+}
+
+static void ttl_prefix(ttl *t, int at)
+{
+    ttl_skip_ws(t);
+    const char *start = t->pos;
+    while (t->pos < t->end && (pn_chars(*t->pos) || *t->pos == '.')) {
+        t->pos++;
+    }
+    ttl_expect(t, ':');
+    if (t->status) {
+        return;
+    }
+    char *name = g_strndup(start, t->pos - 1 - start);
+    ttl_skip_ws(t);
+    if (ttl_peek(t) != '<') {
+        ttl_fail(t, "expected an IRI");
+    }
+    const char *iri = t->status ? NULL : ttl_iriref(t);
+    if (at) {
+        ttl_skip_ws(t);
+        ttl_expect(t, '.');
+    }
+    if (t->status) {
+        g_free(name);
+        return;
+    }
+    g_hash_table_replace(t->p->prefixes, name, g_strdup(iri));
+}
+
+static void ttl_base(ttl *t, int at)
+{
+    ttl_skip_ws(t);
+    if (ttl_peek(t) != '<') {
+        ttl_fail(t, "expected an IRI");
+    }
+    const char *iri = t->status ? NULL : ttl_iriref(t);
+    if (at) {
+        ttl_skip_ws(t);
+        ttl_expect(t, '.');
+    }
+    if (t->status) {
+        return;
+    }
+    g_free(t->p->base);
+    t->p->base = g_strdup(iri);
+}
+
+static void ttl_statement(ttl *t)
+{
+    if (*t->pos == '@') {
+        if (ttl_word(t, "@prefix", 0)) {
+            ttl_prefix(t, 1);
+        } else if (!t->status && ttl_word(t, "@base", 0)) {
+            ttl_base(t, 1);
+        } else {
+            ttl_fail(t, "unknown directive");
+        }
+        return;
+    }
+    if (ttl_word(t, "PREFIX", 1)) {
+        ttl_prefix(t, 0);
+        return;
+    }
+    if (!t->status && ttl_word(t, "BASE", 1)) {
+        ttl_base(t, 0);
+        return;
+    }
+    if (t->status) {
+        return;
+    }
+    ttl_triples(t);
+    ttl_skip_ws(t);
+    ttl_expect(t, '.');
+}
+
+/* parse every complete statement in the buffer */
+static void ttl_parse(rdf_parser *p, int eof)
+{
+    ttl t = {
+        .p = p,
+        .pos = p->buf->str,
+        .end = p->buf->str + p->buf->len,
+        .eof = eof,
+        .strings = g_ptr_array_new_with_free_func(g_free),
+    };
+
+    while (1) {
+        ttl_skip_ws(&t);
+        if (t.status || t.pos >= t.end) {
+            break;
+        }
+        const char *statement = t.pos;
+        gsize written = p->triples->len;
+        long bnodes = p->bnodes;
+
+        ttl_statement(&t);
+        g_ptr_array_set_size(t.strings, 0);
+        if (t.status == TTL_MORE) {
+            g_string_truncate(p->triples, written);
+            p->bnodes = bnodes;
+            t.pos = statement;
+            break;
+        } else if (t.status == TTL_ERROR) {
+            g_string_truncate(p->triples, written);
+            report(p, p->offset + (t.pos - p->buf->str), t.error);
+            /* carry on from the next line */
+            const char *from = MAX(t.pos, statement + 1);
+            const char *nl = from < t.end ? memchr(from, '\n', t.end - from) : NULL;
+            if (nl) {
+                t.pos = nl + 1;
+            } else {
+                t.pos = t.end;
+                p->skip_line = !eof;
+            }
+            t.status = TTL_OK;
+        }
+        if (p->triples->len >= FLUSH_SIZE) {
+            flush_triples(p);
+        }
+    }
+    g_ptr_array_free(t.strings, TRUE);
+
+    gsize used = t.pos - p->buf->str;
+    g_string_erase(p->buf, 0, used);
+    p->offset += used;
+    p->retry_at = p->buf->len * RETRY_GROWTH;
+}
+
+/* RDF/XML */
+
+/* entities aren't substituted while parsing, so any references left in
+ * the value are replaced here */
+static char *attr_value(rdf_parser *p, const xmlChar **attr)
+{
+    int len = attr[4] - attr[3];
+    if (!memchr(attr[3], '&', len)) {
+        return g_strndup((const char *) attr[3], len);
+    }
+    xmlChar *decoded = xmlStringLenDecodeEntities(p->xml, attr[3], len, XML_SUBSTITUTE_REF, 0, 0, 0);
+    char *value = g_strdup(decoded ? (const char *) decoded : "");
+    xmlFree(decoded);
+
+    return value;
+}
+
+static int is_rdf(const xmlChar *uri, const xmlChar *name, const char *local)
+{
+    return uri && !strcmp((const char *) uri, RDF_NS) && !strcmp((const char *) name, local);
+}
+
+static void free_frame(struct frame *f)
+{
+    g_free(f->subject);
+    g_free(f->parent);
+    g_free(f->predicate);
+    g_free(f->object);
+    g_free(f->datatype);
+    g_free(f->reify);
+    g_free(f->base);
+    g_free(f->lang);
+    g_free(f->last);
+    if (f->text) {
+        g_string_free(f->text, TRUE);
+    }
+    g_free(f);
+}
+
+/* set the object of the property or collection parent to node */
+static void xml_object(rdf_parser *p, struct frame *parent, const char *node)
+{
+    if (!parent) {
+        return;
+    }
+    if (parent->kind == FRAME_COLLECTION) {
+        char *cell = new_bnode(p);
+        if (parent->last) {
+            emit(p, parent->last, RDF_REST, cell);
+            g_free(parent->last);
+        } else {
+            parent->object = g_strdup(cell);
+        }
+        emit(p, cell, RDF_FIRST, node);
+        parent->last = cell;
+    } else if (parent->kind == FRAME_PROPERTY) {
+        g_free(parent->object);
+        parent->object = g_strdup(node);
+    }
+}
+
+static void xml_node(rdf_parser *p, struct frame *f, struct frame *parent, const char *name,
+                     int nb_attributes, const xmlChar **attributes)
+{
+    f->kind = FRAME_NODE;
+    for (int i=0; i<nb_attributes; i++) {
+        const xmlChar **attr = attributes + i * 5;
+        char *value = attr_value(p, attr);
+        if (is_rdf(attr[2], attr[0], "about")) {
+            char *iri = resolve(f->base, value);
+            f->subject = term_iri(iri);
+            g_free(iri);
+        } else if (is_rdf(attr[2], attr[0], "ID")) {
+            char *id = g_strconcat("#", value, NULL);
+            char *iri = resolve(f->base, id);
+            f->subject = term_iri(iri);
+            g_free(iri);
+            g_free(id);
+        } else if (is_rdf(attr[2], attr[0], "nodeID")) {
+            f->subject = g_strconcat("_:", p->bnode_prefix, "b", value, NULL);
+        }
+        g_free(value);
+    }
+    if (!f->subject) {
+        f->subject = new_bnode(p);
+    }
+    xml_object(p, parent, f->subject);
+
+    if (strcmp(name, RDF_NS "Description")) {
+        char *type = term_iri(name);
+        emit(p, f->subject, RDF_TYPE, type);
+        g_free(type);
+    }
+
+    /* property attributes */
+    for (int i=0; i<nb_attributes; i++) {
+        const xmlChar **attr = attributes + i * 5;
+        if (!attr[2] || !strcmp((const char *) attr[2], XML_NS) ||
+            is_rdf(attr[2], attr[0], "about") || is_rdf(attr[2], attr[0], "ID") ||
+            is_rdf(attr[2], attr[0], "nodeID")) {
+            continue;
+        }
+        char *value = attr_value(p, attr);
+        char *predicate = g_strconcat((const char *) attr[2], (const char *) attr[0], NULL);
+        char *pred_term = term_iri(predicate);
+        char *object;
+        if (is_rdf(attr[2], attr[0], "type")) {
+            char *iri = resolve(f->base, value);
+            object = term_iri(iri);
+            g_free(iri);
+        } else {
+            object = nt_literal(value, strlen(value), f->lang, NULL);
+        }
+        emit(p, f->subject, pred_term, object);
+        g_free(object);
+        g_free(pred_term);
+        g_free(predicate);
+        g_free(value);
+    }
+}
+
+static void xml_property(rdf_parser *p, struct frame *f, struct frame *parent, const char *name,
+                         int nb_attributes, const xmlChar **attributes)
+{
+    char *parse_type = NULL;
+    char *resource = NULL;
+    char *node_id = NULL;
+
+    f->parent = g_strdup(parent->subject);
+    if (!strcmp(name, RDF_NS "li")) {
+        char *member = g_strdup_printf(RDF_NS "_%d", ++parent->li);
+        f->predicate = term_iri(member);
+        g_free(member);
+    } else {
+        f->predicate = term_iri(name);
+    }
+
+    int properties = 0;
+    for (int i=0; i<nb_attributes; i++) {
+        const xmlChar **attr = attributes + i * 5;
+        if (!attr[2] || !strcmp((const char *) attr[2], XML_NS)) {
+            continue;
+        }
+        char *value = attr_value(p, attr);
+        if (is_rdf(attr[2], attr[0], "resource")) {
+            resource = resolve(f->base, value);
+        } else if (is_rdf(attr[2], attr[0], "nodeID")) {
+            node_id = g_strconcat("_:", p->bnode_prefix, "b", value, NULL);
+        } else if (is_rdf(attr[2], attr[0], "datatype")) {
+            f->datatype = resolve(f->base, value);
+        } else if (is_rdf(attr[2], attr[0], "parseType")) {
+            parse_type = g_strdup(value);
+        } else if (is_rdf(attr[2], attr[0], "ID")) {
+            char *id = g_strconcat("#", value, NULL);
+            char *iri = resolve(f->base, id);
+            f->reify = term_iri(iri);
+            g_free(iri);
+            g_free(id);
+        } else {
+            properties++;
+        }
+        g_free(value);
+    }
+
+    if (parse_type) {
+        if (!strcmp(parse_type, "Resource")) {
+            f->kind = FRAME_RESOURCE;
+            f->subject = new_bnode(p);
+            f->object = g_strdup(f->subject);
+        } else if (!strcmp(parse_type, "Collection")) {
+            f->kind = FRAME_COLLECTION;
+        } else {
+            f->kind = FRAME_LITERAL;
+            f->text = g_string_new(NULL);
+        }
+    } else if (resource || node_id || properties) {
+        f->kind = FRAME_EMPTY;
+        if (resource) {
+            f->object = term_iri(resource);
+        } else {
+            f->object = node_id ? g_strdup(node_id) : new_bnode(p);
+        }
+        for (int i=0; i<nb_attributes; i++) {
+            const xmlChar **attr = attributes + i * 5;
+            if (!attr[2] || !strcmp((const char *) attr[2], XML_NS) ||
+                (!strcmp((const char *) attr[2], RDF_NS) && !is_rdf(attr[2], attr[0], "type"))) {
+                continue;
+            }
+            char *value = attr_value(p, attr);
+            char *predicate = g_strconcat((const char *) attr[2], (const char *) attr[0], NULL);
+            char *pred_term = term_iri(predicate);
+            char *object;
+            if (is_rdf(attr[2], attr[0], "type")) {
+                char *iri = resolve(f->base, value);
+                object = term_iri(iri);
+                g_free(iri);
+            } else {
+                object = nt_literal(value, strlen(value), f->lang, NULL);
+            }
+            emit(p, f->object, pred_term, object);
+            g_free(object);
+            g_free(pred_term);
+            g_free(predicate);
+            g_free(value);
+        }
+    } else {
+        f->kind = FRAME_PROPERTY;
+        f->text = g_string_new(NULL);
+    }
+    g_free(parse_type);
+    g_free(resource);
+    g_free(node_id);
+}
+
+static void literal_text(GString *out, const char *text, int len, int attribute)
+{
+    for (int i=0; i<len; i++) {
+        switch (text[i]) {
+        case '&':
+            g_string_append(out, "&amp;");
+            break;
+        case '<':
+            g_string_append(out, "&lt;");
+            break;
+        case '>':
+            g_string_append(out, "&gt;");
+            break;
+        case '"':
+            g_string_append(out, attribute ? "&quot;" : "\"");
+            break;
+        default:
+            g_string_append_c(out, text[i]);
+        }
+    }
+}
+
+static void literal_name(GString *out, const xmlChar *prefix, const xmlChar *localname)
+{
+    if (prefix) {
+        g_string_append_printf(out, "%s:", (const char *) prefix);
+    }
+    g_string_append(out, (const char *) localname);
+}
+
+static void xml_start(void *ctx, const xmlChar *localname, const xmlChar *prefix,
+                      const xmlChar *URI, int nb_namespaces, const xmlChar **namespaces,
+                      int nb_attributes, int nb_defaulted, const xmlChar **attributes)
+{
+    rdf_parser *p = ((xmlParserCtxtPtr) ctx)->_private;
+    struct frame *parent = p->frames ? p->frames->data : NULL;
+
+    if (parent && parent->kind == FRAME_LITERAL) {
+        GString *out = parent->text;
+        g_string_append_c(out, '<');
+        literal_name(out, prefix, localname);
+        for (int i=0; i<nb_namespaces; i++) {
+            g_string_append(out, namespaces[i * 2] ? " xmlns:" : " xmlns");
+            if (namespaces[i * 2]) {
+                g_string_append(out, (const char *) namespaces[i * 2]);
+            }
+            g_string_append(out, "=\"");
+            literal_text(out, (const char *) namespaces[i * 2 + 1], strlen((const char *) namespaces[i * 2 + 1]), 1);
+            g_string_append_c(out, '"');
+        }
+        for (int i=0; i<nb_attributes; i++) {
+            const xmlChar **attr = attributes + i * 5;
+            g_string_append_c(out, ' ');
+            literal_name(out, attr[1], attr[0]);
+            g_string_append(out, "=\"");
+            char *value = attr_value(p, attr);
+            literal_text(out, value, strlen(value), 1);
+            g_string_append_c(out, '"');
+            g_free(value);
+        }
+        g_string_append_c(out, '>');
+        parent->depth++;
+        return;
+    }
+
+    struct frame *f = g_new0(struct frame, 1);
+    f->base = g_strdup(parent ? parent->base : p->base);
+    f->lang = g_strdup(parent ? parent->lang : NULL);
+    for (int i=0; i<nb_attributes; i++) {
+        const xmlChar **attr = attributes + i * 5;
+        if (!attr[2] || strcmp((const char *) attr[2], XML_NS)) {
+            continue;
+        }
+        char *value = attr_value(p, attr);
+        if (!strcmp((const char *) attr[0], "base")) {
+            char *base = resolve(f->base, value);
+            g_free(f->base);
+            f->base = base;
+        } else if (!strcmp((const char *) attr[0], "lang")) {
+            g_free(f->lang);
+            f->lang = *value ? g_strdup(value) : NULL;
+        }
+        g_free(value);
+    }
+
+    char *name = g_strconcat(URI ? (const char *) URI : "", (const char *) localname, NULL);
+    if (!parent && !strcmp(name, RDF_NS "RDF")) {
+        f->kind = FRAME_RDF;
+    } else if (!parent || parent->kind == FRAME_RDF || parent->kind == FRAME_PROPERTY ||
+               parent->kind == FRAME_COLLECTION) {
+        xml_node(p, f, parent, name, nb_attributes, attributes);
+    } else if (parent->kind == FRAME_NODE || parent->kind == FRAME_RESOURCE) {
+        xml_property(p, f, parent, name, nb_attributes, attributes);
+    } else {
+        report(p, xmlByteConsumed(ctx), "element inside an empty property");
+        f->kind = FRAME_RDF;
+    }
+    g_free(name);
+
+    p->frames = g_slist_prepend(p->frames, f);
+}
+
+static void xml_end(void *ctx, const xmlChar *localname, const xmlChar *prefix, const xmlChar *URI)
+{
+    rdf_parser *p = ((xmlParserCtxtPtr) ctx)->_private;
+    if (!p->frames) {
+        return;
+    }
+    struct frame *f = p->frames->data;
+
+    if (f->kind == FRAME_LITERAL && f->depth > 0) {
+        g_string_append(f->text, "</");
+        literal_name(f->text, prefix, localname);
+        g_string_append_c(f->text, '>');
+        f->depth--;
+        return;
+    }
+    p->frames = g_slist_delete_link(p->frames, p->frames);
+
+    char *object = NULL;
+    switch (f->kind) {
+    case FRAME_PROPERTY:
+        if (f->object) {
+            object = g_strdup(f->object);
+        } else {
+            object = nt_literal(f->text->str, f->text->len, f->datatype ? NULL : f->lang, f->datatype);
+        }
+        break;
+    case FRAME_EMPTY:
+    case FRAME_RESOURCE:
+        object = g_strdup(f->object);
+        break;
+    case FRAME_LITERAL:
+        object = nt_literal(f->text->str, f->text->len, NULL, RDF_NS "XMLLiteral");
+        break;
+    case FRAME_COLLECTION:
+        object = g_strdup(f->object ? f->object : RDF_NIL);
+        if (f->last) {
+            emit(p, f->last, RDF_REST, RDF_NIL);
+        }
+        break;
+    case FRAME_RDF:
+    case FRAME_NODE:
+        break;
+    }
+
+    if (object) {
+        emit(p, f->parent, f->predicate, object);
+        if (f->reify) {
+            emit(p, f->reify, RDF_TYPE, "<" RDF_NS "Statement>");
+            emit(p, f->reify, "<" RDF_NS "subject>", f->parent);
+            emit(p, f->reify, "<" RDF_NS "predicate>", f->predicate);
+            emit(p, f->reify, "<" RDF_NS "object>", object);
+        }
+        g_free(object);
+    }
+    free_frame(f);
+}
+
+static void xml_characters(void *ctx, const xmlChar *ch, int len)
+{
+    rdf_parser *p = ((xmlParserCtxtPtr) ctx)->_private;
+    struct frame *f = p->frames ? p->frames->data : NULL;
+
+    if (!f) {
+        return;
+    }
+    if (f->kind == FRAME_LITERAL) {
+        literal_text(f->text, (const char *) ch, len, 0);
+    } else if (f->kind == FRAME_PROPERTY && !f->object) {
+        g_string_append_len(f->text, (const char *) ch, len);
+    }
+}
+
+/* external entities could pull local files into the output, so a
+ * document that declares one is refused. Internal ones, often used to
+ * abbreviate namespaces, are kept */
+static void xml_entity_decl(void *ctx, const xmlChar *name, int type, const xmlChar *public_id,
+                            const xmlChar *system_id, xmlChar *content)
+{
+    xmlParserCtxtPtr xml = ctx;
+    rdf_parser *p = xml->_private;
+
+    if (type != XML_INTERNAL_GENERAL_ENTITY || system_id) {
+        report(p, xmlByteConsumed(xml), "external entities are not accepted");
+        xmlStopParser(xml);
+        return;
+    }
+    xmlSAX2EntityDecl(ctx, name, type, public_id, system_id, content);
+}
+
+rdf_parser *rdf_parser_new(enum rdf_syntax syntax, const char *base, const char *bnode_prefix, FILE *out)
+{
+    rdf_parser *p = g_new0(rdf_parser, 1);
+    p->syntax = syntax;
+    p->out = out;
+    p->base = g_strdup(base);
+    p->bnode_prefix = g_strdup(bnode_prefix ? bnode_prefix : "");
+    p->triples = g_string_sized_new(FLUSH_SIZE * 2);
+
+    if (syntax == RDF_XML) {
+        static xmlSAXHandler sax;
+        static gsize sax_ready = 0;
+        /* filled in once, whichever thread gets here first */
+        if (g_once_init_enter(&sax_ready)) {
+            xmlSAXVersion(&sax, 2);
+            sax.startElementNs = xml_start;
+            sax.endElementNs = xml_end;
+            sax.characters = xml_characters;
+            sax.cdataBlock = xml_characters;
+            sax.ignorableWhitespace = xml_characters;
+            sax.comment = NULL;
+            sax.processingInstruction = NULL;
+            sax.entityDecl = xml_entity_decl;
+            g_once_init_leave(&sax_ready, 1);
+        }
+        p->xml = xmlCreatePushParserCtxt(&sax, NULL, NULL, 0, base);
+        p->xml->_private = p;
+        /* no XML_PARSE_NOENT, entities are never substituted */
+        xmlCtxtUseOptions(p->xml, XML_PARSE_NONET);
+    } else {
+        p->buf = g_string_new(NULL);
+        p->prefixes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    }
+
+    return p;
+}
+
+size_t rdf_parser_write(void *ptr, size_t size, size_t nmemb, void *parser)
+{
+    rdf_parser *p = parser;
+    size_t len = size * nmemb;
+
+    if (p->syntax == RDF_XML) {
+        if (xmlParseChunk(p->xml, ptr, len, 0)) {
+            p->errors++;
+        }
+    } else {
+        const char *data = ptr;
+        size_t skip = 0;
+        if (p->skip_line) {
+            const char *nl = memchr(data, '\n', len);
+            skip = nl ? nl - data + 1 : len;
+            p->skip_line = !nl;
+            p->offset += skip;
+        }
+        g_string_append_len(p->buf, data + skip, len - skip);
+        if (p->buf->len >= p->retry_at) {
+            ttl_parse(p, 0);
+        }
+    }
+    flush_triples(p);
+
+    return len;
+}
+
+int rdf_parser_finish(rdf_parser *p)
+{
+    int errors;
+
+    if (p->syntax == RDF_XML) {
+        if (xmlParseChunk(p->xml, NULL, 0, 1)) {
+            p->errors++;
+        }
+        g_slist_free_full(p->frames, (GDestroyNotify) free_frame);
+        if (p->xml->myDoc) {
+            xmlFreeDoc(p->xml->myDoc);
+        }
+        xmlFreeParserCtxt(p->xml);
+    } else {
+        ttl_parse(p, 1);
+        g_string_free(p->buf, TRUE);
+        g_hash_table_destroy(p->prefixes);
+    }
+    flush_triples(p);
+    fflush(p->out);
+
+    errors = p->errors;
+    g_string_free(p->triples, TRUE);
+    g_free(p->base);
+    g_free(p->bnode_prefix);
+    g_free(p);
+
+    return errors;
+}
+
+/* vi:set expandtab sts=4 sw=4: */
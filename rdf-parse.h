@@ -0,0 +1,32 @@
+#ifndef RDF_PARSE_H
+#define RDF_PARSE_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+enum rdf_syntax {
+    RDF_NONE,
+    RDF_NTRIPLES,
+    RDF_TURTLE,
+    RDF_XML,
+};
+
+typedef struct _rdf_parser rdf_parser;
+
+/* the syntax served with HTTP Content-Type type, or RDF_NONE */
+enum rdf_syntax rdf_syntax_for_type(const char *type);
+
+/* parse RDF in syntax as it arrives, writing each triple to out as
+ * N-Triples. Relative IRIs are resolved against base. Blank node labels,
+ * the document's own and those made up, start with bnode_prefix, which
+ * keeps apart the nodes of documents written to the same out. It may be
+ * NULL */
+rdf_parser *rdf_parser_new(enum rdf_syntax syntax, const char *base, const char *bnode_prefix, FILE *out);
+
+/* a CURLOPT_WRITEFUNCTION, with the parser as CURLOPT_WRITEDATA */
+size_t rdf_parser_write(void *ptr, size_t size, size_t nmemb, void *parser);
+
+/* parse whatever is left and free parser, returning the number of errors */
+int rdf_parser_finish(rdf_parser *parser);
+
+#endif
@@ -0,0 +1,179 @@
+/*  sparql-query - a SPARQL client with GNU readline support
+    Copyright (C) 2006-8 Nick Lamb and Steve Harris for Garlik
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* parses small Turtle and RDF/XML documents, whole and in pieces of a few
+ * bytes, and checks the N-Triples written and whether errors were found */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "rdf-parse.h"
+
+#define BASE "http://example.org/base/doc"
+
+/* a string too long for any one buffer the parser reads into */
+#define LONG_STRING (1024 * 1024)
+
+typedef struct {
+    const char *name;
+    enum rdf_syntax syntax;
+    const char *doc;
+    const char *expected;
+    int errors;          /* whether there should be any */
+} rdf_case;
+
+static const rdf_case cases[] = {
+    { "turtle", RDF_TURTLE,
+    "@prefix ex: <http://example.org/> .\n"
+    "PREFIX foaf: <http://xmlns.com/foaf/0.1/>\n"
+    "@base <http://example.org/base/> .\n"
+    "ex:a foaf:name \"Alice\"@en ; ex:knows ex:b , <c> ;\n"
+    "  ex:list ( 1 \"two\" ex:three ) ;\n"
+    "  ex:empty () ;\n"
+    "  ex:long \"\"\"line one\n"
+    "line \"two\"\ttab\"\"\" ;\n"
+    "  ex:node [ ex:p 2.5 ; ex:q true ] .\n"
+    "_:x a ex:Thing ; ex:esc \"a\\tb\\n\" .\n",
+    "<http://example.org/a> <http://xmlns.com/foaf/0.1/name> \"Alice\"@en .\n"
+    "<http://example.org/a> <http://example.org/knows> <http://example.org/b> .\n"
+    "<http://example.org/a> <http://example.org/knows> <http://example.org/base/c> .\n"
+    "_:tg1 <http://www.w3.org/1999/02/22-rdf-syntax-ns#first> \"1\"^^<http://www.w3.org/2001/XMLSchema#integer> .\n"
+    "_:tg1 <http://www.w3.org/1999/02/22-rdf-syntax-ns#rest> _:tg2 .\n"
+    "_:tg2 <http://www.w3.org/1999/02/22-rdf-syntax-ns#first> \"two\" .\n"
+    "_:tg2 <http://www.w3.org/1999/02/22-rdf-syntax-ns#rest> _:tg3 .\n"
+    "_:tg3 <http://www.w3.org/1999/02/22-rdf-syntax-ns#first> <http://example.org/three> .\n"
+    "_:tg3 <http://www.w3.org/1999/02/22-rdf-syntax-ns#rest> <http://www.w3.org/1999/02/22-rdf-syntax-ns#nil> .\n"
+    "<http://example.org/a> <http://example.org/list> _:tg1 .\n"
+    "<http://example.org/a> <http://example.org/empty> <http://www.w3.org/1999/02/22-rdf-syntax-ns#nil> .\n"
+    "<http://example.org/a> <http://example.org/long> \"line one\\nline \\\"two\\\"\ttab\" .\n"
+    "_:tg4 <http://example.org/p> \"2.5\"^^<http://www.w3.org/2001/XMLSchema#decimal> .\n"
+    "_:tg4 <http://example.org/q> \"true\"^^<http://www.w3.org/2001/XMLSchema#boolean> .\n"
+    "<http://example.org/a> <http://example.org/node> _:tg4 .\n"
+    "_:tbx <http://www.w3.org/1999/02/22-rdf-syntax-ns#type> <http://example.org/Thing> .\n"
+    "_:tbx <http://example.org/esc> \"a\tb\\n\" .\n",
+    0 },
+
+    { "turtle errors", RDF_TURTLE,
+    "ex:a ex:b ex:c .\n"
+    "<a> <b> \"unterminated .\n",
+    "",
+    1 },
+
+    { "rdf/xml", RDF_XML,
+    "<?xml version=\"1.0\"?>\n"
+    "<!DOCTYPE rdf:RDF [ <!ENTITY ex \"http://example.org/\"> ]>\n"
+    "<rdf:RDF xmlns:rdf=\"http://www.w3.org/1999/02/22-rdf-syntax-ns#\" xmlns:ex=\"http://example.org/\" xml:base=\"http://example.org/base/\">\n"
+    "  <rdf:Description rdf:about=\"&ex;a\" ex:title=\"T &amp; U\">\n"
+    "    <ex:res rdf:parseType=\"Resource\"><ex:p>inner</ex:p></ex:res>\n"
+    "    <ex:coll rdf:parseType=\"Collection\"><rdf:Description rdf:about=\"x\"/><rdf:Description rdf:about=\"y\"/></ex:coll>\n"
+    "    <ex:lit rdf:parseType=\"Literal\"><b xmlns=\"http://www.w3.org/1999/xhtml\">bold</b> text</ex:lit>\n"
+    "    <ex:typed rdf:datatype=\"http://www.w3.org/2001/XMLSchema#integer\">7</ex:typed>\n"
+    "    <ex:lang xml:lang=\"fr\">chat</ex:lang>\n"
+    "  </rdf:Description>\n"
+    "  <rdf:Bag rdf:about=\"bag\"><rdf:li>one</rdf:li><rdf:li>two</rdf:li></rdf:Bag>\n"
+    "</rdf:RDF>\n",
+    "<http://example.org/a> <http://example.org/title> \"T & U\" .\n"
+    "_:tg1 <http://example.org/p> \"inner\" .\n"
+    "<http://example.org/a> <http://example.org/res> _:tg1 .\n"
+    "_:tg2 <http://www.w3.org/1999/02/22-rdf-syntax-ns#first> <http://example.org/base/x> .\n"
+    "_:tg2 <http://www.w3.org/1999/02/22-rdf-syntax-ns#rest> _:tg3 .\n"
+    "_:tg3 <http://www.w3.org/1999/02/22-rdf-syntax-ns#first> <http://example.org/base/y> .\n"
+    "_:tg3 <http://www.w3.org/1999/02/22-rdf-syntax-ns#rest> <http://www.w3.org/1999/02/22-rdf-syntax-ns#nil> .\n"
+    "<http://example.org/a> <http://example.org/coll> _:tg2 .\n"
+    "<http://example.org/a> <http://example.org/lit> \"<b xmlns=\\\"http://www.w3.org/1999/xhtml\\\">bold</b> text\"^^<http://www.w3.org/1999/02/22-rdf-syntax-ns#XMLLiteral> .\n"
+    "<http://example.org/a> <http://example.org/typed> \"7\"^^<http://www.w3.org/2001/XMLSchema#integer> .\n"
+    "<http://example.org/a> <http://example.org/lang> \"chat\"@fr .\n"
+    "<http://example.org/base/bag> <http://www.w3.org/1999/02/22-rdf-syntax-ns#type> <http://www.w3.org/1999/02/22-rdf-syntax-ns#Bag> .\n"
+    "<http://example.org/base/bag> <http://www.w3.org/1999/02/22-rdf-syntax-ns#_1> \"one\" .\n"
+    "<http://example.org/base/bag> <http://www.w3.org/1999/02/22-rdf-syntax-ns#_2> \"two\" .\n",
+    0 },
+
+    { "external entity", RDF_XML,
+    "<?xml version=\"1.0\"?>\n"
+    "<!DOCTYPE rdf:RDF [ <!ENTITY xxe SYSTEM \"file:///etc/hostname\"> ]>\n"
+    "<rdf:RDF xmlns:rdf=\"http://www.w3.org/1999/02/22-rdf-syntax-ns#\" xmlns:ex=\"http://example.org/\">\n"
+    "  <rdf:Description rdf:about=\"http://example.org/a\"><ex:p>&xxe;</ex:p></rdf:Description>\n"
+    "</rdf:RDF>\n",
+    "",
+    1 },
+
+    { NULL }
+};
+
+/* parse doc, piece bytes at a time or all at once if piece is 0, and check
+ * what's written */
+static int check(const char *name, enum rdf_syntax syntax, const char *doc, const char *expected,
+                 int errors, size_t piece)
+{
+    char *out = NULL;
+    size_t out_len = 0;
+    FILE *f = open_memstream(&out, &out_len);
+    rdf_parser *p = rdf_parser_new(syntax, BASE, "t", f);
+    size_t len = strlen(doc);
+
+    for (size_t at = 0; at < len; at += piece ? piece : len) {
+        size_t n = piece ? MIN(piece, len - at) : len;
+        rdf_parser_write((char *) doc + at, 1, n, p);
+    }
+    int found = rdf_parser_finish(p);
+    fclose(f);
+
+    int ok = !strcmp(out, expected) && !found == !errors;
+    if (!ok) {
+        fprintf(stderr, "%s in pieces of %zu: %d errors, wrote\n%s", name, piece, found, out);
+    }
+    free(out);
+
+    return ok;
+}
+
+int main()
+{
+    const size_t pieces[] = { 0, 1, 3, 7 };
+    int failed = 0;
+
+    for (const rdf_case *c = cases; c->name; c++) {
+        int ok = 1;
+        for (size_t i=0; i<G_N_ELEMENTS(pieces); i++) {
+            ok &= check(c->name, c->syntax, c->doc, c->expected, c->errors, pieces[i]);
+        }
+        fprintf(stderr, "%s: %s\n", c->name, ok ? "ok" : "FAILED");
+        failed |= !ok;
+    }
+
+    GString *doc = g_string_new("<a> <b> \"\"\"");
+    GString *expected = g_string_new("<http://example.org/base/a> <http://example.org/base/b> \"");
+    for (int i=0; i<LONG_STRING; i++) {
+        g_string_append_c(doc, 'x');
+        g_string_append_c(expected, 'x');
+    }
+    g_string_append(doc, "\"\"\" .\n");
+    g_string_append(expected, "\" .\n");
+    int ok = check("long string", RDF_TURTLE, doc->str, expected->str, 0, 0) &&
+             check("long string", RDF_TURTLE, doc->str, expected->str, 0, 4096);
+    fprintf(stderr, "long string: %s\n", ok ? "ok" : "FAILED");
+    failed |= !ok;
+    g_string_free(doc, TRUE);
+    g_string_free(expected, TRUE);
+
+    return failed;
+}
+
+/* vi:set expandtab sts=4 sw=4: */
@@ -0,0 +1,143 @@
+/*  sparql-query - a SPARQL client with GNU readline support
+    Copyright (C) 2006-8 Nick Lamb and Steve Harris for Garlik
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Rendering saved results
+ *
+ * Results kept with -n are turned into a table, TSV or Arrow just as if
+ * they had come from an endpoint. sr_parse() maps each file and hands its
+ * pages straight to the parser, so the work is mostly reading the disk.
+ * With several files a process is forked for each, up to one per processor
+ * at a time, so they don't share a heap or a stdout. What's written for a
+ * file that turns out to be broken is removed.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <glib.h>
+
+#include "render.h"
+#include "result-parse.h"
+
+/* name.xml.gz becomes name.tsv and so on */
+static char *output_name(const char *input, const char *format)
+{
+    char *name = g_strdup(input);
+    if (g_str_has_suffix(name, ".gz")) {
+        name[strlen(name) - 3] = '\0';
+    }
+    char *dot = strrchr(name, '.');
+    if (dot && !strchr(dot, '/')) {
+        *dot = '\0';
+    }
+    char *out = g_strdup_printf("%s.%s", name, sr_format_extension(format));
+    g_free(name);
+
+    return out;
+}
+
+static pid_t start(const rn_options *opts, const char *input, const char *output)
+{
+    pid_t pid = fork();
+    if (pid) {
+        if (pid < 0) {
+            perror("can't start rendering");
+        }
+        return pid;
+    }
+    if (!freopen(output, "w", stdout)) {
+        perror(output);
+        _exit(1);
+    }
+    int failed = sr_parse(input, opts->format);
+    if (fflush(stdout) || ferror(stdout)) {
+        perror(output);
+        failed = 1;
+    }
+    if (failed) {
+        unlink(output);
+    }
+    _exit(failed);
+}
+
+int render_files(const rn_options *opts)
+{
+    if (opts->count == 1) {
+        return sr_parse(opts->files[0], opts->format) != 0;
+    }
+
+    int jobs = opts->jobs ? opts->jobs : MIN((int) g_get_num_processors(), RN_MAX_JOBS);
+    char **outputs = g_new0(char *, opts->count);
+    GHashTable *running = g_hash_table_new(NULL, NULL);
+    int failed = 0, next = 0;
+
+    /* nothing buffered may be written twice by the children */
+    fflush(stdout);
+    fflush(stderr);
+    while (next < opts->count || g_hash_table_size(running)) {
+        while (next < opts->count && (int) g_hash_table_size(running) < jobs) {
+            int i = next++;
+            outputs[i] = output_name(opts->files[i], opts->format);
+            if (!strcmp(outputs[i], opts->files[i])) {
+                fprintf(stderr, "%s: would be rendered over itself\n", opts->files[i]);
+                failed++;
+                continue;
+            }
+            if (opts->verbose) {
+                fprintf(stderr, "%s -> %s\n", opts->files[i], outputs[i]);
+            }
+            pid_t pid = start(opts, opts->files[i], outputs[i]);
+            if (pid < 0) {
+                failed++;
+                continue;
+            }
+            g_hash_table_insert(running, GINT_TO_POINTER(pid), GINT_TO_POINTER(i));
+        }
+        if (!g_hash_table_size(running)) {
+            continue;
+        }
+
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0) {
+            perror("waiting for rendering");
+            break;
+        }
+        gpointer i;
+        if (!g_hash_table_lookup_extended(running, GINT_TO_POINTER(pid), NULL, &i)) {
+            continue;
+        }
+        g_hash_table_remove(running, GINT_TO_POINTER(pid));
+        if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+            fprintf(stderr, "%s: failed to render\n", opts->files[GPOINTER_TO_INT(i)]);
+            failed++;
+        }
+    }
+
+    for (int i=0; i<opts->count; i++) {
+        g_free(outputs[i]);
+    }
+    g_free(outputs);
+    g_hash_table_destroy(running);
+
+    return failed;
+}
+
+/* vi:set expandtab sts=4 sw=4: */
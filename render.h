@@ -0,0 +1,19 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#define RN_MAX_JOBS 64
+
+typedef struct {
+    const char *format;  /* MIME type to render as, as for sr_parse() */
+    char **files;        /* of SPARQL XML results, maybe gzipped */
+    int count;
+    int jobs;            /* files rendered at once, 0 for one per processor */
+    int verbose;
+} rn_options;
+
+/* render saved results files. A single file goes to standard out, several
+ * are each written beside themselves with the extension of the format in
+ * place of their own. Returns the number of files that couldn't be done */
+int render_files(const rn_options *opts);
+
+#endif
@@ -0,0 +1,731 @@
+/*  sparql-query - a SPARQL client with GNU readline support
+    Copyright (C) 2006-8 Nick Lamb and Steve Harris for Garlik
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Apache Arrow IPC stream output for SELECT results
+ *
+ * Each variable becomes a nullable column. The first pass over the results
+ * picks a type for each column: IRI-only columns are dictionary encoded,
+ * columns whose literals all share a numeric or boolean XSD type become
+ * int64, float64 or bool, and anything else is utf8, using the same <iri>
+ * and _:label forms as TSV where kinds of term are mixed. Record batches are
+ * written as they fill, each preceded by a delta for any new dictionary
+ * entries.
+ *
+ * The flatbuffer metadata is written front to back by the fb_ functions
+ * below, which know just enough of the format for Arrow's Message tables.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <glib.h>
+
+#include "result-arrow.h"
+
+/* rows per record batch, unless they fill BATCH_BYTES first */
+#define BATCH_ROWS 65536
+#define BATCH_BYTES (16 * 1024 * 1024)
+
+/* dictionary entries kept before starting a fresh dictionary */
+#define DICT_MAX 1000000
+
+#define XSD "http://www.w3.org/2001/XMLSchema#"
+
+/* what the first pass saw in a column */
+#define SEEN_URI     (1 << 0)
+#define SEEN_BNODE   (1 << 1)
+#define SEEN_STRING  (1 << 2)
+#define SEEN_INTEGER (1 << 3)
+#define SEEN_DOUBLE  (1 << 4)
+#define SEEN_BOOLEAN (1 << 5)
+
+enum col_type {
+    COL_UTF8,
+    COL_DICT,
+    COL_INT64,
+    COL_FLOAT64,
+    COL_BOOL,
+};
+
+/* Arrow Schema.fbs and Message.fbs constants */
+enum {
+    ARROW_METADATA_V5 = 4,
+
+    ARROW_HEADER_SCHEMA = 1,
+    ARROW_HEADER_DICTIONARY_BATCH = 2,
+    ARROW_HEADER_RECORD_BATCH = 3,
+
+    ARROW_TYPE_INT = 2,
+    ARROW_TYPE_FLOATING_POINT = 3,
+    ARROW_TYPE_UTF8 = 5,
+    ARROW_TYPE_BOOL = 6,
+
+    ARROW_PRECISION_DOUBLE = 2,
+};
+
+struct column {
+    enum col_type type;
+    unsigned seen;
+    char *name;
+    GByteArray *validity;
+    GByteArray *values; /* offsets for utf8, indices for dictionaries */
+    GByteArray *data;
+    gint64 nulls;
+    /* dictionary columns only */
+    GHashTable *dict;
+    GPtrArray *dict_new;
+    int dict_written; /* entries already in the stream */
+};
+
+struct _sr_arrow {
+    FILE *out;
+    int cols;
+    struct column *col;
+    gint64 rows; /* in the current batch */
+};
+
+/* flatbuffer encoding */
+
+#define FB_OFFSET 0
+
+struct fb_field {
+    int id;
+    int size; /* 1, 2, 4 or 8 byte scalar, or FB_OFFSET to fill in later */
+    gint64 value;
+};
+
+static void fb_put(GByteArray *b, size_t pos, guint64 value, int size)
+{
+    for (int i=0; i<size; i++) {
+        b->data[pos + i] = (value >> (8 * i)) & 0xff;
+    }
+}
+
+static size_t fb_append(GByteArray *b, guint64 value, int size)
+{
+    static const guint8 zero[8];
+    size_t pos = b->len;
+    g_byte_array_append(b, zero, size);
+    fb_put(b, pos, value, size);
+
+    return pos;
+}
+
+static void fb_pad(GByteArray *b, size_t align, size_t extra)
+{
+    while ((b->len + extra) % align) {
+        fb_append(b, 0, 1);
+    }
+}
+
+/* point the offset at slot to pos, which must come after it */
+static void fb_link(GByteArray *b, size_t slot, size_t pos)
+{
+    fb_put(b, slot, pos - slot, 4);
+}
+
+/* write a vtable and table holding fields, returning the table's position.
+ * The positions of FB_OFFSET fields are stored in slots, in field order */
+static size_t fb_table(GByteArray *b, const struct fb_field *fields, int n, size_t *slots)
+{
+    int offsets[16];
+    int nslots = 0;
+    size_t size = 4; /* the vtable offset */
+    for (int i=0; i<n; i++) {
+        int width = fields[i].size == FB_OFFSET ? 4 : fields[i].size;
+        size = (size + width - 1) / width * width;
+        offsets[i] = size;
+        size += width;
+        nslots = MAX(nslots, fields[i].id + 1);
+    }
+
+    /* vtable directly before an 8-aligned table */
+    int vtable_size = 4 + 2 * nslots;
+    fb_pad(b, 2, 0);
+    fb_pad(b, 8, vtable_size);
+    size_t vtable = fb_append(b, vtable_size, 2);
+    fb_append(b, size, 2);
+    for (int id=0; id<nslots; id++) {
+        int offset = 0;
+        for (int i=0; i<n; i++) {
+            if (fields[i].id == id) {
+                offset = offsets[i];
+            }
+        }
+        fb_append(b, offset, 2);
+    }
+
+    size_t table = b->len;
+    g_byte_array_set_size(b, table + size);
+    memset(b->data + table, 0, size);
+    fb_put(b, table, table - vtable, 4);
+    for (int i=0; i<n; i++) {
+        if (fields[i].size == FB_OFFSET) {
+            *(slots++) = table + offsets[i];
+        } else {
+            fb_put(b, table + offsets[i], fields[i].value, fields[i].size);
+        }
+    }
+
+    return table;
+}
+
+static size_t fb_string(GByteArray *b, const char *str)
+{
+    size_t len = strlen(str);
+    fb_pad(b, 4, 0);
+    size_t pos = fb_append(b, len, 4);
+    g_byte_array_append(b, (const guint8 *) str, len + 1);
+
+    return pos;
+}
+
+/* a vector of count slots to be linked to tables later */
+static size_t fb_offset_vector(GByteArray *b, int count, size_t *slots)
+{
+    fb_pad(b, 4, 0);
+    size_t pos = fb_append(b, count, 4);
+    for (int i=0; i<count; i++) {
+        slots[i] = fb_append(b, 0, 4);
+    }
+
+    return pos;
+}
+
+/* a vector of count pairs of longs, ie. FieldNode or Buffer structs */
+static size_t fb_long_pairs(GByteArray *b, const gint64 *pairs, int count)
+{
+    fb_pad(b, 8, 4);
+    size_t pos = fb_append(b, count, 4);
+    for (int i=0; i<count * 2; i++) {
+        fb_append(b, pairs[i], 8);
+    }
+
+    return pos;
+}
+
+/* start a Message, leaving a slot for its header table */
+static GByteArray *fb_message(int header_type, gint64 body_length, size_t *header_slot)
+{
+    GByteArray *b = g_byte_array_new();
+    size_t root = fb_append(b, 0, 4);
+    struct fb_field message[] = {
+        { 0, 2, ARROW_METADATA_V5 },
+        { 1, 1, header_type },
+        { 2, FB_OFFSET, 0 },
+        { 3, 8, body_length },
+    };
+    fb_link(b, root, fb_table(b, message, G_N_ELEMENTS(message), header_slot));
+
+    return b;
+}
+
+/* IPC stream framing */
+
+static void write_message(sr_arrow *arrow, GByteArray *meta, GByteArray *body)
+{
+    fb_pad(meta, 8, 0);
+    guint8 prefix[8];
+    memset(prefix, 0xff, 4);
+    for (int i=0; i<4; i++) {
+        prefix[4 + i] = (meta->len >> (8 * i)) & 0xff;
+    }
+    fwrite(prefix, sizeof(prefix), 1, arrow->out);
+    fwrite(meta->data, meta->len, 1, arrow->out);
+    if (body) {
+        fwrite(body->data, body->len, 1, arrow->out);
+    }
+    g_byte_array_free(meta, TRUE);
+}
+
+/* a record batch body under construction */
+struct batch {
+    GByteArray *body;
+    GArray *nodes;
+    GArray *buffers;
+};
+
+static void batch_buffer(struct batch *batch, const guint8 *data, gsize len)
+{
+    gint64 buffer[2] = { batch->body->len, len };
+    g_array_append_vals(batch->buffers, buffer, 2);
+    if (len) {
+        g_byte_array_append(batch->body, data, len);
+        fb_pad(batch->body, 8, 0);
+    }
+}
+
+static void batch_node(struct batch *batch, gint64 length, gint64 nulls)
+{
+    gint64 node[2] = { length, nulls };
+    g_array_append_vals(batch->nodes, node, 2);
+}
+
+static void batch_init(struct batch *batch)
+{
+    batch->body = g_byte_array_new();
+    batch->nodes = g_array_new(FALSE, FALSE, sizeof(gint64));
+    batch->buffers = g_array_new(FALSE, FALSE, sizeof(gint64));
+}
+
+/* write the RecordBatch table for batch, returning its position */
+static size_t batch_table(GByteArray *b, struct batch *batch, gint64 length)
+{
+    size_t slots[2];
+    struct fb_field record_batch[] = {
+        { 0, 8, length },
+        { 1, FB_OFFSET, 0 },
+        { 2, FB_OFFSET, 0 },
+    };
+    size_t pos = fb_table(b, record_batch, G_N_ELEMENTS(record_batch), slots);
+    fb_link(b, slots[0], fb_long_pairs(b, (gint64 *) batch->nodes->data, batch->nodes->len / 2));
+    fb_link(b, slots[1], fb_long_pairs(b, (gint64 *) batch->buffers->data, batch->buffers->len / 2));
+
+    return pos;
+}
+
+static void batch_free(struct batch *batch)
+{
+    g_byte_array_free(batch->body, TRUE);
+    g_array_free(batch->nodes, TRUE);
+    g_array_free(batch->buffers, TRUE);
+}
+
+/* column builders */
+
+static void column_reset(struct column *col)
+{
+    g_byte_array_set_size(col->validity, 0);
+    g_byte_array_set_size(col->values, 0);
+    g_byte_array_set_size(col->data, 0);
+    col->nulls = 0;
+    if (col->type == COL_UTF8) {
+        fb_append(col->values, 0, 4);
+    }
+}
+
+static void set_bit(GByteArray *bits, gint64 index, int value)
+{
+    if (index % 8 == 0) {
+        fb_append(bits, 0, 1);
+    }
+    if (value) {
+        bits->data[index / 8] |= 1 << (index % 8);
+    }
+}
+
+static int is_integer_type(const char *datatype)
+{
+    static const char *types[] = {
+        "integer", "long", "int", "short", "byte",
+        "nonNegativeInteger", "nonPositiveInteger", "negativeInteger", "positiveInteger",
+        "unsignedInt", "unsignedShort", "unsignedByte",
+        NULL
+    };
+    for (int i=0; types[i]; i++) {
+        if (!strcmp(datatype + strlen(XSD), types[i])) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* work out what a term is, and its numeric value where it has one */
+static unsigned classify(const sr_term *term, gint64 *integer, double *real)
+{
+    switch (term->kind) {
+        case SR_URI:
+            return SEEN_URI;
+        case SR_BNODE:
+            return SEEN_BNODE;
+        case SR_UNBOUND:
+            return 0;
+        case SR_LITERAL:
+            break;
+    }
+
+    const char *dt = term->datatype;
+    if (!dt || strncmp(dt, XSD, strlen(XSD))) {
+        return SEEN_STRING;
+    }
+
+    char *end = NULL;
+    const char *value = term->value;
+    if (is_integer_type(dt)) {
+        errno = 0;
+        *integer = g_ascii_strtoll(value, &end, 10);
+        if (end != value && !*end && !errno) {
+            return SEEN_INTEGER;
+        }
+    } else if (!strcmp(dt, XSD "double") || !strcmp(dt, XSD "float")) {
+        *real = g_ascii_strtod(value, &end);
+        if (end != value && !*end) {
+            return SEEN_DOUBLE;
+        }
+    } else if (!strcmp(dt, XSD "boolean")) {
+        if (!strcmp(value, "true") || !strcmp(value, "1")) {
+            *integer = 1;
+            return SEEN_BOOLEAN;
+        } else if (!strcmp(value, "false") || !strcmp(value, "0")) {
+            *integer = 0;
+            return SEEN_BOOLEAN;
+        }
+    }
+
+    return SEEN_STRING;
+}
+
+static void append_string(struct column *col, const char *prefix, const char *value, const char *suffix)
+{
+    g_byte_array_append(col->data, (const guint8 *) prefix, strlen(prefix));
+    g_byte_array_append(col->data, (const guint8 *) value, strlen(value));
+    g_byte_array_append(col->data, (const guint8 *) suffix, strlen(suffix));
+    fb_append(col->values, col->data->len, 4);
+}
+
+static void append_dict(struct column *col, const char *value)
+{
+    gpointer index;
+    if (!g_hash_table_lookup_extended(col->dict, value, NULL, &index)) {
+        char *key = g_strdup(value);
+        index = GINT_TO_POINTER(g_hash_table_size(col->dict));
+        g_hash_table_insert(col->dict, key, index);
+        g_ptr_array_add(col->dict_new, key);
+    }
+    fb_append(col->values, GPOINTER_TO_INT(index), 4);
+}
+
+static void append_term(struct column *col, gint64 row, const sr_term *term)
+{
+    gint64 integer = 0;
+    double real = 0.0;
+    unsigned kind = classify(term, &integer, &real);
+    int valid = kind != 0;
+
+    switch (col->type) {
+        case COL_UTF8:
+            if (!valid) {
+                fb_append(col->values, col->data->len, 4);
+            } else if (col->seen == kind) {
+                append_string(col, "", term->value, "");
+            } else {
+                const char *prefix = kind == SEEN_URI ? "<" : kind == SEEN_BNODE ? "_:" : "";
+                append_string(col, prefix, term->value, kind == SEEN_URI ? ">" : "");
+            }
+            break;
+        case COL_DICT:
+            if (valid) {
+                append_dict(col, term->value);
+            } else {
+                fb_append(col->values, 0, 4);
+            }
+            break;
+        case COL_INT64:
+            fb_append(col->values, valid ? integer : 0, 8);
+            break;
+        case COL_FLOAT64: {
+            union { double d; guint64 u; } bits;
+            bits.d = kind == SEEN_INTEGER ? (double) integer : real;
+            fb_append(col->values, valid ? bits.u : 0, 8);
+            break;
+        }
+        case COL_BOOL:
+            set_bit(col->values, row, valid && integer);
+            break;
+    }
+
+    set_bit(col->validity, row, valid);
+    if (!valid) {
+        col->nulls++;
+    }
+}
+
+/* messages */
+
+static int type_tag(struct column *col)
+{
+    switch (col->type) {
+        case COL_INT64:
+            return ARROW_TYPE_INT;
+        case COL_FLOAT64:
+            return ARROW_TYPE_FLOATING_POINT;
+        case COL_BOOL:
+            return ARROW_TYPE_BOOL;
+        default:
+            /* dictionaries are described by their value type */
+            return ARROW_TYPE_UTF8;
+    }
+}
+
+static size_t type_table(GByteArray *b, struct column *col)
+{
+    switch (col->type) {
+        case COL_INT64: {
+            struct fb_field type[] = { { 0, 4, 64 }, { 1, 1, 1 } };
+            return fb_table(b, type, G_N_ELEMENTS(type), NULL);
+        }
+        case COL_FLOAT64: {
+            struct fb_field type[] = { { 0, 2, ARROW_PRECISION_DOUBLE } };
+            return fb_table(b, type, G_N_ELEMENTS(type), NULL);
+        }
+        default:
+            /* Utf8 and Bool have no fields */
+            return fb_table(b, NULL, 0, NULL);
+    }
+}
+
+static void write_schema(sr_arrow *arrow)
+{
+    size_t slot;
+    GByteArray *b = fb_message(ARROW_HEADER_SCHEMA, 0, &slot);
+    struct fb_field schema[] = { { 1, FB_OFFSET, 0 } };
+    size_t fields_slot;
+    fb_link(b, slot, fb_table(b, schema, G_N_ELEMENTS(schema), &fields_slot));
+
+    size_t field_slots[arrow->cols + 1];
+    fb_link(b, fields_slot, fb_offset_vector(b, arrow->cols, field_slots));
+    for (int i=0; i<arrow->cols; i++) {
+        struct column *col = &arrow->col[i];
+        size_t slots[4];
+        struct fb_field field[] = {
+            { 0, FB_OFFSET, 0 },
+            { 1, 1, 1 },
+            { 2, 1, type_tag(col) },
+            { 3, FB_OFFSET, 0 },
+            { 5, FB_OFFSET, 0 },
+            { 4, FB_OFFSET, 0 },
+        };
+        /* only dictionary columns have the last field */
+        fb_link(b, field_slots[i], fb_table(b, field, col->type == COL_DICT ? 6 : 5, slots));
+        fb_link(b, slots[0], fb_string(b, col->name));
+        fb_link(b, slots[1], type_table(b, col));
+        size_t children[1];
+        fb_link(b, slots[2], fb_offset_vector(b, 0, children));
+        if (col->type == COL_DICT) {
+            size_t index_slot;
+            struct fb_field encoding[] = {
+                { 0, 8, i },
+                { 1, FB_OFFSET, 0 },
+            };
+            fb_link(b, slots[3], fb_table(b, encoding, G_N_ELEMENTS(encoding), &index_slot));
+            struct fb_field index_type[] = { { 0, 4, 32 }, { 1, 1, 1 } };
+            fb_link(b, index_slot, fb_table(b, index_type, G_N_ELEMENTS(index_type), NULL));
+        }
+    }
+
+    write_message(arrow, b, NULL);
+}
+
+/* write any dictionary entries added since the last batch */
+static void write_dictionary(sr_arrow *arrow, int id)
+{
+    struct column *col = &arrow->col[id];
+    if (col->dict_new->len == 0 && col->dict_written) {
+        return;
+    }
+
+    GByteArray *offsets = g_byte_array_new();
+    GByteArray *data = g_byte_array_new();
+    fb_append(offsets, 0, 4);
+    for (guint i=0; i<col->dict_new->len; i++) {
+        const char *value = g_ptr_array_index(col->dict_new, i);
+        g_byte_array_append(data, (const guint8 *) value, strlen(value));
+        fb_append(offsets, data->len, 4);
+    }
+
+    struct batch batch;
+    batch_init(&batch);
+    batch_node(&batch, col->dict_new->len, 0);
+    batch_buffer(&batch, NULL, 0);
+    batch_buffer(&batch, offsets->data, offsets->len);
+    batch_buffer(&batch, data->data, data->len);
+
+    size_t slot, data_slot;
+    GByteArray *b = fb_message(ARROW_HEADER_DICTIONARY_BATCH, batch.body->len, &slot);
+    struct fb_field dictionary_batch[] = {
+        { 0, 8, id },
+        { 1, FB_OFFSET, 0 },
+        { 2, 1, col->dict_written > 0 },
+    };
+    fb_link(b, slot, fb_table(b, dictionary_batch, G_N_ELEMENTS(dictionary_batch), &data_slot));
+    fb_link(b, data_slot, batch_table(b, &batch, col->dict_new->len));
+    write_message(arrow, b, batch.body);
+
+    col->dict_written += col->dict_new->len;
+    /* the keys belong to the hash table */
+    g_ptr_array_set_size(col->dict_new, 0);
+    batch_free(&batch);
+    g_byte_array_free(offsets, TRUE);
+    g_byte_array_free(data, TRUE);
+}
+
+static void write_batch(sr_arrow *arrow)
+{
+    if (arrow->rows == 0) {
+        return;
+    }
+
+    struct batch batch;
+    batch_init(&batch);
+    for (int i=0; i<arrow->cols; i++) {
+        struct column *col = &arrow->col[i];
+        if (col->type == COL_DICT) {
+            write_dictionary(arrow, i);
+        }
+        batch_node(&batch, arrow->rows, col->nulls);
+        if (col->nulls) {
+            batch_buffer(&batch, col->validity->data, col->validity->len);
+        } else {
+            batch_buffer(&batch, NULL, 0);
+        }
+        batch_buffer(&batch, col->values->data, col->values->len);
+        if (col->type == COL_UTF8) {
+            batch_buffer(&batch, col->data->data, col->data->len);
+        }
+    }
+
+    size_t slot;
+    GByteArray *b = fb_message(ARROW_HEADER_RECORD_BATCH, batch.body->len, &slot);
+    fb_link(b, slot, batch_table(b, &batch, arrow->rows));
+    write_message(arrow, b, batch.body);
+    batch_free(&batch);
+
+    for (int i=0; i<arrow->cols; i++) {
+        struct column *col = &arrow->col[i];
+        column_reset(col);
+        if (col->dict && g_hash_table_size(col->dict) >= DICT_MAX) {
+            /* start over, the next dictionary batch replaces this one */
+            g_hash_table_remove_all(col->dict);
+            col->dict_written = 0;
+        }
+    }
+    arrow->rows = 0;
+}
+
+/* public interface */
+
+sr_arrow *sr_arrow_new(FILE *out, int cols, char **names)
+{
+    sr_arrow *arrow = g_new0(sr_arrow, 1);
+    arrow->out = out;
+    arrow->cols = cols;
+    arrow->col = g_new0(struct column, MAX(cols, 1));
+    for (int i=0; i<cols; i++) {
+        arrow->col[i].name = g_strdup(names[i]);
+        arrow->col[i].validity = g_byte_array_new();
+        arrow->col[i].values = g_byte_array_new();
+        arrow->col[i].data = g_byte_array_new();
+    }
+
+    return arrow;
+}
+
+void sr_arrow_scan(sr_arrow *arrow, const sr_term *row)
+{
+    for (int i=0; i<arrow->cols; i++) {
+        gint64 integer;
+        double real;
+        arrow->col[i].seen |= classify(&row[i], &integer, &real);
+    }
+}
+
+void sr_arrow_schema(sr_arrow *arrow)
+{
+    if (arrow->cols == 0) {
+        /* ASK, see sr_arrow_boolean() */
+        return;
+    }
+    for (int i=0; i<arrow->cols; i++) {
+        struct column *col = &arrow->col[i];
+        if (col->seen == SEEN_URI) {
+            col->type = COL_DICT;
+            col->dict = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+            col->dict_new = g_ptr_array_new();
+        } else if (col->seen == SEEN_INTEGER) {
+            col->type = COL_INT64;
+        } else if (col->seen == SEEN_DOUBLE || col->seen == (SEEN_INTEGER | SEEN_DOUBLE)) {
+            col->type = COL_FLOAT64;
+        } else if (col->seen == SEEN_BOOLEAN) {
+            col->type = COL_BOOL;
+        } else {
+            col->type = COL_UTF8;
+        }
+        column_reset(col);
+    }
+    write_schema(arrow);
+    fflush(arrow->out);
+}
+
+void sr_arrow_row(sr_arrow *arrow, const sr_term *row)
+{
+    gsize bytes = 0;
+    for (int i=0; i<arrow->cols; i++) {
+        append_term(&arrow->col[i], arrow->rows, &row[i]);
+        bytes += arrow->col[i].values->len + arrow->col[i].data->len;
+    }
+    arrow->rows++;
+    if (arrow->rows >= BATCH_ROWS || bytes >= BATCH_BYTES) {
+        write_batch(arrow);
+    }
+}
+
+void sr_arrow_boolean(sr_arrow *arrow, int value)
+{
+    g_free(arrow->col);
+    arrow->cols = 1;
+    arrow->col = g_new0(struct column, 1);
+    arrow->col[0].name = g_strdup("boolean");
+    arrow->col[0].type = COL_BOOL;
+    arrow->col[0].validity = g_byte_array_new();
+    arrow->col[0].values = g_byte_array_new();
+    arrow->col[0].data = g_byte_array_new();
+    write_schema(arrow);
+
+    sr_term term = { SR_LITERAL, value ? "true" : "false", XSD "boolean" };
+    sr_arrow_row(arrow, &term);
+    sr_arrow_finish(arrow);
+}
+
+void sr_arrow_finish(sr_arrow *arrow)
+{
+    write_batch(arrow);
+    /* end of stream */
+    static const guint8 eos[8] = { 0xff, 0xff, 0xff, 0xff, 0, 0, 0, 0 };
+    fwrite(eos, sizeof(eos), 1, arrow->out);
+    fflush(arrow->out);
+}
+
+void sr_arrow_free(sr_arrow *arrow)
+{
+    for (int i=0; i<arrow->cols; i++) {
+        struct column *col = &arrow->col[i];
+        g_free(col->name);
+        g_byte_array_free(col->validity, TRUE);
+        g_byte_array_free(col->values, TRUE);
+        g_byte_array_free(col->data, TRUE);
+        if (col->dict) {
+            g_hash_table_unref(col->dict);
+            g_ptr_array_free(col->dict_new, TRUE);
+        }
+    }
+    g_free(arrow->col);
+    g_free(arrow);
+}
+
+/* vi:set expandtab sts=4 sw=4: */
@@ -0,0 +1,32 @@
+#ifndef RESULT_ARROW_H
+#define RESULT_ARROW_H
+
+#include <stdio.h>
+
+#include "result-parse.h"
+
+#define SR_ARROW_STREAM "application/vnd.apache.arrow.stream"
+
+typedef struct _sr_arrow sr_arrow;
+
+/* writes SPARQL results as an Arrow IPC stream, one column per variable */
+sr_arrow *sr_arrow_new(FILE *out, int cols, char **names);
+
+/* look at a row during the first pass, to choose column types */
+void sr_arrow_scan(sr_arrow *arrow, const sr_term *row);
+
+/* write the schema, no more calls to sr_arrow_scan() after this */
+void sr_arrow_schema(sr_arrow *arrow);
+
+/* add a row, record batches are written as they fill up */
+void sr_arrow_row(sr_arrow *arrow, const sr_term *row);
+
+/* write an ASK result as a stream with a single boolean */
+void sr_arrow_boolean(sr_arrow *arrow, int value);
+
+/* write any remaining rows and the end of stream marker */
+void sr_arrow_finish(sr_arrow *arrow);
+
+void sr_arrow_free(sr_arrow *arrow);
+
+#endif
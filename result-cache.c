@@ -0,0 +1,283 @@
+/*  sparql-query - a SPARQL client with GNU readline support
+    Copyright (C) 2006-8 Nick Lamb and Steve Harris for Garlik
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* The results of an interactive session, kept to be shown again
+ *
+ * Each is gzipped into memory as it's added, which is quick at level 1 and
+ * shrinks SPARQL XML several times over. Once they take more than the
+ * memory allowed, the oldest are moved to temporary files, unlinked at
+ * once so they go when we do. Either way sr_parse_buffer() takes them as
+ * they are, inflating them as it goes.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <glib.h>
+#include <zlib.h>
+
+#include "result-cache.h"
+#include "result-parse.h"
+
+#define COMPRESS_CHUNK (64 * 1024)
+
+/* characters of a query shown by rc_cache_list() */
+#define QUERY_SHOWN 50
+
+typedef struct {
+    int number;
+    char *query;
+    long rows;
+    size_t size;      /* of the XML */
+    GByteArray *data; /* gzipped, or NULL if it's in fd */
+    int fd;
+    size_t stored;    /* bytes gzipped */
+} kept;
+
+struct _rc_cache {
+    int results;
+    size_t memory;
+    size_t held;      /* bytes of data in memory */
+    int numbered;     /* the last number given */
+    GQueue *kept;     /* oldest first */
+};
+
+rc_cache *rc_cache_new(int results, size_t memory)
+{
+    rc_cache *cache = g_new0(rc_cache, 1);
+    cache->results = results;
+    cache->memory = memory;
+    cache->kept = g_queue_new();
+
+    return cache;
+}
+
+static void kept_free(kept *k)
+{
+    if (k->data) {
+        g_byte_array_free(k->data, TRUE);
+    } else {
+        close(k->fd);
+    }
+    g_free(k->query);
+    g_free(k);
+}
+
+/* filename gzipped, or NULL if it can't be read */
+static GByteArray *compress_file(const char *filename, size_t *size)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "can't keep results: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    GByteArray *data = g_byte_array_new();
+    char in[COMPRESS_CHUNK];
+    z_stream z = { .next_in = NULL };
+    /* 16 more window bits for a gzip rather than zlib wrapper */
+    deflateInit2(&z, 1, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+    *size = 0;
+    int flush = Z_NO_FLUSH;
+    while (flush != Z_FINISH) {
+        ssize_t len = read(fd, in, sizeof(in));
+        if (len < 0) {
+            fprintf(stderr, "can't keep results: %s\n", strerror(errno));
+            g_byte_array_free(data, TRUE);
+            data = NULL;
+            break;
+        }
+        *size += len;
+        flush = len ? Z_NO_FLUSH : Z_FINISH;
+        z.next_in = (Bytef *) in;
+        z.avail_in = len;
+        do {
+            guint used = data->len;
+            g_byte_array_set_size(data, used + COMPRESS_CHUNK);
+            z.next_out = data->data + used;
+            z.avail_out = COMPRESS_CHUNK;
+            deflate(&z, flush);
+            g_byte_array_set_size(data, data->len - z.avail_out);
+        } while (z.avail_out == 0);
+    }
+    deflateEnd(&z);
+    close(fd);
+
+    return data;
+}
+
+/* move k's data to a temporary file, returning 0 if it couldn't be */
+static int spill(rc_cache *cache, kept *k)
+{
+    GError *error = NULL;
+    char *name = NULL;
+    int fd = g_file_open_tmp("sparql-query-XXXXXX", &name, &error);
+    if (fd < 0) {
+        fprintf(stderr, "can't keep results in a temporary file: %s\n", error->message);
+        g_error_free(error);
+        return 0;
+    }
+    unlink(name);
+    g_free(name);
+
+    for (size_t done = 0; done < k->data->len; ) {
+        ssize_t len = write(fd, k->data->data + done, k->data->len - done);
+        if (len < 0) {
+            fprintf(stderr, "can't keep results in a temporary file: %s\n", strerror(errno));
+            close(fd);
+            return 0;
+        }
+        done += len;
+    }
+    cache->held -= k->data->len;
+    k->stored = k->data->len;
+    g_byte_array_free(k->data, TRUE);
+    k->data = NULL;
+    k->fd = fd;
+
+    return 1;
+}
+
+int rc_cache_add(rc_cache *cache, const char *query, const char *filename, long rows)
+{
+    kept *k = g_new0(kept, 1);
+    if (!(k->data = compress_file(filename, &k->size))) {
+        g_free(k);
+        return -1;
+    }
+    k->number = ++cache->numbered;
+    k->query = g_strdup(query);
+    k->rows = rows;
+    k->stored = k->data->len;
+    cache->held += k->data->len;
+    g_queue_push_tail(cache->kept, k);
+
+    while ((int) g_queue_get_length(cache->kept) > cache->results) {
+        kept *old = g_queue_pop_head(cache->kept);
+        if (old->data) {
+            cache->held -= old->data->len;
+        }
+        kept_free(old);
+    }
+    /* oldest out of memory first, which may be all of them */
+    for (GList *l = cache->kept->head; l && cache->held > cache->memory; l = l->next) {
+        kept *old = l->data;
+        if (old->data && !spill(cache, old)) {
+            /* forget it rather than go over */
+            cache->held -= old->data->len;
+            int gone = old == k;
+            g_queue_delete_link(cache->kept, l);
+            kept_free(old);
+            return gone ? -1 : k->number;
+        }
+    }
+
+    return k->number;
+}
+
+static void write_size(FILE *out, size_t size)
+{
+    if (size < 1024) {
+        fprintf(out, "%4zuB", size);
+    } else if (size < 1024 * 1024) {
+        fprintf(out, "%4.0fK", size / 1024.0);
+    } else {
+        fprintf(out, "%4.0fM", size / (1024.0 * 1024.0));
+    }
+}
+
+void rc_cache_list(rc_cache *cache, FILE *out)
+{
+    if (g_queue_is_empty(cache->kept)) {
+        fprintf(out, "no results kept\n");
+        return;
+    }
+    for (GList *l = cache->kept->head; l; l = l->next) {
+        kept *k = l->data;
+        char *query = g_strdelimit(g_strndup(k->query, QUERY_SHOWN), "\t\n\r", ' ');
+        fprintf(out, "%4d %9ld rows ", k->number, k->rows);
+        write_size(out, k->size);
+        fprintf(out, " in ");
+        write_size(out, k->stored);
+        fprintf(out, " %-6s %s%s\n", k->data ? "memory" : "file", query,
+                strlen(k->query) > QUERY_SHOWN ? "..." : "");
+        g_free(query);
+    }
+}
+
+/* the XML itself, inflated */
+static void write_xml(const guint8 *data, size_t len)
+{
+    char out[COMPRESS_CHUNK];
+    z_stream z = { .next_in = (Bytef *) data, .avail_in = len };
+    int ret = inflateInit2(&z, 16 + MAX_WBITS);
+
+    while (ret == Z_OK) {
+        z.next_out = (Bytef *) out;
+        z.avail_out = sizeof(out);
+        ret = inflate(&z, Z_NO_FLUSH);
+        fwrite(out, 1, sizeof(out) - z.avail_out, stdout);
+    }
+    if (ret != Z_STREAM_END) {
+        fprintf(stderr, "can't decompress results: %s\n", z.msg ? z.msg : zError(ret));
+    }
+    inflateEnd(&z);
+}
+
+int rc_cache_render(rc_cache *cache, int n, const char *format)
+{
+    kept *k = NULL;
+    for (GList *l = cache->kept->tail; l && !k; l = l->prev) {
+        if (!n || ((kept *) l->data)->number == n) {
+            k = l->data;
+        }
+    }
+    if (!k) {
+        return 1;
+    }
+
+    const guint8 *data = k->data ? k->data->data : NULL;
+    if (!data) {
+        data = mmap(NULL, k->stored, PROT_READ, MAP_PRIVATE, k->fd, 0);
+        if (data == MAP_FAILED) {
+            fprintf(stderr, "can't map kept results: %s\n", strerror(errno));
+            return 1;
+        }
+    }
+    if (format) {
+        sr_parse_buffer((const char *) data, k->stored, format);
+    } else {
+        write_xml(data, k->stored);
+    }
+    if (!k->data) {
+        munmap((void *) data, k->stored);
+    }
+
+    return 0;
+}
+
+void rc_cache_free(rc_cache *cache)
+{
+    g_queue_free_full(cache->kept, (GDestroyNotify) kept_free);
+    g_free(cache);
+}
+
+/* vi:set expandtab sts=4 sw=4: */
@@ -0,0 +1,31 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/* defaults for rc_cache_new() */
+#define RC_DEFAULT_RESULTS 10
+#define RC_DEFAULT_MEMORY (64 * 1024 * 1024)
+
+typedef struct _rc_cache rc_cache;
+
+/* keeps the last results results of a session compressed, up to memory
+ * bytes of them in memory and the rest in temporary files */
+rc_cache *rc_cache_new(int results, size_t memory);
+
+/* keep the SPARQL XML results in filename, the answer to query. Returns
+ * the number they're kept as, or -1 if they couldn't be kept */
+int rc_cache_add(rc_cache *cache, const char *query, const char *filename, long rows);
+
+/* write a line about each of the results kept */
+void rc_cache_list(rc_cache *cache, FILE *out);
+
+/* render results number n, or the latest if n is 0, to standard out as
+ * sr_parse() would, or as the SPARQL XML itself if format is NULL. Returns
+ * non-zero if there are no such results */
+int rc_cache_render(rc_cache *cache, int n, const char *format);
+
+void rc_cache_free(rc_cache *cache);
+
+#endif
@@ -16,42 +16,71 @@
     Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
 #include <locale.h>
 #include <langinfo.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <glib.h>
-#include <libxml/parser.h>
+#include <zlib.h>
 
-/* number of columns names to record widths for in 1st pass */
-#define TMP_COLS 32
+#include "sparqlquery.h"
+#include "result-parse.h"
+#include "result-arrow.h"
+#include "result-profile.h"
+#include "result-sort.h"
+#include "result-split.h"
+#include "spsc.h"
+#include "term-dict.h"
 
-int sr_utf8_column_width(const char *str);
+/* appended to any value cut short by the limits below */
+#define TRUNCATED_MARKER "[...]"
 
-static const char *nullstr = "";
+/* width of the box drawn around an ASK result, enough for "false" */
+#define BOOLEAN_WIDTH 5
 
-enum xmlstate {
-    STATE_START,
-    STATE_SPARQL_WANT_HEAD,
-    STATE_SPARQL_WANT_RESULTS,
-    STATE_SPARQL_WANT_BOOLEAN,
-    STATE_HEAD,
+/* terms kept for reuse once no row holds them may take this share of the
+ * memory limit, up to DICT_MAX */
+#define DICT_SHARE 8
+#define DICT_MAX (4 * 1024 * 1024)
+
+/* how much of a file is handed to the parser at a time */
+#define FILE_CHUNK (256 * 1024)
+
+/* pieces of the document and blocks of rows that may wait between
+ * threads, and how big a block grows before it's sent */
+#define STREAM_CHUNKS 64
+#define STREAM_RECORDS 64
+#define STREAM_BLOCK (64 * 1024)
 
-    STATE_HEAD_ONLY,
-    STATE_HEAD_LINK_ONLY,
-    STATE_LINK,
+/* ceilings on what a single results document may make us hold in memory,
+ * see sr_set_limits() */
+static size_t limit_literal = SR_DEFAULT_MAX_LITERAL;
+static int limit_columns = SR_DEFAULT_MAX_COLUMNS;
+static size_t limit_memory = SR_DEFAULT_MAX_MEMORY;
 
-    STATE_BINDING,
-    STATE_BINDING_DONE,
-    STATE_VARIABLE,
+/* see sr_set_order() */
+static const char *sort_order;
+static int sort_distinct;
+static size_t sort_memory = SR_DEFAULT_SORT_MEMORY;
 
+/* see sr_set_split() */
+static const char *split_prefix;
+static long split_rows;
+static size_t split_bytes;
+static int split_jobs;
+
+enum xmlstate {
+    STATE_START,
     STATE_RESULTS,
     STATE_RESULTS_DONE,
-    STATE_RESULT,
-    STATE_BOOLEAN,
-    STATE_URI,
-    STATE_LITERAL,
-    STATE_BNODE,
-
     STATE_DONE,
 };
 
@@ -69,412 +98,717 @@ struct aa_chars {
     char *BR;
 };
 
-typedef struct _xmlctxt {
+typedef struct _xmlctxt xmlctxt;
+
+enum record_type {
+    RECORD_HEAD,
+    RECORD_ROWS,
+    RECORD_BOOLEAN,
+    RECORD_END,
+};
+
+/* what passes between threads. Rows are packed one after another by
+ * sr_pack_row(), so a block of them is a single allocation */
+typedef struct {
+    enum record_type type;
+    char *data;
+    size_t len;
+} record;
+
+struct _sr_stream {
+    xmlctxt *parse;  /* belongs to the parsing thread */
+    xmlctxt *render; /* belongs to the writing thread */
+    spsc *chunks;
+    spsc *records;
+    GThread *parser;
+    GThread *writer;
+    void (*wake)(void *data);
+    void *wake_data;
+    int blocked;     /* a chunk was turned away */
+    int broken;      /* the document wasn't whole, well-formed results */
+    GString *rows;   /* the parser's block of rows not yet sent */
+};
+
+typedef struct {
+    size_t len;
+    char data[];
+} chunk;
+
+/* queued after the last chunk */
+static chunk end_of_document;
+
+/* where parsed results go: the parser collects the head and each row, then
+ * hands them to one of these. scan is called for every row of the first
+ * pass, so that a sink can size itself before the second pass emits */
+struct sink {
+    void (*prepare)(xmlctxt *ctxt);
+    void (*scan)(xmlctxt *ctxt);
+    void (*head)(xmlctxt *ctxt);
+    void (*row)(xmlctxt *ctxt);
+    void (*boolean)(xmlctxt *ctxt, const char *value);
+    void (*end)(xmlctxt *ctxt);
+};
+
+struct _xmlctxt {
     enum xmlstate state;
     int pass;
-    int col;
     int cols;
     int *widths;
     char **names;
-    char **row;
-    int tmp_widths[TMP_COLS];
-    gchar *text;
+    sr_term *row;    /* what the sinks see, pointing into dict when parsing */
+    unsigned int *cells; /* ids in dict of the current row */
+    term_dict *dict;
+    char *datatype; /* of the literal being read */
+    char *lang;     /* its language tag */
+    GString *text;
+    int text_truncated;
+    size_t resident; /* bytes held in names and the current row */
     struct aa_chars aa;
     GSList *name_list;
+    int dropped_cols;
     int current_col;
+    sq_parser *xml;  /* reading the document, if it's XML */
     int tsv;
-} xmlctxt;
+    int single_pass; /* rows are emitted as they're parsed, never scanned */
+    int failed;      /* a sink couldn't write what it was given */
+    int incomplete;  /* the results were cut short or malformed */
+    const struct sink *sink;
+    sr_arrow *arrow;
+    sr_profile *profile;
+    sr_split *split;
+    sr_stream *stream;
+    sr_sort *sort;          /* rows wait here, if they're to be reordered */
+    const char *map;        /* of the file being parsed, or NULL */
+    size_t released;        /* bytes of it handed back */
+};
+
+/* whether this pass hands results on to be written */
+static int emitting(xmlctxt *ctxt)
+{
+    return ctxt->pass == 1 || ctxt->single_pass;
+}
+
+/* say what's wrong with the document, once even if it's read twice */
+static void complain(xmlctxt *ctxt, const char *format, ...)
+{
+    if (ctxt->pass > 0) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+static void clear_cell(xmlctxt *ctxt, int col)
+{
+    unsigned int id = ctxt->cells[col];
+    ctxt->resident -= td_get(ctxt->dict, id)->len;
+    td_release(ctxt->dict, id);
+    ctxt->cells[col] = TD_UNBOUND;
+}
 
-static int name_to_col(xmlctxt *ctxt, const char *name)
+/* keep a term in the current row, replacing any earlier binding */
+static void keep_cell(xmlctxt *ctxt, enum sr_term_kind kind, const char *value, size_t len,
+                      const char *datatype, const char *lang)
+{
+    if (ctxt->current_col < 0) {
+        /* dropped column */
+        return;
+    }
+    if (ctxt->sort && ctxt->pass == 1) {
+        /* the sort has the rows already */
+        return;
+    }
+    clear_cell(ctxt, ctxt->current_col);
+    ctxt->cells[ctxt->current_col] = td_intern(ctxt->dict, ctxt->current_col, kind, value, len,
+                                               kind == SR_LITERAL ? datatype : NULL,
+                                               kind == SR_LITERAL ? lang : NULL);
+    ctxt->resident += len;
+}
+
+/* keep the text just read in the current row */
+static void set_cell(xmlctxt *ctxt, enum sr_term_kind kind)
+{
+    keep_cell(ctxt, kind, ctxt->text->str, ctxt->text->len, ctxt->datatype, ctxt->lang);
+}
+
+/* point the row the sinks see at the dictionary's terms */
+static void resolve_row(xmlctxt *ctxt)
 {
     for (int i=0; i<ctxt->cols; i++) {
-        if (!strcmp(name, ctxt->names[i])) {
-            return i;
+        ctxt->row[i] = td_get(ctxt->dict, ctxt->cells[i])->term;
+    }
+}
+
+/* the text and table sinks */
+
+static const char *term_prefix(const sr_term *term)
+{
+    switch (term->kind) {
+        case SR_URI:
+            return "<";
+        case SR_BNODE:
+            return "_:";
+        default:
+            return "";
+    }
+}
+
+static const char *term_suffix(const sr_term *term)
+{
+    return term->kind == SR_URI ? ">" : "";
+}
+
+static int term_width(const sr_term *term)
+{
+    if (term->kind == SR_UNBOUND) {
+        return 0;
+    }
+
+    return sr_utf8_column_width(term->value) + strlen(term_prefix(term)) + strlen(term_suffix(term));
+}
+
+/* the width of a cell of the current row, measured once per term */
+static int cell_width(xmlctxt *ctxt, int col)
+{
+    if (!ctxt->dict) {
+        return term_width(&ctxt->row[col]);
+    }
+    td_entry *entry = td_get(ctxt->dict, ctxt->cells[col]);
+    if (entry->width < 0) {
+        entry->width = term_width(&entry->term);
+    }
+
+    return entry->width;
+}
+
+static void print_rule(xmlctxt *ctxt, int cols, const char *left, const char *centre, const char *right)
+{
+    for (int i=0; i<cols; i++) {
+        printf("%s%s%s", i == 0 ? left : centre, ctxt->aa.H, ctxt->aa.H);
+        for (int j=0; j<ctxt->widths[i]; j++) {
+            printf("%s", ctxt->aa.H);
         }
     }
+    printf("%s\n", right);
+}
 
-    fprintf(stderr, "unknown column name ‘%s’ in results\n", name);
+static void text_prepare(xmlctxt *ctxt)
+{
+    for (int k = 0; k < ctxt->cols; ++k) {
+        if (ctxt->tsv) {
+            ctxt->widths[k] = 0;
+        } else {
+            ctxt->widths[k] = g_utf8_strlen(ctxt->names[k], -1) + 1;
+        }
+    }
+}
 
-    return 0;
+static void text_scan(xmlctxt *ctxt)
+{
+    if (ctxt->tsv) {
+        /* nothing to line up */
+        return;
+    }
+    for (int i=0; i<ctxt->cols; i++) {
+        ctxt->widths[i] = MAX(cell_width(ctxt, i), ctxt->widths[i]);
+    }
 }
 
-static void xml_start_document(void *user_data)
+static void text_head(xmlctxt *ctxt)
 {
-    xmlctxt *ctxt = (xmlctxt *) user_data;
-    ctxt->state = STATE_START;
+    if (ctxt->cols == 0) {
+        /* an ASK result, text_boolean does everything */
+        return;
+    }
+    if (!ctxt->tsv) {
+        print_rule(ctxt, ctxt->cols, ctxt->aa.TL, ctxt->aa.TC, ctxt->aa.TR);
+    }
+    for (int i=0; i<ctxt->cols; i++) {
+        if (ctxt->tsv) {
+            printf("%s?%s", i>0 ? ctxt->aa.V : "", ctxt->names[i]);
+        } else {
+            printf("%s ?%*s ", ctxt->aa.V, -ctxt->widths[i] + 1, ctxt->names[i]);
+        }
+    }
+    if (ctxt->tsv) {
+        printf("\n");
+    } else {
+        printf("%s\n", ctxt->aa.V);
+        print_rule(ctxt, ctxt->cols, ctxt->aa.CL, ctxt->aa.CC, ctxt->aa.CR);
+    }
 }
 
-static void xml_end_document(void *user_data)
+static void text_row(xmlctxt *ctxt)
 {
-    xmlctxt *ctxt = (xmlctxt *) user_data;
-    if (ctxt->state != STATE_DONE) {
-        fprintf(stderr, "SPARQL results end abruptly\n");
+    for (int i=0; i<ctxt->cols; i++) {
+        sr_term *term = &ctxt->row[i];
+        const char *value = term->value ? term->value : "";
+        if (ctxt->tsv) {
+            printf("%s%s%s%s", i>0 ? ctxt->aa.V : "", term_prefix(term), value, term_suffix(term));
+        } else {
+            printf("%s %s%s%s%*s ", ctxt->aa.V, term_prefix(term), value, term_suffix(term), -ctxt->widths[i] + cell_width(ctxt, i), "");
+        }
     }
+    printf("%s\n", ctxt->aa.V);
 }
 
-static void xml_start_element(void *user_data, const xmlChar *xml_name, const xmlChar **attrs)
+static void text_boolean(xmlctxt *ctxt, const char *value)
 {
-    const char *name = (const char *) xml_name;
+    if (ctxt->tsv) {
+        printf("%s\n", value);
+        return;
+    }
+    int width = BOOLEAN_WIDTH;
+    ctxt->widths[0] = width;
+    print_rule(ctxt, 1, ctxt->aa.TL, ctxt->aa.TC, ctxt->aa.TR);
+    printf("%s %*s %s\n", ctxt->aa.V, -width, value, ctxt->aa.V);
+    print_rule(ctxt, 1, ctxt->aa.BL, ctxt->aa.BC, ctxt->aa.BR);
+}
 
-    xmlctxt *ctxt = (xmlctxt *) user_data;
-    switch  (ctxt->state) {
-        case STATE_START:
-            if (strcmp(name, "sparql")) {
-                fprintf(stderr, "results not in valid SPARQL results format (missing sparql)\n");
-                /* stop parsing */
-            } else {
-                ctxt->state = STATE_SPARQL_WANT_HEAD;
-            }
-            break;
+static void text_end(xmlctxt *ctxt)
+{
+    if (!ctxt->tsv && ctxt->cols > 0) {
+        print_rule(ctxt, ctxt->cols, ctxt->aa.BL, ctxt->aa.BC, ctxt->aa.BR);
+    }
+}
 
-        case STATE_SPARQL_WANT_HEAD:
-            if (!strcmp(name, "head")) {
-                if (ctxt->pass == 0) {
-                    /* do nothing */
-                } else {
-                    if (!ctxt->tsv) {
-                        for (int i=0; i<MAX(ctxt->cols, 1); i++) {
-                            if (i == 0) {
-                                printf("%s%s%s", ctxt->aa.TL, ctxt->aa.H, ctxt->aa.H);
-                            } else {
-                                printf("%s%s%s", ctxt->aa.TC, ctxt->aa.H, ctxt->aa.H);
-                            }
-                            for (int j=0; j<ctxt->widths[i]; j++) {
-                                printf("%s", ctxt->aa.H);
-                            }
-                        }
-                        printf("%s\n", ctxt->aa.TR);
-                    }
-                }
-                ctxt->state = STATE_HEAD;
-                ctxt->col = 0;
-            } else {
-                fprintf(stderr, "results not in valid SPARQL results format (missing head)\n");
-                /* stop parsing */
-            }
-            break;
+static const struct sink text_sink = {
+    .prepare = text_prepare,
+    .scan = text_scan,
+    .head = text_head,
+    .row = text_row,
+    .boolean = text_boolean,
+    .end = text_end,
+};
 
-        case STATE_HEAD:
-            if (!strcmp(name, "variable")) {
-                ctxt->state = STATE_VARIABLE;
-                while (attrs && *attrs) {
-                    const char *key = (const char *) *(attrs++);
-                    const char *value = (const char *) *(attrs++);
-                    if (ctxt->pass == 0) {
-                        if (ctxt->cols < TMP_COLS) {
-                            ctxt->tmp_widths[ctxt->cols] = g_utf8_strlen(value, -1) + 1;
-                        }
-                        ctxt->name_list = g_slist_append(ctxt->name_list, g_strdup(value));
-                        (ctxt->cols)++;
-                    } else {
-                        if (!strcmp(key, "name")) {
-                            if (ctxt->tsv) {
-                                printf("%s?%s", ctxt->col>0 ? ctxt->aa.V : "", value);
-                            } else {
-                                printf("%s ?%*s ", ctxt->aa.V, -ctxt->widths[ctxt->col] + 1, value);
-                            }
-                            (ctxt->col)++;
-                        }
-                    }
-                }
-                break;
-            }
-                         
-       /* fall through */
-        case STATE_HEAD_LINK_ONLY:
-            if (!strcmp(name, "link")) {
-                ctxt->state = STATE_LINK;
-                /* handle link */
-            } else {
-                fprintf(stderr, "results not in valid SPARQL results format (wrong element in head)\n");
-                /* stop parsing */
-            }
-            break;
+/* the Apache Arrow sink, see result-arrow.c */
 
-        case STATE_SPARQL_WANT_RESULTS:
-            if (!strcmp(name, "results")) {
-                if (ctxt->pass == 0) {
-                    /* do nothing */
-                } else {
-                    for (int i=0; i<ctxt->cols; i++) {
-                        if (i == 0) {
-                            printf("%s%s%s", ctxt->aa.CL, ctxt->aa.H, ctxt->aa.H);
-                        } else {
-                            printf("%s%s%s", ctxt->aa.CC, ctxt->aa.H, ctxt->aa.H);
-                        }
-                        for (int j=0; j<ctxt->widths[i]; j++) {
-                            printf("%s", ctxt->aa.H);
-                        }
-                    }
-                    printf("%s\n", ctxt->aa.CR);
-                }
-                ctxt->state = STATE_RESULTS;
-            } else if (!strcmp(name, "boolean")) {
-                ctxt->state = STATE_BOOLEAN;
-            } else {
-                fprintf(stderr, "results not in valid SPARQL results format (missing results)\n");
-                /* stop parsing */
-            }
-            break;
+static void arrow_prepare(xmlctxt *ctxt)
+{
+    ctxt->arrow = sr_arrow_new(stdout, ctxt->cols, ctxt->names);
+}
 
-        case STATE_RESULTS:
-            if (!strcmp(name, "result")) {
-                ctxt->state = STATE_RESULT;
-                ctxt->col = 0;
-            } else {
-                fprintf(stderr, "results not in valid SPARQL results format (missing result)\n");
-                /* stop parsing */
-            }
-            break;
+static void arrow_scan(xmlctxt *ctxt)
+{
+    sr_arrow_scan(ctxt->arrow, ctxt->row);
+}
 
-        case STATE_RESULT:
-            if (!strcmp(name, "binding")) {
-                while (attrs && *attrs) {
-                    const char *key = (const char *) *(attrs++);
-                    const char *value = (const char *) *(attrs++);
-                    ctxt->current_col = -1;
-                    if (!strcmp(key, "name")) {
-                        ctxt->current_col = name_to_col(ctxt, value);
-                    }
-                    if (ctxt->current_col == -1) {
-                        fprintf(stderr, "no column name found in results\n");
-                        ctxt->current_col = 0;
-                    }
-                }
-                ctxt->state = STATE_BINDING;
-            } else {
-                fprintf(stderr, "results not in valid SPARQL results format (missing binding)\n");
-                /* stop parsing */
-            }
-            break;
+static void arrow_head(xmlctxt *ctxt)
+{
+    sr_arrow_schema(ctxt->arrow);
+}
 
-        case STATE_BINDING:
-            if (!strcmp(name, "uri")) {
-                ctxt->state = STATE_URI;
-            } else if (!strcmp(name, "bnode")) {
-                ctxt->state = STATE_BNODE;
-            } else if (!strcmp(name, "literal")) {
-                /* FIXME we don't worry about lang tags and type URIs here yet */
-                ctxt->state = STATE_LITERAL;
-            } else {
-                fprintf(stderr, "results not in valid SPARQL results format (wrong element in binding)\n");
-                /* stop parsing */
-            }
-            break;
+static void arrow_row(xmlctxt *ctxt)
+{
+    sr_arrow_row(ctxt->arrow, ctxt->row);
+}
 
-        default:
-            fprintf(stderr, "results not in valid SPARQL results format, unexpected <%s>\n", name);
-            /* stop parsing */
-    }
-    g_free(ctxt->text);
-    ctxt->text = NULL;
-}
-
-static void xml_end_element(void *user_data, const xmlChar *xml_name)
-{
-    const char *name = (const char *) xml_name;
-
-    xmlctxt *ctxt = (xmlctxt *) user_data;
-
-    switch  (ctxt->state) {
-        case STATE_HEAD:
-            if (!strcmp(name, "head")) {
-                if (ctxt->pass == 0) {
-                    ctxt->widths = g_new0(int, MAX(ctxt->cols, 1));
-                    ctxt->names = g_new0(char *, MAX(ctxt->cols, 1));
-                    ctxt->row = g_new0(char *, MAX(ctxt->cols, 1));
-                    GSList *nlist = ctxt->name_list;
-                    for (int k = 0; k < ctxt->cols; ++k) {
-                        if (!nlist) {
-                            fprintf(stderr, "name list error\n");
-                            exit(1);
-                        }
-                        ctxt->names[k] = nlist->data;
-                        nlist = nlist->next;
-                        ctxt->row[k] = (char *)nullstr;
-                        if (ctxt->tsv) {
-                            ctxt->widths[k] = 0;
-                        } else if (k < TMP_COLS) {
-                            ctxt->widths[k] = ctxt->tmp_widths[k];
-                        } else {
-                            ctxt->widths[k] = 2;
-                        }
-                    }
-                } else {
-                    if (ctxt->cols > 0 && !ctxt->tsv) {
-                        printf("%s\n", ctxt->aa.V);
-                    }
-                }
-                ctxt->state = STATE_SPARQL_WANT_RESULTS;
-            }
-            break;
+static void arrow_boolean(xmlctxt *ctxt, const char *value)
+{
+    sr_arrow_boolean(ctxt->arrow, !strcmp(value, "true"));
+}
 
-        case STATE_VARIABLE:
-            ctxt->state = STATE_HEAD;
-            break;
+static void arrow_end(xmlctxt *ctxt)
+{
+    sr_arrow_finish(ctxt->arrow);
+}
 
-        case STATE_BOOLEAN:
-            if (ctxt->pass == 0) {
-                ctxt->widths[ctxt->col] = MAX(sr_utf8_column_width(ctxt->text), ctxt->widths[ctxt->col]);
-                ctxt->state = STATE_RESULTS_DONE;
-            } else {
-                printf("%s%s%*s%s%s\n", ctxt->aa.V, ctxt->tsv ? "" : " ", -ctxt->widths[ctxt->col], ctxt->text, ctxt->tsv ? "" : " ", ctxt->aa.V);
-                printf("%s", ctxt->aa.BL);
-                for (int i=0; !ctxt->tsv && i<ctxt->widths[ctxt->col] + ctxt->tsv ? 0 : 2; i++) {
-                    printf("%s", ctxt->aa.H);
-                }
-                printf("%s\n", ctxt->aa.BR);
-                /* by now ctxt->text should be 'true' or 'false' */
-                /* expect sparql close next */
-                ctxt->state = STATE_RESULTS_DONE;
-            }
-            break;
+static const struct sink arrow_sink = {
+    .prepare = arrow_prepare,
+    .scan = arrow_scan,
+    .head = arrow_head,
+    .row = arrow_row,
+    .boolean = arrow_boolean,
+    .end = arrow_end,
+};
 
-        case STATE_URI:
-            if (!strcmp(name, "uri")) {
-                if (ctxt->pass == 0) {
-                    if (ctxt->widths) {
-                        ctxt->widths[ctxt->current_col] = MAX(sr_utf8_column_width(ctxt->text) + 2, ctxt->widths[ctxt->current_col]);
-                    }
-                } else {
-                    ctxt->row[ctxt->current_col] = g_strdup_printf("<%s>", ctxt->text);
-                }
-                ctxt->state = STATE_BINDING_DONE;
-            } else {
-                fprintf(stderr, "results not in valid SPARQL results format, unexpected </%s> after URI\n", name);
-            }
-            break;
+/* the profile sink, see result-profile.c */
 
-        case STATE_LITERAL:
-            if (!strcmp(name, "literal")) {
-                if (ctxt->pass == 0) {
-                    ctxt->widths[ctxt->current_col] = MAX(sr_utf8_column_width(ctxt->text), ctxt->widths[ctxt->current_col]);
-                } else {
-                    ctxt->row[ctxt->current_col] = g_strdup_printf("%s", ctxt->text ? ctxt->text : "");
-                }
-                ctxt->state = STATE_BINDING_DONE;
-            } else {
-                fprintf(stderr, "results not in valid SPARQL results format, unexpected </%s> after literal\n", name);
-            }
-            break;
+static void profile_prepare(xmlctxt *ctxt)
+{
+    ctxt->profile = sr_profile_new(ctxt->cols, ctxt->names);
+}
 
-        case STATE_BNODE:
-            if (!strcmp(name, "bnode")) {
-                if (ctxt->pass == 0) {
-                    ctxt->widths[ctxt->current_col] = MAX(sr_utf8_column_width(ctxt->text) + 2, ctxt->widths[ctxt->current_col]);
-                } else {
-                    ctxt->row[ctxt->current_col] = g_strdup_printf("_:%s", ctxt->text ? ctxt->text : "");
-                }
-                ctxt->state = STATE_BINDING_DONE;
-            } else {
-                fprintf(stderr, "results not in valid SPARQL results format, unexpected </%s> after bnode\n", name);
-            }
-            break;
+static void profile_row(xmlctxt *ctxt)
+{
+    sr_profile_row(ctxt->profile, ctxt->row);
+}
 
-        case STATE_BINDING_DONE:
-            if (!strcmp(name, "binding")) {
-                ctxt->state = STATE_RESULT;
-            } else {
-                fprintf(stderr, "results not in valid SPARQL results format, unexpected </%s> after binding\n", name);
-            }
-            break;
+static void profile_boolean(xmlctxt *ctxt, const char *value)
+{
+    printf("%s\n", value);
+}
 
-        case STATE_RESULT:
-            if (!strcmp(name, "result")) {
-                if (ctxt->pass == 0) {
-                    /* do nothing */
-                } else {
-                    /* print the reuslt row */
-                    for (int i=0; i<ctxt->cols; i++) {
-                        if (ctxt->tsv) {
-                            printf("%s%s", i>0 ? ctxt->aa.V : "", ctxt->row[i]);
-                        } else {
-                            printf("%s %s%*s ", ctxt->aa.V, ctxt->row[i], -ctxt->widths[i] + (int)sr_utf8_column_width(ctxt->row[i]), "");
-                        }
-                        if (ctxt->row[i] != nullstr) {
-                            g_free(ctxt->row[i]);
-                            ctxt->row[i] = (char *)nullstr;
-                        }
-                    }
-                    printf("%s\n", ctxt->aa.V);
-                }
-                ctxt->state = STATE_RESULTS;
-            } else {
-                fprintf(stderr, "results not in valid SPARQL results format, unexpected </%s> after result\n", name);
-            }
-            break;
+static void profile_end(xmlctxt *ctxt)
+{
+    if (ctxt->cols > 0) {
+        sr_profile_write(ctxt->profile, stdout);
+    }
+}
 
-        case STATE_RESULTS:
-            if (!strcmp(name, "results")) {
-                ctxt->state = STATE_RESULTS_DONE;
-                if (ctxt->pass == 0) {
-                    /* do nothing */
-                } else {
-                    if (!ctxt->tsv) {
-                        for (int i=0; i<ctxt->cols; i++) {
-                            if (i == 0) {
-                                printf("%s%s%s", ctxt->aa.BL, ctxt->aa.H, ctxt->aa.H);
-                            } else {
-                                printf("%s%s%s", ctxt->aa.BC, ctxt->aa.H, ctxt->aa.H);
-                            }
-                            for (int j=0; j<ctxt->widths[i]; j++) {
-                                printf("%s", ctxt->aa.H);
-                            }
-                        }
-                        printf("%s\n", ctxt->aa.BR);
-                    }
-                }
-            } else {
-                fprintf(stderr, "results not in valid SPARQL results format, unexpected </%s> after results\n", name);
-            }
-            break;
+static void nothing(xmlctxt *ctxt)
+{
+}
 
-        case STATE_RESULTS_DONE:
-            if (!strcmp(name, "sparql")) {
-                ctxt->state = STATE_DONE;
-            } else {
-                fprintf(stderr, "results not in valid SPARQL results format, unexpected </%s>\n", name);
-            }
-            break;
+static const struct sink profile_sink = {
+    .prepare = profile_prepare,
+    .scan = nothing,
+    .head = nothing,
+    .row = profile_row,
+    .boolean = profile_boolean,
+    .end = profile_end,
+};
 
-        default:
-            fprintf(stderr, "results not in valid SPARQL results format, unexpected </%s>\n", name);
-            /* stop parsing */
+/* the split sink, see result-split.c */
+
+static void split_prepare(xmlctxt *ctxt)
+{
+    if (ctxt->cols == 0) {
+        /* an ASK result, which is only written out */
+        return;
     }
+    ctxt->split = sr_split_new(split_prefix, split_rows, split_bytes, split_jobs, ctxt->cols, ctxt->names);
 }
 
-static void xml_characters(void *user_data, const xmlChar *ch, int len)
+static void split_row(xmlctxt *ctxt)
 {
-    const char *chars = (const char *) ch;
-    xmlctxt *ctxt = (xmlctxt *) user_data;
+    sr_split_row(ctxt->split, ctxt->row);
+}
 
-    if (ctxt->text) {
-        char *tmp1 = ctxt->text;
-        char *tmp2 = g_strndup(chars, len);
-        ctxt->text = g_strconcat(tmp1, tmp2, NULL);
-        g_free(tmp1);
-        g_free(tmp2);
-    } else {
-        ctxt->text = g_strndup(chars, len);
+static void split_end(xmlctxt *ctxt)
+{
+    if (ctxt->split) {
+        ctxt->failed |= sr_split_finish(ctxt->split, !ctxt->incomplete);
+        ctxt->split = NULL;
     }
 }
 
-static xmlSAXHandler sax = {
-    .startDocument = xml_start_document,
-    .endDocument = xml_end_document,
-    .startElement = xml_start_element,
-    .endElement = xml_end_element,
-    .characters = xml_characters,
+static const struct sink split_sink = {
+    .prepare = split_prepare,
+    .scan = nothing,
+    .head = nothing,
+    .row = split_row,
+    .boolean = profile_boolean,
+    .end = split_end,
 };
 
-int sr_parse(const char *filename, const char *format)
+/* the pipe sink, which packs results up for the writing thread */
+
+static void pipe_send(xmlctxt *ctxt, enum record_type type, char *data, size_t len)
 {
-    xmlctxt *ctxt = g_new0(xmlctxt, 1);
-    setlocale(LC_ALL, "");
-    int utf8_mode = (strcmp(nl_langinfo(CODESET), "UTF-8") == 0);
+    record *rec = g_new(record, 1);
+    rec->type = type;
+    rec->data = data;
+    rec->len = len;
+    spsc_push_wait(ctxt->stream->records, rec);
+}
+
+static void pipe_flush(xmlctxt *ctxt)
+{
+    GString *rows = ctxt->stream->rows;
+    if (rows->len) {
+        size_t len = rows->len;
+        pipe_send(ctxt, RECORD_ROWS, g_string_free(rows, FALSE), len);
+        ctxt->stream->rows = g_string_sized_new(STREAM_BLOCK + 1024);
+    }
+}
+
+static void pipe_head(xmlctxt *ctxt)
+{
+    pipe_send(ctxt, RECORD_HEAD, NULL, 0);
+}
+
+static void pipe_row(xmlctxt *ctxt)
+{
+    GString *rows = ctxt->stream->rows;
+    sr_pack_row(rows, ctxt->row, ctxt->cols);
+    if (rows->len >= STREAM_BLOCK) {
+        pipe_flush(ctxt);
+    }
+}
+
+static void pipe_boolean(xmlctxt *ctxt, const char *value)
+{
+    pipe_send(ctxt, RECORD_BOOLEAN, g_strdup(value), strlen(value));
+}
+
+static const struct sink pipe_sink = {
+    .prepare = nothing,
+    .scan = nothing,
+    .head = pipe_head,
+    .row = pipe_row,
+    .boolean = pipe_boolean,
+    .end = pipe_flush,
+};
+
+/* the sorted rows, which the sink has only scanned so far */
+static void emit_sorted(xmlctxt *ctxt)
+{
+    if (ctxt->dict) {
+        /* widths come from the terms themselves now */
+        td_free(ctxt->dict);
+        ctxt->dict = NULL;
+    }
+    const sr_term *row;
+    while ((row = sr_sort_next(ctxt->sort))) {
+        memcpy(ctxt->row, row, ctxt->cols * sizeof(sr_term));
+        ctxt->sink->row(ctxt);
+    }
+}
+
+/* a variable of the head, seen in the first pass */
+static void add_variable(xmlctxt *ctxt, const char *name)
+{
+    if (ctxt->cols >= limit_columns) {
+        (ctxt->dropped_cols)++;
+        return;
+    }
+    ctxt->name_list = g_slist_prepend(ctxt->name_list, g_strdup(name));
+    ctxt->resident += strlen(name);
+    (ctxt->cols)++;
+}
+
+static void head_done(xmlctxt *ctxt)
+{
+    if (ctxt->pass == 0) {
+        if (ctxt->dropped_cols) {
+            fprintf(stderr, "results have %d columns, only showing the first %d\n", ctxt->cols + ctxt->dropped_cols, ctxt->cols);
+        }
+        ctxt->widths = g_new0(int, MAX(ctxt->cols, 1));
+        ctxt->names = g_new0(char *, MAX(ctxt->cols, 1));
+        ctxt->row = g_new0(sr_term, MAX(ctxt->cols, 1));
+        ctxt->cells = g_new0(unsigned int, MAX(ctxt->cols, 1));
+        ctxt->dict = td_new(MIN(limit_memory / DICT_SHARE, DICT_MAX), ctxt->cols);
+        ctxt->name_list = g_slist_reverse(ctxt->name_list);
+        GSList *nlist = ctxt->name_list;
+        for (int k = 0; k < ctxt->cols; ++k) {
+            if (!nlist) {
+                fprintf(stderr, "name list error\n");
+                exit(1);
+            }
+            ctxt->names[k] = nlist->data;
+            nlist = nlist->next;
+        }
+        ctxt->sink->prepare(ctxt);
+        if ((sort_order || sort_distinct) && !ctxt->stream) {
+            ctxt->sort = sr_sort_new(ctxt->cols, ctxt->names, sort_order, sort_distinct, sort_memory);
+        }
+    }
+    if (emitting(ctxt)) {
+        ctxt->sink->head(ctxt);
+    }
+}
+
+static void row_done(xmlctxt *ctxt)
+{
+    resolve_row(ctxt);
+    if (ctxt->pass == 0) {
+        ctxt->sink->scan(ctxt);
+        if (ctxt->sort) {
+            sr_sort_add(ctxt->sort, ctxt->row);
+        }
+    }
+    if (emitting(ctxt) && !ctxt->sort) {
+        ctxt->sink->row(ctxt);
+    }
+    for (int i=0; i<ctxt->cols; i++) {
+        clear_cell(ctxt, i);
+    }
+}
+
+static void results_done(xmlctxt *ctxt)
+{
+    if (emitting(ctxt)) {
+        if (ctxt->sort) {
+            emit_sorted(ctxt);
+        }
+        ctxt->sink->end(ctxt);
+    }
+}
+
+/* keep len more chars of a value, within the limits */
+static void add_text(xmlctxt *ctxt, const char *chars, size_t len)
+{
+    if (ctxt->text_truncated) {
+        return;
+    }
+
+    /* a value may use whatever the row hasn't, up to the literal limit */
+    size_t room = limit_memory > ctxt->resident ? limit_memory - ctxt->resident : 0;
+    room = MIN(room, limit_literal);
+    room = room > ctxt->text->len ? room - ctxt->text->len : 0;
+
+    if (len <= room) {
+        g_string_append_len(ctxt->text, chars, len);
+        return;
+    }
+
+    /* don't cut a UTF-8 sequence in half */
+    while (room > 0 && (chars[room] & 0xC0) == 0x80) {
+        room--;
+    }
+    g_string_append_len(ctxt->text, chars, room);
+    g_string_append(ctxt->text, TRUNCATED_MARKER);
+    ctxt->text_truncated = 1;
+}
+
+/* the parser has its own copy of everything before upto, so those pages
+ * can go, and even a huge file doesn't stay resident */
+static void release_mapped(xmlctxt *ctxt, const char *upto)
+{
+    if (!ctxt->map) {
+        /* a buffer, not a mapping */
+        return;
+    }
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t to = (upto - ctxt->map) / page * page;
+    if (to > ctxt->released) {
+        madvise((char *) ctxt->map + ctxt->released, to - ctxt->released, MADV_DONTNEED);
+        ctxt->released = to;
+    }
+}
+
+/* SPARQL XML results
+ *
+ * libsparqlquery's parser reads these, handing over the head, each row and
+ * the answer to an ASK as they arrive, and holding to the same limits.
+ */
+
+static void xml_head(void *data, int count, char **names)
+{
+    xmlctxt *ctxt = data;
+
+    if (ctxt->pass == 0) {
+        for (int i=0; i<count; i++) {
+            add_variable(ctxt, names[i]);
+        }
+        ctxt->dropped_cols = sq_parser_dropped(ctxt->xml);
+    }
+    head_done(ctxt);
+    /* a row may use whatever the names haven't, and it's held twice, by the
+     * parser and in the row's cells */
+    size_t room = limit_memory > ctxt->resident ? limit_memory - ctxt->resident : 0;
+    sq_parser_set_limits(ctxt->xml, limit_columns, limit_literal, room / 2);
+    ctxt->state = STATE_RESULTS;
+}
+
+static void xml_row(void *data, const sq_term *terms)
+{
+    xmlctxt *ctxt = data;
+
+    for (int i=0; i<ctxt->cols; i++) {
+        const sq_term *term = &terms[i];
+        if (term->kind == SQ_UNBOUND) {
+            continue;
+        }
+        enum sr_term_kind kind = term->kind == SQ_URI ? SR_URI : term->kind == SQ_BNODE ? SR_BNODE : SR_LITERAL;
+        ctxt->current_col = i;
+        if (term->truncated) {
+            g_string_assign(ctxt->text, term->value);
+            g_string_append(ctxt->text, TRUNCATED_MARKER);
+            keep_cell(ctxt, kind, ctxt->text->str, ctxt->text->len, term->datatype, term->lang);
+        } else {
+            keep_cell(ctxt, kind, term->value, strlen(term->value), term->datatype, term->lang);
+        }
+    }
+    row_done(ctxt);
+}
+
+static void xml_boolean(void *data, int value)
+{
+    xmlctxt *ctxt = data;
+
+    if (ctxt->state == STATE_START) {
+        /* the head of an ASK, which has no results to begin */
+        xml_head(ctxt, 0, NULL);
+    }
+    if (emitting(ctxt)) {
+        ctxt->sink->boolean(ctxt, value ? "true" : "false");
+    }
+    ctxt->state = STATE_RESULTS_DONE;
+}
+
+static void xml_new(xmlctxt *ctxt)
+{
+    ctxt->state = STATE_START;
+    ctxt->xml = sq_parser_new(xml_head, xml_row, xml_boolean, ctxt);
+    sq_parser_set_limits(ctxt->xml, limit_columns, limit_literal, limit_memory);
+}
+
+/* end the document, and the results if they came whole. Returns non-zero
+ * if they didn't */
+static int xml_finish(xmlctxt *ctxt)
+{
+    int failed = sq_parser_finish(ctxt->xml);
+    ctxt->xml = NULL;
+    if (failed) {
+        complain(ctxt, "results are not whole, well-formed SPARQL results\n");
+    } else if (ctxt->state == STATE_RESULTS) {
+        results_done(ctxt);
+    }
+    ctxt->state = STATE_DONE;
+
+    return failed;
+}
+
+void sr_set_limits(size_t max_literal, int max_columns, size_t max_memory)
+{
+    limit_literal = max_literal;
+    limit_columns = max_columns;
+    limit_memory = max_memory;
+}
+
+void sr_set_order(const char *order, int distinct, size_t memory)
+{
+    sort_order = order;
+    sort_distinct = distinct;
+    sort_memory = memory;
+}
+
+void sr_set_split(const char *prefix, long rows, size_t bytes, int jobs)
+{
+    split_prefix = prefix;
+    split_rows = rows;
+    split_bytes = bytes;
+    split_jobs = jobs;
+}
+
+static int is_tsv(const char *format)
+{
+    return !strncmp(format, "text/tab-separated-values", 25) ||
+        !strncmp(format, "text/plain", 10);
+}
+
+/* whether tables can be drawn with box characters, asked only once */
+static int utf8_locale()
+{
+    static int utf8 = -1;
+
+    if (utf8 < 0) {
+        setlocale(LC_ALL, "");
+        utf8 = !strcmp(nl_langinfo(CODESET), "UTF-8");
+    }
+
+    return utf8;
+}
+
+static void set_format(xmlctxt *ctxt, const char *format)
+{
+    ctxt->sink = &text_sink;
     /* if we asked for TSV */
-    if (!strncmp(format, "text/tab-separated-values", 25) ||
-        !strncmp(format, "text/plain", 10)) {
+    if (split_prefix) {
+        /* always TSV, nothing to size up */
+        ctxt->sink = &split_sink;
+        ctxt->single_pass = 1;
+    } else if (!strncmp(format, SR_PROFILE, strlen(SR_PROFILE))) {
+        /* nothing to size up */
+        ctxt->sink = &profile_sink;
+        ctxt->single_pass = 1;
+    } else if (!strncmp(format, SR_ARROW_STREAM, strlen(SR_ARROW_STREAM))) {
+        ctxt->sink = &arrow_sink;
+    } else if (is_tsv(format)) {
         ctxt->tsv = 1;
         ctxt->aa.H = "";
         ctxt->aa.V = "	";
@@ -487,7 +821,7 @@ int sr_parse(const char *filename, const char *format)
         ctxt->aa.BL = "";
         ctxt->aa.BC = "";
         ctxt->aa.BR = "";
-    } else if (utf8_mode) {
+    } else if (utf8_locale()) {
         ctxt->aa.H = "─";
         ctxt->aa.V = "│";
         ctxt->aa.TL = "┌";
@@ -512,36 +846,546 @@ int sr_parse(const char *filename, const char *format)
         ctxt->aa.BC = "-";
         ctxt->aa.BR = "'";
     }
-    ctxt->pass = 0;
-    xmlSAXUserParseFile(&sax, (void *) ctxt, filename);
-    ctxt->pass = 1;
-    xmlSAXUserParseFile(&sax, (void *) ctxt, filename);
+}
+
+static void free_ctxt(xmlctxt *ctxt)
+{
+    if (ctxt->arrow) {
+        sr_arrow_free(ctxt->arrow);
+    }
+    if (ctxt->profile) {
+        sr_profile_free(ctxt->profile);
+    }
+    if (ctxt->split) {
+        /* results that ended abruptly, keep what came */
+        sr_split_finish(ctxt->split, 0);
+    }
+    if (ctxt->sort) {
+        sr_sort_free(ctxt->sort);
+    }
     if (ctxt->widths) {
         g_free(ctxt->widths);
     }
+    g_free(ctxt->row);
+    g_free(ctxt->cells);
+    if (ctxt->dict) {
+        td_free(ctxt->dict);
+    }
+    g_free(ctxt->names);
+    g_slist_free_full(ctxt->name_list, g_free);
+    g_free(ctxt->datatype);
+    g_free(ctxt->lang);
+    g_string_free(ctxt->text, TRUE);
     g_free(ctxt);
+}
+
+/* SPARQL TSV results
+ *
+ * A line of ?variables, then a line for each row with its terms written as
+ * in Turtle, separated by tabs. Each complete line is read into the same
+ * row the XML would make. Language tags are dropped, as they are there.
+ */
+
+#define XSD "http://www.w3.org/2001/XMLSchema#"
+
+/* the datatype of a number or boolean written bare */
+static char *bare_datatype(const char *term)
+{
+    if (!strcmp(term, "true") || !strcmp(term, "false")) {
+        return g_strdup(XSD "boolean");
+    }
+    if (strpbrk(term, "eE")) {
+        return g_strdup(XSD "double");
+    }
+
+    return g_strdup(strchr(term, '.') ? XSD "decimal" : XSD "integer");
+}
+
+/* undo the escapes of the quoted string at term, in place, returning the
+ * end of the string and leaving *after past the closing quote */
+static char *unescape(char *term, char **after)
+{
+    char *in = term + 1, *out = term + 1;
+
+    while (*in && *in != '"') {
+        if (*in != '\\' || !in[1]) {
+            *out++ = *in++;
+            continue;
+        }
+        in++;
+        int hex = *in == 'u' ? 4 : *in == 'U' ? 8 : 0;
+        if (hex) {
+            char digits[9] = { 0 };
+            int n = 0;
+            while (n < hex && g_ascii_isxdigit(in[1 + n])) {
+                digits[n] = in[1 + n];
+                n++;
+            }
+            /* never longer than the escape it replaces */
+            out += g_unichar_to_utf8(strtoul(digits, NULL, 16), out);
+            in += 1 + n;
+            continue;
+        }
+        switch (*in) {
+            case 't': *out++ = '\t'; break;
+            case 'n': *out++ = '\n'; break;
+            case 'r': *out++ = '\r'; break;
+            case 'b': *out++ = '\b'; break;
+            case 'f': *out++ = '\f'; break;
+            default: *out++ = *in;
+        }
+        in++;
+    }
+    *after = *in ? in + 1 : in;
+
+    return out;
+}
+
+/* read a term into the current cell, nothing if it's unbound */
+static void tsv_term(xmlctxt *ctxt, char *term, size_t len)
+{
+    g_string_truncate(ctxt->text, 0);
+    ctxt->text_truncated = 0;
+    g_free(ctxt->datatype);
+    g_free(ctxt->lang);
+    ctxt->datatype = ctxt->lang = NULL;
+    if (!len) {
+        return;
+    }
+
+    if (term[0] == '<' && term[len - 1] == '>') {
+        add_text(ctxt, term + 1, len - 2);
+        set_cell(ctxt, SR_URI);
+    } else if (len >= 2 && term[0] == '_' && term[1] == ':') {
+        add_text(ctxt, term + 2, len - 2);
+        set_cell(ctxt, SR_BNODE);
+    } else if (term[0] == '"') {
+        char *after;
+        char *end = unescape(term, &after);
+        add_text(ctxt, term + 1, end - term - 1);
+        if (g_str_has_prefix(after, "^^<") && g_str_has_suffix(after, ">")) {
+            ctxt->datatype = g_strndup(after + 3, strlen(after) - 4);
+        } else if (after[0] == '@' && after[1]) {
+            ctxt->lang = g_strdup(after + 1);
+        }
+        set_cell(ctxt, SR_LITERAL);
+    } else {
+        ctxt->datatype = bare_datatype(term);
+        add_text(ctxt, term, len);
+        set_cell(ctxt, SR_LITERAL);
+    }
+}
+
+/* one line, without its newline. It's changed, unescaping terms */
+static void tsv_line(xmlctxt *ctxt, char *line, size_t len)
+{
+    if (len && line[len - 1] == '\r') {
+        line[--len] = '\0';
+    }
+
+    if (ctxt->state == STATE_START) {
+        if (ctxt->pass == 0) {
+            char **names = g_strsplit(line, "\t", -1);
+            for (int i=0; names[i]; i++) {
+                if (*names[i]) {
+                    add_variable(ctxt, names[i] + (*names[i] == '?' || *names[i] == '$'));
+                }
+            }
+            g_strfreev(names);
+        }
+        head_done(ctxt);
+        ctxt->state = STATE_RESULTS;
+        return;
+    }
+
+    char *cell = line, *end = line + len;
+    for (int col = 0; ; col++) {
+        char *tab = memchr(cell, '\t', end - cell);
+        if (tab) {
+            *tab = '\0';
+        }
+        ctxt->current_col = col < ctxt->cols ? col : -1;
+        tsv_term(ctxt, cell, (tab ? tab : end) - cell);
+        if (!tab) {
+            break;
+        }
+        cell = tab + 1;
+    }
+    row_done(ctxt);
+}
+
+/* hands a document to the XML parser, or a line at a time to tsv_line() if it
+ * starts like TSV */
+typedef struct {
+    xmlctxt *ctxt;
+    int tsv;         /* -1 until the first byte is seen */
+    GString *line;   /* of TSV, so far */
+} reader;
+
+static void reader_write(reader *r, const char *buf, size_t len)
+{
+    if (!len) {
+        return;
+    }
+    if (r->tsv < 0) {
+        r->tsv = buf[0] == '?' || buf[0] == '$';
+        if (r->tsv) {
+            r->ctxt->state = STATE_START;
+            r->line = g_string_new(NULL);
+        } else {
+            xml_new(r->ctxt);
+        }
+    }
+    if (!r->tsv) {
+        sq_parser_write(r->ctxt->xml, buf, len);
+        return;
+    }
+
+    const char *end = buf + len;
+    while (buf < end) {
+        const char *newline = memchr(buf, '\n', end - buf);
+        g_string_append_len(r->line, buf, (newline ? newline : end) - buf);
+        if (!newline) {
+            break;
+        }
+        tsv_line(r->ctxt, r->line->str, r->line->len);
+        g_string_truncate(r->line, 0);
+        buf = newline + 1;
+    }
+}
+
+/* returns non-zero if the document wasn't whole, well-formed results */
+static int reader_finish(reader *r)
+{
+    if (r->tsv < 0) {
+        /* nothing at all, which the XML parser can complain about */
+        xml_new(r->ctxt);
+    }
+    if (r->ctxt->xml) {
+        return xml_finish(r->ctxt);
+    }
+
+    if (r->line->len) {
+        tsv_line(r->ctxt, r->line->str, r->line->len);
+    }
+    g_string_free(r->line, TRUE);
+    if (r->ctxt->state == STATE_RESULTS) {
+        results_done(r->ctxt);
+    }
+    r->ctxt->state = STATE_DONE;
 
     return 0;
 }
 
+/* Files are mapped rather than read, and both passes hand the mapped pages
+ * straight to a push parser, giving each back once it's done with it.
+ * Gzipped files are inflated a piece at a time from the mapping, once for
+ * each pass. SPARQL TSV results are read as well as XML */
+
+static int is_gzip(const char *map, size_t len)
+{
+    return len >= 2 && (unsigned char) map[0] == 0x1f && (unsigned char) map[1] == 0x8b;
+}
+
+/* returns non-zero if the results were malformed or wouldn't inflate */
+static int parse_mapped(xmlctxt *ctxt, const char *map, size_t len)
+{
+    reader r = { .ctxt = ctxt, .tsv = -1 };
+    int failed = 0;
+
+    if (is_gzip(map, len)) {
+        z_stream z = { .next_in = NULL };
+        char *out = g_malloc(FILE_CHUNK);
+        const char *pos = map, *end = map + len;
+        /* 16 more window bits for a gzip rather than zlib wrapper */
+        int ret = inflateInit2(&z, 16 + MAX_WBITS);
+        while (ret == Z_OK) {
+            if (!z.avail_in && pos < end) {
+                release_mapped(ctxt, pos);
+                z.next_in = (Bytef *) pos;
+                z.avail_in = MIN((size_t) (end - pos), FILE_CHUNK);
+                pos += z.avail_in;
+            }
+            z.next_out = (Bytef *) out;
+            z.avail_out = FILE_CHUNK;
+            ret = inflate(&z, Z_NO_FLUSH);
+            if (z.avail_out < FILE_CHUNK) {
+                reader_write(&r, out, FILE_CHUNK - z.avail_out);
+            }
+            if (ret == Z_STREAM_END && (z.avail_in || pos < end)) {
+                /* gzip allows several members one after another */
+                ret = inflateReset(&z);
+            }
+        }
+        if (ret == Z_BUF_ERROR) {
+            /* all the input is in and inflate() can't get any further */
+            complain(ctxt, "compressed results end abruptly\n");
+            failed = 1;
+        } else if (ret != Z_OK && ret != Z_STREAM_END) {
+            complain(ctxt, "can't decompress results: %s\n", z.msg ? z.msg : zError(ret));
+            failed = 1;
+        }
+        inflateEnd(&z);
+        g_free(out);
+    } else {
+        for (size_t at = 0; at < len; at += FILE_CHUNK) {
+            release_mapped(ctxt, map + at);
+            reader_write(&r, map + at, MIN(len - at, FILE_CHUNK));
+        }
+    }
+    /* the sinks end as reader_finish() ends the document */
+    ctxt->incomplete = failed;
+
+    return reader_finish(&r) || failed;
+}
+
+/* map is buf if it was mapped, and its pages can be handed back. Returns
+ * non-zero if either pass found the results broken */
+static int parse_all(const char *map, const char *buf, size_t len, const char *format)
+{
+    int failed = 0;
+    xmlctxt *ctxt = g_new0(xmlctxt, 1);
+    ctxt->text = g_string_new(NULL);
+    set_format(ctxt, format);
+    if (len) {
+        ctxt->map = map;
+        for (ctxt->pass = 0; ctxt->pass < (ctxt->single_pass ? 1 : 2); ctxt->pass++) {
+            ctxt->released = 0;
+            failed |= parse_mapped(ctxt, buf, len);
+        }
+    }
+    failed |= ctxt->failed;
+    free_ctxt(ctxt);
+
+    return failed;
+}
+
+int sr_parse(const char *filename, const char *format)
+{
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st)) {
+        fprintf(stderr, "can't read %s: %s\n", filename, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 1;
+    }
+    char *map = NULL;
+    if (st.st_size > 0) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            fprintf(stderr, "can't map %s: %s\n", filename, strerror(errno));
+            close(fd);
+            return 1;
+        }
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    int failed = parse_all(map, map, st.st_size, format);
+    if (map) {
+        munmap(map, st.st_size);
+    }
+
+    return failed;
+}
+
+int sr_parse_buffer(const char *buf, size_t len, const char *format)
+{
+    return parse_all(NULL, buf, len, format);
+}
+
+const char *sr_format_extension(const char *format)
+{
+    if (!strncmp(format, SR_PROFILE, strlen(SR_PROFILE))) {
+        return "profile";
+    }
+    if (!strncmp(format, SR_ARROW_STREAM, strlen(SR_ARROW_STREAM))) {
+        return "arrow";
+    }
+
+    return is_tsv(format) ? "tsv" : "txt";
+}
+
+/* Streaming
+ *
+ * Only TSV has nothing to line up, so only TSV, a profile or parts can be
+ * written in a single pass. Chunks of the document wait in one queue for
+ * the parsing thread, which packs each row into a record on another queue
+ * for the writing thread. The writer's terms point into the record, nothing
+ * more is copied. Rows that are to be sorted wait in the writer's sort until
+ * the end.
+ */
+
+int sr_stream_supported(const char *format)
+{
+    return split_prefix || is_tsv(format) || !strncmp(format, SR_PROFILE, strlen(SR_PROFILE));
+}
+
+static gpointer stream_parse(gpointer data)
+{
+    sr_stream *stream = data;
+    chunk *c;
+
+    while ((c = spsc_pop_wait(stream->chunks)) != &end_of_document) {
+        /* as soon as there's room, not after parsing, or the transfer may
+         * fill it and be turned away again before we look */
+        if (__atomic_exchange_n(&stream->blocked, 0, __ATOMIC_SEQ_CST) && stream->wake) {
+            stream->wake(stream->wake_data);
+        }
+        sq_parser_write(stream->parse->xml, c->data, c->len);
+        g_free(c);
+    }
+    /* seen by the writer once it has the end */
+    stream->broken = xml_finish(stream->parse);
+    pipe_flush(stream->parse);
+    pipe_send(stream->parse, RECORD_END, NULL, 0);
+
+    return NULL;
+}
+
+static gpointer stream_write(gpointer data)
+{
+    sr_stream *stream = data;
+    xmlctxt *ctxt = stream->render;
+    record *rec;
+
+    while ((rec = spsc_pop_wait(stream->records))->type != RECORD_END) {
+        char *pos = rec->data, *end = rec->data + rec->len;
+        switch (rec->type) {
+            case RECORD_HEAD:
+                /* the parser is done with its names once it sends the head */
+                ctxt->cols = stream->parse->cols;
+                ctxt->names = stream->parse->names;
+                ctxt->widths = g_new0(int, MAX(ctxt->cols, 1));
+                ctxt->row = g_new0(sr_term, MAX(ctxt->cols, 1));
+                ctxt->sink->prepare(ctxt);
+                ctxt->sink->head(ctxt);
+                if (sort_order || sort_distinct) {
+                    ctxt->sort = sr_sort_new(ctxt->cols, ctxt->names, sort_order, sort_distinct, sort_memory);
+                }
+                break;
+            case RECORD_ROWS:
+                while (pos < end) {
+                    pos = (char *) sr_unpack_row(pos, ctxt->row, ctxt->cols);
+                    if (ctxt->sort) {
+                        sr_sort_add(ctxt->sort, ctxt->row);
+                    } else {
+                        ctxt->sink->row(ctxt);
+                    }
+                }
+                break;
+            case RECORD_BOOLEAN:
+                ctxt->sink->boolean(ctxt, rec->data);
+                break;
+            case RECORD_END:
+                break;
+        }
+        g_free(rec->data);
+        g_free(rec);
+    }
+    g_free(rec);
+    if (ctxt->sort) {
+        emit_sorted(ctxt);
+    }
+    ctxt->incomplete = stream->broken;
+    if (ctxt->row) {
+        ctxt->sink->end(ctxt);
+    }
+    fflush(stdout);
+
+    return NULL;
+}
+
+sr_stream *sr_stream_new(const char *format, void (*wake)(void *data), void *data)
+{
+    sr_stream *stream = g_new0(sr_stream, 1);
+    stream->wake = wake;
+    stream->wake_data = data;
+    stream->rows = g_string_sized_new(STREAM_BLOCK + 1024);
+
+    stream->parse = g_new0(xmlctxt, 1);
+    stream->parse->text = g_string_new(NULL);
+    stream->parse->sink = &pipe_sink;
+    stream->parse->single_pass = 1;
+    stream->parse->stream = stream;
+    stream->render = g_new0(xmlctxt, 1);
+    stream->render->text = g_string_new(NULL);
+    set_format(stream->render, format);
+
+    xml_new(stream->parse);
+    stream->chunks = spsc_new(STREAM_CHUNKS);
+    stream->records = spsc_new(STREAM_RECORDS);
+    stream->parser = g_thread_new("sr-parse", stream_parse, stream);
+    stream->writer = g_thread_new("sr-write", stream_write, stream);
+
+    return stream;
+}
+
+int sr_stream_write(sr_stream *stream, const char *buf, size_t len)
+{
+    /* say so first, so a parser that makes room meanwhile will wake us */
+    __atomic_store_n(&stream->blocked, 1, __ATOMIC_SEQ_CST);
+    if (!spsc_has_room(stream->chunks)) {
+        return 0;
+    }
+    __atomic_store_n(&stream->blocked, 0, __ATOMIC_SEQ_CST);
+
+    chunk *c = g_malloc(sizeof(chunk) + len);
+    c->len = len;
+    memcpy(c->data, buf, len);
+    spsc_push(stream->chunks, c);
+
+    return 1;
+}
+
+int sr_stream_ready(sr_stream *stream)
+{
+    return spsc_has_room(stream->chunks);
+}
+
+int sr_stream_finish(sr_stream *stream)
+{
+    spsc_push_wait(stream->chunks, &end_of_document);
+    g_thread_join(stream->parser);
+    g_thread_join(stream->writer);
+    int failed = stream->render->failed || stream->broken;
+
+    /* the names belong to the parser's context */
+    stream->render->names = NULL;
+    free_ctxt(stream->render);
+    free_ctxt(stream->parse);
+    spsc_free(stream->chunks);
+    spsc_free(stream->records);
+    g_string_free(stream->rows, TRUE);
+    g_free(stream);
+
+    return failed;
+}
+
 int sr_utf8_column_width(const char *str)
 {
     if (!str) {
         return 0;
     }
 
-    gunichar *gustr = g_utf8_to_ucs4_fast(str, -1, NULL);
     int width = 0;
-    for (gunichar *pos = gustr; *pos; pos++) {
-        if (g_unichar_iswide(*pos)) {
+    for (const char *pos = str; *pos; pos = g_utf8_next_char(pos)) {
+        if (!(*pos & 0x80)) {
+            /* ASCII is always one column */
+            width++;
+            continue;
+        }
+        gunichar c = g_utf8_get_char(pos);
+        if (g_unichar_iswide(c)) {
             width += 2;
-        } else if (g_unichar_iszerowidth(*pos)) {
+        } else if (g_unichar_iszerowidth(c)) {
             /* do nothing */
         } else {
             width++;
         }
     }
-    g_free(gustr);
 
     return width;
 }
@@ -0,0 +1,82 @@
+#ifndef RESULT_PARSE_H
+#define RESULT_PARSE_H
+
+#include <stddef.h>
+
+/* defaults for sr_set_limits() */
+#define SR_DEFAULT_MAX_LITERAL (16 * 1024 * 1024)
+#define SR_DEFAULT_MAX_COLUMNS 1024
+#define SR_DEFAULT_MAX_MEMORY  (256 * 1024 * 1024)
+
+/* default for sr_set_order() */
+#define SR_DEFAULT_SORT_MEMORY (64 * 1024 * 1024)
+
+enum sr_term_kind {
+    SR_UNBOUND,
+    SR_URI,
+    SR_BNODE,
+    SR_LITERAL,
+};
+
+/* one cell of a result row, value is NULL when unbound */
+typedef struct {
+    enum sr_term_kind kind;
+    char *value;
+    char *datatype; /* literals only, NULL if untyped */
+    char *lang;     /* literals only, NULL if there's no language tag */
+} sr_term;
+
+/* render the SPARQL XML results in filename to standard out, as a table,
+ * as TSV or as an Arrow stream depending on the requested MIME type format.
+ * The file may be gzipped. Returns non-zero if it can't be read, or isn't
+ * whole, well-formed results */
+int sr_parse(const char *filename, const char *format);
+
+/* the same for results held in len bytes at buf */
+int sr_parse_buffer(const char *buf, size_t len, const char *format);
+
+/* the file name extension for what sr_parse() writes for format */
+const char *sr_format_extension(const char *format);
+
+/* bound the memory used by sr_parse(): values longer than max_literal bytes
+ * are truncated and marked, columns beyond max_columns are dropped, and no
+ * more than max_memory bytes of names and values are held at once */
+void sr_set_limits(size_t max_literal, int max_columns, size_t max_memory);
+
+/* have sr_parse() and streams write rows sorted by the variables in order
+ * (see sr_sort_new()) and, with distinct, leave out repeats. Up to memory
+ * bytes of rows are held, the rest wait in temporary files. order may be
+ * NULL */
+void sr_set_order(const char *order, int distinct, size_t memory);
+
+/* have sr_parse() and streams write rows as TSV split into gzipped parts
+ * named from prefix, rather than to standard out. See sr_split_new() for
+ * what rows, bytes and jobs mean. prefix may be NULL */
+void sr_set_split(const char *prefix, long rows, size_t bytes, int jobs);
+
+typedef struct _sr_stream sr_stream;
+
+/* true if results asked for as format can be written as they arrive */
+int sr_stream_supported(const char *format);
+
+/* render SPARQL XML results as they are handed over, parsing them on one
+ * thread and formatting and writing them on another. If sr_stream_write()
+ * turns a chunk away, wake is called from the parsing thread once there's
+ * room again */
+sr_stream *sr_stream_new(const char *format, void (*wake)(void *data), void *data);
+
+/* hand over len more bytes of the document, returning 0 if the stream is
+ * full and they weren't taken */
+int sr_stream_write(sr_stream *stream, const char *buf, size_t len);
+
+/* true if sr_stream_write() would take more now */
+int sr_stream_ready(sr_stream *stream);
+
+/* end the document, wait for everything to be written and free the stream.
+ * Returns non-zero if the results couldn't all be written, or weren't
+ * whole, well-formed results */
+int sr_stream_finish(sr_stream *stream);
+
+int sr_utf8_column_width(const char *str);
+
+#endif
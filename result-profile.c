@@ -0,0 +1,260 @@
+/*  sparql-query - a SPARQL client with GNU readline support
+    Copyright (C) 2006-8 Nick Lamb and Steve Harris for Garlik
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* A profile of results, in one pass and a fixed amount of memory
+ *
+ * Each column counts its bindings by kind, estimates how many distinct
+ * terms it has with a HyperLogLog of HLL_REGISTERS one byte registers, and
+ * finds its most common terms with the Space-Saving algorithm: TOP_COUNTERS
+ * counters, a new term taking over the smallest and its count. Any term
+ * seen more than rows / TOP_COUNTERS times is sure to be among them, with a
+ * count too high by at most the error shown.
+ *
+ * Terms are only ever handled as 64-bit hashes, except those counted.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+
+#include "hash.h"
+#include "result-profile.h"
+
+#define HLL_BITS 14
+#define HLL_REGISTERS (1 << HLL_BITS)
+
+#define TOP_COUNTERS 64
+#define TOP_SHOWN 5
+
+/* bytes of a term shown */
+#define TERM_SHOWN 60
+
+typedef struct {
+    guint64 hash;    /* first, it's the key in index */
+    guint64 count;
+    guint64 error;   /* count may be this much too high */
+    char *term;
+} counter;
+
+struct column {
+    guint64 kinds[SR_LITERAL + 1];
+    guint8 *hll;
+    counter top[TOP_COUNTERS];
+    int used;
+    GHashTable *index; /* hash to counter */
+};
+
+struct _sr_profile {
+    int cols;
+    char **names;
+    guint64 rows;
+    struct column *col;
+};
+
+static guint64 term_hash(const sr_term *term)
+{
+    guint64 h = hash_add_byte(HASH_INIT, term->kind);
+
+    h = hash_add(h, term->value, strlen(term->value));
+    if (term->datatype) {
+        h = hash_add_byte(h, '^');
+        h = hash_add(h, term->datatype, strlen(term->datatype));
+    }
+    if (term->lang) {
+        h = hash_add_byte(h, '@');
+        for (const char *c = term->lang; *c; c++) {
+            h = hash_add_byte(h, g_ascii_tolower(*c));
+        }
+    }
+
+    return hash_finish(h);
+}
+
+static void hll_add(guint8 *hll, guint64 hash)
+{
+    guint64 rest = hash << HLL_BITS;
+    int rank = rest ? __builtin_clzll(rest) + 1 : 64 - HLL_BITS + 1;
+    guint8 *reg = &hll[hash >> (64 - HLL_BITS)];
+
+    if (rank > *reg) {
+        *reg = rank;
+    }
+}
+
+static double hll_estimate(const guint8 *hll)
+{
+    double m = HLL_REGISTERS, sum = 0.0;
+    int zeros = 0;
+
+    for (int i=0; i<HLL_REGISTERS; i++) {
+        sum += ldexp(1.0, -hll[i]);
+        zeros += hll[i] == 0;
+    }
+    double estimate = 0.7213 / (1.0 + 1.079 / m) * m * m / sum;
+    if (estimate <= 2.5 * m && zeros) {
+        /* few enough for linear counting to do better */
+        estimate = m * log(m / zeros);
+    }
+
+    return estimate;
+}
+
+/* the term as TSV would show it, cut short if it's long */
+static char *shown_term(const sr_term *term)
+{
+    const char *prefix = term->kind == SR_URI ? "<" : term->kind == SR_BNODE ? "_:" : "";
+    const char *suffix = term->kind == SR_URI ? ">" : "";
+    size_t len = strlen(term->value);
+
+    if (len <= TERM_SHOWN) {
+        return g_strdup_printf("%s%s%s", prefix, term->value, suffix);
+    }
+    /* don't cut a UTF-8 sequence in half */
+    len = TERM_SHOWN;
+    while (len > 0 && (term->value[len] & 0xC0) == 0x80) {
+        len--;
+    }
+
+    return g_strdup_printf("%s%.*s...%s", prefix, (int) len, term->value, suffix);
+}
+
+static void count_term(struct column *col, const sr_term *term, guint64 hash)
+{
+    counter *c = g_hash_table_lookup(col->index, &hash);
+    if (c) {
+        c->count++;
+        return;
+    }
+
+    if (col->used < TOP_COUNTERS) {
+        c = &col->top[col->used++];
+        c->count = 1;
+        c->error = 0;
+    } else {
+        c = &col->top[0];
+        for (int i=1; i<TOP_COUNTERS; i++) {
+            if (col->top[i].count < c->count) {
+                c = &col->top[i];
+            }
+        }
+        g_hash_table_remove(col->index, &c->hash);
+        g_free(c->term);
+        c->error = c->count;
+        c->count++;
+    }
+    c->hash = hash;
+    c->term = shown_term(term);
+    g_hash_table_insert(col->index, &c->hash, c);
+}
+
+sr_profile *sr_profile_new(int cols, char **names)
+{
+    sr_profile *profile = g_new0(sr_profile, 1);
+    profile->cols = cols;
+    profile->names = names;
+    profile->col = g_new0(struct column, MAX(cols, 1));
+    for (int i=0; i<cols; i++) {
+        profile->col[i].hll = g_new0(guint8, HLL_REGISTERS);
+        profile->col[i].index = g_hash_table_new(g_int64_hash, g_int64_equal);
+    }
+
+    return profile;
+}
+
+void sr_profile_row(sr_profile *profile, const sr_term *row)
+{
+    profile->rows++;
+    for (int i=0; i<profile->cols; i++) {
+        struct column *col = &profile->col[i];
+        col->kinds[row[i].kind]++;
+        if (row[i].kind == SR_UNBOUND) {
+            continue;
+        }
+        guint64 hash = term_hash(&row[i]);
+        hll_add(col->hll, hash);
+        count_term(col, &row[i], hash);
+    }
+}
+
+static gint by_count(gconstpointer a, gconstpointer b)
+{
+    const counter *x = a, *y = b;
+
+    return x->count < y->count ? 1 : x->count > y->count ? -1 : 0;
+}
+
+static void write_count(FILE *out, const char *what, guint64 count, guint64 rows)
+{
+    fprintf(out, "  %-9s %12" G_GUINT64_FORMAT, what, count);
+    if (rows) {
+        fprintf(out, " (%.1f%%)", 100.0 * count / rows);
+    }
+    fprintf(out, "\n");
+}
+
+void sr_profile_write(sr_profile *profile, FILE *out)
+{
+    fprintf(out, "%" G_GUINT64_FORMAT " rows\n", profile->rows);
+    for (int i=0; i<profile->cols; i++) {
+        struct column *col = &profile->col[i];
+        guint64 bound = profile->rows - col->kinds[SR_UNBOUND];
+
+        fprintf(out, "\n?%s\n", profile->names[i]);
+        write_count(out, "bound", bound, profile->rows);
+        write_count(out, "uri", col->kinds[SR_URI], profile->rows);
+        write_count(out, "bnode", col->kinds[SR_BNODE], profile->rows);
+        write_count(out, "literal", col->kinds[SR_LITERAL], profile->rows);
+        if (!bound) {
+            continue;
+        }
+        fprintf(out, "  %-9s %12.0f (about)\n", "distinct", MIN(hll_estimate(col->hll), (double) bound));
+
+        counter top[TOP_COUNTERS];
+        memcpy(top, col->top, col->used * sizeof(counter));
+        qsort(top, col->used, sizeof(counter), by_count);
+        for (int j=0; j<MIN(col->used, TOP_SHOWN); j++) {
+            if (top[j].count - top[j].error < 2) {
+                /* not sure to have come up more than once */
+                break;
+            }
+            fprintf(out, "  %-9s %12" G_GUINT64_FORMAT " ", j == 0 ? "top" : "", top[j].count);
+            if (top[j].error) {
+                fprintf(out, "(+-%" G_GUINT64_FORMAT ") ", top[j].error);
+            }
+            fprintf(out, "%s\n", top[j].term);
+        }
+    }
+}
+
+void sr_profile_free(sr_profile *profile)
+{
+    for (int i=0; i<profile->cols; i++) {
+        struct column *col = &profile->col[i];
+        for (int j=0; j<col->used; j++) {
+            g_free(col->top[j].term);
+        }
+        g_hash_table_destroy(col->index);
+        g_free(col->hll);
+    }
+    g_free(profile->col);
+    g_free(profile);
+}
+
+/* vi:set expandtab sts=4 sw=4: */
@@ -0,0 +1,26 @@
+#ifndef RESULT_PROFILE_H
+#define RESULT_PROFILE_H
+
+#include <stdio.h>
+
+#include "result-parse.h"
+
+/* the format that has sr_parse() and streams profile results instead of
+ * writing them */
+#define SR_PROFILE "text/x-sparql-profile"
+
+typedef struct _sr_profile sr_profile;
+
+/* counts rows, and for each of cols columns how often it's bound and to
+ * what kinds of term, about how many distinct terms it has and which come
+ * up most, all in a fixed amount of memory */
+sr_profile *sr_profile_new(int cols, char **names);
+
+void sr_profile_row(sr_profile *profile, const sr_term *row);
+
+/* write what was found */
+void sr_profile_write(sr_profile *profile, FILE *out);
+
+void sr_profile_free(sr_profile *profile);
+
+#endif
@@ -0,0 +1,602 @@
+/*  sparql-query - a SPARQL client with GNU readline support
+    Copyright (C) 2006-8 Nick Lamb and Steve Harris for Garlik
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* ORDER BY and DISTINCT on our side, for results too big for the endpoint
+ * to sort
+ *
+ * Rows are packed and held until they'd take more than the memory allowed,
+ * then sorted, stably, and written gzipped to an unlinked temporary file as
+ * a run. At the end the runs, and the rows still held, are merged through a
+ * heap. If there are more than MERGE_RUNS, groups of them are first merged
+ * into longer runs. Repeated rows are dropped whenever a run is written and
+ * as the last merge hands them out.
+ *
+ * Terms are ordered as SPARQL orders them: unbound, then blank nodes, IRIs
+ * and literals, with numeric literals compared by value ahead of the rest.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include <zlib.h>
+
+#include "result-sort.h"
+
+/* runs read at once in a merge */
+#define MERGE_RUNS 32
+
+/* buffered by zlib for each run read or written */
+#define RUN_BUFFER (64 * 1024)
+
+/* what holding a row costs beyond its packed terms */
+#define ROW_OVERHEAD (sizeof(char *) + sizeof(guint32) + 16)
+
+#define XSD "http://www.w3.org/2001/XMLSchema#"
+
+typedef struct {
+    int col;
+    int descending;
+} key;
+
+/* rows are a guint32 length then what sr_pack_row() wrote */
+typedef struct {
+    int fd;
+    gzFile gz;
+    GPtrArray *held; /* instead of a file, for the rows never written out */
+    guint pos;
+    char *row;       /* read last, NULL once there are no more */
+    size_t size;
+    int index;       /* ties go to the earlier run */
+} run;
+
+typedef struct {
+    run **heap;
+    int len;
+    run *top;        /* whose row was handed out last */
+} merge;
+
+struct _sr_sort {
+    int cols;
+    key *keys;
+    int nkeys;
+    int distinct;
+    size_t memory;
+
+    GPtrArray *rows; /* held */
+    size_t held;
+    GPtrArray *runs;
+    int spill_failed;
+
+    merge *merge;    /* once reading has begun */
+    GString *last;   /* the row handed out last, for distinct */
+    sr_term *a, *b;
+    sr_term *out;
+};
+
+static guint32 row_len(const char *row)
+{
+    guint32 len;
+    memcpy(&len, row, sizeof(len));
+    return len;
+}
+
+static const char *row_data(const char *row)
+{
+    return row + sizeof(guint32);
+}
+
+void sr_pack_row(GString *buf, const sr_term *row, int cols)
+{
+    for (int i=0; i<cols; i++) {
+        g_string_append_c(buf, row[i].kind);
+        if (row[i].kind == SR_UNBOUND) {
+            continue;
+        }
+        g_string_append_len(buf, row[i].value, strlen(row[i].value) + 1);
+        if (row[i].datatype) {
+            g_string_append(buf, row[i].datatype);
+        }
+        g_string_append_c(buf, '\0');
+        if (row[i].lang) {
+            g_string_append(buf, row[i].lang);
+        }
+        g_string_append_c(buf, '\0');
+    }
+}
+
+const char *sr_unpack_row(const char *data, sr_term *row, int cols)
+{
+    for (int i=0; i<cols; i++) {
+        row[i].kind = *data++;
+        row[i].value = row[i].datatype = row[i].lang = NULL;
+        if (row[i].kind == SR_UNBOUND) {
+            continue;
+        }
+        row[i].value = (char *) data;
+        data += strlen(data) + 1;
+        row[i].datatype = *data ? (char *) data : NULL;
+        data += strlen(data) + 1;
+        row[i].lang = *data ? (char *) data : NULL;
+        data += strlen(data) + 1;
+    }
+
+    return data;
+}
+
+static int numeric_value(const sr_term *term, double *value)
+{
+    static const char *numeric[] = {
+        "integer", "decimal", "double", "float", "int", "long", "short", "byte",
+        "nonNegativeInteger", "positiveInteger", "nonPositiveInteger", "negativeInteger",
+        "unsignedLong", "unsignedInt", "unsignedShort", "unsignedByte", NULL
+    };
+
+    if (term->kind != SR_LITERAL || !term->datatype || strncmp(term->datatype, XSD, strlen(XSD))) {
+        return 0;
+    }
+    for (const char **type = numeric; *type; type++) {
+        if (!strcmp(term->datatype + strlen(XSD), *type)) {
+            char *end;
+            *value = g_ascii_strtod(term->value, &end);
+            return end != term->value && *end == '\0';
+        }
+    }
+
+    return 0;
+}
+
+static int compare_terms(const sr_term *a, const sr_term *b)
+{
+    /* indexed by enum sr_term_kind */
+    static const int rank[] = { 0, 2, 1, 3 };
+
+    if (a->kind != b->kind) {
+        return rank[a->kind] - rank[b->kind];
+    }
+    if (a->kind == SR_UNBOUND) {
+        return 0;
+    }
+    double x, y;
+    int a_numeric = numeric_value(a, &x), b_numeric = numeric_value(b, &y);
+    if (a_numeric != b_numeric) {
+        return b_numeric - a_numeric;
+    }
+    if (a_numeric && x != y) {
+        return x < y ? -1 : 1;
+    }
+    int c = strcmp(a->value, b->value);
+    if (!c) {
+        c = g_strcmp0(a->datatype, b->datatype);
+    }
+    if (!c && a->lang != b->lang) {
+        /* language tags aren't case sensitive; no tag sorts first */
+        c = !a->lang ? -1 : !b->lang ? 1 : g_ascii_strcasecmp(a->lang, b->lang);
+    }
+
+    return c;
+}
+
+static int compare_rows(sr_sort *sort, const char *a, const char *b)
+{
+    sr_unpack_row(row_data(a), sort->a, sort->cols);
+    sr_unpack_row(row_data(b), sort->b, sort->cols);
+
+    for (int i=0; i<sort->nkeys; i++) {
+        int c = compare_terms(&sort->a[sort->keys[i].col], &sort->b[sort->keys[i].col]);
+        if (c) {
+            return sort->keys[i].descending ? -c : c;
+        }
+    }
+    if (sort->distinct) {
+        for (int i=0; i<sort->cols; i++) {
+            int c = compare_terms(&sort->a[i], &sort->b[i]);
+            if (c) {
+                return c;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static gint compare_held(gconstpointer a, gconstpointer b, gpointer data)
+{
+    return compare_rows(data, *(char **) a, *(char **) b);
+}
+
+/* runs written to temporary files */
+
+static run *run_new(sr_sort *sort)
+{
+    GError *error = NULL;
+    char *name = NULL;
+    int fd = g_file_open_tmp("sparql-query-XXXXXX", &name, &error);
+    if (fd < 0) {
+        fprintf(stderr, "can't write sorted rows to a temporary file: %s\n", error->message);
+        g_error_free(error);
+        return NULL;
+    }
+    /* gone as soon as we're done with it, however that happens */
+    unlink(name);
+    g_free(name);
+
+    run *r = g_new0(run, 1);
+    r->fd = fd;
+    r->gz = gzdopen(dup(fd), "wb1");
+    gzbuffer(r->gz, RUN_BUFFER);
+
+    return r;
+}
+
+static void run_free(run *r)
+{
+    if (r->gz) {
+        gzclose(r->gz);
+    }
+    if (r->fd >= 0) {
+        close(r->fd);
+    }
+    if (r->held) {
+        g_ptr_array_free(r->held, TRUE);
+    } else {
+        g_free(r->row);
+    }
+    g_free(r);
+}
+
+/* write out rows, which are in order, leaving out repeats if distinct */
+static int run_write(sr_sort *sort, run *r, const char *row)
+{
+    if (sort->distinct && sort->last->len && !compare_rows(sort, sort->last->str, row)) {
+        return 1;
+    }
+    if (sort->distinct) {
+        g_string_truncate(sort->last, 0);
+        g_string_append_len(sort->last, row, sizeof(guint32) + row_len(row));
+    }
+
+    return gzwrite(r->gz, row, sizeof(guint32) + row_len(row)) > 0;
+}
+
+static int run_finish(run *r)
+{
+    int failed = gzclose(r->gz) != Z_OK;
+    r->gz = NULL;
+    if (failed) {
+        fprintf(stderr, "can't write sorted rows to a temporary file\n");
+    }
+
+    return !failed;
+}
+
+/* move on to the run's next row, returning 0 if there are no more */
+static int run_next(run *r)
+{
+    if (r->held) {
+        r->row = r->pos < r->held->len ? r->held->pdata[r->pos++] : NULL;
+        return r->row != NULL;
+    }
+
+    guint32 len;
+    if (gzread(r->gz, &len, sizeof(len)) != sizeof(len)) {
+        g_free(r->row);
+        r->row = NULL;
+        r->size = 0;
+        return 0;
+    }
+    if (r->size < sizeof(len) + len) {
+        r->size = MAX(sizeof(len) + len, r->size * 2);
+        r->row = g_realloc(r->row, r->size);
+    }
+    memcpy(r->row, &len, sizeof(len));
+    if (gzread(r->gz, r->row + sizeof(len), len) != (int) len) {
+        fprintf(stderr, "sorted rows read back from a temporary file end abruptly\n");
+        g_free(r->row);
+        r->row = NULL;
+        r->size = 0;
+        return 0;
+    }
+
+    return 1;
+}
+
+/* start reading the run from its first row, again if it's been read before */
+static int run_rewind(run *r)
+{
+    if (r->held) {
+        r->pos = 0;
+        return run_next(r);
+    }
+    if (r->gz) {
+        if (gzrewind(r->gz)) {
+            fprintf(stderr, "can't read sorted rows back from a temporary file\n");
+            return 0;
+        }
+        return run_next(r);
+    }
+    lseek(r->fd, 0, SEEK_SET);
+    r->gz = gzdopen(r->fd, "rb");
+    r->fd = -1;
+    gzbuffer(r->gz, RUN_BUFFER);
+
+    return run_next(r);
+}
+
+/* merging */
+
+static int run_before(sr_sort *sort, run *a, run *b)
+{
+    int c = compare_rows(sort, a->row, b->row);
+
+    return c ? c < 0 : a->index < b->index;
+}
+
+static void sift_down(sr_sort *sort, merge *m, int i)
+{
+    for (;;) {
+        int first = i, left = 2 * i + 1, right = left + 1;
+        if (left < m->len && run_before(sort, m->heap[left], m->heap[first])) {
+            first = left;
+        }
+        if (right < m->len && run_before(sort, m->heap[right], m->heap[first])) {
+            first = right;
+        }
+        if (first == i) {
+            return;
+        }
+        run *r = m->heap[i];
+        m->heap[i] = m->heap[first];
+        m->heap[first] = r;
+        i = first;
+    }
+}
+
+static merge *merge_new(sr_sort *sort, run **runs, int count)
+{
+    merge *m = g_new0(merge, 1);
+    m->heap = g_new(run *, MAX(count, 1));
+    for (int i=0; i<count; i++) {
+        if (run_rewind(runs[i])) {
+            m->heap[m->len++] = runs[i];
+        }
+    }
+    for (int i=m->len/2 - 1; i>=0; i--) {
+        sift_down(sort, m, i);
+    }
+
+    return m;
+}
+
+/* the next row of the runs together, or NULL */
+static const char *merge_next(sr_sort *sort, merge *m)
+{
+    if (m->top) {
+        if (!run_next(m->top)) {
+            m->heap[0] = m->heap[--m->len];
+        }
+        m->top = NULL;
+        sift_down(sort, m, 0);
+    }
+    if (m->len == 0) {
+        return NULL;
+    }
+    m->top = m->heap[0];
+
+    return m->top->row;
+}
+
+static void merge_free(merge *m)
+{
+    g_free(m->heap);
+    g_free(m);
+}
+
+/* write the rows held to a run of their own */
+static void spill(sr_sort *sort)
+{
+    g_ptr_array_sort_with_data(sort->rows, compare_held, sort);
+    run *r = run_new(sort);
+    int ok = r != NULL;
+
+    g_string_truncate(sort->last, 0);
+    for (guint i=0; ok && i<sort->rows->len; i++) {
+        ok = run_write(sort, r, sort->rows->pdata[i]);
+    }
+    if (r && !run_finish(r)) {
+        ok = 0;
+    }
+    if (!ok) {
+        /* carry on in memory */
+        if (r) {
+            run_free(r);
+        }
+        sort->spill_failed = 1;
+        return;
+    }
+    r->index = sort->runs->len;
+    g_ptr_array_add(sort->runs, r);
+    g_ptr_array_set_size(sort->rows, 0);
+    sort->held = 0;
+}
+
+/* merge groups of runs until there are few enough to read at once */
+static void merge_runs(sr_sort *sort)
+{
+    while (sort->runs->len > MERGE_RUNS) {
+        GPtrArray *merged = g_ptr_array_new();
+        for (guint i=0; i<sort->runs->len; i+=MERGE_RUNS) {
+            int count = MIN(MERGE_RUNS, sort->runs->len - i);
+            run **group = (run **) sort->runs->pdata + i;
+            run *r = count > 1 ? run_new(sort) : NULL;
+            if (!r) {
+                /* leave them as they are */
+                for (int j=0; j<count; j++) {
+                    g_ptr_array_add(merged, group[j]);
+                }
+                continue;
+            }
+            merge *m = merge_new(sort, group, count);
+            const char *row;
+            int ok = 1;
+            g_string_truncate(sort->last, 0);
+            while (ok && (row = merge_next(sort, m))) {
+                ok = run_write(sort, r, row);
+            }
+            merge_free(m);
+            ok = run_finish(r) && ok;
+            if (!ok) {
+                /* keep the runs it was made from, they're read again from the start */
+                run_free(r);
+                for (int j=0; j<count; j++) {
+                    g_ptr_array_add(merged, group[j]);
+                }
+                continue;
+            }
+            for (int j=0; j<count; j++) {
+                run_free(group[j]);
+            }
+            g_ptr_array_add(merged, r);
+        }
+        if (merged->len == sort->runs->len) {
+            g_ptr_array_free(merged, TRUE);
+            break;
+        }
+        for (guint i=0; i<merged->len; i++) {
+            ((run *) merged->pdata[i])->index = i;
+        }
+        g_ptr_array_free(sort->runs, TRUE);
+        sort->runs = merged;
+    }
+}
+
+sr_sort *sr_sort_new(int cols, char **names, const char *order, int distinct, size_t memory)
+{
+    sr_sort *sort = g_new0(sr_sort, 1);
+    sort->cols = cols;
+    sort->distinct = distinct;
+    sort->memory = memory;
+    sort->rows = g_ptr_array_new_with_free_func(g_free);
+    sort->runs = g_ptr_array_new();
+    sort->last = g_string_new(NULL);
+    sort->a = g_new0(sr_term, MAX(cols, 1));
+    sort->b = g_new0(sr_term, MAX(cols, 1));
+    sort->out = g_new0(sr_term, MAX(cols, 1));
+
+    char **vars = g_strsplit_set(order ? order : "", ", ", -1);
+    sort->keys = g_new0(key, g_strv_length(vars) + 1);
+    for (char **v = vars; *v; v++) {
+        const char *var = *v;
+        int descending = *var == '-';
+        var += descending;
+        if (*var == '?' || *var == '$') {
+            var++;
+        }
+        if (!*var) {
+            continue;
+        }
+        int col = -1;
+        for (int i=0; i<cols; i++) {
+            if (!strcmp(names[i], var)) {
+                col = i;
+                break;
+            }
+        }
+        if (col < 0) {
+            fprintf(stderr, "can't order by ?%s, the results don't have it\n", var);
+            continue;
+        }
+        sort->keys[sort->nkeys++] = (key) { col, descending };
+    }
+    g_strfreev(vars);
+
+    return sort;
+}
+
+void sr_sort_add(sr_sort *sort, const sr_term *row)
+{
+    GString *packed = g_string_sized_new(64);
+    guint32 len = 0;
+    g_string_append_len(packed, (const char *) &len, sizeof(len));
+    sr_pack_row(packed, row, sort->cols);
+    len = packed->len - sizeof(len);
+    memcpy(packed->str, &len, sizeof(len));
+
+    sort->held += packed->len + ROW_OVERHEAD;
+    g_ptr_array_add(sort->rows, g_string_free(packed, FALSE));
+    if (sort->held > sort->memory && !sort->spill_failed) {
+        spill(sort);
+    }
+}
+
+const sr_term *sr_sort_next(sr_sort *sort)
+{
+    if (!sort->merge) {
+        /* the rows still held are merged from memory, they're the last run */
+        g_ptr_array_sort_with_data(sort->rows, compare_held, sort);
+        merge_runs(sort);
+        run *r = g_new0(run, 1);
+        r->fd = -1;
+        r->held = sort->rows;
+        r->index = sort->runs->len;
+        g_ptr_array_add(sort->runs, r);
+        sort->rows = NULL;
+        sort->merge = merge_new(sort, (run **) sort->runs->pdata, sort->runs->len);
+        g_string_truncate(sort->last, 0);
+    }
+
+    const char *row;
+    while ((row = merge_next(sort, sort->merge))) {
+        if (!sort->distinct) {
+            break;
+        }
+        if (!sort->last->len || compare_rows(sort, sort->last->str, row)) {
+            g_string_truncate(sort->last, 0);
+            g_string_append_len(sort->last, row, sizeof(guint32) + row_len(row));
+            break;
+        }
+    }
+    if (!row) {
+        return NULL;
+    }
+    sr_unpack_row(row_data(row), sort->out, sort->cols);
+
+    return sort->out;
+}
+
+void sr_sort_free(sr_sort *sort)
+{
+    if (sort->merge) {
+        merge_free(sort->merge);
+    }
+    for (guint i=0; i<sort->runs->len; i++) {
+        run_free(sort->runs->pdata[i]);
+    }
+    g_ptr_array_free(sort->runs, TRUE);
+    if (sort->rows) {
+        g_ptr_array_free(sort->rows, TRUE);
+    }
+    g_string_free(sort->last, TRUE);
+    g_free(sort->keys);
+    g_free(sort->a);
+    g_free(sort->b);
+    g_free(sort->out);
+    g_free(sort);
+}
+
+/* vi:set expandtab sts=4 sw=4: */
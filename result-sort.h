@@ -0,0 +1,33 @@
+#ifndef RESULT_SORT_H
+#define RESULT_SORT_H
+
+#include <stddef.h>
+#include <glib.h>
+
+#include "result-parse.h"
+
+typedef struct _sr_sort sr_sort;
+
+/* sorts rows of cols columns by the variables in order, separated by
+ * commas or spaces, each descending if it starts with '-'. With distinct,
+ * repeated rows are left out, and any tie is broken by the whole row so
+ * that they come together. Otherwise rows that tie keep their order. Rows
+ * are held in up to memory bytes, the rest go to temporary files */
+sr_sort *sr_sort_new(int cols, char **names, const char *order, int distinct, size_t memory);
+
+void sr_sort_add(sr_sort *sort, const sr_term *row);
+
+/* the next row in order, or NULL once they've all been read. The terms
+ * last until the next call */
+const sr_term *sr_sort_next(sr_sort *sort);
+
+void sr_sort_free(sr_sort *sort);
+
+/* append a row of cols terms to buf, a byte for each kind then the value,
+ * datatype and language tag, each ending in a NUL */
+void sr_pack_row(GString *buf, const sr_term *row, int cols);
+
+/* point row at the terms packed at data, returning where the next begins */
+const char *sr_unpack_row(const char *data, sr_term *row, int cols);
+
+#endif
@@ -0,0 +1,331 @@
+/*  sparql-query - a SPARQL client with GNU readline support
+    Copyright (C) 2006-8 Nick Lamb and Steve Harris for Garlik
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Results split into gzipped parts
+ *
+ * Rows are formatted into blocks of SPLIT_BLOCK bytes, and each block is
+ * compressed on its own, by whichever thread of the pool is free, into a
+ * gzip member. Members joined together are a gzip file, so a part is just
+ * its members in order. They're written WRITE_BLOCK at a time, so every
+ * write but a part's last starts and ends on a WRITE_BLOCK boundary.
+ *
+ * A part is listed in the manifest only once it's complete, so loaders can
+ * take each one as it's listed while the rest are still being written.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <glib.h>
+#include <zlib.h>
+
+#include "result-split.h"
+
+/* uncompressed bytes in a gzip member */
+#define SPLIT_BLOCK (1024 * 1024)
+
+#define WRITE_BLOCK (1024 * 1024)
+
+/* blocks that may be waiting or being compressed, per thread */
+#define BLOCKS_PER_JOB 2
+
+typedef struct {
+    GString *in;
+    guint8 *out;
+    size_t out_len;
+    int done;
+} block;
+
+struct _sr_split {
+    char *prefix;
+    long max_rows;
+    size_t max_bytes;
+    int cols;
+    GString *head;
+    GString *rows;   /* not yet handed to the pool */
+    GThreadPool *pool;
+    int jobs;
+    GQueue *pending; /* blocks handed over, oldest first */
+    GMutex lock;
+    GCond done;
+    GByteArray *out; /* compressed, waiting for a whole WRITE_BLOCK */
+    FILE *manifest;
+    int part;        /* the number of the part being written, 0 before the first */
+    int fd;          /* of it, -1 if none is open */
+    char *filename;
+    long part_rows;
+    size_t part_bytes;
+    size_t written;
+    int failed;
+};
+
+static void compress_block(gpointer data, gpointer user_data)
+{
+    block *b = data;
+    sr_split *split = user_data;
+    z_stream z = { .next_in = (Bytef *) b->in->str, .avail_in = b->in->len };
+
+    /* 16 more window bits for a gzip rather than zlib wrapper */
+    deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+    size_t bound = deflateBound(&z, b->in->len);
+    b->out = g_malloc(bound);
+    z.next_out = b->out;
+    z.avail_out = bound;
+    deflate(&z, Z_FINISH);
+    b->out_len = bound - z.avail_out;
+    deflateEnd(&z);
+
+    g_mutex_lock(&split->lock);
+    b->done = 1;
+    g_cond_broadcast(&split->done);
+    g_mutex_unlock(&split->lock);
+}
+
+static void write_out(sr_split *split, size_t len)
+{
+    for (size_t at = 0; at < len && !split->failed; ) {
+        ssize_t wrote = write(split->fd, split->out->data + at, len - at);
+        if (wrote < 0) {
+            fprintf(stderr, "can't write %s: %s\n", split->filename, strerror(errno));
+            split->failed = 1;
+            break;
+        }
+        at += wrote;
+    }
+    g_byte_array_remove_range(split->out, 0, len);
+}
+
+/* write out compressed blocks in order, until no more than waiting are
+ * still to come */
+static void drain(sr_split *split, guint waiting)
+{
+    block *b;
+
+    while ((b = g_queue_peek_head(split->pending))) {
+        g_mutex_lock(&split->lock);
+        while (!b->done && g_queue_get_length(split->pending) > waiting) {
+            g_cond_wait(&split->done, &split->lock);
+        }
+        int done = b->done;
+        g_mutex_unlock(&split->lock);
+        if (!done) {
+            break;
+        }
+        g_queue_pop_head(split->pending);
+        g_byte_array_append(split->out, b->out, b->out_len);
+        split->written += b->out_len;
+        while (split->out->len >= WRITE_BLOCK) {
+            write_out(split, WRITE_BLOCK);
+        }
+        g_string_free(b->in, TRUE);
+        g_free(b->out);
+        g_free(b);
+    }
+}
+
+static void send_rows(sr_split *split)
+{
+    if (!split->rows->len) {
+        return;
+    }
+    block *b = g_new0(block, 1);
+    b->in = split->rows;
+    split->rows = g_string_sized_new(SPLIT_BLOCK + 1024);
+    g_queue_push_tail(split->pending, b);
+    g_thread_pool_push(split->pool, b, NULL);
+    drain(split, split->jobs * BLOCKS_PER_JOB);
+}
+
+static void open_part(sr_split *split)
+{
+    split->part++;
+    split->filename = g_strdup_printf("%s-%05d.tsv.gz", split->prefix, split->part);
+    split->fd = open(split->filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (split->fd < 0) {
+        fprintf(stderr, "can't write %s: %s\n", split->filename, strerror(errno));
+        split->failed = 1;
+    }
+    split->part_rows = 0;
+    split->part_bytes = 0;
+    split->written = 0;
+    g_string_append_len(split->rows, split->head->str, split->head->len);
+}
+
+static void close_part(sr_split *split)
+{
+    send_rows(split);
+    drain(split, 0);
+    write_out(split, split->out->len);
+    if (split->fd >= 0 && close(split->fd)) {
+        fprintf(stderr, "can't write %s: %s\n", split->filename, strerror(errno));
+        split->failed = 1;
+    }
+    split->fd = -1;
+    if (!split->failed && split->manifest) {
+        char *name = g_path_get_basename(split->filename);
+        fprintf(split->manifest, "%s\t%ld\t%zu\n", name, split->part_rows, split->written);
+        fflush(split->manifest);
+        g_free(name);
+    }
+    g_free(split->filename);
+    split->filename = NULL;
+}
+
+sr_split *sr_split_new(const char *prefix, long rows, size_t bytes, int jobs, int cols, char **names)
+{
+    sr_split *split = g_new0(sr_split, 1);
+    split->prefix = g_strdup(prefix);
+    split->max_rows = rows || bytes ? rows : SR_SPLIT_DEFAULT_ROWS;
+    split->max_bytes = bytes;
+    split->cols = cols;
+    split->jobs = jobs ? jobs : (int) g_get_num_processors();
+    split->fd = -1;
+    split->head = g_string_new(NULL);
+    for (int i=0; i<cols; i++) {
+        g_string_append_printf(split->head, "%s?%s", i > 0 ? "\t" : "", names[i]);
+    }
+    g_string_append_c(split->head, '\n');
+    split->rows = g_string_sized_new(SPLIT_BLOCK + 1024);
+    split->out = g_byte_array_sized_new(WRITE_BLOCK + SPLIT_BLOCK);
+    split->pending = g_queue_new();
+    g_mutex_init(&split->lock);
+    g_cond_init(&split->done);
+    split->pool = g_thread_pool_new(compress_block, split, split->jobs, FALSE, NULL);
+
+    char *manifest = g_strconcat(prefix, ".manifest", NULL);
+    if (!(split->manifest = fopen(manifest, "w"))) {
+        fprintf(stderr, "can't write %s: %s\n", manifest, strerror(errno));
+        split->failed = 1;
+    }
+    g_free(manifest);
+
+    return split;
+}
+
+/* a literal as a SPARQL TSV term, quoted and escaped so it's one field */
+static void append_literal(GString *out, const sr_term *term)
+{
+    const char *pos = term->value;
+
+    g_string_append_c(out, '"');
+    for (;;) {
+        size_t plain = strcspn(pos, "\"\\\n\r\t");
+        g_string_append_len(out, pos, plain);
+        pos += plain;
+        if (!*pos) {
+            break;
+        }
+        switch (*pos++) {
+            case '"': g_string_append(out, "\\\""); break;
+            case '\\': g_string_append(out, "\\\\"); break;
+            case '\n': g_string_append(out, "\\n"); break;
+            case '\r': g_string_append(out, "\\r"); break;
+            case '\t': g_string_append(out, "\\t"); break;
+        }
+    }
+    g_string_append_c(out, '"');
+    if (term->lang) {
+        g_string_append_c(out, '@');
+        g_string_append(out, term->lang);
+    } else if (term->datatype) {
+        g_string_append(out, "^^<");
+        g_string_append(out, term->datatype);
+        g_string_append_c(out, '>');
+    }
+}
+
+void sr_split_row(sr_split *split, const sr_term *row)
+{
+    if (split->fd < 0) {
+        if (split->failed) {
+            return;
+        }
+        open_part(split);
+    }
+
+    size_t before = split->rows->len;
+    for (int i=0; i<split->cols; i++) {
+        const sr_term *term = &row[i];
+        if (i > 0) {
+            g_string_append_c(split->rows, '\t');
+        }
+        switch (term->kind) {
+            case SR_URI:
+                g_string_append_c(split->rows, '<');
+                g_string_append(split->rows, term->value);
+                g_string_append_c(split->rows, '>');
+                break;
+            case SR_BNODE:
+                g_string_append(split->rows, "_:");
+                g_string_append(split->rows, term->value);
+                break;
+            case SR_LITERAL:
+                append_literal(split->rows, term);
+                break;
+            case SR_UNBOUND:
+                break;
+        }
+    }
+    g_string_append_c(split->rows, '\n');
+    split->part_rows++;
+    split->part_bytes += split->rows->len - before;
+
+    if (split->rows->len >= SPLIT_BLOCK) {
+        send_rows(split);
+    }
+    if ((split->max_rows && split->part_rows >= split->max_rows) ||
+        (split->max_bytes && split->part_bytes >= split->max_bytes)) {
+        close_part(split);
+    }
+}
+
+int sr_split_finish(sr_split *split, int complete)
+{
+    if (!complete) {
+        /* keep what came, but don't list it */
+        split->failed = 1;
+    }
+    if (!split->part && !split->failed) {
+        /* no rows, but still the head */
+        open_part(split);
+    }
+    if (split->fd >= 0) {
+        close_part(split);
+    }
+    int failed = split->failed;
+
+    g_thread_pool_free(split->pool, FALSE, TRUE);
+    if (split->manifest && fclose(split->manifest)) {
+        fprintf(stderr, "can't write %s.manifest: %s\n", split->prefix, strerror(errno));
+        failed = 1;
+    }
+    g_queue_free(split->pending);
+    g_mutex_clear(&split->lock);
+    g_cond_clear(&split->done);
+    g_byte_array_free(split->out, TRUE);
+    g_string_free(split->rows, TRUE);
+    g_string_free(split->head, TRUE);
+    g_free(split->prefix);
+    g_free(split);
+
+    return failed;
+}
+
+/* vi:set expandtab sts=4 sw=4: */
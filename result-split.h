@@ -0,0 +1,27 @@
+#ifndef RESULT_SPLIT_H
+#define RESULT_SPLIT_H
+
+#include <stddef.h>
+
+#include "result-parse.h"
+
+/* rows per part if neither rows nor bytes are given to sr_split_new() */
+#define SR_SPLIT_DEFAULT_ROWS 1000000
+
+typedef struct _sr_split sr_split;
+
+/* writes rows of cols columns as SPARQL TSV in gzipped parts, prefix-00001.tsv.gz
+ * and on, each with the head, starting the next once one has rows rows or
+ * bytes bytes of TSV, whichever comes first (0 for no limit). jobs threads
+ * compress, 0 for one per processor. prefix.manifest gets a line for each
+ * part as it's finished */
+sr_split *sr_split_new(const char *prefix, long rows, size_t bytes, int jobs, int cols, char **names);
+
+void sr_split_row(sr_split *split, const sr_term *row);
+
+/* finish the last part and free split. If the rows weren't complete, the
+ * last part is written but left out of the manifest. Returns non-zero if
+ * any part couldn't be written, or complete is 0 */
+int sr_split_finish(sr_split *split, int complete);
+
+#endif
@@ -0,0 +1,366 @@
+/*  sparql-query - a SPARQL client with GNU readline support
+    Copyright (C) 2006-8 Nick Lamb and Steve Harris for Garlik
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* feeds sr_parse() adversarial results documents and checks that peak RSS
+ * stays within the configured limits, then checks that sr_sort puts rows in
+ * SPARQL order and drops repeats when it has to spill them to disk, and that
+ * SPARQL TSV results read back as the terms they were written as */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <glib.h>
+#include <zlib.h>
+
+#include "result-parse.h"
+#include "result-sort.h"
+
+/* allowance for the program, libxml2 and stdio on top of the parse limit */
+#define RSS_SLACK (8 * 1024 * 1024)
+
+#define PARSE_MEMORY (4 * 1024 * 1024)
+
+/* a few dozen rows a run, so there are many more runs than one merge reads */
+#define SORT_MEMORY 4096
+#define SORT_ROWS 10000
+#define SORT_KEYS 1000
+
+#define XSD "http://www.w3.org/2001/XMLSchema#"
+
+static const char *doc_start =
+    "<?xml version=\"1.0\"?>\n"
+    "<sparql xmlns=\"http://www.w3.org/2005/sparql-results#\">\n";
+
+/* write count kilobytes of text */
+static void filler(FILE *f, int count)
+{
+    char block[1024];
+    memset(block, 'x', sizeof(block));
+    /* libxml2 is slow on very long lines */
+    block[sizeof(block) - 1] = '\n';
+    for (int i=0; i<count; i++) {
+        fwrite(block, sizeof(block), 1, f);
+    }
+}
+
+/* one 256MB literal */
+static void huge_literal(FILE *f)
+{
+    fprintf(f, "%s<head><variable name=\"x\"/></head>\n<results><result><binding name=\"x\"><literal>", doc_start);
+    filler(f, 256 * 1024);
+    fprintf(f, "</literal></binding></result></results>\n</sparql>\n");
+}
+
+/* a million variables, and a row binding every one of them */
+static void wide_head(FILE *f)
+{
+    fprintf(f, "%s<head>", doc_start);
+    for (int i=0; i<1000000; i++) {
+        fprintf(f, "<variable name=\"v%d\"/>", i);
+    }
+    fprintf(f, "</head>\n<results><result>");
+    for (int i=0; i<1000000; i++) {
+        fprintf(f, "<binding name=\"v%d\"><literal>%d</literal></binding>", i, i);
+    }
+    fprintf(f, "</result></results>\n</sparql>\n");
+}
+
+/* a row of 256 values each just under the literal limit */
+static void fat_row(FILE *f)
+{
+    fprintf(f, "%s<head>", doc_start);
+    for (int i=0; i<256; i++) {
+        fprintf(f, "<variable name=\"v%d\"/>", i);
+    }
+    fprintf(f, "</head>\n<results><result>");
+    for (int i=0; i<256; i++) {
+        fprintf(f, "<binding name=\"v%d\"><uri>http://example.org/", i);
+        filler(f, 60);
+        fprintf(f, "</uri></binding>");
+    }
+    fprintf(f, "</result></results>\n</sparql>\n");
+}
+
+static sr_term term(enum sr_term_kind kind, const char *value, const char *datatype, const char *lang)
+{
+    return (sr_term) { kind, (char *) value, (char *) datatype, (char *) lang };
+}
+
+/* integer keys with ties, in many runs, sorted both ways. Ties keep the
+ * order they came in */
+static int sort_runs(const char *order)
+{
+    char *names[] = { "n", "seq" };
+    sr_sort *sort = sr_sort_new(2, names, order, 0, SORT_MEMORY);
+    int descending = order[0] == '-';
+
+    for (int i=0; i<SORT_ROWS; i++) {
+        char n[16], seq[16];
+        snprintf(n, sizeof(n), "%d", i * 7919 % SORT_KEYS);
+        snprintf(seq, sizeof(seq), "%d", i);
+        sr_term row[] = { term(SR_LITERAL, n, XSD "integer", NULL), term(SR_LITERAL, seq, XSD "integer", NULL) };
+        sr_sort_add(sort, row);
+    }
+
+    int ok = 1, count = 0;
+    long last_n = 0, last_seq = 0;
+    const sr_term *row;
+    while ((row = sr_sort_next(sort))) {
+        long n = atol(row[0].value), seq = atol(row[1].value);
+        if (count > 0) {
+            int before = descending ? n > last_n : n < last_n;
+            ok &= !before && (n != last_n || seq > last_seq);
+        }
+        last_n = n;
+        last_seq = seq;
+        count++;
+    }
+    sr_sort_free(sort);
+
+    return ok && count == SORT_ROWS;
+}
+
+/* each kind of term, many times over and spilled as they come. Terms only
+ * repeat if kind, value, datatype and language tag, in any case, agree */
+static int sort_distinct()
+{
+    const sr_term terms[] = {
+        term(SR_UNBOUND, NULL, NULL, NULL),
+        term(SR_LITERAL, "x", NULL, NULL),
+        term(SR_LITERAL, "x", NULL, "en"),
+        term(SR_LITERAL, "x", NULL, "EN"),
+        term(SR_LITERAL, "x", NULL, "fr"),
+        term(SR_LITERAL, "x", XSD "string", NULL),
+        term(SR_LITERAL, "x", XSD "token", NULL),
+        term(SR_URI, "x", NULL, NULL),
+        term(SR_BNODE, "x", NULL, NULL),
+    };
+    const int distinct = G_N_ELEMENTS(terms) - 1;
+    char *names[] = { "t" };
+    sr_sort *sort = sr_sort_new(1, names, NULL, 1, 256);
+
+    for (int i=0; i<SORT_ROWS; i++) {
+        sr_sort_add(sort, &terms[i * 7 % G_N_ELEMENTS(terms)]);
+    }
+    int count = 0;
+    while (sr_sort_next(sort)) {
+        count++;
+    }
+    sr_sort_free(sort);
+
+    return count == distinct;
+}
+
+/* unbound, blank nodes, IRIs, numbers by value, then other literals */
+static int sort_term_order()
+{
+    const sr_term terms[] = {
+        term(SR_UNBOUND, NULL, NULL, NULL),
+        term(SR_BNODE, "b", NULL, NULL),
+        term(SR_URI, "http://example.org/a", NULL, NULL),
+        term(SR_URI, "http://example.org/b", NULL, NULL),
+        term(SR_LITERAL, "-1", XSD "decimal", NULL),
+        term(SR_LITERAL, "1.5e0", XSD "double", NULL),
+        term(SR_LITERAL, "2", XSD "integer", NULL),
+        term(SR_LITERAL, "10", XSD "integer", NULL),
+        term(SR_LITERAL, "a", NULL, NULL),
+        term(SR_LITERAL, "a", NULL, "en"),
+        term(SR_LITERAL, "a", XSD "string", NULL),
+        term(SR_LITERAL, "b", NULL, NULL),
+    };
+    const int count = G_N_ELEMENTS(terms);
+    char *names[] = { "t" };
+    /* a row a run, so the order comes from the merge */
+    sr_sort *sort = sr_sort_new(1, names, "t", 0, 1);
+
+    for (int i=0; i<count; i++) {
+        sr_sort_add(sort, &terms[(count - 1 - i) * 5 % count]);
+    }
+    int ok = 1;
+    for (int i=0; i<count; i++) {
+        const sr_term *row = sr_sort_next(sort);
+        ok &= row && row->kind == terms[i].kind && !g_strcmp0(row->value, terms[i].value) &&
+              !g_strcmp0(row->datatype, terms[i].datatype) && !g_strcmp0(row->lang, terms[i].lang);
+    }
+    ok &= !sr_sort_next(sort);
+    sr_sort_free(sort);
+
+    return ok;
+}
+
+/* read tsv and write it out again as TSV parts, which quote and escape
+ * every literal and give its datatype, returning what was written */
+static char *tsv_round_trip(const char *tsv)
+{
+    char dir[] = "/tmp/sparql-test-XXXXXX";
+    if (!mkdtemp(dir)) {
+        return NULL;
+    }
+    char *prefix = g_strconcat(dir, "/part", NULL);
+    sr_set_split(prefix, 0, 0, 1);
+    int failed = sr_parse_buffer(tsv, strlen(tsv), "text/tab-separated-values");
+    sr_set_split(NULL, 0, 0, 0);
+
+    char *part = g_strconcat(prefix, "-00001.tsv.gz", NULL);
+    char *manifest = g_strconcat(prefix, ".manifest", NULL);
+    GString *out = g_string_new(NULL);
+    gzFile gz = gzopen(part, "rb");
+    if (gz) {
+        char buf[4096];
+        int len;
+        while ((len = gzread(gz, buf, sizeof(buf))) > 0) {
+            g_string_append_len(out, buf, len);
+        }
+        gzclose(gz);
+    }
+    unlink(part);
+    unlink(manifest);
+    rmdir(dir);
+    g_free(part);
+    g_free(manifest);
+    g_free(prefix);
+
+    return g_string_free(out, failed || !gz);
+}
+
+static int tsv_matches(const char *tsv, const char *expected)
+{
+    char *read = tsv_round_trip(tsv);
+    int ok = read && !strcmp(read, expected);
+    if (!ok) {
+        fprintf(stderr, "read\n%s", read ? read : "nothing\n");
+    }
+    g_free(read);
+
+    return ok;
+}
+
+/* quoted escapes, \u and \U, tags, bare numbers and booleans, CRLF and a
+ * last line without a newline */
+static int tsv_escapes()
+{
+    return tsv_matches(
+        "?s\t?o\n"
+        "<http://example.org/a>\t\"tab\\there\\nnew \\\"q\\\" back\\\\slash\"\n"
+        "_:b1\t\"caf\\u00E9 \\U0001F600\"@fr\n"
+        "<http://example.org/b>\t\"5\"^^<" XSD "int>\n"
+        "\t42\n"
+        "\t-1.5\n"
+        "\t1e3\n"
+        "\ttrue\n"
+        "<http://example.org/c>\t\"crlf\"\r\n"
+        "<http://example.org/d>\t\"last\"",
+        "?s\t?o\n"
+        "<http://example.org/a>\t\"tab\\there\\nnew \\\"q\\\" back\\\\slash\"\n"
+        "_:b1\t\"caf\xc3\xa9 \xf0\x9f\x98\x80\"@fr\n"
+        "<http://example.org/b>\t\"5\"^^<" XSD "int>\n"
+        "\t\"42\"^^<" XSD "integer>\n"
+        "\t\"-1.5\"^^<" XSD "decimal>\n"
+        "\t\"1e3\"^^<" XSD "double>\n"
+        "\t\"true\"^^<" XSD "boolean>\n"
+        "<http://example.org/c>\t\"crlf\"\n"
+        "<http://example.org/d>\t\"last\"\n");
+}
+
+/* rows with fewer cells than variables leave the rest unbound, and cells
+ * past the last variable are dropped */
+static int tsv_ragged()
+{
+    return tsv_matches(
+        "?a\t?b\t?c\n"
+        "1\n"
+        "<http://example.org/x>\t<http://example.org/y>\t<http://example.org/z>\t<http://example.org/extra>\t\"more\"\n"
+        "\n"
+        "\t\t<http://example.org/z>\n"
+        "\"a\\tb\"\t\"c\"\n",
+        "?a\t?b\t?c\n"
+        "\"1\"^^<" XSD "integer>\t\t\n"
+        "<http://example.org/x>\t<http://example.org/y>\t<http://example.org/z>\n"
+        "\t\t\n"
+        "\t\t<http://example.org/z>\n"
+        "\"a\\tb\"\t\"c\"\t\n");
+}
+
+static long peak_rss()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    return usage.ru_maxrss * 1024L;
+}
+
+int main()
+{
+    struct {
+        const char *name;
+        void (*generate)(FILE *f);
+    } docs[] = {
+        { "huge literal", huge_literal },
+        { "wide head", wide_head },
+        { "fat row", fat_row },
+        { NULL, NULL }
+    };
+    int failed = 0;
+
+    sr_set_limits(64 * 1024, 256, PARSE_MEMORY);
+    /* results go nowhere, we only care about how much memory they took */
+    if (!freopen("/dev/null", "w", stdout)) {
+        perror("/dev/null");
+        return 1;
+    }
+
+    for (int i=0; docs[i].name; i++) {
+        char filename[] = "/tmp/sparql-test-XXXXXX";
+        int fd = mkstemp(filename);
+        FILE *f = fdopen(fd, "w");
+        docs[i].generate(f);
+        fclose(f);
+
+        sr_parse(filename, "text/plain");
+        sr_parse(filename, "application/sparql-results+xml");
+        unlink(filename);
+
+        long rss = peak_rss();
+        int ok = rss < PARSE_MEMORY + RSS_SLACK;
+        fprintf(stderr, "%s: peak RSS %ldkB %s\n", docs[i].name, rss / 1024, ok ? "ok" : "FAILED");
+        failed |= !ok;
+    }
+
+    struct {
+        const char *name;
+        int ok;
+    } sorts[] = {
+        { "sort ascending", sort_runs("n") },
+        { "sort descending", sort_runs("-n") },
+        { "sort distinct", sort_distinct() },
+        { "sort term order", sort_term_order() },
+        { "tsv escapes", tsv_escapes() },
+        { "tsv ragged rows", tsv_ragged() },
+        { NULL, 0 }
+    };
+    for (int i=0; sorts[i].name; i++) {
+        fprintf(stderr, "%s: %s\n", sorts[i].name, sorts[i].ok ? "ok" : "FAILED");
+        failed |= !sorts[i].ok;
+    }
+
+    return failed;
+}
+
+/* vi:set expandtab sts=4 sw=4: */
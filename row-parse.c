@@ -0,0 +1,338 @@
+/*  sparql-query - a SPARQL client with GNU readline support
+    Copyright (C) 2006-8 Nick Lamb and Steve Harris for Garlik
+ 
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Streaming SPARQL XML results
+ *
+ * A libxml2 push parser with SAX callbacks, so a result is handed on as
+ * soon as its closing tag arrives and only one is ever held in memory.
+ * The strings of a result are gathered into one buffer, reused from one
+ * result to the next, and its terms point into that, so nothing is
+ * allocated per term. Bindings for variables missing from the head are
+ * ignored. Limits on columns and on the length of values keep a hostile
+ * document from taking more memory than the caller allows.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <libxml/parser.h>
+#include <libxml/SAX2.h>
+
+#include "sparqlquery.h"
+
+/* where in the result's buffer a term's strings start, if they're there */
+#define NOWHERE ((size_t) -1)
+
+/* more than "true" with any whitespace a server is likely to put round it */
+#define BOOLEAN_TEXT 64
+
+typedef struct {
+    size_t value;
+    size_t lang;
+    size_t datatype;
+} offsets;
+
+struct _sq_parser {
+    xmlParserCtxtPtr xml;
+    sq_head_fn head;
+    sq_row_fn row;
+    sq_boolean_fn boolean;
+    void *data;
+
+    GPtrArray *names;
+    GHashTable *index; /* of names, to their columns */
+    sq_term *terms;   /* of the result being parsed, once the head is known */
+    offsets *at;      /* of each term's strings in buf */
+    GString *buf;     /* the strings of the result being parsed */
+    int col;          /* of the current binding, or -1 */
+    enum sq_kind kind;
+    offsets value;    /* of the value being read */
+    GString *text;
+    int in_value;
+    int in_boolean;
+    int cut;          /* the value being read was cut short */
+
+    int max_columns;
+    size_t max_value;
+    size_t max_result;
+    int dropped;      /* variables past max_columns */
+    int answered;     /* the results or boolean have ended */
+    int done;         /* and then the document */
+};
+
+static char *attribute_value(const xmlChar **attributes, int nb_attributes, const char *name)
+{
+    for (int i=0; i<nb_attributes; i++) {
+        if (!strcmp((const char *) attributes[i * 5], name)) {
+            return g_strndup((const char *) attributes[i * 5 + 3], attributes[i * 5 + 4] - attributes[i * 5 + 3]);
+        }
+    }
+
+    return NULL;
+}
+
+/* copy an attribute's value into the result's buffer */
+static size_t keep_attribute(sq_parser *p, const xmlChar **attributes, int nb_attributes, const char *name)
+{
+    for (int i=0; i<nb_attributes; i++) {
+        if (!strcmp((const char *) attributes[i * 5], name)) {
+            size_t at = p->buf->len;
+            g_string_append_len(p->buf, (const char *) attributes[i * 5 + 3], attributes[i * 5 + 4] - attributes[i * 5 + 3]);
+            g_string_append_c(p->buf, '\0');
+            return at;
+        }
+    }
+
+    return NOWHERE;
+}
+
+static void clear_terms(sq_parser *p)
+{
+    for (guint i=0; i<p->names->len; i++) {
+        p->at[i] = (offsets) { NOWHERE, NOWHERE, NOWHERE };
+        p->terms[i] = (sq_term) { SQ_UNBOUND, NULL, NULL, NULL, 0 };
+    }
+    g_string_truncate(p->buf, 0);
+}
+
+static const char *in_buf(sq_parser *p, size_t at)
+{
+    return at == NOWHERE ? NULL : p->buf->str + at;
+}
+
+static void xml_start(void *ctx, const xmlChar *localname, const xmlChar *prefix,
+                      const xmlChar *URI, int nb_namespaces, const xmlChar **namespaces,
+                      int nb_attributes, int nb_defaulted, const xmlChar **attributes)
+{
+    sq_parser *p = ((xmlParserCtxtPtr) ctx)->_private;
+    const char *name = (const char *) localname;
+
+    if (!strcmp(name, "variable") && !p->terms) {
+        char *var = attribute_value(attributes, nb_attributes, "name");
+        if (!var || g_hash_table_contains(p->index, var)) {
+            g_free(var);
+        } else if ((int) p->names->len >= p->max_columns) {
+            p->dropped++;
+            g_free(var);
+        } else {
+            g_hash_table_insert(p->index, var, GINT_TO_POINTER(p->names->len));
+            g_ptr_array_add(p->names, var);
+        }
+    } else if (!strcmp(name, "results") && !p->terms) {
+        p->terms = g_new0(sq_term, MAX(p->names->len, 1));
+        p->at = g_new0(offsets, MAX(p->names->len, 1));
+        clear_terms(p);
+        if (p->head) {
+            p->head(p->data, p->names->len, (char **) p->names->pdata);
+        }
+    } else if (!strcmp(name, "binding") && p->terms) {
+        char *var = attribute_value(attributes, nb_attributes, "name");
+        gpointer col;
+        p->col = var && g_hash_table_lookup_extended(p->index, var, NULL, &col) ? GPOINTER_TO_INT(col) : -1;
+        g_free(var);
+    } else if (!strcmp(name, "uri") || !strcmp(name, "bnode") || !strcmp(name, "literal")) {
+        p->kind = name[0] == 'u' ? SQ_URI : name[0] == 'b' ? SQ_BNODE : SQ_LITERAL;
+        p->in_value = 1;
+        p->cut = 0;
+        if (p->col < 0) {
+            return;
+        }
+        /* xml:lang */
+        p->value.lang = keep_attribute(p, attributes, nb_attributes, "lang");
+        p->value.datatype = keep_attribute(p, attributes, nb_attributes, "datatype");
+        p->value.value = p->buf->len;
+    } else if (!strcmp(name, "boolean")) {
+        g_string_truncate(p->text, 0);
+        p->in_boolean = 1;
+    }
+}
+
+static void xml_end(void *ctx, const xmlChar *localname, const xmlChar *prefix, const xmlChar *URI)
+{
+    sq_parser *p = ((xmlParserCtxtPtr) ctx)->_private;
+    const char *name = (const char *) localname;
+
+    if (p->in_value && (!strcmp(name, "uri") || !strcmp(name, "bnode") || !strcmp(name, "literal"))) {
+        p->in_value = 0;
+        if (p->col >= 0) {
+            g_string_append_c(p->buf, '\0');
+            p->terms[p->col].kind = p->kind;
+            p->terms[p->col].truncated = p->cut;
+            p->at[p->col] = p->value;
+        }
+    } else if (!strcmp(name, "binding")) {
+        p->col = -1;
+    } else if (!strcmp(name, "result") && p->terms) {
+        if (p->row) {
+            /* only now, the buffer may have moved as it grew */
+            for (guint i=0; i<p->names->len; i++) {
+                p->terms[i].value = in_buf(p, p->at[i].value);
+                p->terms[i].lang = in_buf(p, p->at[i].lang);
+                p->terms[i].datatype = in_buf(p, p->at[i].datatype);
+            }
+            p->row(p->data, p->terms);
+        }
+        clear_terms(p);
+    } else if (!strcmp(name, "results") && p->terms) {
+        p->answered = 1;
+    } else if (p->in_boolean && !strcmp(name, "boolean")) {
+        p->in_boolean = 0;
+        p->answered = 1;
+        g_strstrip(p->text->str);
+        if (p->boolean) {
+            p->boolean(p->data, !strcmp(p->text->str, "true"));
+        }
+    } else if (!strcmp(name, "sparql")) {
+        p->done = p->answered;
+    }
+}
+
+static void xml_characters(void *ctx, const xmlChar *ch, int len)
+{
+    sq_parser *p = ((xmlParserCtxtPtr) ctx)->_private;
+
+    if (p->in_value && p->col >= 0 && !p->cut) {
+        size_t used = p->buf->len - p->value.value;
+        size_t room = p->max_value > used ? p->max_value - used : 0;
+        room = MIN(room, p->max_result > p->buf->len ? p->max_result - p->buf->len : 0);
+        if ((size_t) len > room) {
+            /* don't cut a UTF-8 sequence in half */
+            while (room > 0 && (ch[room] & 0xC0) == 0x80) {
+                room--;
+            }
+            len = room;
+            p->cut = 1;
+        }
+        g_string_append_len(p->buf, (const char *) ch, len);
+    } else if (p->in_boolean && p->text->len < BOOLEAN_TEXT) {
+        g_string_append_len(p->text, (const char *) ch, len);
+    }
+}
+
+sq_parser *sq_parser_new(sq_head_fn head, sq_row_fn row, sq_boolean_fn boolean, void *data)
+{
+    static xmlSAXHandler sax;
+    static gsize sax_ready = 0;
+    /* programs using the library may make parsers on several threads */
+    if (g_once_init_enter(&sax_ready)) {
+        xmlSAXVersion(&sax, 2);
+        sax.startElementNs = xml_start;
+        sax.endElementNs = xml_end;
+        sax.characters = xml_characters;
+        sax.cdataBlock = xml_characters;
+        /* sq_parser_finish() says whether it failed, the program says how */
+        sax.warning = NULL;
+        sax.error = NULL;
+        sax.fatalError = NULL;
+        g_once_init_leave(&sax_ready, 1);
+    }
+
+    sq_parser *p = g_new0(sq_parser, 1);
+    p->head = head;
+    p->row = row;
+    p->boolean = boolean;
+    p->data = data;
+    p->col = -1;
+    p->names = g_ptr_array_new_with_free_func(g_free);
+    p->index = g_hash_table_new(g_str_hash, g_str_equal);
+    p->buf = g_string_new(NULL);
+    p->text = g_string_new(NULL);
+    p->max_columns = G_MAXINT;
+    p->max_value = G_MAXSIZE;
+    p->max_result = G_MAXSIZE;
+    p->xml = xmlCreatePushParserCtxt(&sax, NULL, NULL, 0, NULL);
+    p->xml->_private = p;
+
+    return p;
+}
+
+void sq_parser_set_limits(sq_parser *p, int max_columns, size_t max_value, size_t max_result)
+{
+    p->max_columns = max_columns;
+    p->max_value = max_value;
+    p->max_result = max_result;
+}
+
+int sq_parser_dropped(sq_parser *p)
+{
+    return p->dropped;
+}
+
+void sq_parser_write(sq_parser *p, const char *buf, size_t len)
+{
+    xmlParseChunk(p->xml, buf, len, 0);
+}
+
+int sq_parser_finish(sq_parser *p)
+{
+    xmlParseChunk(p->xml, NULL, 0, 1);
+    int failed = !p->xml->wellFormed || !p->done;
+
+    if (p->xml->myDoc) {
+        xmlFreeDoc(p->xml->myDoc);
+    }
+    xmlFreeParserCtxt(p->xml);
+    g_free(p->terms);
+    g_free(p->at);
+    g_hash_table_unref(p->index);
+    g_ptr_array_free(p->names, TRUE);
+    g_string_free(p->buf, TRUE);
+    g_string_free(p->text, TRUE);
+    g_free(p);
+
+    return failed;
+}
+
+char *sq_term_ntriples(const sq_term *term)
+{
+    GString *out = g_string_new(NULL);
+
+    switch (term->kind) {
+        case SQ_UNBOUND:
+            break;
+        case SQ_URI:
+            g_string_append_printf(out, "<%s>", term->value);
+            break;
+        case SQ_BNODE:
+            g_string_append_printf(out, "_:%s", term->value);
+            break;
+        case SQ_LITERAL:
+            g_string_append_c(out, '"');
+            for (const char *c = term->value; *c; c++) {
+                switch (*c) {
+                    case '"': g_string_append(out, "\\\""); break;
+                    case '\\': g_string_append(out, "\\\\"); break;
+                    case '\n': g_string_append(out, "\\n"); break;
+                    case '\r': g_string_append(out, "\\r"); break;
+                    case '\t': g_string_append(out, "\\t"); break;
+                    default: g_string_append_c(out, *c);
+                }
+            }
+            g_string_append_c(out, '"');
+            if (term->lang) {
+                g_string_append_printf(out, "@%s", term->lang);
+            } else if (term->datatype) {
+                g_string_append_printf(out, "^^<%s>", term->datatype);
+            }
+            break;
+    }
+
+    return g_string_free(out, FALSE);
+}
+
+/* vi:set expandtab sts=4 sw=4: */
@@ -20,6 +20,7 @@
 #include <curl/curl.h>
 
 #include "scan-sparql.h"
+#include "http-share.h"
 
 #define S_UNKNOWN "[unknown]"
 
@@ -31,14 +32,23 @@ static GHashTable *lookup = NULL;
 
 static GKeyFile *keyfile = NULL;
 static char *keyfile_filename = NULL;
+/* whether keyfile needs writing back */
+static int keyfile_changed = 0;
 
-int scan_init()
+/* optimising pays for itself only over many queries */
+static int compile_regexes(int optimize)
 {
     GError *err = NULL;
+    GRegexCompileFlags flags = G_REGEX_CASELESS | G_REGEX_MULTILINE;
+    if (optimize) {
+        flags |= G_REGEX_OPTIMIZE;
+    }
 
+    if (re_prefix && re_qname) {
+        return 0;
+    }
     re_prefix = g_regex_new("PREFIX\\s+([a-z](?:[a-z.-]*[a-z-])?)?:\\s+<([^<>\"{}|^`\\\\\\s>]*)>", 
-            G_REGEX_CASELESS | G_REGEX_MULTILINE | G_REGEX_OPTIMIZE, 0,
-            &err);
+            flags, 0, &err);
     if (err) {
         fprintf(stderr, "Regex compilation error: %s\n", err->message);
         g_error_free(err);
@@ -47,8 +57,7 @@ int scan_init()
     }
 
     re_qname = g_regex_new("(?:\\s|^)([a-z](?:[a-z.-]*[a-z-])?)?:([a-z0-9]([a-z0-9.-]*[a-z0-9-])?)?", 
-            G_REGEX_CASELESS | G_REGEX_MULTILINE | G_REGEX_OPTIMIZE, 0,
-            &err);
+            flags, 0, &err);
     if (err) {
         fprintf(stderr, "Regex compilation error: %s\n", err->message);
         g_error_free(err);
@@ -56,6 +65,17 @@ int scan_init()
         return 1;
     }
 
+    return 0;
+}
+
+/* ~/.sparql, read the first time a prefix is looked up */
+static int load_prefixes()
+{
+    GError *err = NULL;
+
+    if (lookup) {
+        return 0;
+    }
     lookup = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
 
     if (!keyfile) {
@@ -89,6 +109,11 @@ int scan_init()
     return 0;
 }
 
+int scan_init()
+{
+    return compile_regexes(1) || load_prefixes();
+}
+
 void scan_fini()
 {
     if (re_prefix) {
@@ -105,13 +130,16 @@ void scan_fini()
     }
 
     if (keyfile) {
-        GError *err = NULL;
-        gsize length = 0;
-        char *key_data = g_key_file_to_data(keyfile, &length, &err);
-        g_file_set_contents(keyfile_filename, key_data, length, &err);
+        if (keyfile_changed) {
+            GError *err = NULL;
+            gsize length = 0;
+            char *key_data = g_key_file_to_data(keyfile, &length, &err);
+            g_file_set_contents(keyfile_filename, key_data, length, &err);
+            g_free(key_data);
+            keyfile_changed = 0;
+        }
         g_key_file_free(keyfile);
         keyfile = NULL;
-        g_free(key_data);
         g_free(keyfile_filename);
         keyfile_filename = NULL;
     }
@@ -130,22 +158,28 @@ int scan_sparql(const char *str, char **prefixes)
     GMatchInfo *match_info;
     GSList *defined = NULL;
     *prefixes = g_strdup("");
+    if (compile_regexes(0)) {
+        return 1;
+    }
 
     g_regex_match(re_prefix, str, 0, &match_info);
     while (g_match_info_matches(match_info)) {
         gchar *sname = g_match_info_fetch(match_info, 1);
         gchar *prefix = g_match_info_fetch(match_info, 2);
 
+        load_prefixes();
         defined = g_slist_prepend(defined, g_strdup(sname));
         char *lprefix = g_hash_table_lookup(lookup, sname);
         if (lprefix) {
             if (strcmp(prefix, lprefix)) {
                 g_hash_table_replace(lookup, sname, g_strdup(prefix));
                 g_key_file_set_string(keyfile, S_CONFIG_GROUP, sname, prefix);
+                keyfile_changed = 1;
             }
         } else {
             g_hash_table_insert(lookup, g_strdup(sname), g_strdup(prefix));
             g_key_file_set_string(keyfile, S_CONFIG_GROUP, sname, prefix);
+            keyfile_changed = 1;
         }
         g_match_info_next(match_info, NULL);
     }
@@ -168,6 +202,7 @@ int scan_sparql(const char *str, char **prefixes)
         }
         if (!found) {
             char *prefix = NULL;
+            load_prefixes();
             prefix = g_hash_table_lookup(lookup, sname);
             if (prefix && !strcmp(prefix, S_UNKNOWN)) {
                 /* we can't find a value for it */
@@ -177,7 +212,7 @@ int scan_sparql(const char *str, char **prefixes)
                 g_free(old_prefixes);
                 defined = g_slist_prepend(defined, g_strdup(sname));
             } else {
-                CURL *curl = curl_easy_init();
+                CURL *curl = hs_easy_init();
                 FILE *tfile = tmpfile();
                 curl_easy_setopt(curl, CURLOPT_WRITEDATA, tfile);
                 char *url = g_strdup_printf("http://prefix.cc/%s.file.txt", sname);
@@ -197,6 +232,7 @@ int scan_sparql(const char *str, char **prefixes)
                         defined = g_slist_prepend(defined, g_strdup(sname));
                         g_hash_table_insert(lookup, g_strdup(sname), g_strdup(q));
                         g_key_file_set_string(keyfile, S_CONFIG_GROUP, sname, q);
+                        keyfile_changed = 1;
                     } else {
                         g_hash_table_insert(lookup, g_strdup(sname), g_strdup(S_UNKNOWN));
                     }
@@ -0,0 +1,151 @@
+/*  sparql-query - a SPARQL client with GNU readline support
+    Copyright (C) 2006-8 Nick Lamb and Steve Harris for Garlik
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* The client's end of a daemon's socket, see serve.c. Only libc, so that a
+ * client has next to nothing to load before it can send its query */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "serve.h"
+
+int sv_address(const char *path, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "socket path %s is too long\n", path);
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+
+    return 0;
+}
+
+int sv_send_all(int fd, const void *buf, size_t len)
+{
+    const char *pos = buf;
+    while (len) {
+        ssize_t done = send(fd, pos, len, MSG_NOSIGNAL);
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+        if (done <= 0) {
+            return -1;
+        }
+        pos += done;
+        len -= done;
+    }
+
+    return 0;
+}
+
+int sv_read_all(int fd, void *buf, size_t len)
+{
+    char *pos = buf;
+    while (len) {
+        ssize_t done = read(fd, pos, len);
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+        if (done <= 0) {
+            return -1;
+        }
+        pos += done;
+        len -= done;
+    }
+
+    return 0;
+}
+
+int sv_send(const char *path, const sv_request *req)
+{
+    struct sockaddr_un addr;
+    if (sv_address(path, &addr)) {
+        return -1;
+    }
+    int conn = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (conn < 0 || connect(conn, (struct sockaddr *) &addr, sizeof(addr))) {
+        if (conn >= 0) {
+            close(conn);
+        }
+        return -1;
+    }
+
+    const char *fields[] = { req->format, req->endpoint, req->query };
+    size_t lens[3], len = 0;
+    for (int i=0; i<3; i++) {
+        lens[i] = strlen(fields[i]) + 1;
+        len += lens[i];
+    }
+    char *strings = malloc(len), *pos = strings;
+    for (int i=0; i<3; i++) {
+        memcpy(pos, fields[i], lens[i]);
+        pos += lens[i];
+    }
+    struct sv_header head = {
+        .magic = SV_MAGIC,
+        .flags = (req->update ? SV_UPDATE : 0) | (req->parse ? SV_PARSE : 0) |
+                 (req->time ? SV_TIME : 0) | (req->auto_prefix ? SV_AUTO_PREFIX : 0),
+        .verbose = req->verbose,
+        .len = len,
+    };
+
+    union {
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct iovec iov = { .iov_base = &head, .iov_len = sizeof(head) };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+    int fds[2] = { STDOUT_FILENO, STDERR_FILENO };
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    /* anything we've buffered goes first */
+    fflush(stdout);
+    fflush(stderr);
+    int32_t status = -1;
+    ssize_t sent;
+    do {
+        sent = sendmsg(conn, &msg, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    if (sent < 0 || (sent < (ssize_t) sizeof(head) && sv_send_all(conn, (char *) &head + sent, sizeof(head) - sent)) ||
+        sv_send_all(conn, strings, len) || sv_read_all(conn, &status, sizeof(status))) {
+        fprintf(stderr, "the daemon on %s didn't answer\n", path);
+        status = 1;
+    }
+    free(strings);
+    close(conn);
+
+    return status;
+}
+
+/* vi:set expandtab sts=4 sw=4: */
@@ -0,0 +1,239 @@
+/*  sparql-query - a SPARQL client with GNU readline support
+    Copyright (C) 2006-8 Nick Lamb and Steve Harris for Garlik
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Daemon and client
+ *
+ * A daemon keeps what every run of sparql-query would otherwise set up
+ * again: the shared DNS, TLS session and connection caches, the PREFIX
+ * tables and the endpoints' open connections. A client connects to its
+ * Unix socket and sends its standard out and error along with the query
+ * (SCM_RIGHTS), so results are written straight to wherever the client's
+ * would have gone, not relayed. When the query is done the daemon sends
+ * back its exit status.
+ *
+ * Requests are handled one at a time, in the order they connect: each
+ * one takes over the daemon's standard out and error, and the caches it
+ * warms are what the next one is there for, which a forked child's
+ * wouldn't be. So a client that connects and then sends nothing mustn't
+ * hold up the rest, it's dropped after REQUEST_TIMEOUT seconds. The
+ * client's end is in serve-client.c.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <glib.h>
+
+#include "serve.h"
+
+/* the most a request may carry after its header */
+#define MAX_REQUEST (64 * 1024 * 1024)
+
+/* how long a client has to send its request, or to take its status */
+#define REQUEST_TIMEOUT 10
+
+static volatile sig_atomic_t stopping = 0;
+
+static void on_stop(int sig)
+{
+    stopping = 1;
+}
+
+/* the header comes with the client's standard out and error */
+static int read_header(int conn, struct sv_header *head, int fds[2])
+{
+    union {
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = { .iov_base = head, .iov_len = sizeof(*head) };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+
+    ssize_t got;
+    do {
+        got = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+    } while (got < 0 && errno == EINTR);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+        cmsg->cmsg_len == CMSG_LEN(2 * sizeof(int))) {
+        memcpy(fds, CMSG_DATA(cmsg), 2 * sizeof(int));
+    } else if (cmsg && cmsg->cmsg_type == SCM_RIGHTS) {
+        /* not what we sent, but don't leak them */
+        int *passed = (int *) CMSG_DATA(cmsg);
+        for (size_t i=0; i<(cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int); i++) {
+            close(passed[i]);
+        }
+    }
+    if (got < 0 || (got < (ssize_t) sizeof(*head) && sv_read_all(conn, (char *) head + got, sizeof(*head) - got))) {
+        return -1;
+    }
+    if (memcmp(head->magic, SV_MAGIC, 4) || head->len > MAX_REQUEST || fds[0] < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static void handle(int conn, sv_handler handler, void *data)
+{
+    struct sv_header head;
+    int fds[2] = { -1, -1 };
+    char *strings = NULL;
+    int32_t status = 1;
+
+    if (read_header(conn, &head, fds)) {
+        fprintf(stderr, "ignoring a request that isn't from sparql-query\n");
+        goto done;
+    }
+    strings = g_malloc(head.len + 1);
+    if (sv_read_all(conn, strings, head.len)) {
+        goto done;
+    }
+    strings[head.len] = '\0';
+
+    sv_request req = {
+        .update = !!(head.flags & SV_UPDATE),
+        .parse = !!(head.flags & SV_PARSE),
+        .time = !!(head.flags & SV_TIME),
+        .auto_prefix = !!(head.flags & SV_AUTO_PREFIX),
+        .verbose = head.verbose,
+    };
+    const char **fields[] = { &req.format, &req.endpoint, &req.query };
+    char *pos = strings, *end = strings + head.len;
+    for (int i=0; i<3; i++) {
+        if (pos >= end) {
+            fprintf(stderr, "ignoring a request that's cut short\n");
+            goto done;
+        }
+        *fields[i] = pos;
+        pos += strlen(pos) + 1;
+    }
+
+    /* the request writes where the client would have */
+    int out = dup(STDOUT_FILENO), err = dup(STDERR_FILENO);
+    fflush(stdout);
+    fflush(stderr);
+    dup2(fds[0], STDOUT_FILENO);
+    dup2(fds[1], STDERR_FILENO);
+    status = handler(&req, data);
+    fflush(stdout);
+    fflush(stderr);
+    dup2(out, STDOUT_FILENO);
+    dup2(err, STDERR_FILENO);
+    close(out);
+    close(err);
+    clearerr(stdout);
+
+done:
+    sv_send_all(conn, &status, sizeof(status));
+    for (int i=0; i<2; i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+    g_free(strings);
+}
+
+int sv_serve(const char *path, sv_handler handler, void *data)
+{
+    struct sockaddr_un addr;
+    if (sv_address(path, &addr)) {
+        return 1;
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    /* a socket left by a daemon that's gone is replaced, a live one isn't */
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (!connect(probe, (struct sockaddr *) &addr, sizeof(addr))) {
+        fprintf(stderr, "a daemon is already listening on %s\n", path);
+        close(probe);
+        close(listener);
+        return 1;
+    }
+    close(probe);
+    struct stat st;
+    if (!lstat(path, &st)) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "%s is already there and isn't a socket\n", path);
+            close(listener);
+            return 1;
+        }
+        unlink(path);
+    }
+
+    /* only for us */
+    mode_t mask = umask(077);
+    int bound = bind(listener, (struct sockaddr *) &addr, sizeof(addr));
+    umask(mask);
+    if (bound || listen(listener, SOMAXCONN)) {
+        fprintf(stderr, "can't listen on %s: %s\n", path, strerror(errno));
+        close(listener);
+        return 1;
+    }
+    /* what we bound, so that's all we remove at the end */
+    struct stat ours;
+    int have_ours = !lstat(path, &ours);
+
+    /* a client that goes away mustn't take the daemon with it */
+    signal(SIGPIPE, SIG_IGN);
+    /* standard out is always some client's, never a terminal of ours */
+    setvbuf(stdout, NULL, _IOFBF, BUFSIZ);
+    struct sigaction action = { .sa_handler = on_stop };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    while (!stopping) {
+        int conn = accept(listener, NULL, NULL);
+        if (conn < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                perror("accept");
+                break;
+            }
+            continue;
+        }
+        struct timeval timeout = { .tv_sec = REQUEST_TIMEOUT };
+        setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        handle(conn, handler, data);
+        close(conn);
+    }
+    close(listener);
+    if (have_ours && !lstat(path, &st) && st.st_dev == ours.st_dev && st.st_ino == ours.st_ino) {
+        unlink(path);
+    }
+
+    return 0;
+}
+
+/* vi:set expandtab sts=4 sw=4: */
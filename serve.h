@@ -0,0 +1,59 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/un.h>
+
+/* a query handed to a daemon by a client */
+typedef struct {
+    const char *endpoint;
+    const char *query;
+    const char *format;  /* MIME type to ask for */
+    int update;          /* the query is an update */
+    int parse;           /* render SPARQL XML results, as without -n */
+    int time;            /* report how long it took, as with -t */
+    int auto_prefix;     /* add missing PREFIXes, as with -a */
+    int verbose;
+} sv_request;
+
+/* run a request with standard out and error being the client's, returning
+ * its exit status */
+typedef int (*sv_handler)(const sv_request *req, void *data);
+
+/* listen on the Unix socket at path, handling one request at a time, until
+ * SIGINT or SIGTERM. A client that's slow to send its request is dropped.
+ * Returns non-zero if it couldn't listen */
+int sv_serve(const char *path, sv_handler handler, void *data);
+
+/* have the daemon listening at path run req, writing straight to our
+ * standard out and error. Returns its exit status, or -1 if no daemon
+ * answered. Needs nothing but libc, see sparql-connect.c */
+int sv_send(const char *path, const sv_request *req);
+
+/* On the wire a request is this header, sent along with the client's
+ * standard out and error, then the format, endpoint and query, each
+ * NUL-terminated. The answer is the exit status as an int32_t */
+
+#define SV_MAGIC "SQD1"
+
+enum {
+    SV_UPDATE = 1,
+    SV_PARSE = 2,
+    SV_TIME = 4,
+    SV_AUTO_PREFIX = 8,
+};
+
+struct sv_header {
+    char magic[4];
+    uint32_t flags;
+    uint32_t verbose;
+    uint32_t len;   /* of the strings that follow */
+};
+
+/* shared by both ends, returning non-zero on error */
+int sv_address(const char *path, struct sockaddr_un *addr);
+int sv_send_all(int fd, const void *buf, size_t len);
+int sv_read_all(int fd, void *buf, size_t len);
+
+#endif
@@ -0,0 +1,98 @@
+/*  sparql-query - a SPARQL client with GNU readline support
+    Copyright (C) 2006-8 Nick Lamb and Steve Harris for Garlik
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* A client for sparql-query --daemon with nothing to load but libc, for
+ * scripts that run a great many queries */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "serve.h"
+
+static int usage(const char *cmd)
+{
+    fprintf(stderr, "Usage: %s [-v] [-n] [-t] [-a] [-u] [-p] [-f MIME type] <socket> <ep> [<query>] e.g.\n", cmd);
+    fprintf(stderr, " %s /tmp/sparql.sock http://example.net/sparql 'SELECT * WHERE { ?s ?p ?o } LIMIT 10'\n", cmd);
+    fprintf(stderr, " -n  don't parse SPARQL XML results\n");
+    fprintf(stderr, " -t  print execution time\n");
+    fprintf(stderr, " -a  automatically add PREFIXes if missing\n");
+    fprintf(stderr, " -u  the query is an update\n");
+    fprintf(stderr, " -p  read the query from standard input\n");
+    fprintf(stderr, " <socket> is where sparql-query --daemon is listening\n");
+
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    sv_request req = { .format = NULL, .parse = 1 };
+    int pipe = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "f:vntaup")) != -1) {
+        switch (c) {
+            case 'f': req.format = optarg; break;
+            case 'v': req.verbose++; break;
+            case 'n': req.parse = 0; break;
+            case 't': req.time = 1; break;
+            case 'a': req.auto_prefix = 1; break;
+            case 'u': req.update = 1; break;
+            case 'p': pipe = 1; break;
+            default: return usage(argv[0]);
+        }
+    }
+    if (argc - optind != (pipe ? 2 : 3)) {
+        return usage(argv[0]);
+    }
+    const char *path = argv[optind];
+    req.endpoint = argv[optind + 1];
+    if (!req.format) {
+        req.format = req.update ? "text/plain" : "application/sparql-results+xml";
+    }
+
+    char *query = NULL;
+    if (pipe) {
+        size_t len = 0, got;
+        char block[4096];
+        while ((got = fread(block, 1, sizeof(block), stdin)) > 0) {
+            query = realloc(query, len + got + 1);
+            memcpy(query + len, block, got);
+            len += got;
+        }
+        if (!len) {
+            return 0;
+        }
+        query[len] = '\0';
+        req.query = query;
+    } else {
+        req.query = argv[optind + 2];
+    }
+
+    int status = sv_send(path, &req);
+    if (status < 0) {
+        fprintf(stderr, "no daemon is listening on %s\n", path);
+        status = 1;
+    }
+    free(query);
+
+    return status;
+}
+
+/* vi:set expandtab sts=4 sw=4: */
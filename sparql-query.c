@@ -20,11 +20,13 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <libgen.h>
 #include <glib.h>
 #include <getopt.h>
 #include <sys/time.h>
+#include <signal.h>
 
 #include <curl/curl.h>
 
@@ -32,23 +34,139 @@
 #include <readline/history.h>
 
 #include "scan-sparql.h"
-
-extern int sr_parse(const char *filename, const char *format);
+#include "result-parse.h"
+#include "result-profile.h"
+#include "result-arrow.h"
+#include "result-cache.h"
+#include "result-split.h"
+#include "diff.h"
+#include "rdf-parse.h"
+#include "bulk-load.h"
+#include "graph-store.h"
+#include "http-share.h"
+#include "federate.h"
+#include "lookup.h"
+#include "render.h"
+#include "serve.h"
+#include "probe.h"
+
+/* long options without a short equivalent */
+enum {
+    OPT_MAX_LITERAL = 256,
+    OPT_MAX_COLUMNS,
+    OPT_MAX_MEMORY,
+    OPT_LOAD,
+    OPT_BATCH,
+    OPT_BATCH_SIZE,
+    OPT_JOBS,
+    OPT_PUT,
+    OPT_POST,
+    OPT_DELETE,
+    OPT_GRAPH,
+    OPT_TYPE,
+    OPT_GZIP,
+    OPT_SESSION_CACHE,
+    OPT_SHARD,
+    OPT_SOURCE,
+    OPT_DISTINCT,
+    OPT_CONNECT_TIMEOUT,
+    OPT_TIMEOUT,
+    OPT_RETRIES,
+    OPT_HEDGE,
+    OPT_KEYS,
+    OPT_BIND,
+    OPT_PIPELINE,
+    OPT_RENDER,
+    OPT_DAEMON,
+    OPT_CONNECT,
+    OPT_ORDER_BY,
+    OPT_SORT_MEMORY,
+    OPT_PROFILE,
+    OPT_DIFF,
+    OPT_WATCH,
+    OPT_CACHE,
+    OPT_CACHE_MEMORY,
+    OPT_PROBE,
+    OPT_PARTS,
+    OPT_PART_ROWS,
+    OPT_PART_BYTES,
+};
+
+#define DEFAULT_RETRIES 2
+
+/* how long to wait between tries, in seconds */
+#define BACKOFF_BASE 0.25
+#define BACKOFF_MAX 10.0
+#define RETRY_AFTER_MAX 120
+
+/* bigger pieces of response for the pipeline's threads to pass around */
+#define PIPELINE_BUFFER (256 * 1024)
+
+/* times to first response kept for working out when to hedge */
+#define LATENCY_SAMPLES 100
+#define HEDGE_MIN_SAMPLES 20
+
+typedef struct attempt_struct attempt;
 
 typedef struct query_bits_struct {
     char *format;
     char *ep;
+    const char *url; /* of ep, which may name a Unix socket to use */
     CURL *curl;
+    struct curl_slist *headers;
     FILE *file;
     char filename[20];
     int verbose;
     int xml_filter;
+    rdf_parser *rdf; /* streaming CONSTRUCT/DESCRIBE results as N-Triples */
     int parse;  /* true if we want to parse results */
     int time; /* print execution time */
     const char *operation;
     int auto_prefix; /* true if we want to add PREFIXes */
+    hs_warmup *warmup; /* connecting to the endpoint in the background */
+    int interactive; /* run transfers so that Ctrl-C cancels them */
+    CURLM *multi;
+    attempt *winner; /* whose response is being shown */
+    int max_retries; /* for queries, updates are only sent once */
+    double hedge_after; /* seconds, 0 for never, negative for the p95 */
+    double timeout; /* seconds for the whole query including retries */
+    double connect_timeout;
+    double latency[LATENCY_SAMPLES];
+    int latencies;
+    int tries, hedges, hedge_wins; /* for the current query */
+    long rows; /* seen so far in the current response */
+    int row_match; /* characters of </result> matched */
+    curl_off_t received;
+    int pipeline; /* parse and write TSV results on their own threads */
+    sr_stream *stream;
+    CURL *paused; /* waiting for room in the stream */
+    int cache_results; /* kept in interactive mode to show again */
+    size_t cache_memory;
+    rc_cache *cache;
+    int probe; /* find out which formats ep serves, and choose one */
+    int tsv_results; /* ask for SPARQL TSV, and read it as we would XML */
+    int tsv_response; /* and that's what came */
+    int parts; /* rows go to --parts files, as they arrive */
 } query_bits;
 
+/* one sending of the request, a retry or hedge makes another */
+struct attempt_struct {
+    query_bits *bits;
+    CURL *curl;
+    char error[CURL_ERROR_SIZE];
+    CURLcode code;
+    double started;
+    long status;
+    char *type; /* of the response */
+    int retriable; /* the response says try again, so its body is ignored */
+    int retry_after; /* seconds the server asked us to wait, or -1 */
+    int hedge;
+    int last; /* no more retries, so any response will do */
+};
+
+/* set by SIGINT while a cancellable transfer is running */
+static volatile sig_atomic_t cancelled = 0;
+
 /* must not be longer than 20 bytes, see above */
 static const char *tmp_filename = "/tmp/sparql-XXXXXXX";
 
@@ -56,19 +174,82 @@ static int execute_operation(const char *query, query_bits *bits);
 static void sparql_curl_init(query_bits *bits);
 
 static void interactive(query_bits *bits);
+static int serve_request(const sv_request *req, void *data);
 
 static const char *op_query = "query";
 static const char *op_update = "update";
 
+/* read a query from standard input for -p, leaving it NULL if there was
+ * nothing there. Returns non-zero on error */
+static int read_query(char **query)
+{
+    ssize_t obtained = 0;
+    size_t querylen = 0;
+    char block[1024];
+    while ((obtained = read(STDIN_FILENO, block, 1024)) != 0) {
+        if (obtained < 0) {
+            perror("failed to read from standard input");
+            return 1;
+        }
+        *query = (char *)realloc(*query, querylen + obtained + 1);
+        memcpy(*query + querylen, block, obtained);
+        querylen += obtained;
+    }
+    if (querylen > 0) {
+        (*query)[querylen] = '\0';
+    }
+
+    return 0;
+}
+
+/* parse a byte count with an optional k, M or G suffix, 0 on error */
+static size_t parse_size(const char *str)
+{
+    char *end = NULL;
+    unsigned long long size = strtoull(str, &end, 10);
+    switch (*end) {
+        case 'k': case 'K': size <<= 10; end++; break;
+        case 'm': case 'M': size <<= 20; end++; break;
+        case 'g': case 'G': size <<= 30; end++; break;
+    }
+    if (end == str || *end != '\0') {
+        return 0;
+    }
+
+    return size;
+}
+
 int main(int argc, char *argv[])
 {
-    query_bits bits = { .format = NULL, .ep = NULL, .verbose = 0, .xml_filter = 0, .parse = 1, .time = 0, .operation = op_query};
+    query_bits bits = { .format = NULL, .ep = NULL, .verbose = 0, .xml_filter = 0, .parse = 1, .time = 0, .operation = op_query, .max_retries = DEFAULT_RETRIES,
+                        .cache_results = RC_DEFAULT_RESULTS, .cache_memory = RC_DEFAULT_MEMORY };
 
     static char *optstring = "f:vnthp";
     char *query = NULL;
     int help = 0;
     int pipe = 0;
     int c, opt_index = 0;
+    char *session_cache = NULL;
+    GPtrArray *shards = g_ptr_array_new();
+    fed_options fed = { .source = 0, .distinct = 0 };
+    size_t max_literal = SR_DEFAULT_MAX_LITERAL;
+    int max_columns = SR_DEFAULT_MAX_COLUMNS;
+    size_t max_memory = SR_DEFAULT_MAX_MEMORY;
+    char *order_by = NULL;
+    size_t sort_memory = SR_DEFAULT_SORT_MEMORY;
+    bl_options load = { .filename = NULL, .triples = BL_DEFAULT_TRIPLES, .bytes = BL_DEFAULT_BYTES, .jobs = 0 };
+    enum gs_method gs_method = GS_NONE;
+    gs_options gs = { .graph = NULL, .filename = NULL, .type = NULL, .gzip = 0 };
+    lk_options lookup_opts = { .filename = NULL, .var = NULL, .batch = 0, .jobs = 0 };
+    rn_options render = { .files = NULL, .count = 0, .jobs = 0 };
+    int rendering = 0;
+    int profile = 0;
+    df_options diff = { .before = NULL, .is_file = 0 };
+    double watch = 0.0;
+    char *parts = NULL;
+    long part_rows = 0;
+    size_t part_bytes = 0;
+    char *daemon_socket = NULL, *connect_socket = NULL;
 
     static struct option long_options[] = {
         { "format", 1, 0, 'f' },
@@ -78,6 +259,44 @@ int main(int argc, char *argv[])
         { "help", 0, 0, 'h' },
         { "pipe", 0, 0, 'p' },
         { "auto", 0, 0, 'a' },
+        { "max-literal", 1, 0, OPT_MAX_LITERAL },
+        { "max-columns", 1, 0, OPT_MAX_COLUMNS },
+        { "max-memory", 1, 0, OPT_MAX_MEMORY },
+        { "load", 1, 0, OPT_LOAD },
+        { "batch", 1, 0, OPT_BATCH },
+        { "batch-size", 1, 0, OPT_BATCH_SIZE },
+        { "jobs", 1, 0, OPT_JOBS },
+        { "put", 1, 0, OPT_PUT },
+        { "post", 1, 0, OPT_POST },
+        { "delete", 0, 0, OPT_DELETE },
+        { "graph", 1, 0, OPT_GRAPH },
+        { "type", 1, 0, OPT_TYPE },
+        { "gzip", 0, 0, OPT_GZIP },
+        { "session-cache", 1, 0, OPT_SESSION_CACHE },
+        { "shard", 1, 0, OPT_SHARD },
+        { "source", 0, 0, OPT_SOURCE },
+        { "distinct", 0, 0, OPT_DISTINCT },
+        { "connect-timeout", 1, 0, OPT_CONNECT_TIMEOUT },
+        { "timeout", 1, 0, OPT_TIMEOUT },
+        { "retries", 1, 0, OPT_RETRIES },
+        { "hedge", 1, 0, OPT_HEDGE },
+        { "keys", 1, 0, OPT_KEYS },
+        { "bind", 1, 0, OPT_BIND },
+        { "pipeline", 0, 0, OPT_PIPELINE },
+        { "render", 0, 0, OPT_RENDER },
+        { "daemon", 1, 0, OPT_DAEMON },
+        { "connect", 1, 0, OPT_CONNECT },
+        { "order-by", 1, 0, OPT_ORDER_BY },
+        { "sort-memory", 1, 0, OPT_SORT_MEMORY },
+        { "profile", 0, 0, OPT_PROFILE },
+        { "diff", 1, 0, OPT_DIFF },
+        { "watch", 1, 0, OPT_WATCH },
+        { "cache", 1, 0, OPT_CACHE },
+        { "cache-memory", 1, 0, OPT_CACHE_MEMORY },
+        { "probe", 0, 0, OPT_PROBE },
+        { "parts", 1, 0, OPT_PARTS },
+        { "part-rows", 1, 0, OPT_PART_ROWS },
+        { "part-bytes", 1, 0, OPT_PART_BYTES },
         { 0, 0, 0, 0 }
     };
 
@@ -100,11 +319,130 @@ int main(int argc, char *argv[])
             pipe = 1;
         } else if (c == 'a') {
             bits.auto_prefix = 1;
+        } else if (c == OPT_MAX_LITERAL) {
+            if (!(max_literal = parse_size(optarg))) help = 1;
+        } else if (c == OPT_MAX_COLUMNS) {
+            if ((max_columns = atoi(optarg)) <= 0) help = 1;
+        } else if (c == OPT_MAX_MEMORY) {
+            if (!(max_memory = parse_size(optarg))) help = 1;
+        } else if (c == OPT_LOAD) {
+            load.filename = optarg;
+        } else if (c == OPT_BATCH) {
+            if ((load.triples = lookup_opts.batch = atoi(optarg)) <= 0) help = 1;
+        } else if (c == OPT_BATCH_SIZE) {
+            if (!(load.bytes = parse_size(optarg))) help = 1;
+        } else if (c == OPT_JOBS) {
+            if ((load.jobs = lookup_opts.jobs = render.jobs = atoi(optarg)) <= 0) help = 1;
+        } else if (c == OPT_PUT || c == OPT_POST || c == OPT_DELETE) {
+            if (gs_method != GS_NONE) help = 1;
+            gs_method = c == OPT_PUT ? GS_PUT : c == OPT_POST ? GS_POST : GS_DELETE;
+            gs.filename = optarg;
+        } else if (c == OPT_GRAPH) {
+            gs.graph = optarg;
+        } else if (c == OPT_TYPE) {
+            gs.type = optarg;
+        } else if (c == OPT_GZIP) {
+            gs.gzip = 1;
+        } else if (c == OPT_SESSION_CACHE) {
+            session_cache = optarg;
+        } else if (c == OPT_SHARD) {
+            g_ptr_array_add(shards, optarg);
+        } else if (c == OPT_SOURCE) {
+            fed.source = 1;
+        } else if (c == OPT_DISTINCT) {
+            fed.distinct = 1;
+        } else if (c == OPT_KEYS) {
+            lookup_opts.filename = optarg;
+        } else if (c == OPT_BIND) {
+            lookup_opts.var = optarg[0] == '?' || optarg[0] == '$' ? optarg + 1 : optarg;
+        } else if (c == OPT_CONNECT_TIMEOUT) {
+            if ((bits.connect_timeout = g_ascii_strtod(optarg, NULL)) <= 0.0) help = 1;
+        } else if (c == OPT_TIMEOUT) {
+            if ((bits.timeout = g_ascii_strtod(optarg, NULL)) <= 0.0) help = 1;
+        } else if (c == OPT_RETRIES) {
+            if ((bits.max_retries = atoi(optarg)) < 0) help = 1;
+        } else if (c == OPT_PIPELINE) {
+            bits.pipeline = 1;
+        } else if (c == OPT_RENDER) {
+            rendering = 1;
+        } else if (c == OPT_DAEMON) {
+            daemon_socket = optarg;
+        } else if (c == OPT_CONNECT) {
+            connect_socket = optarg;
+        } else if (c == OPT_ORDER_BY) {
+            order_by = optarg;
+        } else if (c == OPT_SORT_MEMORY) {
+            if (!(sort_memory = parse_size(optarg))) help = 1;
+        } else if (c == OPT_PROFILE) {
+            profile = 1;
+        } else if (c == OPT_DIFF) {
+            diff.before = optarg;
+            diff.is_file = g_file_test(optarg, G_FILE_TEST_EXISTS);
+        } else if (c == OPT_WATCH) {
+            if ((watch = g_ascii_strtod(optarg, NULL)) <= 0.0) help = 1;
+        } else if (c == OPT_CACHE) {
+            bits.cache_results = atoi(optarg);
+        } else if (c == OPT_CACHE_MEMORY) {
+            if (!(bits.cache_memory = parse_size(optarg))) help = 1;
+        } else if (c == OPT_PROBE) {
+            bits.probe = 1;
+        } else if (c == OPT_PARTS) {
+            parts = optarg;
+        } else if (c == OPT_PART_ROWS) {
+            if ((part_rows = atol(optarg)) <= 0) help = 1;
+        } else if (c == OPT_PART_BYTES) {
+            if (!(part_bytes = parse_size(optarg))) help = 1;
+        } else if (c == OPT_HEDGE) {
+            if (!strcmp(optarg, "auto")) {
+                bits.hedge_after = -1.0;
+            } else if ((bits.hedge_after = g_ascii_strtod(optarg, NULL) / 1000.0) <= 0.0) {
+                help = 1;
+            }
         } else {
             help = 1;
         }
     }
 
+    if (profile) {
+        /* instead of whatever -f said */
+        bits.format = SR_PROFILE;
+        if (!bits.parse || bits.operation != op_query || shards->len || lookup_opts.filename) {
+            help = 1;
+        }
+    }
+    if (rendering) {
+        /* the arguments are files rather than an endpoint and query */
+        render.files = argv + optind;
+        render.count = argc - optind;
+        if (!render.count || bits.operation != op_query || load.filename || gs_method != GS_NONE ||
+            shards->len || lookup_opts.filename || pipe) {
+            help = 1;
+        }
+        optind = argc;
+    }
+    if (parts) {
+        /* read as XML, written as TSV, whatever -f said */
+        bits.format = "application/sparql-results+xml";
+        bits.parts = 1;
+        if (!bits.parse || bits.operation != op_query || profile || shards->len || lookup_opts.filename ||
+            diff.before || watch > 0.0 || daemon_socket || connect_socket || (rendering && render.count != 1)) {
+            help = 1;
+        }
+    } else if (part_rows || part_bytes) {
+        help = 1;
+    }
+    /* the arguments are endpoints to connect to ahead of any query */
+    char **warm = argv + optind;
+    int warm_count = 0;
+    if (daemon_socket) {
+        warm_count = argc - optind;
+        if (rendering || connect_socket || load.filename || gs_method != GS_NONE ||
+            shards->len || lookup_opts.filename || pipe) {
+            help = 1;
+        }
+        optind = argc;
+    }
+
     for (int k = optind; k < argc; ++k) {
         if (!bits.ep) {
             bits.ep = argv[k];
@@ -115,7 +453,38 @@ int main(int argc, char *argv[])
         }
     }
 
-    if (help || !bits.ep) {
+    if ((load.filename || gs_method != GS_NONE) && query) {
+        help = 1;
+    }
+    if (parts && !rendering && !query && !pipe) {
+        /* every query of a session would write over the last's */
+        help = 1;
+    }
+    if (load.filename && gs_method != GS_NONE) {
+        help = 1;
+    }
+    if (shards->len && (bits.operation != op_query || load.filename || gs_method != GS_NONE || order_by)) {
+        help = 1;
+    }
+    if (lookup_opts.filename && (!lookup_opts.var || bits.operation != op_query || shards->len ||
+                                 load.filename || gs_method != GS_NONE || order_by)) {
+        help = 1;
+    }
+
+    if ((diff.before || watch > 0.0) && (bits.operation != op_query || load.filename || gs_method != GS_NONE || shards->len ||
+                        lookup_opts.filename || rendering || daemon_socket || order_by || profile)) {
+        help = 1;
+    }
+    if (diff.before && watch > 0.0) {
+        help = 1;
+    }
+
+    if (connect_socket && (rendering || load.filename || gs_method != GS_NONE || shards->len ||
+                           lookup_opts.filename)) {
+        help = 1;
+    }
+
+    if (help || (!bits.ep && !rendering && !daemon_socket)) {
         char *example;
         if (bits.operation == op_update) {
             example = "INSERT DATA { <s> <p> <o> }";
@@ -125,44 +494,214 @@ int main(int argc, char *argv[])
         fprintf(stderr, "%s revision %s\n", argv[0], GIT_REV);
         fprintf(stderr, "Usage: %s [-v] [-n] [-t] [-p] [-f MIME type] <ep> [<%s>] e.g.\n", cmd, bits.operation);
         fprintf(stderr, " %s http://example.net/sparql '%s'\n", cmd, example);
+        fprintf(stderr, "       %s --render [-f MIME type] [--jobs N] <file>...\n", cmd);
+        fprintf(stderr, "       %s --daemon SOCKET [<ep>...]\n", cmd);
         fprintf(stderr, " -n, --noparse  don't parse SPARQL XML results\n");
         fprintf(stderr, " -t, --time     print execution time for each %s\n", bits.operation);
         fprintf(stderr, " -p, --pipe     read %s from standard input and execute immediately\n", bits.operation);
         fprintf(stderr, " -a, --auto     automatically add PREFIXes if missing\n");
-        fprintf(stderr, " <ep> is a SPARQL HTTP endpoint\n");
+        fprintf(stderr, " --max-literal BYTES  truncate longer values (default 16M)\n");
+        fprintf(stderr, " --max-columns N      drop columns after the first N (default %d)\n", SR_DEFAULT_MAX_COLUMNS);
+        fprintf(stderr, " --max-memory BYTES   limit memory held while parsing results (default 256M)\n");
+        fprintf(stderr, " --order-by VARS      sort the results here by VARS, separated by commas, each\n");
+        fprintf(stderr, "                      descending if it starts with -\n");
+        fprintf(stderr, " --distinct           leave out repeated rows, which sorts them too\n");
+        fprintf(stderr, " --sort-memory BYTES  hold this much for --order-by, --distinct and --diff\n");
+        fprintf(stderr, "                      before using temporary files (default 64M)\n");
+        fprintf(stderr, " --profile            count rows, and how often each column is bound, to what,\n");
+        fprintf(stderr, "                      about how many distinct values it has and which are most\n");
+        fprintf(stderr, "                      common, instead of writing the results\n");
+        fprintf(stderr, " --diff EP|FILE       run the query on EP and <ep> at once, or compare <ep> with\n");
+        fprintf(stderr, "                      SPARQL XML results saved in FILE, writing the rows only\n");
+        fprintf(stderr, "                      one has, marked - or +\n");
+        fprintf(stderr, " --watch SECS         run the query every SECS, writing the rows that came or\n");
+        fprintf(stderr, "                      went since, marked + or -\n");
+        fprintf(stderr, " --load FILE          INSERT DATA the N-Triples in FILE (- for standard input)\n");
+        fprintf(stderr, " --batch N            most triples per INSERT DATA when loading (default %d)\n", BL_DEFAULT_TRIPLES);
+        fprintf(stderr, " --batch-size BYTES   most bytes per INSERT DATA when loading (default 4M)\n");
+        fprintf(stderr, " --jobs N             requests in flight at once for --load and --keys (default\n");
+        fprintf(stderr, "                      adapts to the store, up to %d and %d), and threads for\n", BL_MAX_JOBS, LK_MAX_JOBS);
+        fprintf(stderr, "                      --render and --parts (default one per processor)\n");
+        fprintf(stderr, " --put FILE           replace a graph with the RDF in FILE (- for standard input)\n");
+        fprintf(stderr, " --post FILE          add the RDF in FILE to a graph\n");
+        fprintf(stderr, " --delete             delete a graph\n");
+        fprintf(stderr, "   --graph IRI        the graph for --put, --post and --delete (default graph if absent)\n");
+        fprintf(stderr, "   --type MIME        the RDF syntax of FILE (guessed from its name otherwise)\n");
+        fprintf(stderr, "   --gzip             compress FILE as it is sent\n");
+        fprintf(stderr, " --session-cache FILE keep TLS sessions in FILE between runs\n");
+        fprintf(stderr, " --shard EP           also send the query to EP and merge the results as TSV,\n");
+        fprintf(stderr, "                      may be repeated, needs a query on the command line or -p\n");
+        fprintf(stderr, "   --source           add a ?source column naming the endpoint of each row\n");
+        fprintf(stderr, "   --distinct         leave out rows already seen from another endpoint\n");
+        fprintf(stderr, " --keys FILE          run the query for each value in FILE (- for standard input),\n");
+        fprintf(stderr, "                      --batch (default %d) at a time, writing TSV\n", LK_DEFAULT_BATCH);
+        fprintf(stderr, "   --bind VAR         the variable in the query that takes each value\n");
+        fprintf(stderr, " --cache N            keep the last N results (default %d) of an interactive\n", RC_DEFAULT_RESULTS);
+        fprintf(stderr, "                      session to show again, see \\help\n");
+        fprintf(stderr, " --cache-memory BYTES hold this much of them, compressed, before using\n");
+        fprintf(stderr, "                      temporary files (default 64M)\n");
+        fprintf(stderr, " --parts PREFIX       write the rows as TSV in gzipped parts, PREFIX-00001.tsv.gz\n");
+        fprintf(stderr, "                      and on, listed in PREFIX.manifest as each is finished,\n");
+        fprintf(stderr, "                      compressing on --jobs (default one per processor) threads\n");
+        fprintf(stderr, "   --part-rows N      rows in each part (default %d)\n", SR_SPLIT_DEFAULT_ROWS);
+        fprintf(stderr, "   --part-bytes BYTES start a new part after this much TSV\n");
+        fprintf(stderr, " --probe              find out which results formats <ep> serves, remembered\n");
+        fprintf(stderr, "                      for a day, and ask for TSV rather than XML if it can\n");
+        fprintf(stderr, " --connect-timeout SECS  give up connecting after SECS\n");
+        fprintf(stderr, " --timeout SECS       give up on a %s after SECS, retries included\n", bits.operation);
+        fprintf(stderr, " --retries N          retry failed or refused queries N times (default %d)\n", DEFAULT_RETRIES);
+        fprintf(stderr, " --hedge MS|auto      send a query again if there's no answer after MS, or the\n");
+        fprintf(stderr, "                      usual worst time so far, and take whichever answers first\n");
+        fprintf(stderr, " --pipeline           parse and write TSV results on separate threads while\n");
+        fprintf(stderr, "                      they download\n");
+        fprintf(stderr, " --render             render saved SPARQL XML results files, maybe gzipped, to\n");
+        fprintf(stderr, "                      standard out, or beside each one if there are several,\n");
+        fprintf(stderr, "                      --jobs (default one per processor) at a time\n");
+        fprintf(stderr, " --daemon SOCKET      keep connections and caches, running %s sent to\n",
+                bits.operation == op_query ? "queries" : "updates");
+        fprintf(stderr, "                      SOCKET with --connect, after connecting to any <ep> given\n");
+        fprintf(stderr, " --connect SOCKET     have the daemon on SOCKET run the %s, or run it here if\n", bits.operation);
+        fprintf(stderr, "                      there isn't one\n");
+        fprintf(stderr, " <ep> is a SPARQL HTTP endpoint, or a graph store for --put, --post and --delete,\n");
+        fprintf(stderr, "      unix:PATH:URL to reach URL through the Unix socket PATH\n");
         fprintf(stderr, " <%s> is a SPARQL %s to execute immediately in non-interactive mode\n", bits.operation, bits.operation);
         fprintf(stderr, "remember to use shell quoting if necessary\n");
         return 1;
     }
 
+    if (connect_socket && (query || pipe)) {
+        /* before anything a daemon would have ready */
+        if (!query && pipe) {
+            int failed = read_query(&query);
+            if (failed || !query) return failed;
+        }
+        sv_request req = {
+            .endpoint = bits.ep,
+            .query = query,
+            .format = bits.format ? bits.format : "application/sparql-results+xml",
+            .update = bits.operation == op_update,
+            .parse = bits.parse,
+            .time = bits.time,
+            .auto_prefix = bits.auto_prefix,
+            .verbose = bits.verbose,
+        };
+        int status = sv_send(connect_socket, &req);
+        if (status >= 0) {
+            return status;
+        }
+        if (bits.verbose) {
+            fprintf(stderr, "no daemon on %s, running the %s here\n", connect_socket, bits.operation);
+        }
+    }
+
     atexit(scan_fini);
+    hs_init(session_cache);
+    atexit(hs_fini);
+    sr_set_limits(max_literal, max_columns, max_memory);
+    if (!shards->len) {
+        /* with --shard, --distinct is federate()'s */
+        sr_set_order(order_by, fed.distinct, sort_memory);
+    }
+    sr_set_split(parts, part_rows, part_bytes, load.jobs);
+
+    if (rendering) {
+        render.format = bits.format ? bits.format : "text/plain";
+        render.verbose = bits.verbose;
+
+        return render_files(&render) != 0;
+    }
+
+    if (daemon_socket) {
+        /* everything a request would otherwise wait for */
+        scan_init();
+        for (int i=0; i<warm_count; i++) {
+            char error[CURL_ERROR_SIZE];
+            if (hs_warmup_finish(hs_warmup_start(warm[i], bits.verbose), error) && bits.verbose) {
+                fprintf(stderr, "%s: %s\n", warm[i], error);
+            }
+        }
+
+        return sv_serve(daemon_socket, serve_request, &bits);
+    }
+
+    if (load.filename) {
+        load.endpoint = bits.ep;
+        load.verbose = bits.verbose;
+
+        return bulk_load(&load) != 0;
+    }
+
+    if (gs_method != GS_NONE) {
+        gs.endpoint = bits.ep;
+        gs.verbose = bits.verbose;
+
+        return graph_store(gs_method, &gs);
+    }
 
     if (!bits.format) {
         bits.format = "application/sparql-results+xml";
     }
 
     if (!query && pipe) {
-	ssize_t obtained = 0;
-	size_t querylen = 0;
-	char block[1024];
-	while ((obtained = read(STDIN_FILENO, block, 1024)) != 0) {
-	    if (obtained < 0) {
-		perror("failed to read from standard input");
-		return 1;
-	    }
-	    query = (char *)realloc(query, querylen + obtained + 1);
-	    memcpy(query + querylen, block, obtained);
-	    querylen += obtained;
-	}
-	if (querylen == 0) return 0;
-	query[querylen] = '\0';
+        int failed = read_query(&query);
+        if (failed || !query) return failed;
+    }
+
+    if (shards->len) {
+        if (!query) {
+            fprintf(stderr, "--shard needs a query to run\n");
+            return 1;
+        }
+        g_ptr_array_insert(shards, 0, bits.ep);
+        fed.query = query;
+        fed.endpoints = (const char **) shards->pdata;
+        fed.count = shards->len;
+        fed.verbose = bits.verbose;
+
+        return federate(&fed) != 0;
+    }
+
+    if (diff.before || watch > 0.0) {
+        if (!query) {
+            fprintf(stderr, "%s needs a query to run\n", watch > 0.0 ? "--watch" : "--diff");
+            return 1;
+        }
+        diff.query = query;
+        diff.after = bits.ep;
+        diff.memory = sort_memory;
+        diff.verbose = bits.verbose;
+        if (watch > 0.0) {
+            /* only returns if it's stopped */
+            watch_results(&diff, watch);
+            return 0;
+        }
+        int changed = diff_results(&diff);
+
+        return changed < 0 ? 2 : changed > 0;
+    }
+
+    if (lookup_opts.filename) {
+        if (!query) {
+            fprintf(stderr, "--keys needs a query to run\n");
+            return 1;
+        }
+        if (!strcmp(lookup_opts.filename, "-") && pipe) {
+            fprintf(stderr, "--keys - and --pipe can't both read standard input\n");
+            return 1;
+        }
+        lookup_opts.endpoint = bits.ep;
+        lookup_opts.query = query;
+        lookup_opts.verbose = bits.verbose;
+        if (!lookup_opts.batch) {
+            lookup_opts.batch = LK_DEFAULT_BATCH;
+        }
+
+        return lookup(&lookup_opts) != 0;
     }
 
     if (query) {
+        /* scan_sparql() sets itself up for just the one query */
         sparql_curl_init(&bits);
-        if (bits.auto_prefix) {
-            scan_init();
-        }
         CURLcode error = execute_operation(query, &bits);
 
         return error;
@@ -213,47 +752,467 @@ static void save_history_dotfile(query_bits *bits)
     g_free(dotfile);
 }
 
+/* a profile is made from SPARQL XML results, and never needs them saved */
+static int profiling(query_bits *bits)
+{
+    return !strcmp(bits->format, SR_PROFILE);
+}
+
+/* TSV says everything XML does that we show, in less, and reads faster.
+ * It's only worth asking for if the results are parsed into a file first,
+ * rather than streamed or asked for as TSV to begin with */
+static int choose_tsv(query_bits *bits)
+{
+    return bits->probe && bits->parse && bits->operation == op_query && !bits->pipeline && !bits->parts &&
+        !profiling(bits) && !g_str_has_prefix(bits->format, "text/tab-separated-values") &&
+        !g_str_has_prefix(bits->format, "text/plain") && (pr_formats(bits->ep, bits->verbose) & PR_TSV);
+}
+
 static void sparql_curl_init(query_bits *bits)
 {
-    bits->curl = curl_easy_init();
+    bits->curl = hs_easy_init();
+    bits->url = hs_endpoint(bits->curl, bits->ep);
+    bits->tsv_results = choose_tsv(bits);
     struct curl_slist *headers = NULL;
     char *accept;
-    if (bits->parse) {
-        accept = g_strdup_printf("Accept: %s, application/sparql-results+xml", bits->format);
+    if (profiling(bits)) {
+        accept = g_strdup("Accept: application/sparql-results+xml");
+    } else if (bits->tsv_results) {
+        accept = g_strdup("Accept: text/tab-separated-values, application/sparql-results+xml;q=0.9, "
+                          "application/n-triples;q=0.9, text/turtle;q=0.8, application/rdf+xml;q=0.7");
+    } else if (bits->parse) {
+        accept = g_strdup_printf("Accept: %s, application/sparql-results+xml, "
+                                 "application/n-triples;q=0.9, text/turtle;q=0.8, "
+                                 "application/rdf+xml;q=0.7", bits->format);
     } else {
         accept = g_strdup_printf("Accept: %s", bits->format);
     }
     headers = curl_slist_append(headers, accept);
     g_free(accept);
+    bits->headers = headers;
 
     curl_easy_setopt(bits->curl, CURLOPT_VERBOSE, bits->verbose);
     curl_easy_setopt(bits->curl, CURLOPT_HTTPHEADER, headers);
+    if (bits->connect_timeout > 0.0) {
+        curl_easy_setopt(bits->curl, CURLOPT_CONNECTTIMEOUT_MS, (long) (bits->connect_timeout * 1000.0));
+    }
+    /* any encoding libcurl can undo */
+    curl_easy_setopt(bits->curl, CURLOPT_ACCEPT_ENCODING, "");
+    if (bits->pipeline) {
+        curl_easy_setopt(bits->curl, CURLOPT_BUFFERSIZE, (long) PIPELINE_BUFFER);
+    }
+}
+
+/* CURLOPT_WRITEFUNCTION, CURLOPT_WRITEDATA is the attempt */
+static size_t my_write_fn(void *ptr, size_t size, size_t nmemb, void *stream)
+{
+    attempt *at = (attempt *) stream;
+    query_bits *bits = at->bits;
+    const char *end_result = "</result>";
+    size_t len = size * nmemb;
+
+    if (bits->winner != at) {
+        /* the body of a response we're going to retry, or a lost hedge */
+        return at->retriable ? len : 0;
+    }
+    if (bits->rdf) {
+        return rdf_parser_write(ptr, size, nmemb, bits->rdf);
+    }
+    if (!bits->xml_filter) {
+        return fwrite(ptr, 1, len, stdout);
+    }
+    if (bits->stream && !sr_stream_write(bits->stream, ptr, len)) {
+        /* the parser is behind, perform() carries on when it catches up */
+        bits->paused = at->curl;
+        return CURL_WRITEFUNC_PAUSE;
+    }
+
+    /* count rows for the status line */
+    if (bits->tsv_response) {
+        for (const char *c = ptr; (c = memchr(c, '\n', len - (c - (char *) ptr))); c++) {
+            /* the first is the head's */
+            bits->rows += bits->row_match++ > 0;
+        }
+        return fwrite(ptr, 1, len, bits->file);
+    }
+    for (size_t i=0; i<len; i++) {
+        char c = ((char *) ptr)[i];
+        if (c == end_result[bits->row_match]) {
+            if (!end_result[++bits->row_match]) {
+                bits->rows++;
+                bits->row_match = 0;
+            }
+        } else {
+            bits->row_match = c == '<';
+        }
+    }
+
+    return bits->stream ? len : fwrite(ptr, 1, len, bits->file);
+}
+
+/* responses worth trying again, the server or something in front of it
+ * was too busy or gave up */
+static int retriable_status(long status)
+{
+    return status == 408 || status == 429 || status == 502 || status == 503 || status == 504;
+}
+
+static int retriable_code(CURLcode code)
+{
+    switch (code) {
+        case CURLE_COULDNT_RESOLVE_HOST:
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_OPERATION_TIMEDOUT:
+        case CURLE_SSL_CONNECT_ERROR:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+        case CURLE_GOT_NOTHING:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* seconds to wait for an answer before sending a hedge, 0 for never */
+static double hedge_delay(query_bits *bits)
+{
+    if (bits->hedge_after >= 0.0) {
+        return bits->hedge_after;
+    }
+
+    /* the 95th percentile of recent times to first response */
+    int count = MIN(bits->latencies, LATENCY_SAMPLES);
+    if (count < HEDGE_MIN_SAMPLES) {
+        return 0.0;
+    }
+    double sorted[LATENCY_SAMPLES];
+    memcpy(sorted, bits->latency, count * sizeof(double));
+    qsort(sorted, count, sizeof(double), compare_doubles);
+
+    return sorted[(count * 95) / 100];
 }
 
-/* CURLOPT_WRITEFUNCTION 
-CURLOPT_WRITEDATA */
+/* full jitter, anything up to a doubling ceiling, unless the server asked
+ * for a particular wait */
+static double backoff(query_bits *bits, int retry_after)
+{
+    if (retry_after >= 0) {
+        return MIN(retry_after, RETRY_AFTER_MAX);
+    }
+    double ceiling = MIN(BACKOFF_BASE * (1 << MIN(bits->tries - 1, 16)), BACKOFF_MAX);
 
+    return g_random_double_range(0.0, ceiling);
+}
+
+/* called from the stream's parsing thread when there's room again */
+static void wake_transfer(void *data)
+{
+#if LIBCURL_VERSION_NUM >= 0x074400
+    query_bits *bits = data;
+    curl_multi_wakeup(bits->multi);
+#endif
+}
+
+/* wait until a transfer needs attention, the stream has made room for a
+ * paused one, or it's time to look around anyway */
+static void wait_for_transfers(query_bits *bits)
+{
+#if LIBCURL_VERSION_NUM >= 0x074400
+    curl_multi_poll(bits->multi, NULL, 0, 100, NULL);
+#else
+    curl_multi_wait(bits->multi, NULL, 0, bits->paused ? 1 : 100, NULL);
+#endif
+}
+
+/* the first complete response wins, and is the one shown */
+static void choose_response(attempt *at)
+{
+    query_bits *bits = at->bits;
+    const char *sparql = "application/sparql-results+xml";
+
+    bits->winner = at;
+    bits->latency[bits->latencies++ % LATENCY_SAMPLES] = double_time() - at->started;
+    if (at->hedge) {
+        bits->hedge_wins++;
+    }
+
+    if (bits->parse != 1 || !at->type) {
+        return;
+    }
+    bits->tsv_response = bits->tsv_results && g_str_has_prefix(at->type, "text/tab-separated-values");
+    if (g_str_has_prefix(at->type, sparql) || bits->tsv_response) {
+        bits->xml_filter = 1;
+        if ((bits->pipeline || profiling(bits) || bits->parts) && sr_stream_supported(bits->format)) {
+            bits->stream = sr_stream_new(bits->format, wake_transfer, bits);
+            return;
+        }
+        strcpy(bits->filename, tmp_filename);
+        int fd = mkstemp(bits->filename);
+        bits->file = fdopen(fd, "a");
+    } else {
+        enum rdf_syntax syntax = rdf_syntax_for_type(at->type);
+        if (syntax != RDF_NONE) {
+            char *url = NULL;
+            curl_easy_getinfo(at->curl, CURLINFO_EFFECTIVE_URL, &url);
+            bits->rdf = rdf_parser_new(syntax, url, NULL, stdout);
+        }
+    }
+}
+
+/* CURLOPT_HEADERFUNCTION, CURLOPT_HEADERDATA is the attempt */
 static size_t my_header_fn(void *ptr, size_t size, size_t nmemb, void *stream)
 {
-    query_bits *bits = (query_bits *) stream;
+    attempt *at = (attempt *) stream;
+    query_bits *bits = at->bits;
+    const char *line = ptr;
+    size_t len = size * nmemb;
 
     const char content_type[] = "Content-Type:";
-    const char *sparql = "application/sparql-results+xml";
+    const char retry_after[] = "Retry-After:";
+
+    if (bits->winner && bits->winner != at) {
+        /* another attempt answered first */
+        return 0;
+    }
+
+    if (len > 5 && !strncmp(line, "HTTP/", 5)) {
+        /* a new response, perhaps after 100 Continue */
+        char *status = g_strndup(line, len);
+        at->status = 0;
+        sscanf(status, "HTTP/%*s %ld", &at->status);
+        g_free(status);
+        at->retriable = !at->last && retriable_status(at->status);
+        at->retry_after = -1;
+        g_free(at->type);
+        at->type = NULL;
+    } else if (len > sizeof(content_type) && !strncasecmp(line, content_type, sizeof(content_type) - 1)) {
+        g_free(at->type);
+        at->type = g_strstrip(g_strndup(line + sizeof(content_type) - 1, len - sizeof(content_type) + 1));
+    } else if (len > sizeof(retry_after) && !strncasecmp(line, retry_after, sizeof(retry_after) - 1)) {
+        /* either a number of seconds or an HTTP date */
+        char *value = g_strstrip(g_strndup(line + sizeof(retry_after) - 1, len - sizeof(retry_after) + 1));
+        if (g_ascii_isdigit(*value)) {
+            at->retry_after = atoi(value);
+        } else {
+            time_t when = curl_getdate(value, NULL);
+            if (when > 0) {
+                at->retry_after = MAX(0, when - time(NULL));
+            }
+        }
+        g_free(value);
+    } else if ((len == 2 && line[0] == '\r' && line[1] == '\n') || (len == 1 && line[0] == '\n')) {
+        /* end of the headers */
+        if (at->status >= 200 && !at->retriable && !bits->winner) {
+            choose_response(at);
+        }
+    }
+
+    return len;
+}
+
+static void on_interrupt(int sig)
+{
+    cancelled = 1;
+}
+
+/* CURLOPT_XFERINFOFUNCTION, aborts the transfer once it's cancelled */
+static int my_progress_fn(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+{
+    attempt *at = (attempt *) clientp;
+    if (at->bits->winner == at) {
+        at->bits->received = dlnow;
+    }
+
+    return cancelled;
+}
+
+static attempt *attempt_start(query_bits *bits, int hedge, int last, double deadline)
+{
+    attempt *at = g_new0(attempt, 1);
+    at->bits = bits;
+    at->curl = curl_easy_duphandle(bits->curl);
+    at->started = double_time();
+    at->hedge = hedge;
+    at->last = last;
+    at->retry_after = -1;
+
+    curl_easy_setopt(at->curl, CURLOPT_PRIVATE, at);
+    curl_easy_setopt(at->curl, CURLOPT_ERRORBUFFER, at->error);
+    curl_easy_setopt(at->curl, CURLOPT_WRITEDATA, at);
+    curl_easy_setopt(at->curl, CURLOPT_HEADERDATA, at);
+    curl_easy_setopt(at->curl, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(at->curl, CURLOPT_XFERINFOFUNCTION, my_progress_fn);
+    curl_easy_setopt(at->curl, CURLOPT_XFERINFODATA, at);
+    if (deadline > 0.0) {
+        curl_easy_setopt(at->curl, CURLOPT_TIMEOUT_MS, MAX(1L, (long) ((deadline - at->started) * 1000.0)));
+    }
+    curl_multi_add_handle(bits->multi, at->curl);
+
+    return at;
+}
+
+/* an aborted transfer's connection is closed, not kept for reuse */
+static void attempt_free(attempt *at)
+{
+    if (!at) {
+        return;
+    }
+    curl_multi_remove_handle(at->bits->multi, at->curl);
+    curl_easy_cleanup(at->curl);
+    g_free(at->type);
+    g_free(at);
+}
+
+/* send the request until something answers, retrying failures and, if it
+ * takes longer than usual, racing a second copy against the first. In
+ * interactive mode Ctrl-C cancels it, and a status line shows how it's
+ * going */
+static CURLcode perform(query_bits *bits, char *error)
+{
+    struct sigaction action = { .sa_handler = on_interrupt }, old_action;
+    int status = bits->interactive && isatty(STDERR_FILENO);
+    /* only queries are safe to send more than once */
+    int max_retries = bits->operation == op_query ? bits->max_retries : 0;
+    double hedge_after = bits->operation == op_query ? hedge_delay(bits) : 0.0;
+    double started = double_time();
+    double deadline = bits->timeout > 0.0 ? started + bits->timeout : 0.0;
+    double retry_at = 0.0;
+    GPtrArray *running = g_ptr_array_new();
+    attempt *failed = NULL; /* the latest to finish without an answer */
+    attempt *winner = NULL;
+    CURLcode code = CURLE_OK;
+    int shown = 0;
+
+    if (!bits->multi) {
+        bits->multi = curl_multi_init();
+    }
+    cancelled = 0;
+    bits->received = 0;
+    bits->winner = NULL;
+    bits->tries = 1;
+    bits->hedges = 0;
+    bits->hedge_wins = 0;
+    if (bits->interactive) {
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGINT, &action, &old_action);
+    }
+
+    g_ptr_array_add(running, attempt_start(bits, 0, max_retries == 0, deadline));
+    for (;;) {
+        int still_running;
+        if (bits->paused && sr_stream_ready(bits->stream)) {
+            /* resuming may deliver data, and pause again, at once */
+            CURL *curl = bits->paused;
+            bits->paused = NULL;
+            curl_easy_pause(curl, CURLPAUSE_CONT);
+        }
+        curl_multi_perform(bits->multi, &still_running);
+        CURLMsg *msg;
+        int left;
+        while ((msg = curl_multi_info_read(bits->multi, &left))) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+            attempt *at = NULL;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &at);
+            at->code = msg->data.result;
+            g_ptr_array_remove(running, at);
+            if (at == bits->winner) {
+                winner = at;
+            } else if (!bits->winner) {
+                attempt_free(failed);
+                failed = at;
+            } else {
+                attempt_free(at);
+            }
+        }
+
+        if (bits->winner) {
+            /* drop the losing hedge at once, rather than let it finish */
+            while (running->len && g_ptr_array_index(running, 0) != bits->winner) {
+                attempt_free(g_ptr_array_remove_index(running, 0));
+            }
+            while (running->len > 1) {
+                attempt_free(g_ptr_array_remove_index(running, 1));
+            }
+            if (winner) {
+                code = winner->code;
+                strcpy(error, winner->error);
+                break;
+            }
+        } else if (!running->len && !retry_at) {
+            /* nothing answered */
+            if (!cancelled && bits->tries <= max_retries &&
+                (failed->retriable || retriable_code(failed->code))) {
+                retry_at = double_time() + backoff(bits, failed->retry_after);
+                if (deadline > 0.0 && retry_at >= deadline) {
+                    retry_at = 0.0;
+                }
+            }
+            if (!retry_at) {
+                code = failed->code;
+                strcpy(error, failed->error);
+                if (code == CURLE_OK) {
+                    code = CURLE_HTTP_RETURNED_ERROR;
+                    snprintf(error, CURL_ERROR_SIZE, "The endpoint returned HTTP %ld", failed->status);
+                }
+                break;
+            }
+        }
+
+        double now = double_time();
+        if (cancelled && retry_at) {
+            code = CURLE_ABORTED_BY_CALLBACK;
+            break;
+        }
+        if (retry_at && now >= retry_at) {
+            retry_at = 0.0;
+            bits->tries++;
+            g_ptr_array_add(running, attempt_start(bits, 0, bits->tries > max_retries, deadline));
+        } else if (!bits->winner && hedge_after > 0.0 && !bits->hedges && running->len == 1 &&
+                   now - ((attempt *) g_ptr_array_index(running, 0))->started >= hedge_after) {
+            bits->hedges++;
+            attempt *first = g_ptr_array_index(running, 0);
+            g_ptr_array_add(running, attempt_start(bits, 1, first->last, deadline));
+        }
+
+        if (running->len) {
+            wait_for_transfers(bits);
+        } else {
+            g_usleep(MIN(100000, (gulong) ((retry_at - now) * G_USEC_PER_SEC) + 1));
+        }
 
-    if (size * nmemb > sizeof(content_type) && !strncasecmp((char *) ptr, content_type, sizeof(content_type) - 1)) {
-        /* content type */
-        char *type = (char *) ptr + sizeof(content_type);
-        size_t len = (size * nmemb) - sizeof(content_type);
-        if (bits->parse == 1 && len > strlen(sparql) && !strncmp(type, sparql, strlen(sparql))) {
-            bits->xml_filter = 1;
-            strcpy(bits->filename, tmp_filename);
-            int fd = mkstemp(bits->filename);
-            bits->file = fdopen(fd, "a");
-            curl_easy_setopt(bits->curl, CURLOPT_WRITEDATA, bits->file);
+        double elapsed = double_time() - started;
+        if (status && elapsed > 0.5) {
+            fprintf(stderr, "\r%.1fs, %" CURL_FORMAT_CURL_OFF_T " bytes, %ld rows  (Ctrl-C to cancel)",
+                    elapsed, bits->received, bits->rows);
+            shown = 1;
         }
     }
+    if (shown) {
+        fprintf(stderr, "\r\033[K");
+    }
+
+    for (guint k = 0; k < running->len; k++) {
+        attempt_free(g_ptr_array_index(running, k));
+    }
+    g_ptr_array_free(running, TRUE);
+    attempt_free(failed);
+    attempt_free(winner);
+    bits->winner = NULL;
+    bits->paused = NULL;
+    if (bits->interactive) {
+        sigaction(SIGINT, &old_action, NULL);
+    }
 
-    return size * nmemb;
+    return code;
 }
 
 static int execute_operation(const char *query, query_bits *bits)
@@ -279,14 +1238,14 @@ static int execute_operation(const char *query, query_bits *bits)
 
     if (bits->operation == op_query) {
         char *encoded = curl_easy_escape (bits->curl, executed_query, 0);
-        if (strchr(bits->ep, '?')) {
-            query_url = g_strdup_printf("%s&query=%s", bits->ep, encoded);
+        if (strchr(bits->url, '?')) {
+            query_url = g_strdup_printf("%s&query=%s", bits->url, encoded);
         } else {
-            query_url = g_strdup_printf("%s?query=%s", bits->ep, encoded);
+            query_url = g_strdup_printf("%s?query=%s", bits->url, encoded);
         }
         curl_free(encoded);
     } else if (bits->operation == op_update) {
-        query_url = g_strdup(bits->ep);
+        query_url = g_strdup(bits->url);
     } else {
         printf("Unknown operation %s\n", bits->operation);
         g_free(executed_query);
@@ -296,55 +1255,94 @@ static int execute_operation(const char *query, query_bits *bits)
 
     /* default to not filtering */
     bits->xml_filter = 0;
-    curl_easy_setopt(bits->curl, CURLOPT_WRITEDATA, stdout);
-    curl_easy_setopt(bits->curl, CURLOPT_ERRORBUFFER, my_curl_error);
+    bits->rows = 0;
+    bits->row_match = 0;
+    curl_easy_setopt(bits->curl, CURLOPT_WRITEFUNCTION, my_write_fn);
     curl_easy_setopt(bits->curl, CURLOPT_URL, query_url);
     curl_easy_setopt(bits->curl, CURLOPT_HEADERFUNCTION, my_header_fn);
-    curl_easy_setopt(bits->curl, CURLOPT_HEADERDATA, bits);
     double then = 0.0, now = 0.0;
     if (bits->time) then = double_time();
+    char *field = NULL;
     if (bits->operation == op_update) {
         curl_easy_setopt(bits->curl, CURLOPT_POST, 1);
         char *encoded = curl_easy_escape (bits->curl, executed_query, 0);
-        char *field = g_strdup_printf("update=%s", encoded);
+        field = g_strdup_printf("update=%s", encoded);
         curl_free(encoded);
         curl_easy_setopt(bits->curl, CURLOPT_POSTFIELDS, field);
     }
-    CURLcode code = curl_easy_perform(bits->curl);
+    CURLcode code = perform(bits, my_curl_error);
+    int failed = 0;
+    g_free(field);
 
-    if (code) {
+    if (code == CURLE_ABORTED_BY_CALLBACK && cancelled) {
+        fprintf(stderr, "Cancelled\n");
+    } else if (code) {
         fprintf(stderr, "CURL: %s\n", my_curl_error);
     }
     if (bits->time) now = double_time();
-    if (bits->xml_filter) {
+    if (bits->stream) {
+        failed = sr_stream_finish(bits->stream);
+        bits->stream = NULL;
+        bits->xml_filter = 0;
+    } else if (bits->xml_filter) {
         fclose(bits->file);
-        sr_parse(bits->filename, bits->format);
+        if (!cancelled) {
+            failed = sr_parse(bits->filename, bits->format);
+            if (bits->cache && code == CURLE_OK && !failed) {
+                rc_cache_add(bits->cache, query, bits->filename, bits->rows);
+            }
+        }
         unlink(bits->filename);
         bits->xml_filter = 0;
     }
+    if (bits->rdf) {
+        failed |= rdf_parser_finish(bits->rdf) > 0;
+        bits->rdf = NULL;
+    }
     if (bits->time) {
         fprintf(stderr, "Execution time: %.1fms\n", (now-then)*1000.0);
+        fprintf(stderr, "Retries: %d, hedged: %d, won by hedge: %d\n",
+                bits->tries - 1, bits->hedges, bits->hedge_wins);
     }
     g_free(executed_query);
 
+    return code ? (int) code : failed;
+}
+
+/* a query sent by sparql-query --connect, run with the daemon's settings and
+ * connections but the client's format and flags */
+static int serve_request(const sv_request *req, void *data)
+{
+    query_bits *bits = data;
+    bits->ep = (char *) req->endpoint;
+    bits->format = (char *) req->format;
+    bits->operation = req->update ? op_update : op_query;
+    bits->parse = req->parse;
+    bits->time = req->time;
+    bits->auto_prefix = req->auto_prefix;
+    bits->verbose = req->verbose;
+
+    sparql_curl_init(bits);
+    int code = execute_operation(req->query, bits);
+    curl_easy_cleanup(bits->curl);
+    curl_slist_free_all(bits->headers);
+    bits->curl = NULL;
+    bits->headers = NULL;
+
     return code;
 }
 
+/* wait for the warm-up connection to the endpoint, if it's still going */
 static int check_endpoint(query_bits *bits)
 {
     char my_curl_error[CURL_ERROR_SIZE];
     CURLcode code;
 
-    code = curl_easy_setopt(bits->curl, CURLOPT_ERRORBUFFER, my_curl_error);
-    if (!code) code = curl_easy_setopt(bits->curl, CURLOPT_URL, bits->ep);
-    if (!code) code = curl_easy_setopt(bits->curl, CURLOPT_NOBODY, 1);
-    if (!code) code = curl_easy_perform(bits->curl);
-
-    /* put everything back regardless */
-    curl_easy_setopt(bits->curl, CURLOPT_NOBODY, 0);
-    /* (some versions of?) curl forces HTTP requests to HEAD when NOBODY is set, but doesn't put it back... */
-    curl_easy_setopt(bits->curl, CURLOPT_HTTPGET, 1);
-    /* can't put back ERRORBUFFER so future callers must set it ... */
+    if (!bits->warmup) {
+        return 0;
+    }
+    code = hs_warmup_finish(bits->warmup, my_curl_error);
+    bits->warmup = NULL;
 
     switch (code) {
         case CURLE_UNSUPPORTED_PROTOCOL:
@@ -362,13 +1360,108 @@ static int check_endpoint(query_bits *bits)
     }
 }
 
+/* a format for \show and the like, NULL for the XML itself */
+static const char *command_format(const char *name)
+{
+    if (!strcmp(name, "table")) {
+        return "application/sparql-results+xml";
+    } else if (!strcmp(name, "tsv")) {
+        return "text/tab-separated-values";
+    } else if (!strcmp(name, "arrow")) {
+        return SR_ARROW_STREAM;
+    } else if (!strcmp(name, "profile")) {
+        return SR_PROFILE;
+    }
+
+    return name;
+}
+
+/* render results kept with fd as standard out */
+static void render_kept(query_bits *bits, int n, const char *format, int fd)
+{
+    int saved = -1;
+
+    fflush(stdout);
+    if (fd >= 0) {
+        saved = dup(STDOUT_FILENO);
+        dup2(fd, STDOUT_FILENO);
+    }
+    if (rc_cache_render(bits->cache, n, format)) {
+        fprintf(stderr, "no results %d kept, see \\results\n", n);
+    }
+    fflush(stdout);
+    if (saved >= 0) {
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+    }
+}
+
+/* \results, \show, \save and \page re-render the results kept this
+ * session, without asking the endpoint again */
+static void run_command(query_bits *bits, const char *line)
+{
+    char **words = g_strsplit_set(line + 1, " \t", -1);
+    const char *command = words[0], *file = NULL, *format = bits->format;
+    int n = 0, bad = 0;
+
+    for (int i=1; words[i]; i++) {
+        if (!*words[i]) {
+            continue;
+        }
+        if (!strcmp(command, "save") && !file) {
+            file = words[i];
+        } else if (strspn(words[i], "0123456789") == strlen(words[i])) {
+            n = atoi(words[i]);
+        } else if (!strcmp(words[i], "xml")) {
+            format = NULL;
+        } else if (strchr(words[i], '/') || strcmp(command_format(words[i]), words[i])) {
+            format = command_format(words[i]);
+        } else {
+            bad = 1;
+        }
+    }
+
+    if (!strcmp(command, "help") || bad) {
+        printf("\\results                  list the results kept\n");
+        printf("\\show [N] [FORMAT]        show results N again (default the last)\n");
+        printf("\\page [N] [FORMAT]        the same, through $PAGER\n");
+        printf("\\save FILE [N] [FORMAT]   write them to FILE\n");
+        printf("FORMAT is table, tsv, xml, arrow, profile or a MIME type as for -f\n");
+    } else if (!bits->cache) {
+        fprintf(stderr, "no results are kept with --cache 0\n");
+    } else if (!strcmp(command, "results")) {
+        rc_cache_list(bits->cache, stdout);
+    } else if (!strcmp(command, "show")) {
+        render_kept(bits, n, format, -1);
+    } else if (!strcmp(command, "save") && file) {
+        FILE *out = fopen(file, "w");
+        if (out) {
+            render_kept(bits, n, format, fileno(out));
+            fclose(out);
+        } else {
+            fprintf(stderr, "can't write %s: %s\n", file, strerror(errno));
+        }
+    } else if (!strcmp(command, "page")) {
+        const char *pager = getenv("PAGER");
+        FILE *out = popen(pager && *pager ? pager : "less", "w");
+        if (out) {
+            /* quitting the pager early isn't an error */
+            void (*old)(int) = signal(SIGPIPE, SIG_IGN);
+            render_kept(bits, n, format, fileno(out));
+            pclose(out);
+            signal(SIGPIPE, old);
+        }
+    } else {
+        fprintf(stderr, "unknown command \\%s, see \\help\n", command);
+    }
+    g_strfreev(words);
+}
+
 static void interactive(query_bits *bits)
 {
     const char *prompt =   "sparql$ ";
     const char *reprompt = "      $ ";
 
-    scan_init();
-
     if (!isatty(0)) {
         /* no terminal input so disable TAB completion */
         rl_bind_key ('\t', rl_insert);
@@ -377,15 +1470,21 @@ static void interactive(query_bits *bits)
     } else {
         using_history();
         bits->auto_prefix = 1;
+        bits->interactive = 1;
+        if (bits->cache_results > 0) {
+            bits->cache = rc_cache_new(bits->cache_results, bits->cache_memory);
+        }
+    }
+    if (bits->auto_prefix) {
+        scan_init();
     }
 
     /* fill out readline functions */
     load_history_dotfile(bits);
 
     sparql_curl_init(bits);
-    if (check_endpoint(bits)) {
-        return;
-    }
+    /* connect while the user types, so the prompt appears at once */
+    bits->warmup = hs_warmup_start(bits->ep, bits->verbose);
 
     char *query = NULL;
 
@@ -401,6 +1500,12 @@ static void interactive(query_bits *bits)
             free(line);
             continue;
         }
+        if (*line == '\\') {
+            add_history(line);
+            run_command(bits, line);
+            free(line);
+            continue;
+        }
 
         while (line && !g_str_has_suffix(line, ";")) {
             free(line);
@@ -421,12 +1526,24 @@ static void interactive(query_bits *bits)
         if (g_str_has_suffix(query, ";\n")) {
             query[strlen(query) - 2] = '\0';
         }
+        if (check_endpoint(bits)) {
+            break;
+        }
         if (query) {
             execute_operation(query, bits);
         }
     } while (query);
+    check_endpoint(bits);
+    if (bits->multi) {
+        curl_multi_cleanup(bits->multi);
+        bits->multi = NULL;
+    }
 
     save_history_dotfile(bits);
+    if (bits->cache) {
+        rc_cache_free(bits->cache);
+        bits->cache = NULL;
+    }
 
     return;
 }
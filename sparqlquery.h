@@ -0,0 +1,71 @@
+#ifndef SPARQLQUERY_H
+#define SPARQLQUERY_H
+
+/* libsparqlquery, SPARQL queries over HTTP with results streamed to
+ * callbacks. Link with `pkg-config --libs sparqlquery` */
+
+#include <stddef.h>
+
+/* room for the message sq_query() leaves on failure */
+#define SQ_ERROR_SIZE 256
+
+typedef struct _sq_parser sq_parser;
+
+enum sq_kind {
+    SQ_UNBOUND,
+    SQ_URI,
+    SQ_BNODE,
+    SQ_LITERAL
+};
+
+/* one cell of a result. The strings point into the parser's buffer, and
+ * are only good until the callback returns */
+typedef struct {
+    enum sq_kind kind;
+    const char *value;    /* IRI, blank node label or lexical form */
+    const char *lang;     /* or NULL */
+    const char *datatype; /* or NULL */
+    int truncated;        /* value was cut short, see sq_parser_set_limits() */
+} sq_term;
+
+/* the variables, once the head has been read */
+typedef void (*sq_head_fn)(void *data, int count, char **names);
+
+/* one result, with a term for each variable in the head */
+typedef void (*sq_row_fn)(void *data, const sq_term *terms);
+
+/* the answer to an ASK */
+typedef void (*sq_boolean_fn)(void *data, int value);
+
+/* a push parser for SPARQL XML results, calling back as each part of the
+ * document arrives. Any of the callbacks may be NULL */
+sq_parser *sq_parser_new(sq_head_fn head, sq_row_fn row, sq_boolean_fn boolean, void *data);
+
+/* leave variables past the first max_columns out of the head, and cut
+ * values short at max_value bytes and the strings of a result at max_result,
+ * never splitting a UTF-8 sequence. There are no limits until this is called.
+ * max_columns only counts before the head ends, the others may be changed
+ * from the head callback */
+void sq_parser_set_limits(sq_parser *parser, int max_columns, size_t max_value, size_t max_result);
+
+/* how many variables sq_parser_set_limits() left out of the head */
+int sq_parser_dropped(sq_parser *parser);
+
+/* feed it more of the document */
+void sq_parser_write(sq_parser *parser, const char *buf, size_t len);
+
+/* end the document and free the parser, returning non-zero if it wasn't
+ * whole, well-formed SPARQL results */
+int sq_parser_finish(sq_parser *parser);
+
+/* term written as in N-Triples, or the empty string if unbound. Free it
+ * with free() */
+char *sq_term_ntriples(const sq_term *term);
+
+/* send query to endpoint, calling back as its results arrive. Returns 0 on
+ * success, or non-zero with a message in error, which must have room for
+ * SQ_ERROR_SIZE bytes */
+int sq_query(const char *endpoint, const char *query, sq_head_fn head, sq_row_fn row,
+             sq_boolean_fn boolean, void *data, char *error);
+
+#endif
@@ -0,0 +1,95 @@
+/*  sparql-query - a SPARQL client with GNU readline support
+    Copyright (C) 2006-8 Nick Lamb and Steve Harris for Garlik
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* passes items between two threads through a small spsc queue, so both
+ * spend most of their time finding it full or empty and going to sleep,
+ * and checks every item comes out once, in order */
+
+#include <stdio.h>
+#include <glib.h>
+
+#include "spsc.h"
+
+#define ITEMS 1000000
+
+/* small, so the threads keep waiting on each other */
+#define CAPACITY 4
+
+static gpointer produce(gpointer data)
+{
+    spsc *q = data;
+
+    for (guint i=1; i<=ITEMS; i++) {
+        spsc_push_wait(q, GUINT_TO_POINTER(i));
+    }
+
+    return NULL;
+}
+
+/* a queue used by one thread: full and empty are seen without waiting */
+static int single_thread(void)
+{
+    spsc *q = spsc_new(3);
+    int ok = spsc_pop(q) == NULL;
+
+    /* rounded up to 4 */
+    for (guint i=1; i<=4; i++) {
+        ok &= spsc_push(q, GUINT_TO_POINTER(i));
+    }
+    ok &= !spsc_has_room(q) && !spsc_push(q, GUINT_TO_POINTER(5));
+    for (guint i=1; i<=4; i++) {
+        ok &= spsc_pop(q) == GUINT_TO_POINTER(i);
+    }
+    ok &= spsc_pop(q) == NULL && spsc_has_room(q);
+    spsc_free(q);
+    fprintf(stderr, "full and empty: %s\n", ok ? "ok" : "FAILED");
+
+    return !ok;
+}
+
+static int two_threads(void)
+{
+    spsc *q = spsc_new(CAPACITY);
+    GThread *producer = g_thread_new("producer", produce, q);
+    guint expected = 1;
+
+    for (guint i=1; i<=ITEMS; i++) {
+        guint item = GPOINTER_TO_UINT(spsc_pop_wait(q));
+        if (item != expected) {
+            fprintf(stderr, "item %u came out after %u\n", item, expected - 1);
+            break;
+        }
+        expected++;
+    }
+    g_thread_join(producer);
+    int ok = expected == ITEMS + 1 && spsc_pop(q) == NULL;
+    spsc_free(q);
+    fprintf(stderr, "%d items between threads: %s\n", ITEMS, ok ? "ok" : "FAILED");
+
+    return !ok;
+}
+
+int main()
+{
+    int failed = single_thread();
+    failed |= two_threads();
+
+    return failed;
+}
+
+/* vi:set expandtab sts=4 sw=4: */
@@ -0,0 +1,158 @@
+/*  sparql-query - a SPARQL client with GNU readline support
+    Copyright (C) 2006-8 Nick Lamb and Steve Harris for Garlik
+ 
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Single producer, single consumer ring buffer
+ *
+ * The producer only writes tail and the consumer only writes head, so the
+ * fast path needs no locks, just acquire and release ordering on the two
+ * indexes. A thread that finds the queue full or empty spins briefly and
+ * then sleeps on a condition; its peer only takes the lock to wake it if
+ * the sleeping flag says someone is waiting.
+ */
+
+#include <sched.h>
+#include <glib.h>
+
+#include "spsc.h"
+
+/* tries before a waiting thread goes to sleep */
+#define SPINS 100
+
+/* a lost wake-up can only delay a sleeper this long, in microseconds */
+#define MAX_SLEEP 10000
+
+struct _spsc {
+    unsigned int mask;
+    void **items;
+    /* apart, so the two threads aren't fighting over one cache line */
+    unsigned int head __attribute__((aligned(64)));
+    unsigned int tail __attribute__((aligned(64)));
+    int sleeping __attribute__((aligned(64)));
+    GMutex lock;
+    GCond wake;
+};
+
+spsc *spsc_new(unsigned int capacity)
+{
+    spsc *q = g_new0(spsc, 1);
+    unsigned int size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    q->mask = size - 1;
+    q->items = g_new0(void *, size);
+    g_mutex_init(&q->lock);
+    g_cond_init(&q->wake);
+
+    return q;
+}
+
+void spsc_free(spsc *q)
+{
+    g_mutex_clear(&q->lock);
+    g_cond_clear(&q->wake);
+    g_free(q->items);
+    g_free(q);
+}
+
+static void wake_peer(spsc *q)
+{
+    if (__atomic_load_n(&q->sleeping, __ATOMIC_SEQ_CST)) {
+        g_mutex_lock(&q->lock);
+        g_cond_signal(&q->wake);
+        g_mutex_unlock(&q->lock);
+    }
+}
+
+int spsc_has_room(spsc *q)
+{
+    unsigned int tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    unsigned int head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+
+    return tail - head <= q->mask;
+}
+
+int spsc_push(spsc *q, void *item)
+{
+    if (!spsc_has_room(q)) {
+        return 0;
+    }
+    unsigned int tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    q->items[tail & q->mask] = item;
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_SEQ_CST);
+    wake_peer(q);
+
+    return 1;
+}
+
+void *spsc_pop(spsc *q)
+{
+    unsigned int head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    if (head == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    void *item = q->items[head & q->mask];
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_SEQ_CST);
+    wake_peer(q);
+
+    return item;
+}
+
+/* sleep until ready(q) is true, checking again after saying we're asleep
+ * so that a peer that changed things meanwhile is sure to wake us */
+static void wait_for(spsc *q, int (*ready)(spsc *q))
+{
+    for (int i=0; i<SPINS; i++) {
+        if (ready(q)) {
+            return;
+        }
+        sched_yield();
+    }
+
+    g_mutex_lock(&q->lock);
+    __atomic_store_n(&q->sleeping, 1, __ATOMIC_SEQ_CST);
+    while (!ready(q)) {
+        g_cond_wait_until(&q->wake, &q->lock, g_get_monotonic_time() + MAX_SLEEP);
+    }
+    __atomic_store_n(&q->sleeping, 0, __ATOMIC_SEQ_CST);
+    g_mutex_unlock(&q->lock);
+}
+
+static int has_item(spsc *q)
+{
+    return __atomic_load_n(&q->head, __ATOMIC_RELAXED) != __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+}
+
+void spsc_push_wait(spsc *q, void *item)
+{
+    while (!spsc_push(q, item)) {
+        wait_for(q, spsc_has_room);
+    }
+}
+
+void *spsc_pop_wait(spsc *q)
+{
+    void *item;
+    while (!(item = spsc_pop(q))) {
+        wait_for(q, has_item);
+    }
+
+    return item;
+}
+
+/* vi:set expandtab sts=4 sw=4: */
@@ -0,0 +1,25 @@
+#ifndef SPSC_H
+#define SPSC_H
+
+typedef struct _spsc spsc;
+
+/* a bounded queue of pointers between exactly one producer thread and one
+ * consumer thread. capacity is rounded up to a power of two */
+spsc *spsc_new(unsigned int capacity);
+
+void spsc_free(spsc *q);
+
+/* add item, returning 0 without waiting if the queue is full */
+int spsc_push(spsc *q, void *item);
+
+/* take the oldest item, or NULL without waiting if there isn't one */
+void *spsc_pop(spsc *q);
+
+/* as above, but sleep until there's room or an item */
+void spsc_push_wait(spsc *q, void *item);
+void *spsc_pop_wait(spsc *q);
+
+/* true if a push would succeed now */
+int spsc_has_room(spsc *q);
+
+#endif
@@ -0,0 +1,149 @@
+/*  sparql-query - a SPARQL client with GNU readline support
+    Copyright (C) 2006-8 Nick Lamb and Steve Harris for Garlik
+ 
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* One query, results to callbacks
+ *
+ * The transport half of libsparqlquery. The query goes out as a GET, or as
+ * a POST if that would make too long a URL, over the connections shared by
+ * every handle from hs_easy_init(), and the response is fed to a parser as
+ * it arrives.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+#include <curl/curl.h>
+
+#include "http-share.h"
+#include "sparqlquery.h"
+
+#if CURL_ERROR_SIZE > SQ_ERROR_SIZE
+#error "SQ_ERROR_SIZE is too small for libcurl's messages"
+#endif
+
+#define SPARQL_RESULTS "application/sparql-results+xml"
+
+/* longest URL sent with GET */
+#define MAX_GET 4096
+
+typedef struct {
+    CURL *curl;
+    sq_parser *parser;
+    char *type;
+    sq_head_fn head;
+    sq_row_fn row;
+    sq_boolean_fn boolean;
+    void *data;
+} request;
+
+static size_t write_fn(void *ptr, size_t size, size_t nmemb, void *data)
+{
+    request *r = data;
+    size_t len = size * nmemb;
+
+    if (r->parser) {
+        sq_parser_write(r->parser, ptr, len);
+    }
+
+    return len;
+}
+
+static size_t header_fn(void *ptr, size_t size, size_t nmemb, void *data)
+{
+    request *r = data;
+    size_t len = size * nmemb;
+    const char content_type[] = "Content-Type:";
+
+    if (len <= sizeof(content_type) || g_ascii_strncasecmp(ptr, content_type, sizeof(content_type) - 1)) {
+        return len;
+    }
+    long status = 0;
+    curl_easy_getinfo(r->curl, CURLINFO_RESPONSE_CODE, &status);
+    if (status >= 300 || r->type) {
+        return len;
+    }
+
+    r->type = g_strstrip(g_strndup((char *) ptr + sizeof(content_type) - 1, len - sizeof(content_type) + 1));
+    if (!g_ascii_strncasecmp(r->type, SPARQL_RESULTS, strlen(SPARQL_RESULTS))) {
+        r->parser = sq_parser_new(r->head, r->row, r->boolean, r->data);
+    }
+
+    return len;
+}
+
+int sq_query(const char *endpoint, const char *query, sq_head_fn head, sq_row_fn row,
+             sq_boolean_fn boolean, void *data, char *error)
+{
+    request r = { .head = head, .row = row, .boolean = boolean, .data = data };
+    struct curl_slist *headers = curl_slist_append(NULL, "Accept: " SPARQL_RESULTS);
+    r.curl = hs_easy_init();
+    const char *ep = hs_endpoint(r.curl, endpoint);
+
+    char *encoded = curl_easy_escape(r.curl, query, 0);
+    char *url = g_strdup_printf("%s%squery=%s", ep, strchr(ep, '?') ? "&" : "?", encoded);
+    char *fields = NULL;
+    if (strlen(url) > MAX_GET) {
+        fields = g_strdup_printf("query=%s", encoded);
+        curl_easy_setopt(r.curl, CURLOPT_URL, ep);
+        curl_easy_setopt(r.curl, CURLOPT_POSTFIELDS, fields);
+    } else {
+        curl_easy_setopt(r.curl, CURLOPT_URL, url);
+    }
+    curl_free(encoded);
+    curl_easy_setopt(r.curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(r.curl, CURLOPT_ACCEPT_ENCODING, "");
+    curl_easy_setopt(r.curl, CURLOPT_ERRORBUFFER, error);
+    curl_easy_setopt(r.curl, CURLOPT_HEADERFUNCTION, header_fn);
+    curl_easy_setopt(r.curl, CURLOPT_HEADERDATA, &r);
+    curl_easy_setopt(r.curl, CURLOPT_WRITEFUNCTION, write_fn);
+    curl_easy_setopt(r.curl, CURLOPT_WRITEDATA, &r);
+
+    error[0] = '\0';
+    CURLcode code = curl_easy_perform(r.curl);
+    long status = 0;
+    curl_easy_getinfo(r.curl, CURLINFO_RESPONSE_CODE, &status);
+
+    int failed = 1;
+    if (code) {
+        if (!error[0]) {
+            snprintf(error, SQ_ERROR_SIZE, "%s", curl_easy_strerror(code));
+        }
+    } else if (status >= 300) {
+        snprintf(error, SQ_ERROR_SIZE, "%s returned HTTP %ld", endpoint, status);
+    } else if (!r.parser) {
+        snprintf(error, SQ_ERROR_SIZE, "%s answered with %s, not SPARQL results", endpoint,
+                 r.type ? r.type : "no Content-Type");
+    } else {
+        failed = 0;
+    }
+    if (r.parser && sq_parser_finish(r.parser) && !failed) {
+        snprintf(error, SQ_ERROR_SIZE, "results from %s are not well-formed", endpoint);
+        failed = 1;
+    }
+
+    curl_easy_cleanup(r.curl);
+    curl_slist_free_all(headers);
+    g_free(r.type);
+    g_free(url);
+    g_free(fields);
+
+    return failed;
+}
+
+/* vi:set expandtab sts=4 sw=4: */
@@ -0,0 +1,283 @@
+/*  sparql-query - a SPARQL client with GNU readline support
+    Copyright (C) 2006-8 Nick Lamb and Steve Harris for Garlik
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Term dictionary
+ *
+ * Results repeat the same few IRIs over and over, so rather than copying
+ * every one, each distinct term is kept once and rows hold its id. An
+ * entry and its strings are a single allocation, keyed by its kind,
+ * datatype and value packed together. Entries no row holds wait in a
+ * queue, most recently used first, and are forgotten from the far end
+ * once they take too much room. Long values seldom repeat, so they aren't
+ * kept past their last use, and neither are those of a column that has
+ * stopped repeating itself, which isn't looked up in the index for a while.
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "term-dict.h"
+
+/* values longer than this aren't worth keeping for reuse */
+#define MAX_SHARED 1024
+
+/* a column is checked every SAMPLE lookups, and if fewer than one in
+ * MIN_REPEATS of them were found its next BYPASS terms aren't looked up */
+#define SAMPLE 4096
+#define MIN_REPEATS 8
+#define BYPASS (64 * 1024)
+
+typedef struct {
+    unsigned int lookups;
+    unsigned int found;
+    unsigned int bypass;  /* terms still to go before looking up again */
+} column;
+
+typedef struct {
+    td_entry e;
+    unsigned int id;
+    unsigned int refs;
+    int shared;      /* in the index */
+    GList idle;      /* its place in the queue of unheld entries */
+    const char *key; /* kind, datatype flag, datatype, NUL, value, NUL */
+    size_t key_len;
+    char data[];     /* where the key is kept */
+} entry;
+
+struct _term_dict {
+    size_t max_bytes;
+    size_t idle_bytes;   /* of keys in the idle queue */
+    GHashTable *index;   /* of shared entries by key */
+    GPtrArray *entries;  /* by id, NULL where one was forgotten */
+    GArray *free_ids;
+    GQueue idle;
+    GString *probe;      /* the key being looked up */
+    column *columns;
+    int cols;
+    entry unbound;
+};
+
+/* a word at a time, keys are mostly long IRIs */
+static guint key_hash(gconstpointer p)
+{
+    const entry *e = p;
+    guint64 h = e->key_len;
+    size_t i = 0;
+    for (; i + 8 <= e->key_len; i += 8) {
+        guint64 word;
+        memcpy(&word, e->key + i, 8);
+        h = (h ^ word) * G_GUINT64_CONSTANT(0x9e3779b97f4a7c15);
+        h ^= h >> 29;
+    }
+    for (; i < e->key_len; i++) {
+        h = (h ^ (unsigned char) e->key[i]) * G_GUINT64_CONSTANT(0x100000001b3);
+    }
+
+    return (guint) (h ^ (h >> 32));
+}
+
+static gboolean key_equal(gconstpointer a, gconstpointer b)
+{
+    const entry *x = a, *y = b;
+
+    return x->key_len == y->key_len && !memcmp(x->key, y->key, x->key_len);
+}
+
+term_dict *td_new(size_t max_bytes, int cols)
+{
+    term_dict *d = g_new0(term_dict, 1);
+    d->max_bytes = max_bytes;
+    d->cols = cols;
+    d->columns = g_new0(column, MAX(cols, 1));
+    d->index = g_hash_table_new(key_hash, key_equal);
+    d->entries = g_ptr_array_new();
+    d->free_ids = g_array_new(FALSE, FALSE, sizeof(unsigned int));
+    g_queue_init(&d->idle);
+    d->probe = g_string_new(NULL);
+    d->unbound.e.term.kind = SR_UNBOUND;
+    d->unbound.id = TD_UNBOUND;
+    g_ptr_array_add(d->entries, &d->unbound);
+
+    return d;
+}
+
+static void forget(term_dict *d, entry *e)
+{
+    if (e->shared) {
+        g_hash_table_remove(d->index, e);
+    }
+    g_ptr_array_index(d->entries, e->id) = NULL;
+    g_array_append_val(d->free_ids, e->id);
+    g_free(e);
+}
+
+/* forget the least recently used unheld entries until they fit */
+static void evict(term_dict *d)
+{
+    while (d->idle_bytes > d->max_bytes) {
+        GList *oldest = g_queue_peek_tail_link(&d->idle);
+        entry *e = oldest->data;
+        g_queue_unlink(&d->idle, oldest);
+        d->idle_bytes -= e->key_len;
+        forget(d, e);
+    }
+}
+
+/* the key is what tells terms apart: kind, whether there's a datatype or a
+ * language tag, which of them there is, then the value. tag is the one
+ * there is, if any */
+static size_t key_length(size_t len, const char *tag)
+{
+    return 2 + (tag ? strlen(tag) : 0) + 1 + len + 1;
+}
+
+static size_t write_key(char *key, enum sr_term_kind kind, const char *value, size_t len, const char *datatype,
+                        const char *lang)
+{
+    char *pos = key;
+    *pos++ = kind;
+    *pos++ = datatype ? 'd' : lang ? 'l' : '-';
+    if (datatype || lang) {
+        pos = stpcpy(pos, datatype ? datatype : lang);
+    }
+    *pos++ = '\0';
+    memcpy(pos, value, len);
+    pos[len] = '\0';
+
+    return pos - key;
+}
+
+static entry *add(term_dict *d, int shared, enum sr_term_kind kind, const char *value, size_t len,
+                  const char *datatype, const char *lang)
+{
+    size_t key_len = key_length(len, datatype ? datatype : lang);
+    entry *e = g_malloc(sizeof(entry) + key_len);
+    size_t value_at = write_key(e->data, kind, value, len, datatype, lang);
+    e->key = e->data;
+    e->key_len = key_len;
+    e->refs = 0;
+    e->shared = shared;
+    e->idle = (GList) { .data = e };
+    e->e.term.kind = kind;
+    e->e.term.value = e->data + value_at;
+    e->e.term.datatype = datatype ? e->data + 2 : NULL;
+    e->e.term.lang = !datatype && lang ? e->data + 2 : NULL;
+    e->e.len = len;
+    e->e.width = -1;
+
+    if (d->free_ids->len) {
+        e->id = g_array_index(d->free_ids, unsigned int, d->free_ids->len - 1);
+        g_array_set_size(d->free_ids, d->free_ids->len - 1);
+        g_ptr_array_index(d->entries, e->id) = e;
+    } else {
+        e->id = d->entries->len;
+        g_ptr_array_add(d->entries, e);
+    }
+    if (shared) {
+        g_hash_table_add(d->index, e);
+    }
+
+    return e;
+}
+
+/* whether a term of col is worth looking up in the index */
+static int worth_looking(term_dict *d, int col)
+{
+    if (col < 0 || col >= d->cols) {
+        return 1;
+    }
+    column *c = &d->columns[col];
+    if (c->bypass) {
+        c->bypass--;
+        return 0;
+    }
+    if (c->lookups >= SAMPLE) {
+        if (c->found * MIN_REPEATS < c->lookups) {
+            c->bypass = BYPASS;
+        }
+        c->lookups = c->found = 0;
+    }
+
+    return 1;
+}
+
+unsigned int td_intern(term_dict *d, int col, enum sr_term_kind kind, const char *value, size_t len,
+                       const char *datatype, const char *lang)
+{
+    if (kind == SR_UNBOUND) {
+        return TD_UNBOUND;
+    }
+
+    entry *e = NULL;
+    int shared = len <= MAX_SHARED && worth_looking(d, col);
+    if (shared) {
+        GString *key = d->probe;
+        g_string_set_size(key, key_length(len, datatype ? datatype : lang));
+        write_key(key->str, kind, value, len, datatype, lang);
+        entry probe = { .key = key->str, .key_len = key->len };
+        e = g_hash_table_lookup(d->index, &probe);
+        if (col >= 0 && col < d->cols) {
+            d->columns[col].lookups++;
+            d->columns[col].found += e != NULL;
+        }
+    }
+    if (!e) {
+        e = add(d, shared, kind, value, len, datatype, lang);
+    } else if (!e->refs) {
+        g_queue_unlink(&d->idle, &e->idle);
+        d->idle_bytes -= e->key_len;
+    }
+    e->refs++;
+
+    return e->id;
+}
+
+td_entry *td_get(term_dict *d, unsigned int id)
+{
+    return &((entry *) g_ptr_array_index(d->entries, id))->e;
+}
+
+void td_release(term_dict *d, unsigned int id)
+{
+    entry *e = g_ptr_array_index(d->entries, id);
+    if (id == TD_UNBOUND || --e->refs) {
+        return;
+    }
+    if (!e->shared) {
+        forget(d, e);
+        return;
+    }
+    g_queue_push_head_link(&d->idle, &e->idle);
+    d->idle_bytes += e->key_len;
+    evict(d);
+}
+
+void td_free(term_dict *d)
+{
+    for (guint i=1; i<d->entries->len; i++) {
+        g_free(g_ptr_array_index(d->entries, i));
+    }
+    g_ptr_array_free(d->entries, TRUE);
+    g_array_free(d->free_ids, TRUE);
+    g_hash_table_destroy(d->index);
+    g_string_free(d->probe, TRUE);
+    g_free(d->columns);
+    g_free(d);
+}
+
+/* vi:set expandtab sts=4 sw=4: */
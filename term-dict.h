@@ -0,0 +1,38 @@
+#ifndef TERM_DICT_H
+#define TERM_DICT_H
+
+#include <stddef.h>
+
+#include "result-parse.h"
+
+/* id of the unbound term, which every dictionary has */
+#define TD_UNBOUND 0
+
+typedef struct _term_dict term_dict;
+
+/* a term as the dictionary holds it. width is for whoever displays it to
+ * fill in, it starts as -1 */
+typedef struct {
+    sr_term term;
+    size_t len;   /* of the value */
+    int width;
+} td_entry;
+
+/* a dictionary of the terms in one set of results with cols columns.
+ * Terms are kept while any id for them is held, and afterwards, up to
+ * max_bytes of them, in case they come up again. The least recently used
+ * go first */
+term_dict *td_new(size_t max_bytes, int cols);
+
+/* the id for a term of column col, adding it if it's new. The id is held
+ * until td_release(). datatype and lang may be NULL, and only one is kept */
+unsigned int td_intern(term_dict *d, int col, enum sr_term_kind kind, const char *value, size_t len,
+                       const char *datatype, const char *lang);
+
+td_entry *td_get(term_dict *d, unsigned int id);
+
+void td_release(term_dict *d, unsigned int id);
+
+void td_free(term_dict *d);
+
+#endif